@@ -0,0 +1,149 @@
+// Compares loading/freeing a deck with one strdup per card (the old loader)
+// against load_deck_cards at 10k, 100k and 1M cards. load_deck_cards now reads
+// only card ids and leaves the text to deck_card, so the arena_ columns show
+// the cost of opening a deck rather than of copying its text.
+// arena_reload is load_deck_cards on an already loaded Deck, the path taken
+// when the TUI refreshes a stale deck.
+#include "../include/db.h"
+
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#define RUNS 5
+
+FlashDb* db;
+
+static const size_t sizes[] = {10000, 100000, 1000000};
+
+static double now_ms(void) {
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static int cmp_double(const void* a, const void* b) {
+   double x = *(const double*)a, y = *(const double*)b;
+   return (x > y) - (x < y);
+}
+
+static double median(double* v, int n) {
+   qsort(v, n, sizeof(*v), cmp_double);
+   return v[n / 2];
+}
+
+// The loader as it was before the arena: two strdup per card, freed one by one
+static void strdup_load(int deck_id, Cards** items, size_t* count) {
+   sqlite3_stmt* stmt = db_stmt_acquire(db, STMT_DECK_CARDS);
+   size_t cap = 256, n = 0;
+   Cards* out = malloc(cap * sizeof(*out));
+
+   sqlite3_bind_int(stmt, 1, deck_id);
+   while (sqlite3_step(stmt) == SQLITE_ROW) {
+      if (n == cap) {
+         cap *= 2;
+         out = realloc(out, cap * sizeof(*out));
+      }
+      out[n].id = sqlite3_column_int(stmt, 0);
+      out[n].deck_id = deck_id;
+      out[n].study_flag = 0;
+      out[n].front = strdup((const char*)sqlite3_column_text(stmt, 1));
+      out[n].back = strdup((const char*)sqlite3_column_text(stmt, 2));
+      n++;
+   }
+   db_stmt_release(db, STMT_DECK_CARDS);
+   *items = out;
+   *count = n;
+}
+
+static void strdup_free(Cards* items, size_t count) {
+   for (size_t i = 0; i < count; i++) {
+      free(items[i].front);
+      free(items[i].back);
+   }
+   free(items);
+}
+
+static void random_text(char* buf, int min_len, int max_len) {
+   int len = min_len + rand() % (max_len - min_len + 1);
+   for (int i = 0; i < len; i++)
+      buf[i] = 'a' + rand() % 26;
+   buf[len] = '\0';
+}
+
+static int make_deck(size_t cards) {
+   char name[64];
+   snprintf(name, sizeof(name), "bench-%zu", cards);
+
+   int deck_id;
+   get_or_create_deck(db, name, &deck_id);
+
+   char front[128], back[256];
+   db_begin(db);
+   for (size_t i = 0; i < cards; i++) {
+      random_text(front, 8, 60);
+      random_text(back, 16, 200);
+      sqlite3_stmt* stmt = db_stmt_acquire(db, STMT_ADD_CARD);
+      sqlite3_bind_int(stmt, 1, deck_id);
+      sqlite3_bind_text(stmt, 2, front, -1, SQLITE_STATIC);
+      sqlite3_bind_text(stmt, 3, back, -1, SQLITE_STATIC);
+      sqlite3_step(stmt);
+      db_stmt_release(db, STMT_ADD_CARD);
+   }
+   db_commit(db);
+   return deck_id;
+}
+
+int main(void) {
+   char dir[] = "/tmp/flash-bench-XXXXXX";
+   if (!mkdtemp(dir)) {
+      perror("mkdtemp");
+      return EXIT_FAILURE;
+   }
+   setenv("HOME", dir, 1);
+   setup_database(&db);
+   srand(42);
+
+   printf("%10s %14s %14s %14s %14s %14s\n",
+          "cards", "strdup_load", "strdup_free", "arena_load", "arena_reload", "arena_free");
+   for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+      int deck_id = make_deck(sizes[s]);
+      double sl[RUNS], sf[RUNS], al[RUNS], ar[RUNS], af[RUNS];
+
+      for (int r = 0; r < RUNS; r++) {
+         Cards* items;
+         size_t count;
+         double t0 = now_ms();
+         strdup_load(deck_id, &items, &count);
+         double t1 = now_ms();
+         strdup_free(items, count);
+         double t2 = now_ms();
+
+         Deck deck = {0};
+         load_deck_cards(db, deck_id, &deck);
+         double t3 = now_ms();
+         load_deck_cards(db, deck_id, &deck);
+         double t4 = now_ms();
+         free_deck_cards(&deck);
+         double t5 = now_ms();
+
+         sl[r] = t1 - t0;
+         sf[r] = t2 - t1;
+         al[r] = t3 - t2;
+         ar[r] = t4 - t3;
+         af[r] = t5 - t4;
+      }
+
+      printf("%10zu %12.2fms %12.2fms %12.2fms %12.2fms %12.2fms\n", sizes[s],
+             median(sl, RUNS), median(sf, RUNS), median(al, RUNS), median(ar, RUNS), median(af, RUNS));
+   }
+
+   char path[sizeof(dir) + 64];
+   close_database(db);
+   snprintf(path, sizeof(path), "%s/tui-cards/flashcards.db", dir);
+   unlink(path);
+   snprintf(path, sizeof(path), "%s/tui-cards", dir);
+   rmdir(path);
+   rmdir(dir);
+   return 0;
+}
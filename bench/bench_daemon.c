@@ -0,0 +1,326 @@
+// Runs many simulated TUI clients at once against flash-cardsd, started in this
+// process on a generated database, and prints per-operation latency and
+// throughput as JSON. --direct runs the same clients with a connection and
+// writer each instead, the way separate TUIs work without the daemon:
+//   make bench-daemon BENCH_ARGS="--clients 64" > daemon.json
+#define _GNU_SOURCE  // nftw
+#include "gen.h"
+#include "../include/daemon.h"
+#include "../include/remote.h"
+#include "../include/protocol.h"
+#include "../include/writer.h"
+#include "../include/scheduler.h"
+#include "../include/search.h"
+#include "../include/review_log.h"
+
+#include <ftw.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <linux/limits.h>
+#include <unistd.h>
+
+#define DEFAULT_CLIENTS 16
+#define DEFAULT_SECONDS 5
+#define MAX_CLIENTS 1000
+#define BROWSE_STEPS 5           // cards looked at per deck opened
+#define EDIT_PERCENT 10          // decks opened that get a card edited
+#define SEARCH_PERCENT 5         // decks opened that are followed by a search
+
+// What one simulated client does, timed separately
+typedef enum {
+   OP_DECK_LIST,
+   OP_OPEN_DECK,
+   OP_BROWSE,
+   OP_EDIT,
+   OP_ANSWER,
+   OP_SEARCH,
+   OP_COUNT
+} BenchOp;
+
+static const char* op_names[OP_COUNT] = {
+   "load_deck_list", "load_deck_cards", "deck_card", "update_card", "answer", "search_cards"
+};
+
+typedef struct {
+   double* items;                // microseconds
+   size_t count;
+   size_t capacity;
+} Samples;
+
+typedef struct {
+   int index;
+   int ok;
+   unsigned long errors;         // writes that failed after being queued
+   Samples samples[OP_COUNT];
+} Client;
+
+FlashDb* db;
+
+static const char* socket_path;
+static int direct;
+static atomic_int stopping;
+
+static unsigned long long now_ns(void) {
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int cmp_double(const void* a, const void* b) {
+   double x = *(const double*)a, y = *(const double*)b;
+   return (x > y) - (x < y);
+}
+
+static void record(Client* c, BenchOp op, unsigned long long start) {
+   double us = (now_ns() - start) / 1e3;
+   da_append(&c->samples[op], us);
+}
+
+// One simulated TUI: open a deck, browse it, sometimes edit or search, and
+// answer a card, over and over until the run ends
+static void* run_client(void* arg) {
+   Client* c = arg;
+   FlashDb* conn = NULL;
+   if (direct) {
+      setup_database(&conn);
+      writer_start(conn);
+   } else if (!remote_connect(&conn, socket_path)) {
+      fprintf(stderr, "client %d: could not connect to %s\n", c->index, socket_path);
+      return NULL;
+   }
+   unsigned seed = 0x9e3779b9u * (c->index + 1);
+   ReviewLog log = {0};
+   char front[64], back[64];
+
+   while (!atomic_load(&stopping)) {
+      unsigned long long start = now_ns();
+      DeckInfoList decks = {0};
+      load_deck_list(conn, &decks);
+      record(c, OP_DECK_LIST, start);
+      if (decks.count == 0) {
+         free_deck_list(&decks);
+         break;
+      }
+      int deck_id = decks.items[rand_r(&seed) % decks.count].id;
+      free_deck_list(&decks);
+
+      Deck deck = {0};
+      start = now_ns();
+      load_deck_cards(conn, deck_id, &deck);
+      record(c, OP_OPEN_DECK, start);
+      if (deck.count == 0) {
+         free_deck_cards(&deck);
+         continue;
+      }
+
+      int card_id = 0;
+      for (int i = 0; i < BROWSE_STEPS; i++) {
+         start = now_ns();
+         const Cards* card = deck_card(&deck, rand_r(&seed) % deck.count);
+         record(c, OP_BROWSE, start);
+         if (card)
+            card_id = card->id;
+      }
+
+      if (card_id && (int)(rand_r(&seed) % 100) < EDIT_PERCENT) {
+         snprintf(front, sizeof(front), "edited by client %d", c->index);
+         snprintf(back, sizeof(back), "%s", gen_word(rand_r(&seed) % GEN_VOCAB_SIZE));
+         start = now_ns();
+         update_card(conn, &deck, card_id, front, back);
+         record(c, OP_EDIT, start);
+      }
+
+      if (card_id) {
+         time_t now = time(NULL);
+         int correct = rand_r(&seed) % 4 != 0;
+         Schedule sched = { .due = now, .ease = SCHED_INITIAL_EASE };
+         sm2_review(&sched, correct ? SCHED_GRADE_CORRECT : SCHED_GRADE_INCORRECT, now);
+         ReviewEntry entry = { card_id, deck_id, now, correct, 1000 };
+         start = now_ns();
+         save_schedule(conn, card_id, &sched);
+         review_log_add(conn, &log, &entry);
+         record(c, OP_ANSWER, start);
+      }
+      free_deck_cards(&deck);
+
+      if ((int)(rand_r(&seed) % 100) < SEARCH_PERCENT) {
+         SearchResults results = {0};
+         start = now_ns();
+         search_cards(conn, gen_word(rand_r(&seed) % 64), 50, 0, &results);
+         record(c, OP_SEARCH, start);
+         free_search_results(&results);
+      }
+   }
+
+   review_log_flush(conn, &log);
+   if (direct) {
+      writer_stop(conn);
+      c->errors = writer_take_errors(conn);
+   } else {
+      // A read waits for the writes queued before it, so the count below is complete
+      DeckInfoList decks = {0};
+      load_deck_list(conn, &decks);
+      free_deck_list(&decks);
+      c->errors = remote_take_errors(conn);
+   }
+   close_database(conn);
+   c->ok = 1;
+   return NULL;
+}
+
+static void* run_daemon(void* arg) {
+   daemon_run(arg);
+   return NULL;
+}
+
+static int remove_entry(const char* path, const struct stat* st, int flag, struct FTW* ftw) {
+   (void)st, (void)flag, (void)ftw;
+   remove(path);
+   return 0;
+}
+
+static void usage(void) {
+   fprintf(stderr, "Usage: bench-daemon %s [--clients N] [--seconds N] [--direct]\n", GEN_USAGE);
+   fprintf(stderr, "  --clients N  simulated TUIs running at once (default %d)\n", DEFAULT_CLIENTS);
+   fprintf(stderr, "  --seconds N  how long they run (default %d)\n", DEFAULT_SECONDS);
+   fprintf(stderr, "  --direct     give each client its own connection and writer, no daemon\n");
+}
+
+int main(int argc, char** argv) {
+   GenOptions opts;
+   gen_default_options(&opts);
+   int clients = DEFAULT_CLIENTS;
+   int seconds = DEFAULT_SECONDS;
+
+   for (int i = 1; i < argc; i++) {
+      int used = gen_parse_option(&opts, argc, argv, &i);
+      if (used < 0)
+         return EXIT_FAILURE;
+      if (used)
+         continue;
+      if (strcmp(argv[i], "--clients") == 0 && i + 1 < argc) {
+         clients = atoi(argv[++i]);
+      } else if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc) {
+         seconds = atoi(argv[++i]);
+      } else if (strcmp(argv[i], "--direct") == 0) {
+         direct = 1;
+      } else {
+         usage();
+         return EXIT_FAILURE;
+      }
+   }
+   if (clients < 1 || clients > MAX_CLIENTS || seconds < 1) {
+      fprintf(stderr, "--clients must be between 1 and %d, --seconds at least 1\n", MAX_CLIENTS);
+      return EXIT_FAILURE;
+   }
+
+   char tmp_dir[] = "/tmp/flash-bench-XXXXXX";
+   if (!mkdtemp(tmp_dir)) {
+      perror("mkdtemp");
+      return EXIT_FAILURE;
+   }
+   setenv("HOME", tmp_dir, 1);
+   char path[PATH_MAX];
+   snprintf(path, sizeof(path), "%s/%s", tmp_dir, PROTO_SOCKET_NAME);
+   socket_path = path;
+
+   setup_database(&db);
+   GenStats gen = {0};
+   fprintf(stderr, "Generating %d cards in %d decks...\n", opts.cards, opts.decks);
+   if (!gen_database(db, &opts, &gen)) {
+      close_database(db);
+      nftw(tmp_dir, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+      return EXIT_FAILURE;
+   }
+   // A snapshot taken mid-run would be timed as client latency
+   db->config.backup_interval = 0;
+
+   Daemon* server = NULL;
+   pthread_t server_thread;
+   if (!direct) {
+      writer_start(db);
+      if (!(server = daemon_start(db, socket_path)) ||
+          pthread_create(&server_thread, NULL, run_daemon, server) != 0) {
+         daemon_free(server);
+         writer_stop(db);
+         close_database(db);
+         nftw(tmp_dir, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+         return EXIT_FAILURE;
+      }
+   }
+
+   fprintf(stderr, "Running %d %s clients for %d s...\n", clients, direct ? "direct" : "daemon",
+           seconds);
+   Client* pool = calloc(clients, sizeof(Client));
+   pthread_t* threads = calloc(clients, sizeof(pthread_t));
+   if (!pool || !threads) {
+      fprintf(stderr, "Out of memory\n");
+      exit(EXIT_FAILURE);
+   }
+   unsigned long long start = now_ns();
+   int started = 0;
+   for (; started < clients; started++) {
+      pool[started].index = started;
+      if (pthread_create(&threads[started], NULL, run_client, &pool[started]) != 0)
+         break;
+   }
+   sleep(seconds);
+   atomic_store(&stopping, 1);
+   for (int i = 0; i < started; i++)
+      pthread_join(threads[i], NULL);
+   double elapsed = (now_ns() - start) / 1e9;
+
+   if (server) {
+      daemon_stop(server);
+      pthread_join(server_thread, NULL);
+      daemon_print_stats(server, stderr);
+      writer_print_stats(db, stderr);
+      daemon_free(server);
+      writer_stop(db);
+   }
+
+   int connected = 0;
+   unsigned long errors = 0;
+   for (int i = 0; i < started; i++) {
+      connected += pool[i].ok;
+      errors += pool[i].errors;
+   }
+   printf("{\n  \"sqlite_version\": \"%s\",\n  \"timestamp\": %lld,\n", sqlite3_libversion(),
+          (long long)time(NULL));
+   printf("  \"database\": {\"decks\": %d, \"cards\": %d, \"seed\": %u, \"generate_s\": %.2f},\n",
+          gen.decks, gen.cards, opts.seed, gen.seconds);
+   printf("  \"mode\": \"%s\", \"clients\": %d, \"connected\": %d, \"seconds\": %.2f, "
+          "\"write_errors\": %lu,\n  \"results\": [",
+          direct ? "direct" : "daemon", clients, connected, elapsed, errors);
+
+   for (int op = 0; op < OP_COUNT; op++) {
+      Samples all = {0};
+      for (int i = 0; i < started; i++) {
+         Samples* s = &pool[i].samples[op];
+         for (size_t k = 0; k < s->count; k++)
+            da_append(&all, s->items[k]);
+         free(s->items);
+      }
+      double p50 = 0, p99 = 0, max = 0;
+      if (all.count > 0) {
+         qsort(all.items, all.count, sizeof(double), cmp_double);
+         p50 = all.items[all.count / 2];
+         p99 = all.items[(size_t)(all.count * 0.99)];
+         max = all.items[all.count - 1];
+      }
+      fprintf(stderr, "%-16s %9zu ops %10.0f/s  p50 %9.1f us  p99 %9.1f us  max %9.1f us\n",
+              op_names[op], all.count, all.count / elapsed, p50, p99, max);
+      printf("%s\n    {\"name\": \"%s\", \"ops\": %zu, \"per_s\": %.1f, \"p50_us\": %.1f, "
+             "\"p99_us\": %.1f, \"max_us\": %.1f}",
+             op ? "," : "", op_names[op], all.count, all.count / elapsed, p50, p99, max);
+      free(all.items);
+   }
+   printf("\n  ]\n}\n");
+
+   free(pool);
+   free(threads);
+   close_database(db);
+   nftw(tmp_dir, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+   return connected == clients ? 0 : EXIT_FAILURE;
+}
@@ -0,0 +1,505 @@
+// Times the db.c entry points, study card selection and the render helpers on a
+// generated database and prints the results as JSON, so runs from different
+// releases can be compared:  make bench > before.json
+#include "gen.h"
+#include "../include/render.h"
+#include "../include/scheduler.h"
+#include "../include/search.h"
+#include "../include/tui.h"
+#include "../include/menu_utils.h"
+#include "../include/writer.h"
+#include "../include/layout.h"
+#include "../include/editor.h"
+#include "../include/dedupe.h"
+
+#include <locale.h>
+#include <time.h>
+#include <linux/limits.h>
+#include <unistd.h>
+
+#define DEFAULT_RUNS 5
+#define BENCH_WRITES 500         // cards written per run by the write benchmarks
+#define BENCH_LOOKUPS 1000       // calls per run for the cheap benchmarks
+#define BENCH_EDIT_TEXT (1 << 20) // bytes of text the editor benchmark types into
+#define MAX_RUNS 100
+
+typedef struct {
+   const char* name;
+   int ops;                      // operations per run, for the per-op figures
+   void (*setup)(void);          // untimed, before every run (may be NULL)
+   void (*run)(void);
+   void (*teardown)(void);       // untimed, after every run (may be NULL)
+} Bench;
+
+FlashDb* db;
+
+static DeckInfoList decks;
+static int big_deck_id;          // deck with the most cards
+static int big_deck_cards;
+static Deck deck;
+static int card_ids[BENCH_WRITES];
+static StudyQueue queue;
+static WINDOW* bench_win;
+static int bench_scroll;
+static GapBuffer edit_buffer;
+
+static unsigned long long now_ns(void) {
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int cmp_double(const void* a, const void* b) {
+   double x = *(const double*)a, y = *(const double*)b;
+   return (x > y) - (x < y);
+}
+
+// Setup and teardown helpers shared by the write benchmarks
+
+static void add_untimed_cards(void) {
+   db_begin(db);
+   for (int i = 0; i < BENCH_WRITES; i++)
+      card_ids[i] = add_card(db, NULL, big_deck_id, "bench front", "bench back");
+   db_commit(db);
+}
+
+static void delete_untimed_cards(void) {
+   db_begin(db);
+   for (int i = 0; i < BENCH_WRITES; i++)
+      delete_card_by_id(db, NULL, card_ids[i]);
+   db_commit(db);
+}
+
+// Benchmarks
+
+static void run_setup_database(void) {
+   FlashDb* other;
+   setup_database(&other);
+   close_database(other);
+}
+
+static void run_load_deck_list(void) {
+   DeckInfoList list = {0};
+   load_deck_list(db, &list);
+   free_deck_list(&list);
+}
+
+static void run_calc_max_line_width(void) {
+   for (int i = 0; i < BENCH_LOOKUPS; i++)
+      calc_max_line_width(&decks);
+}
+
+static void run_deck_exists(void) {
+   for (int i = 0; i < BENCH_LOOKUPS; i++) {
+      DeckInfo* d = &decks.items[i % decks.count];
+      deck_exists(db, d->name, NULL);
+   }
+}
+
+// Fronts of the big deck, each looked up as if it were added again
+static char* dup_fronts[BENCH_LOOKUPS];
+
+static void load_dup_fronts(void) {
+   sqlite3_stmt* stmt;
+   sqlite3_prepare_v2(db->conn, "SELECT front FROM cards WHERE deck_id = ? LIMIT ?;", -1, &stmt, NULL);
+   sqlite3_bind_int(stmt, 1, big_deck_id);
+   sqlite3_bind_int(stmt, 2, BENCH_LOOKUPS);
+   for (int i = 0; i < BENCH_LOOKUPS && sqlite3_step(stmt) == SQLITE_ROW; i++)
+      dup_fronts[i] = strdup((const char*)sqlite3_column_text(stmt, 0));
+   sqlite3_finalize(stmt);
+}
+
+static void run_find_duplicate(void) {
+   for (int i = 0; i < BENCH_LOOKUPS && dup_fronts[i]; i++) {
+      Cards existing;
+      if (find_duplicate_card(db, big_deck_id, dup_fronts[i], card_text_hash(dup_fronts[i]), &existing)) {
+         free(existing.front);
+         free(existing.back);
+      }
+   }
+}
+
+static void free_dup_fronts(void) {
+   for (int i = 0; i < BENCH_LOOKUPS; i++) {
+      free(dup_fronts[i]);
+      dup_fronts[i] = NULL;
+   }
+}
+
+static void run_load_deck_cards(void) {
+   load_deck_cards(db, big_deck_id, &deck);
+}
+
+static void free_deck(void) {
+   free_deck_cards(&deck);
+   deck = (Deck){0};
+}
+
+static void load_deck(void) {
+   load_deck_cards(db, big_deck_id, &deck);
+}
+
+// Stepping through cards the way display_cards does, pages fetched as needed
+static void run_deck_browse(void) {
+   for (int i = 0; i < BENCH_LOOKUPS; i++)
+      deck_card(&deck, i % deck.count);
+}
+
+static void run_load_deck_stats(void) {
+   DeckStatsList stats = {0};
+   load_deck_stats(db, time(NULL), &stats);
+   free_deck_stats(&stats);
+}
+
+static void run_check_deck_counts(void) {
+   check_deck_counts(db, 0, NULL);
+}
+
+static void search(const char* text) {
+   SearchResults results = {0};
+   search_cards(db, text, SEARCH_PAGE_SIZE, 0, &results);
+   free_search_results(&results);
+}
+
+static void run_search_common(void) {
+   search(gen_word(0));
+}
+
+static void run_search_rare(void) {
+   search(gen_word(GEN_VOCAB_SIZE - 1));
+}
+
+// Every add commits on its own, as it does from the TUI without the writer
+static void run_add_card(void) {
+   for (int i = 0; i < BENCH_WRITES; i++)
+      card_ids[i] = add_card(db, NULL, big_deck_id, "bench front", "bench back");
+}
+
+static void start_writer(void) {
+   writer_start(db);
+}
+
+static void stop_writer_and_delete(void) {
+   writer_stop(db);
+   delete_untimed_cards();
+}
+
+static void run_add_card_writer(void) {
+   for (int i = 0; i < BENCH_WRITES; i++)
+      card_ids[i] = add_card(db, NULL, big_deck_id, "bench front", "bench back");
+   writer_flush(db);
+}
+
+static void run_update_card(void) {
+   for (int i = 0; i < BENCH_WRITES; i++)
+      update_card(db, NULL, card_ids[i], "bench front edited", "bench back edited");
+}
+
+static void run_delete_card(void) {
+   for (int i = 0; i < BENCH_WRITES; i++)
+      delete_card_by_id(db, NULL, card_ids[i]);
+}
+
+static void run_create_delete_deck(void) {
+   char name[] = "bench-scratch";
+   int deck_id;
+   create_deck(db, name);
+   if (deck_exists(db, name, &deck_id))
+      delete_deck_by_id(db, deck_id);
+}
+
+static void run_study_queue_load(void) {
+   study_queue_load(db, big_deck_id, time(NULL), NULL, &queue);
+}
+
+static void free_queue(void) {
+   free_study_queue(&queue);
+   queue = (StudyQueue){0};
+}
+
+static void start_study(void) {
+   study_queue_load(db, big_deck_id, time(NULL), NULL, &queue);
+   db_begin(db);
+}
+
+// Selection from the heap plus the schedule upsert, inside one transaction
+static void run_study_next_card(void) {
+   time_t now = time(NULL);
+   for (int i = 0; i < BENCH_WRITES && study_queue_peek(&queue); i++)
+      study_queue_answer(db, &queue, i % 4 != 0, 1000, now);
+}
+
+// Answer and then get the next card's text, back to back: no think time for
+// the prefetch worker to hide its read in, so this is the slowest case
+static void run_study_show_next(void) {
+   time_t now = time(NULL);
+   for (int i = 0; i < BENCH_WRITES && study_queue_card(&queue); i++)
+      study_queue_answer(db, &queue, i % 4 != 0, 1000, now);
+}
+
+// Rolled back so every run starts from new cards and --db databases are left alone.
+// Freeing the queue first puts its last logged answers inside the rollback too.
+static void end_study(void) {
+   free_queue();
+   db_rollback(db);
+}
+
+// Word wrapping alone, without the layout cache render_card goes through
+static void run_layout_wrap(void) {
+   for (int i = 0; i < BENCH_LOOKUPS; i++) {
+      LayoutLine* lines;
+      int count;
+      const char* text = deck_card(&deck, i % deck.count)->back;
+      if (layout_wrap(text, CARD_TEXT_COLUMNS(CARD_WIDTH), &lines, &count))
+         free(lines);
+   }
+}
+
+static void start_edit(void) {
+   char* text = malloc(BENCH_EDIT_TEXT + 1);
+   memset(text, 'x', BENCH_EDIT_TEXT);
+   text[BENCH_EDIT_TEXT] = '\0';
+   gap_init(&edit_buffer, text);
+   gap_move(&edit_buffer, BENCH_EDIT_TEXT / 2);
+   free(text);
+}
+
+static void end_edit(void) {
+   gap_free(&edit_buffer);
+}
+
+// Typing in the middle of a long text: mostly inserts, some deletes and cursor moves
+static void run_edit_keystrokes(void) {
+   for (int i = 0; i < BENCH_LOOKUPS; i++) {
+      size_t cursor = edit_buffer.gap_start;
+      if (i % 16 == 15)
+         gap_move(&edit_buffer, cursor - 40);
+      else if (i % 8 == 7)
+         gap_delete(&edit_buffer, cursor - 1, cursor);
+      else
+         gap_insert(&edit_buffer, "a", 1);
+   }
+}
+
+static void run_render_card_full(void) {
+   for (int i = 0; i < BENCH_LOOKUPS; i++) {
+      render_touch();
+      render_card(bench_win, deck_card(&deck, i % deck.count), i + 1, deck.count, SHOW_FRONT, "",
+                  &bench_scroll);
+      wnoutrefresh(bench_win);
+      doupdate();
+   }
+}
+
+static void run_render_card_flip(void) {
+   for (int i = 0; i < BENCH_LOOKUPS; i++) {
+      render_card(bench_win, deck_card(&deck, 0), 1, deck.count, i % 2 ? SHOW_BACK : SHOW_FRONT, "",
+                  &bench_scroll);
+      wnoutrefresh(bench_win);
+      doupdate();
+   }
+}
+
+static void run_render_menu_page(void) {
+   int rows = getmaxy(bench_win) - 2;
+   for (int i = 0; i < rows; i++)
+      render_deck_info_item(bench_win, i + 1, i % decks.count, 0, &decks);
+   wnoutrefresh(bench_win);
+   doupdate();
+}
+
+static const Bench db_benches[] = {
+   {"setup_database",      1, NULL, run_setup_database, NULL},
+   {"load_deck_list",      1, NULL, run_load_deck_list, NULL},
+   {"calc_max_line_width", BENCH_LOOKUPS, NULL, run_calc_max_line_width, NULL},
+   {"deck_exists",         BENCH_LOOKUPS, NULL, run_deck_exists, NULL},
+   {"find_duplicate",      BENCH_LOOKUPS, load_dup_fronts, run_find_duplicate, free_dup_fronts},
+   {"load_deck_cards",     1, NULL, run_load_deck_cards, free_deck},
+   {"load_deck_cards_reload", 1, load_deck, run_load_deck_cards, free_deck},
+   {"deck_browse",         BENCH_LOOKUPS, load_deck, run_deck_browse, free_deck},
+   {"load_deck_stats",     1, NULL, run_load_deck_stats, NULL},
+   {"check_deck_counts",   1, NULL, run_check_deck_counts, NULL},
+   {"search_cards_common", 1, NULL, run_search_common, NULL},
+   {"search_cards_rare",   1, NULL, run_search_rare, NULL},
+   {"add_card",            BENCH_WRITES, NULL, run_add_card, delete_untimed_cards},
+   {"add_card_writer",     BENCH_WRITES, start_writer, run_add_card_writer, stop_writer_and_delete},
+   {"update_card",         BENCH_WRITES, add_untimed_cards, run_update_card, delete_untimed_cards},
+   {"delete_card",         BENCH_WRITES, add_untimed_cards, run_delete_card, NULL},
+   {"create_delete_deck",  1, NULL, run_create_delete_deck, NULL},
+   {"study_queue_load",    1, NULL, run_study_queue_load, free_queue},
+   {"study_next_card",     BENCH_WRITES, start_study, run_study_next_card, end_study},
+   {"study_show_next",     BENCH_WRITES, start_study, run_study_show_next, end_study},
+};
+
+static const Bench render_benches[] = {
+   {"layout_wrap",         BENCH_LOOKUPS, load_deck, run_layout_wrap, free_deck},
+   {"edit_keystrokes",     BENCH_LOOKUPS, start_edit, run_edit_keystrokes, end_edit},
+   {"render_card_full",    BENCH_LOOKUPS, load_deck, run_render_card_full, free_deck},
+   {"render_card_flip",    BENCH_LOOKUPS, load_deck, run_render_card_flip, free_deck},
+   {"render_menu_page",    1, NULL, run_render_menu_page, NULL},
+};
+
+#define COUNT(a) (sizeof(a) / sizeof((a)[0]))
+
+static void run_bench(FILE* out, const Bench* b, int runs, int* first) {
+   double ms[MAX_RUNS];
+   fprintf(stderr, "%-24s", b->name);
+   for (int r = 0; r < runs; r++) {
+      if (b->setup)
+         b->setup();
+      unsigned long long start = now_ns();
+      b->run();
+      ms[r] = (now_ns() - start) / 1e6;
+      if (b->teardown)
+         b->teardown();
+   }
+   qsort(ms, runs, sizeof(*ms), cmp_double);
+
+   double median = ms[runs / 2];
+   fprintf(stderr, "%10.3f ms\n", median);
+   fprintf(out, "%s\n    {\"name\": \"%s\", \"ops\": %d, \"runs\": %d, "
+           "\"median_ms\": %.4f, \"min_ms\": %.4f, \"max_ms\": %.4f, "
+           "\"us_per_op\": %.3f, \"ops_per_sec\": %.0f}",
+           *first ? "" : ",", b->name, b->ops, runs, median, ms[0], ms[runs - 1],
+           median * 1e3 / b->ops, median > 0 ? b->ops / (median / 1e3) : 0.0);
+   *first = 0;
+}
+
+// curses writing to /dev/null at a fixed size, so render timings do not depend
+// on the terminal the benchmark runs in
+static int start_render(void) {
+   FILE* out = fopen("/dev/null", "w");
+   FILE* in = fopen("/dev/null", "r");
+   if (!out || !in)
+      return 0;
+   setenv("LINES", "50", 1);
+   setenv("COLUMNS", "160", 1);
+   const char* term = getenv("TERM");
+   if (!newterm(term && *term ? term : "xterm-256color", out, in))
+      return 0;
+   bench_win = newwin(CARD_HEIGHT, CARD_WIDTH, 0, 0);
+   return bench_win != NULL;
+}
+
+static void remove_database(const char* dir) {
+   const char* files[] = {"tui-cards/flashcards.db", "tui-cards/flashcards.db-wal",
+                          "tui-cards/flashcards.db-shm", "tui-cards"};
+   char path[PATH_MAX];
+   for (size_t i = 0; i < COUNT(files); i++) {
+      snprintf(path, sizeof(path), "%s/%s", dir, files[i]);
+      if (unlink(path) != 0)
+         rmdir(path);
+   }
+   rmdir(dir);
+}
+
+static void usage(void) {
+   fprintf(stderr, "Usage: bench-flash %s [--runs N] [--db DIR] [-o FILE]\n", GEN_USAGE);
+   fprintf(stderr, "  --db DIR   benchmark DIR/tui-cards/flashcards.db (from gen-db) instead of generating one\n");
+}
+
+int main(int argc, char** argv) {
+   setlocale(LC_ALL, "");
+   GenOptions opts;
+   gen_default_options(&opts);
+   int runs = DEFAULT_RUNS;
+   const char* db_dir = NULL;
+   const char* out_path = NULL;
+
+   for (int i = 1; i < argc; i++) {
+      int used = gen_parse_option(&opts, argc, argv, &i);
+      if (used < 0)
+         return EXIT_FAILURE;
+      if (used)
+         continue;
+      if (strcmp(argv[i], "--runs") == 0 && i + 1 < argc) {
+         runs = atoi(argv[++i]);
+      } else if (strcmp(argv[i], "--db") == 0 && i + 1 < argc) {
+         db_dir = argv[++i];
+      } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+         out_path = argv[++i];
+      } else {
+         usage();
+         return EXIT_FAILURE;
+      }
+   }
+   if (runs < 1 || runs > MAX_RUNS) {
+      fprintf(stderr, "--runs must be between 1 and %d\n", MAX_RUNS);
+      return EXIT_FAILURE;
+   }
+
+   char tmp_dir[] = "/tmp/flash-bench-XXXXXX";
+   if (!db_dir && !mkdtemp(tmp_dir)) {
+      perror("mkdtemp");
+      return EXIT_FAILURE;
+   }
+   setenv("HOME", db_dir ? db_dir : tmp_dir, 1);
+   setup_database(&db);
+
+   GenStats gen = {0};
+   if (!db_dir) {
+      fprintf(stderr, "Generating %d cards in %d decks...\n", opts.cards, opts.decks);
+      if (!gen_database(db, &opts, &gen)) {
+         close_database(db);
+         remove_database(tmp_dir);
+         return EXIT_FAILURE;
+      }
+   }
+
+   load_deck_list(db, &decks);
+   int total_cards = 0;
+   for (size_t i = 0; i < decks.count; i++) {
+      total_cards += decks.items[i].card_count;
+      if (decks.items[i].card_count > big_deck_cards) {
+         big_deck_cards = decks.items[i].card_count;
+         big_deck_id = decks.items[i].id;
+      }
+   }
+   if (big_deck_cards == 0) {
+      fprintf(stderr, "The database has no cards to benchmark\n");
+      close_database(db);
+      if (!db_dir)
+         remove_database(tmp_dir);
+      return EXIT_FAILURE;
+   }
+
+   FILE* out = out_path ? fopen(out_path, "w") : stdout;
+   if (!out) {
+      perror(out_path);
+      return EXIT_FAILURE;
+   }
+
+   fprintf(out, "{\n  \"sqlite_version\": \"%s\",\n  \"timestamp\": %lld,\n", sqlite3_libversion(),
+           (long long)time(NULL));
+   fprintf(out, "  \"database\": {\"decks\": %zu, \"cards\": %d, \"largest_deck\": %d, \"generated\": %s",
+           decks.count, total_cards, big_deck_cards, db_dir ? "false" : "true");
+   if (!db_dir) {
+      fprintf(out, ", \"front\": [%d, %d], \"back\": [%d, %d], \"dist\": \"%s\", \"seed\": %u, "
+              "\"generate_s\": %.2f",
+              opts.front_min, opts.front_max, opts.back_min, opts.back_max,
+              opts.dist == GEN_LEN_UNIFORM ? "uniform" : "skewed", opts.seed, gen.seconds);
+   }
+   fprintf(out, "},\n  \"results\": [");
+
+   int first = 1;
+   for (size_t i = 0; i < COUNT(db_benches); i++)
+      run_bench(out, &db_benches[i], runs, &first);
+
+   if (start_render()) {
+      for (size_t i = 0; i < COUNT(render_benches); i++)
+         run_bench(out, &render_benches[i], runs, &first);
+      delwin(bench_win);
+      endwin();
+   } else {
+      fprintf(stderr, "curses unavailable, skipping render benchmarks\n");
+   }
+   fprintf(out, "\n  ]\n}\n");
+   if (out != stdout)
+      fclose(out);
+
+   free_deck_list(&decks);
+   close_database(db);
+   if (!db_dir)
+      remove_database(tmp_dir);
+   return 0;
+}
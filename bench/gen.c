@@ -0,0 +1,187 @@
+#include "gen.h"
+
+#include <time.h>
+
+static const char* syllables[32] = {
+   "ka", "lo", "mi", "ne", "ru", "ta", "si", "po",
+   "ve", "da", "gu", "he", "jo", "be", "fi", "zu",
+   "an", "or", "el", "is", "um", "ya", "wo", "xi",
+   "ch", "th", "sh", "qu", "tr", "pl", "st", "gr"
+};
+
+static char vocab[GEN_VOCAB_SIZE][8];
+static unsigned rng_state;
+
+// xorshift32: the same seed gives the same database on every libc
+static unsigned next_rand(void) {
+   unsigned x = rng_state;
+   x ^= x << 13;
+   x ^= x >> 17;
+   x ^= x << 5;
+   return rng_state = x;
+}
+
+static double next_unit(void) {
+   return next_rand() / 4294967296.0;
+}
+
+static void build_vocab(void) {
+   if (vocab[0][0])
+      return;
+   // Two syllables for the first 1024 words, three after that, all distinct
+   for (int i = 0; i < GEN_VOCAB_SIZE; i++) {
+      snprintf(vocab[i], sizeof(vocab[i]), "%s%s%s", syllables[i % 32], syllables[(i / 32) % 32],
+               i >= 1024 ? syllables[i / 1024] : "");
+   }
+}
+
+static int pick_length(int min, int max, GenLengthDist dist) {
+   double u = next_unit();
+   if (dist == GEN_LEN_SKEWED)
+      u = u * u * u;
+   return min + (int)(u * (max - min + 1));
+}
+
+// Words with a low index are far more likely, like in real text
+static void fill_text(char* buf, int len) {
+   int pos = 0;
+   while (pos < len) {
+      double u = next_unit();
+      const char* word = vocab[(int)(u * u * u * u * GEN_VOCAB_SIZE)];
+      if (pos > 0)
+         buf[pos++] = ' ';
+      for (const char* w = word; *w && pos < len; w++)
+         buf[pos++] = *w;
+   }
+   buf[len] = '\0';
+}
+
+void gen_default_options(GenOptions* opts) {
+   *opts = (GenOptions){
+      .decks = 20,
+      .cards = 100000,
+      .front_min = 4, .front_max = 80,
+      .back_min = 8, .back_max = 400,
+      .dist = GEN_LEN_SKEWED,
+      .seed = 42,
+   };
+}
+
+int gen_parse_range(const char* text, int* min, int* max) {
+   int lo, hi;
+   if (sscanf(text, "%d:%d", &lo, &hi) != 2 || lo < 1 || hi < lo || hi >= MAX_BUFFER)
+      return 0;
+   *min = lo;
+   *max = hi;
+   return 1;
+}
+
+int gen_parse_option(GenOptions* opts, int argc, char** argv, int* i) {
+   const char* arg = argv[*i];
+   if (*i + 1 >= argc)
+      return 0;
+
+   const char* value = argv[*i + 1];
+   int ok = 1;
+   if (strcmp(arg, "--decks") == 0) {
+      opts->decks = atoi(value);
+      ok = opts->decks > 0;
+   } else if (strcmp(arg, "--cards") == 0) {
+      opts->cards = atoi(value);
+      ok = opts->cards >= 0;
+   } else if (strcmp(arg, "--front") == 0) {
+      ok = gen_parse_range(value, &opts->front_min, &opts->front_max);
+   } else if (strcmp(arg, "--back") == 0) {
+      ok = gen_parse_range(value, &opts->back_min, &opts->back_max);
+   } else if (strcmp(arg, "--dist") == 0) {
+      ok = strcmp(value, "uniform") == 0 || strcmp(value, "skewed") == 0;
+      opts->dist = strcmp(value, "uniform") == 0 ? GEN_LEN_UNIFORM : GEN_LEN_SKEWED;
+   } else if (strcmp(arg, "--seed") == 0) {
+      opts->seed = (unsigned)strtoul(value, NULL, 10);
+   } else {
+      return 0;
+   }
+
+   if (!ok) {
+      fprintf(stderr, "invalid value '%s' for %s\n", value, arg);
+      return -1;
+   }
+   (*i)++;
+   return 1;
+}
+
+const char* gen_word(int index) {
+   build_vocab();
+   return vocab[index];
+}
+
+int gen_database(FlashDb* db, const GenOptions* opts, GenStats* stats) {
+   GenStats local_stats;
+   if (!stats) stats = &local_stats;
+   memset(stats, 0, sizeof(*stats));
+   if (opts->decks < 1 || opts->cards < 0)
+      return 0;
+
+   struct timespec start, end;
+   clock_gettime(CLOCK_MONOTONIC, &start);
+   build_vocab();
+   rng_state = opts->seed ? opts->seed : 1;
+
+   char front[MAX_BUFFER], back[MAX_BUFFER];
+   int ok = 1;
+   int in_batch = 0;
+
+   for (int d = 0; d < opts->decks && ok; d++) {
+      char name[64];
+      snprintf(name, sizeof(name), "bench-%d", d);
+      int deck_id;
+      if (!get_or_create_deck(db, name, &deck_id)) {
+         ok = 0;
+         break;
+      }
+      stats->decks++;
+
+      // The first deck takes the remainder so the total is exact
+      int cards = opts->cards / opts->decks + (d == 0 ? opts->cards % opts->decks : 0);
+      for (int i = 0; i < cards && ok; i++) {
+         if (in_batch == 0 && !db_begin(db)) {
+            ok = 0;
+            break;
+         }
+
+         fill_text(front, pick_length(opts->front_min, opts->front_max, opts->dist));
+         fill_text(back, pick_length(opts->back_min, opts->back_max, opts->dist));
+
+         sqlite3_stmt* stmt = db_stmt_acquire(db, STMT_ADD_CARD);
+         if (!stmt) {
+            ok = 0;
+            break;
+         }
+         sqlite3_bind_int(stmt, 1, deck_id);
+         sqlite3_bind_text(stmt, 2, front, -1, SQLITE_STATIC);
+         sqlite3_bind_text(stmt, 3, back, -1, SQLITE_STATIC);
+         ok = sqlite3_step(stmt) == SQLITE_DONE;
+         db_stmt_release(db, STMT_ADD_CARD);
+         stats->cards += ok;
+
+         if (ok && ++in_batch == GEN_BATCH_ROWS) {
+            if (!(ok = db_commit(db)))
+               db_rollback(db);
+            in_batch = 0;
+         }
+      }
+   }
+
+   if (in_batch > 0) {
+      if (ok)
+         ok = db_commit(db);
+      if (!ok)
+         db_rollback(db);
+   }
+   if (!ok)
+      fprintf(stderr, "gen: %s\n", sqlite3_errmsg(db->conn));
+
+   clock_gettime(CLOCK_MONOTONIC, &end);
+   stats->seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+   return ok;
+}
@@ -0,0 +1,77 @@
+#ifndef BENCH_GEN_H
+#define BENCH_GEN_H
+
+#include "../include/db.h"
+
+#define GEN_VOCAB_SIZE 4096        // distinct words card text is made of
+#define GEN_BATCH_ROWS 10000       // cards inserted per transaction
+
+// How card text lengths are spread between their min and max
+typedef enum {
+   GEN_LEN_UNIFORM,                // every length equally likely
+   GEN_LEN_SKEWED                  // mostly short, with a long tail up to max
+} GenLengthDist;
+
+typedef struct {
+   int decks;
+   int cards;                      // total, split evenly over the decks
+   int front_min, front_max;       // bytes
+   int back_min, back_max;
+   GenLengthDist dist;
+   unsigned seed;
+} GenOptions;
+
+typedef struct {
+   int decks;
+   int cards;
+   double seconds;
+} GenStats;
+
+/*
+* Brief - Options used when nothing is given: 20 decks, 100k cards, skewed lengths
+* Input - opts: options to fill
+* Output - None
+*/
+void gen_default_options(GenOptions* opts);
+
+/*
+* Brief - Parse "MIN:MAX" into a length range
+* Input - text: range text
+*         min, max: receive the bounds
+* Output - Returns 1 if the range is valid, 0 otherwise
+*/
+int gen_parse_range(const char* text, int* min, int* max);
+
+/*
+* Brief - Consume one generator option (--decks, --cards, --front, --back, --dist,
+*         --seed) and its value from the command line
+* Input - opts: options to update
+*         argc, argv: command line
+*         i: index of the option, advanced past its value when consumed
+* Output - 1 if consumed, 0 if argv[*i] is not a generator option, -1 on a bad value
+*/
+int gen_parse_option(GenOptions* opts, int argc, char** argv, int* i);
+
+#define GEN_USAGE "[--decks N] [--cards N] [--front MIN:MAX] [--back MIN:MAX] " \
+                  "[--dist uniform|skewed] [--seed N]"
+
+/*
+* Brief - Fill a database with decks named bench-N and cards whose text is drawn
+*         from a fixed vocabulary. Word frequencies follow a long tail, so
+*         gen_word(0) is in most cards and the last words are rare. The same
+*         seed always produces the same database.
+* Input - db: database context (schema already migrated)
+*         opts: what to generate
+*         stats: receives counts and timing (may be NULL)
+* Output - Returns 1 on success, 0 on failure
+*/
+int gen_database(FlashDb* db, const GenOptions* opts, GenStats* stats);
+
+/*
+* Brief - Get a word of the generator's vocabulary
+* Input - index: 0 (most frequent) to GEN_VOCAB_SIZE - 1 (least frequent)
+* Output - Static string
+*/
+const char* gen_word(int index);
+
+#endif
@@ -0,0 +1,46 @@
+// Generates a synthetic database for benchmarks and for trying the TUI on big
+// collections:  gen-db [options] DIR  writes DIR/tui-cards/flashcards.db, which
+// HOME=DIR ./bin/flash-cards then opens.
+#include "gen.h"
+
+#include <errno.h>
+#include <sys/stat.h>
+
+FlashDb* db;
+
+int main(int argc, char** argv) {
+   GenOptions opts;
+   gen_default_options(&opts);
+   const char* dir = NULL;
+
+   for (int i = 1; i < argc; i++) {
+      int used = gen_parse_option(&opts, argc, argv, &i);
+      if (used < 0)
+         return EXIT_FAILURE;
+      if (used)
+         continue;
+      if (argv[i][0] == '-' || dir) {
+         fprintf(stderr, "Usage: gen-db %s DIR\n", GEN_USAGE);
+         return EXIT_FAILURE;
+      }
+      dir = argv[i];
+   }
+   if (!dir) {
+      fprintf(stderr, "Usage: gen-db %s DIR\n", GEN_USAGE);
+      return EXIT_FAILURE;
+   }
+
+   // setup_database creates DIR/tui-cards and migrates the schema
+   if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+      perror(dir);
+      return EXIT_FAILURE;
+   }
+   setenv("HOME", dir, 1);
+   setup_database(&db);
+
+   GenStats stats;
+   int ok = gen_database(db, &opts, &stats);
+   fprintf(stderr, "Generated %d cards in %d decks in %.2f s\n", stats.cards, stats.decks, stats.seconds);
+   close_database(db);
+   return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,58 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+#define ARENA_MIN_BLOCK (64 * 1024)
+#define ARENA_MAX_BLOCK (8 * 1024 * 1024)
+
+typedef struct ArenaBlock {
+   struct ArenaBlock* next;
+   size_t used;
+   size_t size;
+   char data[];
+} ArenaBlock;
+
+// Bump allocator for strings that share a lifetime (e.g. all card text of a
+// Deck). Blocks double in size, so n bytes cost O(log n) mallocs and freeing
+// the arena releases everything at once.
+typedef struct {
+   ArenaBlock* head;
+   ArenaBlock* spare;       // blocks kept by arena_reset for reuse
+   size_t total;            // bytes handed out
+} Arena;
+
+/*
+* Brief - Allocate uninitialised memory from the arena
+* Input - arena: arena to allocate from (zero-initialised Arena is valid)
+*         size: number of bytes
+* Output - Pointer valid until arena_free, NULL if out of memory
+*/
+void* arena_alloc(Arena* arena, size_t size);
+
+/*
+* Brief - Copy a string (or its first len bytes) into the arena
+* Input - arena: arena to allocate from
+*         str: string to copy
+*         len: number of bytes to copy (arena_strndup only)
+* Output - NUL terminated copy, NULL if out of memory
+*/
+char* arena_strdup(Arena* arena, const char* str);
+char* arena_strndup(Arena* arena, const char* str, size_t len);
+
+/*
+* Brief - Invalidate everything allocated so far but keep the blocks for reuse,
+*         so reloading data of a similar size does not touch malloc at all
+* Input - arena: arena to reset
+* Output - None
+*/
+void arena_reset(Arena* arena);
+
+/*
+* Brief - Release every block owned by the arena and reset it to empty
+* Input - arena: arena to free
+* Output - None
+*/
+void arena_free(Arena* arena);
+
+#endif
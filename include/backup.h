@@ -0,0 +1,122 @@
+#ifndef BACKUP_H
+#define BACKUP_H
+
+#include <stdio.h>
+#include <time.h>
+#include "flash_db.h"
+
+#define BACKUP_STEP_PAGES 256           // pages per sqlite3_backup_step, 1 MiB at 4 KiB pages
+#define BACKUP_DIR "backups"            // next to the database
+#define BACKUP_PREFIX "flashcards-"     // snapshots are BACKUP_PREFIX YYYYmmdd-HHMMSS .db
+#define BACKUP_SAVED_PREFIX "before-restore-"  // the database a restore replaced, not a snapshot
+
+typedef struct Backup Backup;
+
+typedef struct {
+   const char* dest;         // file the copy ends up in
+   int pages;                // pages in the snapshot, 0 until the first step
+   int remaining;            // pages still to copy
+   int done;                 // the copy has finished, successfully or not
+   int ok;
+} BackupProgress;
+
+// Called after every step; returning 0 cancels the copy
+typedef int (*BackupProgressFn)(const BackupProgress* progress, void* data);
+
+typedef struct {
+   char** items;             // file names in the backup directory, oldest first
+   size_t count;
+   size_t capacity;
+} BackupList;
+
+/*
+* Brief - Get the directory rotating snapshots go to, next to the database file
+* Input - db: database context
+*         path: buffer for the directory
+*         size: size of path
+* Output - Returns 1 on success, 0 for an in-memory or remote database or a path
+*          too long
+*/
+int backup_dir(FlashDb* db, char* path, size_t size);
+
+/*
+* Brief - List the snapshots in the backup directory
+* Input - db: database context
+*         list: receives the file names, oldest first (free with free_backup_list)
+* Output - Returns 1 on success (also when the directory does not exist), 0 on failure
+*/
+int list_backups(FlashDb* db, BackupList* list);
+
+/*
+* Brief - Free a BackupList
+* Input - list: list to free
+* Output - None
+*/
+void free_backup_list(BackupList* list);
+
+/*
+* Brief - Tell whether the newest snapshot is older than the configured
+*         backup_interval (always 0 when it is 0)
+* Input - db: database context
+*         now: current time
+* Output - Returns 1 if a snapshot should be taken, 0 otherwise
+*/
+int backup_due(FlashDb* db, time_t now);
+
+/*
+* Brief - Copy the database to a file while it stays in use. A connection of its
+*         own holds one read transaction for the whole copy, so in WAL mode
+*         writers go on and the copy is the database as of its start instead of
+*         restarting whenever someone commits. Pages are copied BACKUP_STEP_PAGES
+*         at a time into FILE.tmp, which is renamed over FILE once it is synced.
+*         Without dest a rotating snapshot is written, and afterwards only the
+*         newest backup_keep snapshots are kept.
+* Input - db: database context (only its file name and config are used)
+*         dest: file to write, NULL for a new snapshot in the backup directory
+*         progress: called after every step (may be NULL)
+*         data: passed to progress
+* Output - Returns 1 on success, 0 on failure (message printed to stderr)
+*/
+int backup_database(FlashDb* db, const char* dest, BackupProgressFn progress, void* data);
+
+/*
+* Brief - Run backup_database on a background thread
+* Input - db: database context; must outlive backup_finish
+*         dest: file to write, NULL for a new snapshot
+* Output - Handle to poll and finish, NULL if the thread could not start
+*/
+Backup* backup_start(FlashDb* db, const char* dest);
+
+/*
+* Brief - Get how far a background backup has got, without waiting
+* Input - backup: running backup
+*         progress: receives the progress
+* Output - None
+*/
+void backup_poll(Backup* backup, BackupProgress* progress);
+
+/*
+* Brief - Wait for a background backup and free it. A cancelled copy stops at
+*         its next step and leaves no file behind.
+* Input - backup: backup to finish, NULL does nothing
+*         cancel: stop copying instead of waiting for the end
+* Output - Returns 1 if the backup completed, 0 otherwise (reported through
+*          db_report unless cancelled)
+*/
+int backup_finish(Backup* backup, int cancel);
+
+/*
+* Brief - Replace the database with a snapshot. The current database is first
+*         saved as BACKUP_SAVED_PREFIX YYYYmmdd-HHMMSS .db next to the snapshots
+*         (not one of them), and the schema is migrated afterwards if the
+*         snapshot is older than the app. Other processes must not have the
+*         database open.
+* Input - db: database context
+*         snapshot: snapshot file, a bare name is looked up in the backup directory
+*         progress: called after every step (may be NULL)
+*         data: passed to progress
+* Output - Returns 1 on success, 0 on failure (message printed to stderr)
+*/
+int restore_backup(FlashDb* db, const char* snapshot, BackupProgressFn progress, void* data);
+
+#endif
@@ -0,0 +1,14 @@
+#ifndef CLI_H
+#define CLI_H
+
+#include "flash_db.h"
+
+/*
+* Brief - Run a non-interactive subcommand (e.g. `flash-cards import deck.tsv`)
+* Input - db: database context
+*         argc, argv: arguments as passed to main
+* Output - Process exit status
+*/
+int run_cli(FlashDb* db, int argc, char** argv);
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include <stdio.h>
+#include "flash_db.h"
+
+#define DAEMON_CACHE_BYTES (64u << 20)     // reply cache size, least recently used goes first
+#define DAEMON_MAX_CLIENTS 1024
+#define DAEMON_OUT_LIMIT (1u << 20)        // bytes queued for a client before its requests wait
+#define DAEMON_INVALIDATE_DEDUP 16         // decks a client is told about before "anything changed"
+#define DAEMON_BACKUP_CHECK_MS 60000       // how often backup_due is asked while idle
+#define DAEMON_ACCEPT_RETRY_MS 1000        // wait before accepting again when full or out of fds
+
+typedef struct Daemon Daemon;
+
+/*
+* Brief - Listen for TUI clients on a Unix socket. One thread serves every
+*         client from db: reads go through a cache of encoded replies shared by
+*         all of them, writes from all of them are committed together by db's
+*         writer, and a client that changes a deck gets the others told so.
+* Input - db: database context, with a writer running for batched commits;
+*             its message sink is taken over until daemon_free
+*         path: socket to create; a stale one is replaced, a live one is an error
+* Output - Daemon to run, NULL on failure (message printed to stderr)
+*/
+Daemon* daemon_start(FlashDb* db, const char* path);
+
+/*
+* Brief - Serve clients until daemon_stop. Also takes the automatic snapshots the
+*         TUI takes when it runs alone.
+* Input - d: daemon
+* Output - Returns 1 after daemon_stop, 0 on a fatal error
+*/
+int daemon_run(Daemon* d);
+
+/*
+* Brief - Make daemon_run return. Safe to call from a signal handler or another thread.
+* Input - d: daemon
+* Output - None
+*/
+void daemon_stop(Daemon* d);
+
+/*
+* Brief - Disconnect every client, remove the socket and free the daemon
+* Input - d: daemon (may be NULL)
+* Output - None
+*/
+void daemon_free(Daemon* d);
+
+/*
+* Brief - Print request, cache and client counters
+* Input - d: daemon
+*         out: stream to write to
+* Output - None
+*/
+void daemon_print_stats(Daemon* d, FILE* out);
+
+#endif
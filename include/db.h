@@ -2,12 +2,18 @@
 #define DB_H
 
 #include <sqlite3.h>
+#include "flash_db.h"
+#include "arena.h"
 #include <stdio.h>
 #include <string.h>
 #include <ctype.h>
 #include <stdlib.h>
+#include <time.h>
 
 #define MAX_BUFFER 1024
+#define DB_BUSY_TIMEOUT_MS 5000   // how long a connection waits for another one's write lock
+#define DECK_PAGE_SIZE 64         // cards fetched per query when browsing a deck
+#define DECK_CACHE_PAGES 16       // pages of card text a Deck keeps (least recently used goes first)
 
 // Yoinked from Tsoding
 // Dyanmic Arrays in C
@@ -30,11 +36,29 @@ typedef struct {
    char *back;
 } Cards;
 
+// Text of DECK_PAGE_SIZE consecutive cards of a Deck
+typedef struct {
+   size_t page;                    // ordinal of the first card / DECK_PAGE_SIZE
+   unsigned long last_used;        // 0: slot is empty
+   Cards cards[DECK_PAGE_SIZE];
+   size_t count;
+   Arena arena;                    // owns the text of cards
+} DeckPage;
+
+// A deck holds only its card ids up front. Text is fetched a page at a time
+// with deck_card and kept in a small LRU cache, so opening and browsing a deck
+// costs the same for 50 cards and for 500k.
 typedef struct {
    char* deck_name;
-   Cards *items;
+   int deck_id;
+   int stale;          // set when the in-memory copy no longer matches the database
+   int* ids;           // card ids in ascending order; a card's index is its ordinal
    size_t count;
    size_t capacity;
+   FlashDb* db;        // connection pages are fetched from
+   DeckPage pages[DECK_CACHE_PAGES];
+   unsigned long tick; // LRU clock
+   Arena arena;        // owns deck_name
 } Deck;
 
 typedef struct {
@@ -47,31 +71,56 @@ typedef struct {
    DeckInfo* items;
    size_t count;
    size_t capacity;
+   Arena arena;        // owns every DeckInfo.name
 } DeckInfoList;
 
+typedef struct {
+   int id;
+   char* name;
+   int cards;
+   int due;            // never studied or due by the given time
+   int reviewed;       // studied at least once
+} DeckStats;
+
+typedef struct {
+   DeckStats* items;
+   size_t count;
+   size_t capacity;
+   Arena arena;        // owns every DeckStats.name
+} DeckStatsList;
+
 /*
-* Brief - Initialize and create SQLite database connection
-* Input - Pointer to sqlite3* database handle (output parameter)
+* Brief - Initialize and create SQLite database connection wrapped in a FlashDb context
+* Input - Pointer to FlashDb* context (output parameter, free with close_database)
 * Output - None (assumes error handling inside)
 */
-void setup_database(sqlite3** db);
+void setup_database(FlashDb** db);
 
 /*
 * Brief - Check if a deck exists by name and optionally retrieve its ID
-* Input - db: SQLite database handle
+* Input - db: database context
 *         deck_name: name of the deck to check
 *         deck_id: pointer to int to store deck ID if found (can be NULL)
 * Output - Returns 1 if deck exists, 0 otherwise
 */
-int deck_exists(sqlite3* db, const char* deck_name, int* deck_id);
+int deck_exists(FlashDb* db, const char* deck_name, int* deck_id);
 
 /*
 * Brief - Load all deck metadata into a DeckInfoList structure
-* Input - db: SQLite database handle
+* Input - db: database context
 *         list: pointer to DeckInfoList struct to populate
 * Output - None (assumes list is initialized/empty)
 */
-void load_deck_list(sqlite3* db, DeckInfoList* list);
+void load_deck_list(FlashDb* db, DeckInfoList* list);
+
+/*
+* Brief - Compare every deck's stored card_count with the real number of cards
+* Input - db: database context
+*         repair: if non-zero, rewrite the counts that are wrong
+*         out: stream that receives one line per mismatching deck (can be NULL)
+* Output - Number of mismatching decks, or -1 on error
+*/
+int check_deck_counts(FlashDb* db, int repair, FILE* out);
 
 /*
 * Brief - Free memory allocated inside a DeckInfoList structure
@@ -81,20 +130,48 @@ void load_deck_list(sqlite3* db, DeckInfoList* list);
 void free_deck_list(DeckInfoList* list);
 
 /*
-* Brief - Load all cards for a given deck ID into a Deck structure
-* Input - db: SQLite database handle
-*         deck_id: ID of the deck whose cards to load
-*         deck: pointer to Deck struct to populate
+* Brief - Count cards, due cards and reviewed cards for every deck
+* Input - db: database context
+*         now: time that decides which cards are due
+*         list: receives one entry per deck, ordered by name (free with free_deck_stats)
+* Output - Returns 1 on success, 0 on failure
+*/
+int load_deck_stats(FlashDb* db, time_t now, DeckStatsList* list);
+
+/*
+* Brief - Free memory allocated inside a DeckStatsList structure
+* Input - list: pointer to DeckStatsList to free
 * Output - None
 */
-void load_deck_cards(sqlite3* db, int deck_id, Deck* deck);
+void free_deck_stats(DeckStatsList* list);
 
 /*
-* Brief - Reset the study_flag on all cards in the Deck to 0 (not studied)
-* Input - deck: pointer to Deck whose cards will be reset
+* Brief - Load the name and card ids of a deck into a Deck structure. Card text
+*         is not read until deck_card asks for it.
+* Input - db: database context
+*         deck_id: ID of the deck whose cards to load
+*         deck: pointer to Deck struct to populate (reused between loads)
 * Output - None
 */
-void reset_study_flags(Deck* deck);
+void load_deck_cards(FlashDb* db, int deck_id, Deck* deck);
+
+/*
+* Brief - Get a card of a loaded Deck by ordinal, fetching its page of text by
+*         card id range when it is not cached
+* Input - deck: loaded deck
+*         index: ordinal of the card, below deck->count
+* Output - Card valid until DECK_CACHE_PAGES other pages have been fetched or the
+*          deck changes, NULL if the page could not be read
+*/
+const Cards* deck_card(Deck* deck, size_t index);
+
+/*
+* Brief - Find a card in a loaded Deck by its database ID (binary search)
+* Input - deck: pointer to Deck to search
+*         card_id: ID of the card
+* Output - Ordinal of the card, or -1 if not present
+*/
+int deck_find_card(const Deck* deck, int card_id);
 
 /*
 * Brief - Free all dynamically allocated memory inside a Deck structure
@@ -105,55 +182,67 @@ void free_deck_cards(Deck* deck);
 
 /*
 * Brief - Insert a new deck into the database
-* Input - db: SQLite database handle
+* Input - db: database context
 *         deck_name: name of the deck to create
-* Output - None
+* Output - Returns 1 if the deck was created, 0 otherwise
 */
-void create_deck(sqlite3* db, char* deck_name);
+int create_deck(FlashDb* db, char* deck_name);
+
+/*
+* Brief - Look up a deck by name, creating it if missing, without any UI output
+* Input - db: database context
+*         deck_name: name of the deck
+*         deck_id: pointer to int that receives the deck ID
+* Output - Returns 1 on success, 0 if the deck could not be found or created
+*/
+int get_or_create_deck(FlashDb* db, const char* deck_name, int* deck_id);
 
 /*
 * Brief - Delete a deck and its associated cards by deck name
-* Input - db: SQLite database handle
+* Input - db: database context
 *         deck_name: name of the deck to delete
-* Output - None
+* Output - Returns 1 if the deck was deleted, 0 otherwise
 */
-void delete_deck_by_name(sqlite3* db, char* deck_name);
+int delete_deck_by_name(FlashDb* db, char* deck_name);
 
 /*
 * Brief - Delete a deck and its associated cards by deck ID
-* Input - db: SQLite database handle
+* Input - db: database context
 *         deck_id: ID of the deck to delete
-* Output - None
+* Output - Returns 1 if the statement ran (also when no deck had that ID), 0 otherwise
 */
-void delete_deck_by_id(sqlite3* db, int deck_id);
+int delete_deck_by_id(FlashDb* db, int deck_id);
 
 /*
 * Brief - Add a card to the database under a specific deck
-* Input - db: SQLite database handle
+* Input - db: database context
+*         deck: loaded copy of the deck to patch in place (can be NULL)
 *         deck_id: ID of the deck to add card to
 *         front: front text of the card
 *         back: back text of the card
-* Output - None
+* Output - Returns the new card's ID, 0 on failure (deck is marked stale on failure)
 */
-void add_card(sqlite3* db, int deck_id, const char* front, const char* back);
+int add_card(FlashDb* db, Deck* deck, int deck_id, const char* front, const char* back);
 
 /*
 * Brief - Delete a card from the database by card ID
-* Input - db: SQLite database handle
+* Input - db: database context
+*         deck: loaded copy of the deck to patch in place (can be NULL)
 *         card_id: ID of the card to delete
-* Output - None
+* Output - Returns 1 on success, 0 otherwise (deck is marked stale on failure)
 */
-void delete_card_by_id(sqlite3* db, int card_id);
+int delete_card_by_id(FlashDb* db, Deck* deck, int card_id);
 
 /*
 * Brief - Update the front and back text of a card by card ID
-* Input - db: SQLite database handle
+* Input - db: database context
+*         deck: loaded copy of the deck to patch in place (can be NULL)
 *         card_id: ID of the card to update
 *         new_front: new front text
 *         new_back: new back text
-* Output - None
+* Output - Returns 1 on success, 0 otherwise (deck is marked stale on failure)
 */
-void update_card(sqlite3* db, int card_id, const char* new_front, const char* new_back);
+int update_card(FlashDb* db, Deck* deck, int card_id, const char* new_front, const char* new_back);
 
 /*
 * Brief - Remove newline character from a string, if present
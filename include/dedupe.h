@@ -0,0 +1,91 @@
+#ifndef DEDUPE_H
+#define DEDUPE_H
+
+#include <stdio.h>
+#include "db.h"
+
+// What to do with a card whose front a card in the same deck already has
+typedef enum {
+   DUP_SKIP,           // leave the existing card as it is
+   DUP_MERGE,          // add the new back to the existing card's, unless it already says it
+   DUP_KEEP            // add the card anyway
+} DupPolicy;
+
+typedef struct {
+   size_t cards;       // cards scanned
+   size_t groups;      // fronts shared by more than one card
+   size_t removed;     // later copies deleted
+   size_t merged;      // cards whose back took in the backs of their copies
+   double seconds;
+} DedupeStats;
+
+/*
+* Brief - Hash a card front for duplicate checks: 64-bit FNV-1a of the text with
+*         Latin, Greek and Cyrillic letters lowercased, runs of whitespace turned
+*         into one space and leading/trailing whitespace dropped. It does not
+*         depend on the locale.
+* Input - text: NUL terminated text
+* Output - The hash, as SQLite stores it in cards.front_hash
+*/
+long long card_text_hash(const char* text);
+
+/*
+* Brief - Compare two texts as card_text_hash sees them
+* Input - a, b: NUL terminated texts
+* Output - Returns 1 if they normalize to the same text, 0 otherwise
+*/
+int card_text_equal(const char* a, const char* b);
+
+/*
+* Brief - Register card_hash(text), card_text_hash as an SQL function, on a
+*         connection. Every connection that writes cards needs it.
+* Input - conn: connection
+* Output - Returns 1 on success, 0 on failure
+*/
+int register_card_hash(sqlite3* conn);
+
+/*
+* Brief - Parse "skip", "merge" or "keep"
+* Input - name: text to parse
+*         policy: receives the policy
+* Output - Returns 1 on success, 0 if name is none of them
+*/
+int parse_dup_policy(const char* name, DupPolicy* policy);
+
+/*
+* Brief - Find the card in a deck whose front matches front once normalized. An
+*         index on (deck_id, front_hash) makes this one lookup, whatever the deck
+*         size. Queued writes are flushed first.
+* Input - db: database context
+*         deck_id: deck to look in
+*         front: front of the card about to be added
+*         hash: card_text_hash(front)
+*         card: receives the matching card, with malloc'd front and back
+* Output - Returns 1 if a card matched, 0 if none did or on error
+*/
+int find_duplicate_card(FlashDb* db, int deck_id, const char* front, long long hash, Cards* card);
+
+/*
+* Brief - Combine the back of an existing card with the back of its duplicate,
+*         one per line
+* Input - existing: back of the card that stays
+*         added: back of its duplicate
+* Output - malloc'd combined back, NULL if existing already has added as a line
+*          (or out of memory)
+*/
+char* merge_backs(const char* existing, const char* added);
+
+/*
+* Brief - Remove duplicate cards from every deck in one pass over the
+*         (deck_id, front_hash) index, keeping the oldest card of each front.
+*         Card text is only read for fronts that share a hash. Runs in one
+*         transaction.
+* Input - db: database context
+*         merge: fold the backs of removed cards into the card kept
+*         dry_run: count only, change nothing
+*         stats: receives counts and timing (may be NULL)
+* Output - Returns 1 on success, 0 on failure (message printed to stderr)
+*/
+int dedupe_cards(FlashDb* db, int merge, int dry_run, DedupeStats* stats);
+
+#endif
@@ -0,0 +1,108 @@
+#ifndef EDITOR_H
+#define EDITOR_H
+
+#include <ncurses.h>
+#include <stddef.h>
+
+#define EDIT_MULTILINE 1           // Alt+Enter inserts a newline
+#define EDIT_DASHES 2              // spaces are typed as '-' (deck names)
+
+// Text with a gap at the cursor. Typing and deleting there only move the gap
+// edges; moving the cursor copies the bytes between the old and new position.
+typedef struct {
+   char* data;
+   size_t size;                    // bytes allocated
+   size_t gap_start;               // the cursor, as an offset into the text
+   size_t gap_end;
+} GapBuffer;
+
+/*
+* Brief - Create a gap buffer holding text, with the cursor at its end
+* Input - gb: buffer to initialise
+*         text: initial text (may be NULL)
+* Output - Returns 1 on success, 0 if out of memory
+*/
+int gap_init(GapBuffer* gb, const char* text);
+
+/*
+* Brief - Free a gap buffer
+* Input - gb: buffer to free
+* Output - None
+*/
+void gap_free(GapBuffer* gb);
+
+/*
+* Brief - Get the length of the text, the gap not included
+* Input - gb: buffer
+* Output - Bytes of text
+*/
+size_t gap_length(const GapBuffer* gb);
+
+/*
+* Brief - Get one byte of the text
+* Input - gb: buffer
+*         pos: offset into the text, below gap_length
+* Output - The byte
+*/
+char gap_byte(const GapBuffer* gb, size_t pos);
+
+/*
+* Brief - Copy part of the text out of the buffer, across the gap
+* Input - gb: buffer
+*         from, to: offsets into the text, from <= to <= gap_length
+*         out: receives to - from bytes, no NUL is added
+* Output - None
+*/
+void gap_copy(const GapBuffer* gb, size_t from, size_t to, char* out);
+
+/*
+* Brief - Move the cursor (the gap)
+* Input - gb: buffer
+*         pos: new cursor offset, at most gap_length
+* Output - None
+*/
+void gap_move(GapBuffer* gb, size_t pos);
+
+/*
+* Brief - Insert bytes at the cursor and move the cursor past them. The buffer
+*         doubles when the gap runs out.
+* Input - gb: buffer
+*         bytes: bytes to insert
+*         n: number of bytes
+* Output - Returns 1 on success, 0 if out of memory
+*/
+int gap_insert(GapBuffer* gb, const char* bytes, size_t n);
+
+/*
+* Brief - Delete part of the text and put the cursor where it was
+* Input - gb: buffer
+*         from, to: offsets into the text, from <= to <= gap_length
+* Output - None
+*/
+void gap_delete(GapBuffer* gb, size_t from, size_t to);
+
+/*
+* Brief - Copy the whole text out of the buffer
+* Input - gb: buffer
+* Output - malloc'd NUL terminated text, NULL if out of memory
+*/
+char* gap_text(const GapBuffer* gb);
+
+/*
+* Brief - Edit text in a box of a window. Lines wrap at the box width and the
+*         box scrolls to keep the cursor in view; after each key only the rows
+*         whose text changed are drawn. UTF-8 input is taken a character at a
+*         time. Keys: arrows, Home/End (line), Ctrl+Left/Right or Alt+B/F
+*         (word), Backspace, Delete, Ctrl+W (word before the cursor), Enter to
+*         submit, ESC to cancel, and Alt+Enter for a newline with EDIT_MULTILINE.
+* Input - win: window to edit in
+*         y, x: top left of the box
+*         rows, columns: size of the box
+*         initial: text to start from (may be NULL)
+*         flags: EDIT_MULTILINE and/or EDIT_DASHES
+*         result: receives the malloc'd text when submitted
+* Output - Returns 1 when submitted, 0 when cancelled or out of memory
+*/
+int edit_text(WINDOW* win, int y, int x, int rows, int columns, const char* initial, int flags, char** result);
+
+#endif
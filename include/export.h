@@ -0,0 +1,52 @@
+#ifndef EXPORT_H
+#define EXPORT_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include "flash_db.h"
+
+#define EXPORT_BUFFER_SIZE (1 << 20)
+
+typedef enum {EXPORT_TSV, EXPORT_JSON} ExportFormat;
+
+typedef struct {
+   const char* deck_name;   // deck to export, NULL: every deck
+   ExportFormat format;
+} ExportOptions;
+
+typedef struct {
+   size_t decks;
+   size_t cards;
+   double seconds;
+} ExportStats;
+
+/*
+* Brief - Stream cards straight from the SQLite cursor to an output file
+* Input - db: database context
+*         path: output file, "-" for stdout
+*         opts: export options
+*         stats: receives deck/card counts and timing (may be NULL)
+* Output - Returns 1 on success, 0 on failure (message printed to stderr)
+*/
+int export_cards(FlashDb* db, const char* path, const ExportOptions* opts, ExportStats* stats);
+
+/*
+* Brief - Write one TSV field, quoted the way the importer (and Anki) expects when
+*         it holds anything that would otherwise split the row or look like a header line
+* Input - out: stream to write to
+*         text: field text (need not be NUL terminated)
+*         len: length of text in bytes
+* Output - None
+*/
+void write_tsv_field(FILE* out, const char* text, int len);
+
+/*
+* Brief - Write text as a quoted, escaped JSON string
+* Input - out: stream to write to
+*         text: string text (need not be NUL terminated)
+*         len: length of text in bytes
+* Output - None
+*/
+void write_json_string(FILE* out, const char* text, int len);
+
+#endif
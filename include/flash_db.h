@@ -0,0 +1,186 @@
+#ifndef FLASH_DB_H
+#define FLASH_DB_H
+
+#include <sqlite3.h>
+#include <stdio.h>
+
+// Every statement the data layer runs more than once gets a slot here
+typedef enum {
+   STMT_DECK_LIST,
+   STMT_DECK_NAME,
+   STMT_DECK_NAMES,
+   STMT_DECK_CARDS,
+   STMT_DECK_CARD_IDS,
+   STMT_DECK_PAGE,
+   STMT_DECK_EXISTS,
+   STMT_CREATE_DECK,
+   STMT_DELETE_DECK,
+   STMT_ADD_CARD,
+   STMT_INSERT_CARD,
+   STMT_DELETE_CARD,
+   STMT_UPDATE_CARD,
+   STMT_FIND_DUPLICATE,
+   STMT_DUE_CARDS,
+   STMT_CARD_TEXT,
+   STMT_SAVE_SCHEDULE,
+   STMT_LOG_REVIEW,
+   STMT_SEARCH_CARDS,
+   STMT_CARD_SEQ,
+   STMT_SET_CARD_SEQ,
+   STMT_INIT_CARD_SEQ,
+   STMT_BEGIN,
+   STMT_COMMIT,
+   STMT_ROLLBACK,
+   STMT_COUNT
+} StmtId;
+
+typedef struct {
+   sqlite3_stmt* stmt;
+   unsigned long prepares;          // times the SQL was compiled
+   unsigned long hits;              // times the compiled statement was reused
+   unsigned long long total_ns;     // time spent between acquire and release
+   unsigned long long max_ns;
+   unsigned long long started_ns;
+} StmtCacheEntry;
+
+// How loudly a data layer message should be shown
+typedef enum {
+   DB_MSG_STATUS,      // routine confirmation, e.g. "Card Deleted"
+   DB_MSG_NOTICE,      // outcome the user should acknowledge
+   DB_MSG_ERROR
+} DbMessageLevel;
+
+typedef void (*DbMessageSink)(DbMessageLevel level, const char* message, void* data);
+
+// Connection tuning, applied to every connection the app opens
+typedef struct {
+   int cache_size;                  // PRAGMA cache_size: pages, or KiB when negative
+   long long mmap_size;             // bytes of the file read through mmap, 0 turns it off
+   int temp_store;                  // 0 default, 1 file, 2 memory
+   int synchronous;                 // 0 off, 1 normal, 2 full, 3 extra
+   int backup_keep;                 // rotating snapshots kept, 0 keeps them all
+   int backup_interval;             // hours between automatic snapshots, 0 turns them off
+} DbConfig;
+
+struct Writer;
+struct Remote;
+
+typedef struct {
+   sqlite3* conn;                   // NULL when remote is set
+   StmtCacheEntry stmts[STMT_COUNT];
+   struct Writer* writer;           // background writer, NULL when writes run inline
+   struct Remote* remote;           // flash-cardsd connection, calls go to the daemon
+   DbMessageSink sink;              // where db.c messages go, NULL: errors to stderr
+   void* sink_data;
+   DbConfig config;
+} FlashDb;
+
+/*
+* Brief - Settings used when nothing is configured: an 8 MiB page cache, 256 MiB
+*         of mmap, temp tables in memory and synchronous = NORMAL, which in WAL
+*         mode never corrupts the database but may lose the last commits on
+*         power loss. The TUI snapshots the database once a day and the
+*         newest 5 snapshots are kept.
+* Input - config: settings to fill
+* Output - None
+*/
+void db_default_config(DbConfig* config);
+
+/*
+* Brief - Read "key = value" lines (cache_size, mmap_size, temp_store, synchronous,
+*         backup_keep, backup_interval; '#' starts a comment) from a config file,
+*         then let FLASH_CARDS_CACHE_SIZE, FLASH_CARDS_MMAP_SIZE,
+*         FLASH_CARDS_TEMP_STORE, FLASH_CARDS_SYNCHRONOUS, FLASH_CARDS_BACKUP_KEEP
+*         and FLASH_CARDS_BACKUP_INTERVAL override them. A missing file is not an
+*         error.
+* Input - config: settings to update, usually from db_default_config
+*         path: config file
+* Output - Returns 1 if every setting was valid, 0 otherwise (each problem is
+*          printed to stderr and the setting keeps its previous value)
+*/
+int db_load_config(DbConfig* config, const char* path);
+
+/*
+* Brief - Apply db->config to db->conn
+* Input - db: database context with an open connection
+* Output - Returns 1 on success, 0 otherwise
+*/
+int db_apply_config(FlashDb* db);
+
+/*
+* Brief - Print the settings the connection is actually running with
+* Input - db: database context
+*         out: stream to write to
+* Output - None
+*/
+void db_print_config(FlashDb* db, FILE* out);
+
+/*
+* Brief - Route the messages the data layer produces, so it works the same
+*         under the TUI and from the command line
+* Input - db: database context
+*         sink: message handler, NULL to restore the default
+*         data: passed to every sink call
+* Output - None
+*/
+void db_set_message_sink(FlashDb* db, DbMessageSink sink, void* data);
+
+/*
+* Brief - Hand a message to the installed sink. Without one, errors are printed
+*         to stderr and everything else is dropped.
+* Input - db: database context
+*         level: message level
+*         message: text to report
+* Output - None
+*/
+void db_report(FlashDb* db, DbMessageLevel level, const char* message);
+
+/*
+* Brief - Get the prepared statement for id, compiling it on first use
+* Input - db: database context
+*         id: statement to fetch
+* Output - Ready to bind statement, or NULL if preparing failed
+*/
+sqlite3_stmt* db_stmt_acquire(FlashDb* db, StmtId id);
+
+/*
+* Brief - Reset a statement acquired with db_stmt_acquire and record its timing
+* Input - db: database context
+*         id: statement to release
+* Output - None
+*/
+void db_stmt_release(FlashDb* db, StmtId id);
+
+/*
+* Brief - Get the SQL text and a short name for a statement id
+* Input - id: statement id
+* Output - Static string
+*/
+const char* db_stmt_sql(StmtId id);
+const char* db_stmt_name(StmtId id);
+
+/*
+* Brief - Begin, commit or roll back a write transaction using cached statements
+* Input - db: database context
+* Output - Returns 1 on success, 0 otherwise
+*/
+int db_begin(FlashDb* db);
+int db_commit(FlashDb* db);
+int db_rollback(FlashDb* db);
+
+/*
+* Brief - Print per-statement prepare/hit counts and timings
+* Input - db: database context
+*         out: stream to write to
+* Output - None
+*/
+void db_print_stmt_stats(const FlashDb* db, FILE* out);
+
+/*
+* Brief - Finalize every cached statement, close the connection and free the context
+* Input - db: database context (may be NULL)
+* Output - None
+*/
+void close_database(FlashDb* db);
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef IMPORT_H
+#define IMPORT_H
+
+#include <stddef.h>
+#include "flash_db.h"
+#include "dedupe.h"
+
+#define IMPORT_CHUNK_SIZE (1 << 20)
+#define IMPORT_BATCH_ROWS 50000
+#define IMPORT_MAX_FIELDS 16
+#define IMPORT_MAX_JOBS 16
+
+typedef struct {
+   const char* deck_name;   // deck to import into, NULL: deck column or file name
+   char separator;          // field separator, 0: guess from file extension
+   size_t batch_rows;       // rows per transaction, 0: IMPORT_BATCH_ROWS
+   int jobs;                // parse workers, 0: one per core (at most IMPORT_MAX_JOBS)
+   DupPolicy duplicates;    // rows whose front the deck already has, DUP_SKIP by default
+} ImportOptions;
+
+typedef struct {
+   size_t rows;             // cards inserted
+   size_t skipped;          // rows with missing front/back
+   size_t invalid;          // rows that are not valid UTF-8
+   size_t duplicates;       // rows whose front the deck already had (not with DUP_KEEP)
+   size_t merged;           // duplicates whose back was added to the existing card
+   size_t batches;          // transactions committed
+   size_t bytes;            // bytes read from the input
+   int jobs;                // parse workers used
+   double seconds;          // wall clock, the stages below overlap
+   double read_seconds;     // reading and splitting the input into chunks
+   double parse_seconds;    // parsing and validating, summed over the workers
+   double insert_seconds;   // inserting and committing
+   double wait_seconds;     // inserter waiting for parsed rows
+} ImportStats;
+
+/*
+* Brief - Stream a CSV/TSV/Anki text export into the database. A reader thread
+*         cuts the input into chunks of whole rows, a pool of workers parses and
+*         validates them, and the calling thread inserts the rows in file order.
+* Input - db: database context
+*         path: file to read, "-" for stdin
+*         opts: import options (may be NULL for defaults)
+*         stats: receives row counts and timing (may be NULL)
+* Output - Returns 1 on success, 0 on failure (message printed to stderr)
+*/
+int import_cards(FlashDb* db, const char* path, const ImportOptions* opts, ImportStats* stats);
+
+#endif
@@ -0,0 +1,89 @@
+#ifndef LAYOUT_H
+#define LAYOUT_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+#define LAYOUT_CACHE_SIZE 64       // laid out texts kept, the least recently used is replaced
+
+// One display line of a wrapped text
+typedef struct {
+   int start;                      // byte offset of the line in the text
+   int bytes;
+   int columns;                    // display width
+} LayoutLine;
+
+// A text broken into lines no wider than width columns. Cached per card and
+// width; the hash tells an edited card from the text that was laid out.
+typedef struct {
+   int card_id;
+   int width;
+   size_t length;
+   unsigned hash;                  // FNV-1a of the text
+   LayoutLine* lines;
+   int count;
+   unsigned long last_used;        // 0: cache slot is empty
+   int pins;                       // acquired and not yet released, never replaced while > 0
+} TextLayout;
+
+/*
+* Brief - Decode the character at the start of text and measure it. Bytes that
+*         are not valid in the current locale count as one column each.
+*         setlocale(LC_CTYPE, "") must have run for UTF-8 to be understood.
+* Input - text: character to measure
+*         len: bytes available (at least 1)
+*         columns: receives the display width (0 for combining marks)
+* Output - Bytes the character takes
+*/
+size_t layout_char(const char* text, size_t len, int* columns);
+
+/*
+* Brief - Word wrap a text: lines break after spaces where possible, inside a
+*         word only when it is wider than a line, and always at '\n'
+* Input - text: NUL terminated text
+*         width: columns per line (at least 1)
+*         lines: receives a malloc'd array, free it with free()
+*         count: receives the number of lines (at least 1)
+* Output - Returns 1 on success, 0 if out of memory
+*/
+int layout_wrap(const char* text, int width, LayoutLine** lines, int* count);
+
+/*
+* Brief - Get the wrapped layout of a card's text from the cache, laying it out
+*         on a miss. Safe to call from any thread.
+* Input - card_id: card the text belongs to
+*         text: front or back of the card
+*         width: columns per line
+* Output - Layout pinned until layout_release, NULL if out of memory
+*/
+const TextLayout* layout_acquire(int card_id, const char* text, int width);
+
+/*
+* Brief - Unpin a layout returned by layout_acquire
+* Input - layout: layout to release (may be NULL)
+* Output - None
+*/
+void layout_release(const TextLayout* layout);
+
+/*
+* Brief - Lay out a text ahead of time so a later layout_acquire is a cache hit
+* Input - card_id, text, width: as for layout_acquire
+* Output - None
+*/
+void layout_warm(int card_id, const char* text, int width);
+
+/*
+* Brief - Print cache hits and misses
+* Input - out: stream to write to
+* Output - None
+*/
+void layout_print_stats(FILE* out);
+
+/*
+* Brief - Free every cached layout. None may be pinned.
+* Input - None
+* Output - None
+*/
+void layout_cache_free(void);
+
+#endif
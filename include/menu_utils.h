@@ -14,12 +14,28 @@ typedef enum {SHOW_FRONT, SHOW_BACK} State;
 #define RETURN_INDEX 0
 #define RETURN_CUSTOM_ID 1
 
-typedef void (*MenuItemRenderer)(WINDOW* win, int index, int highlight, void* data);
+// Menu Layout Macros 
+#define MENU_FIRST_ROW 3          // row of the first item
+#define MENU_CHROME_ROWS 7        // title, spacing, footer and border rows around the items
+#define MENU_PREFIX_TIMEOUT 1     // seconds before a typed prefix starts over
+
+#define MENU_FOOTER "Arrow keys to navigate, Enter to select, ESC to quit"
+
+// Card Layout Macros
+#define CARD_TEXT_X 4                              // column card text starts at
+#define CARD_TEXT_Y 3                              // row of the first text line
+#define CARD_TEXT_COLUMNS(win_width) ((win_width) - 2 * CARD_TEXT_X)
+
+typedef void (*MenuItemRenderer)(WINDOW* win, int row, int index, int highlight, void* data);
+typedef const char* (*MenuItemLabel)(int index, void* data);
 
 /*
-* Brief - Render a generic window given generic data and renderer function
-* Input - Ncurses window, number of items, title of window, generic data, renderer to use
-* and return specifier
+* Brief - Render a generic scrollable menu given generic data and renderer function.
+*         Only the rows that fit in the window are drawn, so cost per key does not
+*         depend on item_count. Supports PageUp/PageDown/Home/End and typing the
+*         start of an item's label to jump to it.
+* Input - Ncurses window, number of items, title of window, generic data, renderer to use,
+* label lookup for jump-to-prefix (may be NULL) and return specifier
 * Output - Returns line index or a custom return value specified by the renderer
 */
 int generic_menu(WINDOW* win,                 // ncurses window 
@@ -27,29 +43,53 @@ int generic_menu(WINDOW* win,                 // ncurses window
                  const char* title,           // menu title 
                  void* data,                  // pointer to data 
                  MenuItemRenderer renderer,   // function pointer to render data 
+                 MenuItemLabel label,         // function pointer to an item's text 
                  int return_id);              // return item index or ID 
 
 /* Both renderers 
 * Brief - Renders the data 
 * Input - win: window to draw menu in,
+*         row: window row to draw the item on,
 *         index: index of current item or ID,
 *         highlight: specifies which line to highlight,
 *         data: void pointer to data to be cast into applicable datatype
 * Output - None
 */
-void render_string_menu_item(WINDOW* win, int index, int highlight, void* data);
-void render_deck_info_item(WINDOW* win, int index, int highlight, void* data);
+void render_string_menu_item(WINDOW* win, int row, int index, int highlight, void* data);
+void render_deck_info_item(WINDOW* win, int row, int index, int highlight, void* data);
+
+/* Both labels 
+* Brief - Text used to match a typed prefix 
+* Input - index: index of the item,
+*         data: void pointer to data to be cast into applicable datatype
+* Output - Item label
+*/
+const char* string_menu_label(int index, void* data);
+const char* deck_info_label(int index, void* data);
 
 /*
-* Brief - Renders the cards front or back 
+* Brief - Renders the cards front or back, word wrapped to the card width. Text
+*         taller than the card scrolls; the layout is cached per card and width,
+*         so flipping and redrawing do not wrap again.
 * Input - win: window to draw card in, 
-*         deck: pointer to Deck structure containing cards,
-*         index: ID of current card,
+*         card: card to show,
+*         position: 1-based number of the card shown in the header,
+*         total: number of cards shown in the header,
 *         state: flag for either the cards front or back,
 *         footer: pointer for footer message for cards,
+*         scroll: first text line to show, clamped to the lines there are
 * Output - None
 */ 
-void render_card(WINDOW* win, Deck* deck, int index, State state, const char* footer);
+void render_card(WINDOW* win, const Cards* card, int position, size_t total, State state,
+                 const char* footer, int* scroll);
+
+/*
+* Brief - Lay out both sides of a card for a CARD_WIDTH window ahead of time, so
+*         render_card finds them cached. Safe to call from any thread.
+* Input - card: card to lay out
+* Output - None
+*/
+void warm_card_layout(const Cards* card);
 
 #endif
 
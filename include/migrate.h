@@ -0,0 +1,38 @@
+#ifndef MIGRATE_H
+#define MIGRATE_H
+
+#include <sqlite3.h>
+#include <stdio.h>
+
+typedef struct {
+   int version;
+   const char* name;
+   const char* sql;
+} Migration;
+
+/*
+* Brief - Bring the schema up to date, applying each pending migration in its own
+*         transaction and recording it (with its run time) in schema_migrations.
+*         PRAGMA user_version holds the current version, so an up to date
+*         database costs a single pragma read.
+* Input - conn: open SQLite connection
+* Output - Returns 1 on success, 0 on failure (message printed to stderr)
+*/
+int run_migrations(sqlite3* conn);
+
+/*
+* Brief - Get the schema version the code expects
+* Input - None
+* Output - Latest migration version
+*/
+int latest_schema_version(void);
+
+/*
+* Brief - Print the applied migrations and their timings
+* Input - conn: open SQLite connection
+*         out: stream to write to
+* Output - None
+*/
+void print_migrations(sqlite3* conn, FILE* out);
+
+#endif
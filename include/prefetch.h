@@ -0,0 +1,59 @@
+#ifndef PREFETCH_H
+#define PREFETCH_H
+
+#include <stdio.h>
+#include "db.h"
+
+#define PREFETCH_DEPTH 4           // cards kept ready, the one on screen included
+
+typedef struct Prefetch Prefetch;
+
+// Runs on the worker after a card is read, e.g. to lay out its text
+typedef void (*PrefetchHook)(const Cards* card);
+
+/*
+* Brief - Start fetching card text off the calling thread. A worker with its own
+*         read-only connection fills up to PREFETCH_DEPTH slots with the cards
+*         asked for by prefetch_want. Without a database file (or a thread) the
+*         text is read inline on db when prefetch_get asks for it.
+* Input - db: database context (the UI connection)
+*         warm: called on the worker for every card it reads (may be NULL)
+* Output - Prefetcher, NULL when out of memory
+*/
+Prefetch* prefetch_start(FlashDb* db, PrefetchHook warm);
+
+/*
+* Brief - Say which cards are needed next, most urgent first. Slots holding other
+*         cards are freed, missing ones are queued for the worker. Does no I/O.
+* Input - p: prefetcher
+*         ids: card ids
+*         count: number of ids, at most PREFETCH_DEPTH
+* Output - None
+*/
+void prefetch_want(Prefetch* p, const int* ids, size_t count);
+
+/*
+* Brief - Get a card's text. A card that is ready costs a lookup; one the worker
+*         is still reading is waited for, any other card is read inline.
+* Input - p: prefetcher
+*         card_id: card to get
+* Output - Pointer to the card, valid until prefetch_want no longer asks for it
+*          or prefetch_stop. NULL if it could not be read.
+*/
+const Cards* prefetch_get(Prefetch* p, int card_id);
+
+/*
+* Brief - Stop the worker, close its connection and free every slot
+* Input - p: prefetcher (may be NULL)
+* Output - None
+*/
+void prefetch_stop(Prefetch* p);
+
+/*
+* Brief - Print how often a card was ready when it was needed
+* Input - out: stream to write to
+* Output - None
+*/
+void prefetch_print_stats(FILE* out);
+
+#endif
@@ -0,0 +1,178 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Framing between flash-cardsd and its clients. Every frame is an 8 byte header
+// (payload length, op, status, two bytes reserved) and a payload of
+// little-endian integers and length-prefixed strings. A client's requests are
+// answered in order, each with the request's op; PROTO_EVENT_* frames from the
+// daemon may come in between.
+#define PROTO_VERSION 1
+#define PROTO_HEADER_SIZE 8
+#define PROTO_MAX_PAYLOAD (64u << 20)   // a frame larger than this drops the connection
+#define PROTO_SOCKET_NAME "flash-cardsd.sock"  // next to the database unless FLASH_CARDS_SOCKET is set
+
+typedef enum {
+   PROTO_HELLO = 1,          // u32 version, u8 flags (PROTO_WANT_EVENTS) -> u32 version
+   PROTO_DECK_LIST,          // -> u32 n, n x (i32 id, str name, i32 cards)
+   PROTO_DECK_STATS,         // i64 now -> u8 ok, u32 n, n x (i32 id, str name, i32 cards, i32 due, i32 reviewed)
+   PROTO_REVIEW_STATS,       // i64 now -> u8 ok, u32 n, n x (i32 id, str name, i32 cards, i32 reviews,
+                             //    i32 correct, i64 response_ms, i32 streak, i32 best, i32 days, i64 last)
+   PROTO_DECK_EXISTS,        // str name -> u8 found, i32 id
+   PROTO_CREATE_DECK,        // str name -> u8 ok
+   PROTO_DELETE_DECK,        // i32 id -> u8 ok
+   PROTO_DELETE_DECK_NAME,   // str name -> u8 ok
+   PROTO_DECK_CARDS,         // i32 deck -> u8 found, str name, u32 n, n x i32 id
+   PROTO_DECK_PAGE,          // i32 deck, i32 first, i32 last -> u8 ok, u32 n, n x (i32 id, str front, str back)
+   PROTO_CARD_TEXT,          // i32 card -> u8 found, i32 deck, str front, str back
+   PROTO_ADD_CARD,           // i32 deck, str front, str back -> i32 id
+   PROTO_UPDATE_CARD,        // i32 deck (0 if unknown), i32 card, str front, str back -> u8 ok
+   PROTO_DELETE_CARD,        // i32 deck (0 if unknown), i32 card -> u8 ok
+   PROTO_FIND_DUPLICATE,     // i32 deck, str front, i64 hash -> u8 found, i32 id, str front, str back
+   PROTO_SEARCH,             // str text, i32 limit, i32 offset -> u8 ok, u8 has_more, u32 n,
+                             //    n x (i32 card, i32 deck, str deck name, str front, str back)
+   PROTO_STUDY_LOAD,         // i32 deck, i64 now -> u8 ok, u32 n,
+                             //    n x (i32 card, i64 due, f64 interval, f64 ease, i32 reps, i32 lapses)
+   PROTO_SAVE_SCHEDULE,      // i32 card, i64 due, f64 interval, f64 ease, i32 reps, i32 lapses -> u8 ok
+   PROTO_LOG_REVIEWS,        // u32 n, n x (i32 card, i32 deck, i64 at, u8 correct, i32 ms) -> u8 ok
+   PROTO_OP_COUNT,
+   PROTO_EVENT_INVALIDATE = 0x80,  // i32 deck: its cards changed, 0: only the deck list did,
+                                   // -1: anything may have changed
+   PROTO_EVENT_WRITE_ERRORS        // u32 writes of this client the daemon could not commit
+} ProtoOp;
+
+#define PROTO_WANT_EVENTS 1  // HELLO flag: push PROTO_EVENT_INVALIDATE to this connection
+
+// Status byte of a reply
+#define PROTO_OK 0
+#define PROTO_FAILED 1       // the payload is one str, the reason
+
+// Every reply payload starts with the messages the daemon's data layer reported
+// while serving it: u8 count, count x (u8 DbMessageLevel, str text)
+
+typedef struct {
+   uint8_t* data;
+   size_t len;
+   size_t cap;
+   int failed;               // out of memory, the frame is incomplete
+} ProtoBuf;
+
+typedef struct {
+   const uint8_t* pos;
+   size_t left;
+   int failed;               // read past the end, every get returns 0 from then on
+} ProtoReader;
+
+/*
+* Brief - Start a frame: reset buf and reserve the header
+* Input - buf: buffer to write into
+*         op: op of the frame
+*         status: PROTO_OK or PROTO_FAILED (0 for requests)
+* Output - None
+*/
+void proto_begin(ProtoBuf* buf, uint8_t op, uint8_t status);
+
+/*
+* Brief - Write the payload length into the header of a frame
+* Input - buf: frame started with proto_begin
+* Output - Returns 1 on success, 0 if the buffer failed or the payload is too large
+*/
+int proto_end(ProtoBuf* buf);
+
+/*
+* Brief - Append a little-endian value to a frame
+* Input - buf: buffer to write into
+*         value: value to write
+* Output - None (buf->failed is set if memory runs out)
+*/
+void proto_put_u8(ProtoBuf* buf, uint8_t value);
+void proto_put_u32(ProtoBuf* buf, uint32_t value);
+void proto_put_i32(ProtoBuf* buf, int32_t value);
+void proto_put_i64(ProtoBuf* buf, int64_t value);
+void proto_put_f64(ProtoBuf* buf, double value);
+
+/*
+* Brief - Write a string: u32 length, the bytes and a NUL, so a reader can use
+*         it in place
+* Input - buf: buffer to write into
+*         text: string, NULL is written as ""
+*         len: bytes of text
+* Output - None
+*/
+void proto_put_strn(ProtoBuf* buf, const char* text, size_t len);
+void proto_put_str(ProtoBuf* buf, const char* text);
+
+/*
+* Brief - Append raw bytes, e.g. a whole frame to an output queue
+* Input - buf: buffer to write into
+*         data, len: bytes to append
+* Output - None
+*/
+void proto_put_bytes(ProtoBuf* buf, const void* data, size_t len);
+
+/*
+* Brief - Free a buffer's memory
+* Input - buf: buffer to free
+* Output - None
+*/
+void proto_free(ProtoBuf* buf);
+
+/*
+* Brief - Read the header at the start of data
+* Input - data: PROTO_HEADER_SIZE bytes
+*         len: receives the payload length
+*         op, status: receive the op and status
+* Output - None
+*/
+void proto_read_header(const uint8_t* data, uint32_t* len, uint8_t* op, uint8_t* status);
+
+/*
+* Brief - Read the next little-endian value of a payload
+* Input - r: reader
+* Output - The value, 0 once the reader failed
+*/
+uint8_t proto_get_u8(ProtoReader* r);
+uint32_t proto_get_u32(ProtoReader* r);
+int32_t proto_get_i32(ProtoReader* r);
+int64_t proto_get_i64(ProtoReader* r);
+double proto_get_f64(ProtoReader* r);
+
+/*
+* Brief - Read a string written by proto_put_strn
+* Input - r: reader
+*         len: receives its length (may be NULL)
+* Output - Pointer into the frame, NUL terminated; "" once the reader failed
+*/
+const char* proto_get_str(ProtoReader* r, size_t* len);
+
+/*
+* Brief - Write all of a buffer to a blocking socket, retrying short writes. A
+*         closed peer is an error rather than SIGPIPE.
+* Input - fd: socket
+*         data, len: bytes to write
+* Output - Returns 1 on success, 0 on failure
+*/
+int proto_write_all(int fd, const void* data, size_t len);
+
+/*
+* Brief - Read one frame from a blocking socket
+* Input - fd: socket
+*         buf: receives the whole frame, header included
+*         op, status: receive the op and status
+*         payload: reader over the payload, valid until buf changes
+* Output - Returns 1 on success, 0 on end of file, error or a frame too large
+*/
+int proto_read_frame(int fd, ProtoBuf* buf, uint8_t* op, uint8_t* status, ProtoReader* payload);
+
+/*
+* Brief - Get the daemon's socket path: FLASH_CARDS_SOCKET, else
+*         ~/tui-cards/PROTO_SOCKET_NAME
+* Input - path: buffer for the path
+*         size: size of path
+* Output - Returns 1 on success, 0 without $HOME or if the path does not fit
+*/
+int proto_socket_path(char* path, size_t size);
+
+#endif
@@ -0,0 +1,102 @@
+#ifndef REMOTE_H
+#define REMOTE_H
+
+#include <stdio.h>
+#include "db.h"
+#include "search.h"
+#include "scheduler.h"
+#include "review_log.h"
+
+// Client side of flash-cardsd. A FlashDb with db->remote set has no connection of
+// its own: the db.c, scheduler, search, review log and prefetch entry points
+// check for it first and send the call to the daemon instead, so the TUI works
+// the same either way. Reads wait for their reply. Edits, schedules and review
+// batches are sent without waiting, like writes queued for the writer thread;
+// a failure comes back later and is counted for remote_take_errors.
+
+typedef struct Remote Remote;
+
+/*
+* Brief - Connect to a running daemon and make a FlashDb that talks to it
+* Input - out: receives the context (free with close_database)
+*         path: daemon socket
+* Output - Returns 1 on success, 0 if no daemon answers (nothing is printed)
+*/
+int remote_connect(FlashDb** out, const char* path);
+
+/*
+* Brief - Open another connection to the daemon db talks to, for a worker thread.
+*         It gets no invalidation events.
+* Input - db: remote database context
+* Output - New context (free with close_database), NULL on failure
+*/
+FlashDb* remote_reconnect(FlashDb* db);
+
+/*
+* Brief - Close the daemon connection of a context, called by close_database
+* Input - db: remote database context
+* Output - None
+*/
+void remote_close(FlashDb* db);
+
+/*
+* Brief - Read the events the daemon pushed, without waiting, and tell whether a
+*         deck's cards were changed by another client since the last call
+* Input - db: database context (0 is returned for a local one)
+*         deck_id: deck to check
+* Output - Returns 1 if the deck changed, 0 otherwise
+*/
+int remote_deck_changed(FlashDb* db, int deck_id);
+
+/*
+* Brief - Get and reset the count of writes the daemon could not commit
+* Input - db: database context (0 is returned for a local one)
+* Output - Number of failed writes since the last call
+*/
+unsigned long remote_take_errors(FlashDb* db);
+
+/*
+* Brief - Print round trips, writes sent without waiting and bytes moved
+* Input - db: database context (nothing is printed for a local one)
+*         out: stream to write to
+* Output - None
+*/
+void remote_print_stats(FlashDb* db, FILE* out);
+
+// The calls below mirror the local entry point named in each comment, and are
+// only made by it
+
+void remote_load_deck_list(FlashDb* db, DeckInfoList* list);                 // load_deck_list
+int remote_load_deck_stats(FlashDb* db, time_t now, DeckStatsList* list);     // load_deck_stats
+int remote_load_review_stats(FlashDb* db, time_t now, DeckReviewStatsList* list);  // load_review_stats
+int remote_deck_exists(FlashDb* db, const char* deck_name, int* deck_id);     // deck_exists
+int remote_create_deck(FlashDb* db, const char* deck_name);                   // create_deck
+int remote_delete_deck(FlashDb* db, int deck_id);                             // delete_deck_by_id
+int remote_delete_deck_by_name(FlashDb* db, const char* deck_name);           // delete_deck_by_name
+int remote_load_deck_cards(FlashDb* db, int deck_id, Deck* deck);             // load_deck_cards
+
+/*
+* Brief - Read the text of a page of a deck (deck_fetch_page)
+* Input - db: remote database context
+*         deck: deck the page belongs to
+*         ids: ids of the page's cards
+*         count: number of ids
+*         cards: receives count cards, text in arena ("" for a card no longer there)
+*         arena: owns the text
+*         stale: set to 1 if a card is missing or the range holds cards not in ids
+* Output - Returns 1 on success, 0 on failure
+*/
+int remote_deck_page(FlashDb* db, int deck_id, const int* ids, size_t count, Cards* cards,
+                     Arena* arena, int* stale);
+
+int remote_card_text(FlashDb* db, int card_id, Cards* card, char** text);     // prefetch read_card
+int remote_add_card(FlashDb* db, int deck_id, const char* front, const char* back);  // add_card
+int remote_update_card(FlashDb* db, int deck_id, int card_id, const char* front, const char* back);  // update_card
+int remote_delete_card(FlashDb* db, int deck_id, int card_id);                // delete_card_by_id
+int remote_find_duplicate(FlashDb* db, int deck_id, const char* front, long long hash, Cards* card);  // find_duplicate_card
+int remote_search(FlashDb* db, const char* text, int limit, int offset, SearchResults* results);  // search_cards
+int remote_load_due_cards(FlashDb* db, int deck_id, time_t now, StudyQueue* queue);  // load_due_cards
+int remote_save_schedule(FlashDb* db, int card_id, const Schedule* sched);    // save_schedule
+int remote_log_reviews(FlashDb* db, const ReviewEntry* entries, size_t count);  // review_log_flush
+
+#endif
@@ -0,0 +1,88 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+#include <ncurses.h>
+#include <stdio.h>
+
+typedef struct {
+   unsigned long long bytes;     // bytes written to the terminal
+   unsigned long long flushes;   // render_flush calls
+   unsigned long long keys;      // keys answered by a screen update
+   unsigned long long latency_total_ns;
+   unsigned long long latency_max_ns;
+   unsigned long long first_flush_ns; // CLOCK_MONOTONIC time of the first update, 0 before it
+} RenderStats;
+
+/*
+* Brief - Start curses, optionally with its output routed through a tap that
+*         counts every byte sent to the terminal. Replaces initscr().
+* Input - count_output: 1 to count bytes (costs a pipe and a thread), 0 to
+*                       write to the terminal directly
+* Output - Returns 1 on success, 0 on failure
+*/
+int render_init(int count_output);
+
+/*
+* Brief - Read a key like wgetch and start the input to screen clock, which the
+*         next render_flush stops
+* Input - win: window to read from
+* Output - Key code as returned by wgetch
+*/
+int render_getch(WINDOW* win);
+
+/*
+* Brief - Push every window staged with wnoutrefresh to the terminal in one write
+* Input - None
+* Output - None
+*/
+void render_flush(void);
+
+/*
+* Brief - Note that part of the screen was overwritten (e.g. by a popup that went
+*         away), so views that only repaint their damaged cells must redraw fully
+* Input - None
+* Output - None
+*/
+void render_touch(void);
+
+/*
+* Brief - Get the current screen generation, bumped by render_touch. A view that
+*         remembers the generation it drew at knows when its cells were lost.
+* Input - None
+* Output - Screen generation
+*/
+unsigned render_generation(void);
+
+/*
+* Brief - Draw a line of text at a position, each control character as a space
+*         (curses would draw it as ^X and break the width the layout measured)
+* Input - win: window to draw in
+*         row, col: where the line starts
+*         text: line to draw, not NUL terminated
+*         bytes: length of text
+* Output - None
+*/
+void render_text_line(WINDOW* win, int row, int col, const char* text, size_t bytes);
+
+/*
+* Brief - Get terminal output counters
+* Input - stats: filled with the counters so far
+* Output - None
+*/
+void render_get_stats(RenderStats* stats);
+
+/*
+* Brief - Print terminal output counters
+* Input - out: stream to write to
+* Output - None
+*/
+void render_print_stats(FILE* out);
+
+/*
+* Brief - End curses and remove the tap. Counters stay readable.
+* Input - None
+* Output - None
+*/
+void render_end(void);
+
+#endif
@@ -0,0 +1,90 @@
+#ifndef REVIEW_LOG_H
+#define REVIEW_LOG_H
+
+#include <time.h>
+#include "db.h"
+
+#define REVIEW_LOG_BATCH 32        // answers kept in memory before they are written
+
+// One answer, as appended to the review_log table
+typedef struct {
+   int card_id;
+   int deck_id;
+   time_t reviewed_at;
+   int correct;
+   int response_ms;    // from the front being shown to the answer
+} ReviewEntry;
+
+// Answers not written yet. A study session fills it, a full buffer is handed to
+// the writer as one request, so logging costs no I/O per answer.
+typedef struct {
+   ReviewEntry pending[REVIEW_LOG_BATCH];
+   size_t count;
+} ReviewLog;
+
+// A deck's review history, from the aggregates a trigger keeps in step with the log
+typedef struct {
+   int id;
+   char* name;
+   int cards;
+   int reviews;
+   int correct;
+   long long response_ms;  // total, divide by reviews for the average
+   int streak;             // correct answers in a row, up to the last one
+   int best_streak;
+   int day_streak;         // days in a row with a review, 0 once a day is missed
+   time_t last_review;     // 0 if never reviewed
+} DeckReviewStats;
+
+typedef struct {
+   DeckReviewStats* items;
+   size_t count;
+   size_t capacity;
+   Arena arena;            // owns every DeckReviewStats.name
+} DeckReviewStatsList;
+
+/*
+* Brief - Buffer an answer, writing the buffer out once it is full
+* Input - db: database context
+*         log: answers not written yet
+*         entry: answer to add
+* Output - Returns 1 on success, 0 if a full buffer could not be written
+*/
+int review_log_add(FlashDb* db, ReviewLog* log, const ReviewEntry* entry);
+
+/*
+* Brief - Write out every buffered answer: queued on the writer when one runs,
+*         otherwise inserted inline (in the caller's transaction if one is open)
+* Input - db: database context
+*         log: answers not written yet, empty afterwards
+* Output - Returns 1 on success, 0 on failure
+*/
+int review_log_flush(FlashDb* db, ReviewLog* log);
+
+/*
+* Brief - Insert answers into review_log without opening a transaction
+* Input - db: database context
+*         entries: answers to insert
+*         count: number of answers
+* Output - Returns 1 on success, 0 on failure
+*/
+int write_reviews(FlashDb* db, const ReviewEntry* entries, size_t count);
+
+/*
+* Brief - Get the review aggregates of every deck. Reads one row per deck, never
+*         the log itself.
+* Input - db: database context
+*         now: time that decides whether the day streak is still running
+*         list: receives one entry per deck, ordered by name (free with free_review_stats)
+* Output - Returns 1 on success, 0 on failure
+*/
+int load_review_stats(FlashDb* db, time_t now, DeckReviewStatsList* list);
+
+/*
+* Brief - Free memory allocated inside a DeckReviewStatsList structure
+* Input - list: list to free
+* Output - None
+*/
+void free_review_stats(DeckReviewStatsList* list);
+
+#endif
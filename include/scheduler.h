@@ -0,0 +1,122 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <time.h>
+#include "db.h"
+#include "prefetch.h"
+#include "review_log.h"
+
+// SM-2 parameters
+#define SCHED_INITIAL_EASE 2.5
+#define SCHED_MIN_EASE 1.3
+#define SCHED_GRADE_CORRECT 4
+#define SCHED_GRADE_INCORRECT 1
+#define SCHED_RELEARN_SECONDS 60  // a missed card comes back this much later in the session
+#define SECONDS_PER_DAY 86400
+
+typedef struct {
+   time_t due;
+   double interval;    // days until the next review
+   double ease;
+   int reps;           // successful reviews in a row
+   int lapses;
+} Schedule;
+
+typedef struct {
+   int card_id;
+   Schedule sched;
+} StudyCard;
+
+// Cards due for review in one deck, ordered by due time in a binary min-heap.
+// Only ids and schedules are loaded; the text of the next PREFETCH_DEPTH cards
+// is read ahead in the background after every answer.
+typedef struct {
+   int deck_id;
+   StudyCard* items;
+   size_t count;
+   size_t capacity;
+   size_t* heap;       // indices into items
+   size_t heap_len;
+   size_t graduated;   // cards answered correctly this session
+   Prefetch* prefetch; // card text
+   FlashDb* db;        // where the review log is flushed when the queue is freed
+   ReviewLog log;      // answers not written to review_log yet
+} StudyQueue;
+
+/*
+* Brief - Load the cards of a deck that are due at `now` (new cards included)
+* Input - db: database context
+*         deck_id: deck to study
+*         now: current time
+*         warm: run on the prefetch worker for every card read ahead (may be NULL)
+*         queue: zero-initialised queue to fill
+* Output - Returns 1 on success, 0 on failure
+*/
+int study_queue_load(FlashDb* db, int deck_id, time_t now, PrefetchHook warm, StudyQueue* queue);
+
+/*
+* Brief - Append the due cards of a deck to queue->items, without ordering them
+* Input - db: database context
+*         deck_id: deck to read
+*         now: current time, new cards are due at it
+*         queue: queue whose items receive the cards
+* Output - Returns 1 on success, 0 on failure
+*/
+int load_due_cards(FlashDb* db, int deck_id, time_t now, StudyQueue* queue);
+
+/*
+* Brief - Get the card that is due first without removing it (O(1))
+* Input - queue: study queue
+* Output - Pointer to the next card, NULL when the session is complete
+*/
+StudyCard* study_queue_peek(StudyQueue* queue);
+
+/*
+* Brief - Get the text of the card that is due first. It was read ahead while
+*         the previous card was on screen, so this normally does no I/O.
+* Input - queue: study queue
+* Output - Pointer to the card, valid until the next study_queue_answer.
+*          NULL when the session is complete or the card could not be read.
+*/
+const Cards* study_queue_card(StudyQueue* queue);
+
+/*
+* Brief - Grade the card returned by study_queue_peek, persist its new schedule,
+*         log the answer and reorder the queue (O(log n)). Correct cards leave
+*         the session, incorrect ones are requeued SCHED_RELEARN_SECONDS later.
+*         Answers are logged in batches of REVIEW_LOG_BATCH.
+* Input - db: database context
+*         queue: study queue
+*         correct: 1 if the user knew the card
+*         response_ms: time the user took to answer
+*         now: current time
+* Output - Returns 1 if the schedule was saved (and the log, when it was due), 0 otherwise
+*/
+int study_queue_answer(FlashDb* db, StudyQueue* queue, int correct, int response_ms, time_t now);
+
+/*
+* Brief - Write a card's schedule to the database
+* Input - db: database context
+*         card_id: card the schedule belongs to
+*         sched: schedule to store
+* Output - Returns 1 on success, 0 otherwise
+*/
+int save_schedule(FlashDb* db, int card_id, const Schedule* sched);
+
+/*
+* Brief - Apply one SM-2 review to a schedule
+* Input - sched: schedule to update
+*         grade: 0-5 recall quality
+*         now: time of the review
+* Output - None
+*/
+void sm2_review(Schedule* sched, int grade, time_t now);
+
+/*
+* Brief - Write the answers still buffered and free all memory owned by a study queue
+* Input - queue: study queue
+* Output - None
+*/
+void free_study_queue(StudyQueue* queue);
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include "db.h"
+
+#define SEARCH_PAGE_SIZE 100
+#define SEARCH_MAX_QUERY 512     // bytes of FTS5 query built from the user's text
+
+typedef struct {
+   int card_id;
+   int deck_id;
+   char* deck_name;
+   char* front;
+   char* back;
+} SearchResult;
+
+typedef struct {
+   SearchResult* items;     // best match first
+   size_t count;
+   size_t capacity;
+   int offset;              // rank of items[0] among all matches
+   int has_more;            // another page follows this one
+   Arena arena;             // owns all result text
+} SearchResults;
+
+/*
+* Brief - Turn free text into an FTS5 query: every word is quoted, so punctuation
+*         and FTS5 operators are matched literally, and matches as a prefix
+* Input - text: user's search text
+*         query: buffer for the FTS5 query
+*         size: size of query
+* Output - Returns 1 if the text held at least one word, 0 otherwise
+*/
+int build_search_query(const char* text, char* query, size_t size);
+
+/*
+* Brief - Full text search over card fronts and backs in every deck, ranked by bm25
+* Input - db: database context
+*         text: user's search text
+*         limit: results per page
+*         offset: number of ranked results to skip
+*         results: receives the page (reused between calls, free with free_search_results)
+* Output - Returns 1 on success, 0 on failure
+*/
+int search_cards(FlashDb* db, const char* text, int limit, int offset, SearchResults* results);
+
+/*
+* Brief - Free all memory owned by a SearchResults
+* Input - results: results to free
+* Output - None
+*/
+void free_search_results(SearchResults* results);
+
+#endif
@@ -0,0 +1,137 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdio.h>
+#include <time.h>
+
+#define TRACE_EVENTS_PER_THREAD (1 << 16)   // most recent spans kept per thread for --trace
+#define TRACE_HOTKEY KEY_F(12)              // writes a snapshot while the TUI runs
+#define TRACE_SNAPSHOT_FILE "flash-cards-stats.txt"
+
+// Every instrumented span gets a slot here
+typedef enum {
+   TRACE_LOAD_DECK_LIST,
+   TRACE_LOAD_DECK_STATS,
+   TRACE_LOAD_REVIEW_STATS,
+   TRACE_LOAD_DECK_CARDS,
+   TRACE_CHECK_DECK_COUNTS,
+   TRACE_DECK_EXISTS,
+   TRACE_CREATE_DECK,
+   TRACE_DELETE_DECK,
+   TRACE_ADD_CARD,
+   TRACE_DELETE_CARD,
+   TRACE_UPDATE_CARD,
+   TRACE_FIND_DUPLICATE,
+   TRACE_DEDUPE_CARDS,
+   TRACE_SEARCH_CARDS,
+   TRACE_STUDY_LOAD,
+   TRACE_STUDY_ANSWER,
+   TRACE_PREFETCH_LOAD,
+   TRACE_PREFETCH_WAIT,
+   TRACE_WRITER_COMMIT,
+   TRACE_IMPORT_READ,
+   TRACE_IMPORT_PARSE,
+   TRACE_IMPORT_INSERT,
+   TRACE_BACKUP,
+   TRACE_BACKUP_STEP,
+   TRACE_REMOTE_CALL,
+   TRACE_DAEMON_REQUEST,
+   TRACE_MENU_REDRAW,
+   TRACE_RENDER_CARD,
+   TRACE_EDITOR_REDRAW,
+   TRACE_SCREEN_UPDATE,
+   TRACE_INPUT_WAIT,
+   TRACE_COUNT
+} TraceId;
+
+typedef enum {
+   TRACE_STATS = 1,      // count and latency histograms
+   TRACE_EVENTS = 2      // also keep individual spans for a Chrome trace
+} TraceFlags;
+
+// Checked inline at every span, so a disabled trace costs one load and branch
+extern int trace_enabled;
+
+typedef struct {
+   TraceId id;
+   unsigned long long start;
+} TraceSpan;
+
+static inline unsigned long long trace_now_ns(void) {
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+* Brief - Start tracing. Call before any other thread is started.
+* Input - flags: TRACE_STATS, optionally with TRACE_EVENTS
+*         trace_path: file the Chrome trace is written to (NULL without TRACE_EVENTS)
+* Output - None
+*/
+void trace_init(int flags, const char* trace_path);
+
+/*
+* Brief - Name the calling thread in reports and traces
+* Input - name: static string
+* Output - None
+*/
+void trace_set_thread_name(const char* name);
+
+/*
+* Brief - Record a finished span in the calling thread's histogram (and event ring).
+*         Only the owning thread writes its histograms, so no locks are taken.
+* Input - id: span kind
+*         start, end: trace_now_ns() at both ends
+* Output - None
+*/
+void trace_record(TraceId id, unsigned long long start, unsigned long long end);
+
+static inline unsigned long long trace_begin(void) {
+   return trace_enabled ? trace_now_ns() : 0;
+}
+
+static inline void trace_end(TraceId id, unsigned long long start) {
+   if (start)
+      trace_record(id, start, trace_now_ns());
+}
+
+static inline void trace_span_end(TraceSpan* span) {
+   trace_end(span->id, span->start);
+}
+
+// Times from here to the end of the enclosing block, whichever return leaves it
+#define TRACE_SCOPE(id) \
+   TraceSpan trace_span_ __attribute__((cleanup(trace_span_end))) = {(id), trace_begin()}
+
+/*
+* Brief - Print count, total and p50/p90/p99/max latency of every span kind,
+*         merged over all threads
+* Input - out: stream to write to
+* Output - None
+*/
+void trace_print_report(FILE* out);
+
+/*
+* Brief - Write the recorded spans as Chrome trace JSON (chrome://tracing, Perfetto)
+* Input - path: output file
+* Output - Returns 1 on success, 0 on failure
+*/
+int trace_write_chrome(const char* path);
+
+/*
+* Brief - Append a report to TRACE_SNAPSHOT_FILE and rewrite the Chrome trace, if
+*         one was requested. Bound to TRACE_HOTKEY.
+* Input - None
+* Output - Returns 1 on success, 0 on failure
+*/
+int trace_snapshot(void);
+
+/*
+* Brief - Write the Chrome trace, if one was requested, at exit
+* Input - None
+* Output - Returns 1 on success or when there is nothing to write, 0 on failure
+*/
+int trace_finish(void);
+
+#endif
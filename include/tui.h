@@ -5,6 +5,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include "db.h"
+#include "editor.h"
 
 // Window Dimension Macros
 #define MAIN_MENU_HEIGHT 15
@@ -16,6 +17,7 @@
 
 #define FORM_HEIGHT 7
 #define FORM_WIDTH  70
+#define FORM_INPUT_ROWS (FORM_HEIGHT - 3)
 
 #define POPUP_HEIGHT 7 
 #define POPUP_WIDTH 70
@@ -23,8 +25,12 @@
 #define CARD_HEIGHT 10 
 #define CARD_WIDTH  75
 
+#define SEARCH_WIDTH 100
+#define STATS_WIDTH 84
+
 #define CARD_FORM_HEIGHT 10
 #define CARD_FORM_WIDTH 70
+#define CARD_FORM_INPUT_ROWS (CARD_FORM_HEIGHT - 4)
 
 // Margin Macros
 #define BOTTOM_MARGIN 15
@@ -41,6 +47,9 @@
 #define CARD_PROMPT "Enter Card Information:"
 #define DECKC_PROMPT "Enter deck name: "
 #define DECKD_PROMPT "Enter deck to delete "
+#define SEARCH_PROMPT "Search cards:"
+#define REVIEW_STATS_COLUMNS "%-20.20s %7s %7s %6s %6s %5s %7s  %s"
+#define EDIT_HINT "[Enter] Save  [Alt+Enter] New line  [ESC] Cancel"
 
 // Attributes 
 #define A_ALL_ATTRS (A_NORMAL | A_STANDOUT | A_UNDERLINE | A_REVERSE | \
@@ -75,30 +84,36 @@ int show_deck_info(WINDOW* parent, DeckInfoList* info);
 /*
 * Brief - Display all cards of a deck in the given window.
 * Input - parent: window to draw cards in,
-*         deck: pointer to Deck structure containing cards
+*         deck: pointer to Deck structure containing cards,
+*         start: index of the card to show first (0 when out of range)
 * Output - None
 */
-void display_cards(WINDOW* parent, Deck* deck);
+void display_cards(WINDOW* parent, Deck* deck, int start);
 
 /*
-* Brief - Allow user to study the cards in the deck interactively.
-* Input - parent: window to draw study interface,
-*         deck: pointer to Deck structure containing cards
+* Brief - Ask for search text and list matching cards from every deck, best match
+*         first, a page at a time. Selecting a result opens its deck at that card.
+* Input - parent: parent window (usually stdscr)
 * Output - None
 */
-void study_cards(WINDOW* parent, Deck* deck);
+void search_screen(WINDOW* parent);
 
 /*
-* Brief - Interactive input line with cursor navigation and editing features.
-* Input - win: window where input is received,
-*         y, x: starting coordinates within the window,
-*         buffer: buffer to store user input,
-*         max_len: max buffer length,
-*         visible_width: width of input box displayed,
-*         dash_flag: flag to control behavior (e.g., allow dashes)
-* Output - Number of characters entered or -1 on error.
+* Brief - List every deck's review history: reviews, accuracy, answer and day
+*         streaks, average answer time and last review. Reads the per deck
+*         aggregates, so it costs the same however long the review log is.
+* Input - parent: parent window (usually stdscr)
+* Output - None
+*/
+void review_stats_screen(WINDOW* parent);
+
+/*
+* Brief - Study the cards of a deck that are due, scheduling them with SM-2.
+* Input - parent: window to draw study interface,
+*         deck_id: ID of the deck to study
+* Output - None
 */
-int get_input_line(WINDOW* win, int y, int x, char* buffer, int max_len, int visible_width, int dash_flag);
+void study_cards(WINDOW* parent, int deck_id);
 
 /*
 * Brief - Create a new window centered relative to the parent window.
@@ -117,26 +132,24 @@ WINDOW* create_centered_window(WINDOW* parent, int height, int width);
 void clear_and_destroy_window(WINDOW* win);
 
 /*
-* Brief - Display a prompt and get user input within a form interface.
+* Brief - Display a prompt and let the user type, or edit, text in a form.
 * Input - parent_win: parent window for the prompt,
 *         form_prompt: prompt message string,
-*         input: buffer to store user input,
-*         max_len: max length of input buffer,
-*         dash_flag: flag to control input behavior (e.g., allow dashes)
-* Output - None
+*         initial: text to start from (may be NULL),
+*         flags: EDIT_MULTILINE and/or EDIT_DASHES (see editor.h)
+* Output - malloc'd text, NULL if cancelled
 */
-void form_input(WINDOW* parent_win, const char* form_prompt, char* input, int max_len, int dash_flag);
+char* form_input(WINDOW* parent_win, const char* form_prompt, const char* initial, int flags);
 
 /*
-* Brief - Similar to form_input but accepts two separate input buffers (e.g. for question and answer).
+* Brief - Similar to form_input but asks for the front and then the back of a new card.
 * Input - parent_win: parent window for the prompt,
 *         form_prompt: prompt message string,
-*         input1: first input buffer,
-*         input2: second input buffer,
-*         max_len: max length for both buffers
-* Output - None
+*         front: receives the malloc'd front,
+*         back: receives the malloc'd back
+* Output - Returns 1 when both were entered, 0 if cancelled (both are then NULL)
 */
-void card_input(WINDOW* parent_win, const char* form_prompt, char* input1, char* input2, int max_len);
+int card_input(WINDOW* parent_win, const char* form_prompt, char** front, char** back);
 
 /*
 * Brief - Create and display a popup window showing a message.
@@ -153,6 +166,16 @@ void popup_message(WINDOW * parent_win, const char* message);
 */
 void perrorw(const char* err_msg);
 
+/*
+* Brief - Message sink that shows data layer messages on screen: notices in a
+*         popup, status lines and errors at the bottom of stdscr
+* Input - level: message level
+*         message: text to show
+*         data: unused
+* Output - None
+*/
+void tui_message_sink(DbMessageLevel level, const char* message, void* data);
+
 /*
 * Brief - Disable all text attributes (e.g. bold, underline, reverse) on the given window.
 * Input - win: window to clear attributes from
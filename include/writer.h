@@ -0,0 +1,94 @@
+#ifndef WRITER_H
+#define WRITER_H
+
+#include <semaphore.h>
+#include <stdio.h>
+#include "scheduler.h"
+
+#define WRITER_QUEUE_SIZE 1024     // ring slots, a power of two
+#define WRITER_MAX_BATCH 512       // writes per group commit
+#define WRITER_ID_BLOCK 1024       // card ids reserved at a time for add_card
+
+typedef enum {
+   WRITE_ADD_CARD,
+   WRITE_UPDATE_CARD,
+   WRITE_DELETE_CARD,
+   WRITE_SAVE_SCHEDULE,
+   WRITE_LOG_REVIEWS,    // a batch of answers for review_log
+   WRITE_FLUSH,          // internal: commit and signal the waiting thread
+   WRITE_RESERVE_IDS,    // internal: reserve the next block of card ids if none is spare
+   WRITE_STOP            // internal: commit and exit
+} WriteOp;
+
+typedef struct {
+   WriteOp op;
+   int card_id;
+   int deck_id;
+   char* front;          // malloc'd copies, freed by the writer
+   char* back;
+   Schedule sched;
+   ReviewEntry* reviews; // malloc'd, freed by the writer
+   size_t review_count;
+   sem_t* done;          // WRITE_FLUSH: posted once everything before it is committed;
+                         // WRITE_RESERVE_IDS: posted once a spare block is ready (may be NULL)
+} WriteRequest;
+
+/*
+* Brief - Start a writer thread with its own connection. From then on card and
+*         schedule writes made through db are queued and committed in groups off
+*         the calling thread; WAL lets db keep reading while the writer commits.
+* Input - db: database context (the UI connection)
+* Output - Returns 1 on success, 0 if writes stay inline
+*/
+int writer_start(FlashDb* db);
+
+/*
+* Brief - Commit everything queued, stop the thread and close its connection
+* Input - db: database context
+* Output - None
+*/
+void writer_stop(FlashDb* db);
+
+/*
+* Brief - Queue a write. The request is copied; front/back ownership moves to
+*         the writer. Blocks only while the queue is full.
+* Input - db: database context with a running writer
+*         req: write to queue
+* Output - None
+*/
+void writer_submit(FlashDb* db, const WriteRequest* req);
+
+/*
+* Brief - Wait until every queued write is committed, so reads on db see them.
+*         Returns at once when nothing is pending or no writer runs.
+* Input - db: database context
+* Output - None
+*/
+void writer_flush(FlashDb* db);
+
+/*
+* Brief - Hand out an id for a new card before it is written, so the caller can
+*         use it right away. Ids come from blocks the writer thread reserves in
+*         sqlite_sequence one block ahead, so the caller never commits; it only
+*         waits if adds outrun the writer. An unused rest of a block is skipped.
+* Input - db: database context with a running writer
+* Output - Card id, or 0 on failure
+*/
+int writer_reserve_card_id(FlashDb* db);
+
+/*
+* Brief - Get and clear the number of queued writes that failed
+* Input - db: database context
+* Output - Failed writes since the last call
+*/
+unsigned long writer_take_errors(FlashDb* db);
+
+/*
+* Brief - Print queue and group commit counters
+* Input - db: database context
+*         out: stream to write to
+* Output - None
+*/
+void writer_print_stats(FlashDb* db, FILE* out);
+
+#endif
@@ -0,0 +1,76 @@
+#include "../include/arena.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+void* arena_alloc(Arena* arena, size_t size) {
+   ArenaBlock* block = arena->head;
+
+   if (!block || block->size - block->used < size) {
+      ArenaBlock* spare = arena->spare;
+      if (spare && spare->size >= size) {
+         arena->spare = spare->next;
+         block = spare;
+      } else {
+         // Grow geometrically, oversized requests get a block of their own
+         size_t block_size = block ? block->size * 2 : ARENA_MIN_BLOCK;
+         if (block_size > ARENA_MAX_BLOCK)
+            block_size = ARENA_MAX_BLOCK;
+         if (block_size < size)
+            block_size = size;
+
+         block = malloc(sizeof(ArenaBlock) + block_size);
+         if (!block)
+            return NULL;
+         block->size = block_size;
+      }
+      block->used = 0;
+      block->next = arena->head;
+      arena->head = block;
+   }
+
+   void* ptr = block->data + block->used;
+   block->used += size;
+   arena->total += size;
+   return ptr;
+}
+
+char* arena_strndup(Arena* arena, const char* str, size_t len) {
+   char* copy = arena_alloc(arena, len + 1);
+   if (!copy)
+      return NULL;
+   memcpy(copy, str, len);
+   copy[len] = '\0';
+   return copy;
+}
+
+char* arena_strdup(Arena* arena, const char* str) {
+   return arena_strndup(arena, str, strlen(str));
+}
+
+void arena_reset(Arena* arena) {
+   // Move the used chain onto the spare list, oldest (smallest) block first
+   while (arena->head) {
+      ArenaBlock* block = arena->head;
+      arena->head = block->next;
+      block->next = arena->spare;
+      arena->spare = block;
+   }
+   arena->total = 0;
+}
+
+static void free_chain(ArenaBlock* block) {
+   while (block) {
+      ArenaBlock* next = block->next;
+      free(block);
+      block = next;
+   }
+}
+
+void arena_free(Arena* arena) {
+   free_chain(arena->head);
+   free_chain(arena->spare);
+   arena->head = NULL;
+   arena->spare = NULL;
+   arena->total = 0;
+}
@@ -0,0 +1,433 @@
+#define _GNU_SOURCE // sync_file_range
+#include "../include/backup.h"
+#include "../include/migrate.h"
+#include "../include/writer.h"
+#include "../include/trace.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <linux/limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define BACKUP_SUFFIX ".db"
+#define BACKUP_RETRY_MS 10      // wait before retrying a step that found the file locked
+#define BACKUP_WRITEBACK_STEPS 16  // steps between starting writeback of what was copied
+#define BACKUP_ERROR_SIZE (PATH_MAX + MAX_BUFFER)   // a path and SQLite's message
+#define BACKUP_MSG_SIZE (BACKUP_ERROR_SIZE + 32)    // an error with "Backup failed: " in front
+
+struct Backup {
+   FlashDb* db;
+   pthread_t thread;
+   char src_path[PATH_MAX];
+   char dest[PATH_MAX];
+   char dir[PATH_MAX];           // prune this directory afterwards, empty for a named file
+   int keep;
+   char error[BACKUP_ERROR_SIZE];
+   atomic_int pages;
+   atomic_int remaining;
+   atomic_int done;
+   atomic_int ok;
+   atomic_int cancel;
+};
+
+// Copy every page of src into dest, BACKUP_STEP_PAGES at a time
+static int copy_pages(sqlite3* dest, sqlite3* src, const char* dest_path, BackupProgressFn progress,
+                      void* data, char* error, size_t size) {
+   sqlite3_backup* backup = sqlite3_backup_init(dest, "main", src, "main");
+   if (!backup) {
+      snprintf(error, size, "%s", sqlite3_errmsg(dest));
+      return 0;
+   }
+
+   BackupProgress state = { .dest = dest_path };
+   int rc, cancelled = 0;
+   do {
+      unsigned long long start = trace_begin();
+      rc = sqlite3_backup_step(backup, BACKUP_STEP_PAGES);
+      trace_end(TRACE_BACKUP_STEP, start);
+      if (rc == SQLITE_BUSY || rc == SQLITE_LOCKED)
+         sqlite3_sleep(BACKUP_RETRY_MS);
+      state.pages = sqlite3_backup_pagecount(backup);
+      state.remaining = sqlite3_backup_remaining(backup);
+      cancelled = progress && !progress(&state, data);
+   } while (!cancelled && (rc == SQLITE_OK || rc == SQLITE_BUSY || rc == SQLITE_LOCKED));
+
+   int finish_rc = sqlite3_backup_finish(backup);
+   if (cancelled) {
+      snprintf(error, size, "cancelled");
+      return 0;
+   }
+   if (rc != SQLITE_DONE || finish_rc != SQLITE_OK) {
+      snprintf(error, size, "%s", sqlite3_errstr(rc != SQLITE_DONE ? rc : finish_rc));
+      return 0;
+   }
+   return 1;
+}
+
+static int sync_path(const char* path, int flags) {
+   int fd = open(path, flags);
+   if (fd < 0)
+      return 0;
+   int ok = fsync(fd) == 0;
+   close(fd);
+   return ok;
+}
+
+// Make a rename durable by syncing the directory that holds the file
+static int sync_parent(const char* path) {
+   char copy[PATH_MAX];
+   snprintf(copy, sizeof(copy), "%s", path);
+   return sync_path(dirname(copy), O_RDONLY | O_DIRECTORY);
+}
+
+// Writes the copy out as it goes, so the final fsync has little left to do: one
+// large fsync at the end stalls the commits of the app for as long as it takes
+typedef struct {
+   int fd;
+   int steps;
+   BackupProgressFn progress;
+   void* data;
+} Writeback;
+
+static int start_writeback(const BackupProgress* progress, void* data) {
+   Writeback* wb = data;
+   if (wb->fd >= 0 && ++wb->steps % BACKUP_WRITEBACK_STEPS == 0)
+      sync_file_range(wb->fd, 0, 0, SYNC_FILE_RANGE_WRITE);
+   return !wb->progress || wb->progress(progress, wb->data);
+}
+
+static int copy_file(const char* src_path, const char* dest, BackupProgressFn progress, void* data,
+                     char* error, size_t size) {
+   TRACE_SCOPE(TRACE_BACKUP);
+   char tmp[PATH_MAX];
+   if (snprintf(tmp, sizeof(tmp), "%s.tmp", dest) >= (int)sizeof(tmp)) {
+      snprintf(error, size, "path too long");
+      return 0;
+   }
+   unlink(tmp); // left over from a copy that was interrupted
+
+   sqlite3* src = NULL;
+   sqlite3* out = NULL;
+   int ok = 1;
+   if (sqlite3_open_v2(src_path, &src, SQLITE_OPEN_READONLY, NULL) != SQLITE_OK) {
+      snprintf(error, size, "%s: %s", src_path, sqlite3_errmsg(src));
+      ok = 0;
+   }
+   if (ok) {
+      sqlite3_busy_timeout(src, DB_BUSY_TIMEOUT_MS);
+      // Reading the schema starts the read transaction, and its snapshot is what gets copied
+      ok = sqlite3_exec(src, "BEGIN; SELECT COUNT(*) FROM sqlite_schema;", 0, 0, 0) == SQLITE_OK;
+      if (!ok)
+         snprintf(error, size, "%s", sqlite3_errmsg(src));
+   }
+   if (ok && sqlite3_open_v2(tmp, &out, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, NULL) != SQLITE_OK) {
+      snprintf(error, size, "%s: %s", tmp, sqlite3_errmsg(out));
+      ok = 0;
+   }
+   // Nothing reads the temporary file before it is synced and renamed, so it needs no journal
+   Writeback wb = { .fd = -1, .progress = progress, .data = data };
+   if (ok) {
+      sqlite3_exec(out, "PRAGMA journal_mode = OFF; PRAGMA synchronous = OFF;", 0, 0, 0);
+      wb.fd = open(tmp, O_RDONLY);
+   }
+   ok = ok && copy_pages(out, src, dest, start_writeback, &wb, error, size);
+   // The copy comes out in WAL mode like the database; a rollback journal keeps a
+   // snapshot to one file that can be opened read-only without leaving -wal/-shm behind
+   if (ok && sqlite3_exec(out, "PRAGMA journal_mode = DELETE;", 0, 0, 0) != SQLITE_OK) {
+      snprintf(error, size, "%s", sqlite3_errmsg(out));
+      ok = 0;
+   }
+   if (wb.fd >= 0)
+      close(wb.fd);
+
+   if (src)
+      sqlite3_exec(src, "COMMIT;", 0, 0, 0);
+   sqlite3_close(src);
+   sqlite3_close(out);
+
+   if (ok && !(sync_path(tmp, O_RDONLY) && rename(tmp, dest) == 0 && sync_parent(dest))) {
+      snprintf(error, size, "%s: %s", dest, strerror(errno));
+      ok = 0;
+   }
+   if (!ok)
+      unlink(tmp);
+   return ok;
+}
+
+static int compare_names(const void* a, const void* b) {
+   return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+static int read_backup_dir(const char* dir, BackupList* list) {
+   list->items = NULL;
+   list->count = 0;
+   list->capacity = 0;
+
+   DIR* handle = opendir(dir);
+   if (!handle)
+      return errno == ENOENT;
+
+   size_t prefix_len = strlen(BACKUP_PREFIX);
+   size_t suffix_len = strlen(BACKUP_SUFFIX);
+   struct dirent* entry;
+   while ((entry = readdir(handle))) {
+      size_t len = strlen(entry->d_name);
+      if (len <= prefix_len + suffix_len || strncmp(entry->d_name, BACKUP_PREFIX, prefix_len) != 0
+          || strcmp(entry->d_name + len - suffix_len, BACKUP_SUFFIX) != 0)
+         continue;
+      char* name = strdup(entry->d_name);
+      if (name)
+         da_append(list, name);
+   }
+   closedir(handle);
+
+   // The timestamp in the name makes name order the order they were taken in
+   if (list->count > 1)
+      qsort(list->items, list->count, sizeof(*list->items), compare_names);
+   return 1;
+}
+
+// Delete the oldest snapshots until keep are left
+static void prune_backups(const char* dir, int keep) {
+   BackupList list;
+   if (keep <= 0 || !read_backup_dir(dir, &list))
+      return;
+   for (size_t i = 0; i + keep < list.count; i++) {
+      char path[PATH_MAX];
+      snprintf(path, sizeof(path), "%s/%s", dir, list.items[i]);
+      unlink(path);
+   }
+   free_backup_list(&list);
+}
+
+// Name a new snapshot, or a copy starting with another prefix, after the current
+// time, creating the directory if needed
+static int snapshot_path(const char* dir, const char* prefix, char* path, size_t size) {
+   if (mkdir(dir, 0755) != 0 && errno != EEXIST)
+      return 0;
+   char stamp[32];
+   time_t now = time(NULL);
+   struct tm tm;
+   localtime_r(&now, &tm);
+   strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &tm);
+   return snprintf(path, size, "%s/%s%s%s", dir, prefix, stamp, BACKUP_SUFFIX) < (int)size;
+}
+
+int backup_dir(FlashDb* db, char* path, size_t size) {
+   if (!db->conn)  // a daemon's client, the daemon takes the snapshots
+      return 0;
+   const char* file = sqlite3_db_filename(db->conn, "main");
+   if (!file || !*file)
+      return 0;
+   char copy[PATH_MAX];
+   snprintf(copy, sizeof(copy), "%s", file);
+   return snprintf(path, size, "%s/%s", dirname(copy), BACKUP_DIR) < (int)size;
+}
+
+int list_backups(FlashDb* db, BackupList* list) {
+   char dir[PATH_MAX];
+   if (!backup_dir(db, dir, sizeof(dir))) {
+      *list = (BackupList){0};
+      return 0;
+   }
+   return read_backup_dir(dir, list);
+}
+
+void free_backup_list(BackupList* list) {
+   for (size_t i = 0; i < list->count; i++)
+      free(list->items[i]);
+   free(list->items);
+   list->items = NULL;
+   list->count = 0;
+   list->capacity = 0;
+}
+
+int backup_due(FlashDb* db, time_t now) {
+   if (db->config.backup_interval <= 0)
+      return 0;
+   char dir[PATH_MAX];
+   BackupList list;
+   if (!backup_dir(db, dir, sizeof(dir)) || !read_backup_dir(dir, &list))
+      return 0;
+
+   int due = 1;
+   if (list.count > 0) {
+      char path[PATH_MAX];
+      struct stat st;
+      // A name too long for a path cannot be a snapshot that is there
+      due = snprintf(path, sizeof(path), "%s/%s", dir, list.items[list.count - 1]) >= (int)sizeof(path)
+            || stat(path, &st) != 0 || now - st.st_mtime >= (time_t)db->config.backup_interval * 3600;
+   }
+   free_backup_list(&list);
+   return due;
+}
+
+// Fill in where a backup of db goes; dir is left empty unless it is a rotating snapshot
+static int plan_backup(FlashDb* db, const char* dest, char* src_path, char* path, char* dir,
+                       char* error, size_t size) {
+   const char* file = sqlite3_db_filename(db->conn, "main");
+   if (!file || !*file || !backup_dir(db, dir, PATH_MAX)) {
+      snprintf(error, size, "the database has no file to copy");
+      return 0;
+   }
+   snprintf(src_path, PATH_MAX, "%s", file);
+   if (dest) {
+      snprintf(path, PATH_MAX, "%s", dest);
+      *dir = '\0';
+   } else if (!snapshot_path(dir, BACKUP_PREFIX, path, PATH_MAX)) {
+      snprintf(error, size, "%s: %s", dir, strerror(errno));
+      return 0;
+   }
+   return 1;
+}
+
+int backup_database(FlashDb* db, const char* dest, BackupProgressFn progress, void* data) {
+   char src_path[PATH_MAX], path[PATH_MAX], dir[PATH_MAX];
+   char error[BACKUP_ERROR_SIZE] = {0};
+   int ok = plan_backup(db, dest, src_path, path, dir, error, sizeof(error))
+            && copy_file(src_path, path, progress, data, error, sizeof(error));
+   if (!ok) {
+      fprintf(stderr, "Backup failed: %s\n", error);
+      return 0;
+   }
+   if (*dir)
+      prune_backups(dir, db->config.backup_keep);
+   return 1;
+}
+
+static int record_progress(const BackupProgress* progress, void* data) {
+   Backup* backup = data;
+   atomic_store(&backup->pages, progress->pages);
+   atomic_store(&backup->remaining, progress->remaining);
+   return !atomic_load(&backup->cancel);
+}
+
+static void* backup_main(void* arg) {
+   Backup* backup = arg;
+   trace_set_thread_name("backup");
+   int ok = copy_file(backup->src_path, backup->dest, record_progress, backup,
+                      backup->error, sizeof(backup->error));
+   if (ok && *backup->dir)
+      prune_backups(backup->dir, backup->keep);
+   atomic_store(&backup->ok, ok);
+   atomic_store(&backup->done, 1);
+   return NULL;
+}
+
+Backup* backup_start(FlashDb* db, const char* dest) {
+   char status_msg[BACKUP_MSG_SIZE] = {0};
+   Backup* backup = calloc(1, sizeof(*backup));
+   if (!backup)
+      return NULL;
+   backup->db = db;
+   backup->keep = db->config.backup_keep;
+
+   // Everything the thread needs is copied here, so it never touches db->conn
+   if (!plan_backup(db, dest, backup->src_path, backup->dest, backup->dir,
+                    backup->error, sizeof(backup->error))
+       || pthread_create(&backup->thread, NULL, backup_main, backup) != 0) {
+      snprintf(status_msg, sizeof(status_msg), "Backup failed: %s",
+               *backup->error ? backup->error : "could not start a thread");
+      db_report(db, DB_MSG_ERROR, status_msg);
+      free(backup);
+      return NULL;
+   }
+   return backup;
+}
+
+void backup_poll(Backup* backup, BackupProgress* progress) {
+   progress->dest = backup->dest;
+   progress->pages = atomic_load(&backup->pages);
+   progress->remaining = atomic_load(&backup->remaining);
+   progress->done = atomic_load(&backup->done);
+   progress->ok = atomic_load(&backup->ok);
+}
+
+int backup_finish(Backup* backup, int cancel) {
+   char status_msg[BACKUP_MSG_SIZE] = {0};
+   if (!backup)
+      return 0;
+   if (cancel)
+      atomic_store(&backup->cancel, 1);
+   pthread_join(backup->thread, NULL);
+
+   int ok = atomic_load(&backup->ok);
+   if (ok) {
+      snprintf(status_msg, sizeof(status_msg), "Backup saved to %s", backup->dest);
+      db_report(backup->db, DB_MSG_STATUS, status_msg);
+   } else if (!cancel) {
+      snprintf(status_msg, sizeof(status_msg), "Backup failed: %s", backup->error);
+      db_report(backup->db, DB_MSG_ERROR, status_msg);
+   }
+   free(backup);
+   return ok;
+}
+
+// Resolve "latest" or a bare name against the backup directory
+static int find_snapshot(FlashDb* db, const char* snapshot, char* path, size_t size) {
+   char dir[PATH_MAX];
+   if (strchr(snapshot, '/') || !backup_dir(db, dir, sizeof(dir)))
+      return snprintf(path, size, "%s", snapshot) < (int)size;
+   if (strcmp(snapshot, "latest") != 0)
+      return snprintf(path, size, "%s/%s", dir, snapshot) < (int)size;
+
+   BackupList list;
+   if (!read_backup_dir(dir, &list) || list.count == 0) {
+      fprintf(stderr, "restore: no snapshots in %s\n", dir);
+      return 0;
+   }
+   int ok = snprintf(path, size, "%s/%s", dir, list.items[list.count - 1]) < (int)size;
+   free_backup_list(&list);
+   return ok;
+}
+
+int restore_backup(FlashDb* db, const char* snapshot, BackupProgressFn progress, void* data) {
+   char path[PATH_MAX];
+   if (!find_snapshot(db, snapshot, path, sizeof(path)))
+      return 0;
+
+   sqlite3* src = NULL;
+   sqlite3_stmt* stmt = NULL;
+   int ok = sqlite3_open_v2(path, &src, SQLITE_OPEN_READONLY, NULL) == SQLITE_OK
+            && sqlite3_prepare_v2(src, "SELECT COUNT(*) FROM sqlite_schema "
+                                       "WHERE type = 'table' AND name IN ('decks', 'cards');",
+                                  -1, &stmt, NULL) == SQLITE_OK
+            && sqlite3_step(stmt) == SQLITE_ROW;
+   if (!ok)
+      fprintf(stderr, "restore: %s: %s\n", path, sqlite3_errmsg(src));
+   else if (sqlite3_column_int(stmt, 0) != 2) {
+      fprintf(stderr, "restore: %s is not a flash cards database\n", path);
+      ok = 0;
+   }
+   sqlite3_finalize(stmt);
+
+   // Keep what is being replaced. Its own prefix keeps it out of the snapshot list,
+   // so it is never pruned, due-checked or restored as "latest", and cannot take
+   // the name of a snapshot from the same second, which may be the one restored.
+   char dir[PATH_MAX] = {0}, saved[PATH_MAX];
+   if (ok && !(backup_dir(db, dir, sizeof(dir)) && snapshot_path(dir, BACKUP_SAVED_PREFIX, saved, sizeof(saved)))) {
+      fprintf(stderr, "restore: cannot save the current database in %s\n", dir);
+      ok = 0;
+   }
+   ok = ok && backup_database(db, saved, NULL, NULL);
+   if (ok)
+      fprintf(stderr, "Saved the current database as %s\n", saved);
+
+   if (ok) {
+      char error[BACKUP_ERROR_SIZE] = {0};
+      writer_flush(db);
+      ok = copy_pages(db->conn, src, sqlite3_db_filename(db->conn, "main"), progress, data,
+                      error, sizeof(error));
+      if (!ok)
+         fprintf(stderr, "restore: %s\n", error);
+   }
+   sqlite3_close(src);
+
+   // A snapshot from an older version comes back with its old schema
+   return ok && run_migrations(db->conn);
+}
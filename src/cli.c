@@ -0,0 +1,688 @@
+#include "../include/cli.h"
+#include "../include/db.h"
+#include "../include/import.h"
+#include "../include/export.h"
+#include "../include/migrate.h"
+#include "../include/search.h"
+#include "../include/dedupe.h"
+#include "../include/backup.h"
+
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <linux/limits.h>
+
+typedef int (*CommandHandler)(FlashDb* db, int argc, char** argv);
+
+typedef struct {
+   const char* name;
+   const char* usage;
+   CommandHandler handler;
+} Command;
+
+static int cmd_import(FlashDb* db, int argc, char** argv);
+static int cmd_export(FlashDb* db, int argc, char** argv);
+static int cmd_schema(FlashDb* db, int argc, char** argv);
+static int cmd_config(FlashDb* db, int argc, char** argv);
+static int cmd_check_counts(FlashDb* db, int argc, char** argv);
+static int cmd_search(FlashDb* db, int argc, char** argv);
+static int cmd_list(FlashDb* db, int argc, char** argv);
+static int cmd_add(FlashDb* db, int argc, char** argv);
+static int cmd_delete(FlashDb* db, int argc, char** argv);
+static int cmd_stats(FlashDb* db, int argc, char** argv);
+static int cmd_query(FlashDb* db, int argc, char** argv);
+static int cmd_dedupe(FlashDb* db, int argc, char** argv);
+static int cmd_backup(FlashDb* db, int argc, char** argv);
+static int cmd_restore(FlashDb* db, int argc, char** argv);
+
+static const Command commands[] = {
+   {"import", "import FILE [--deck NAME] [--format csv|tsv] [--batch ROWS] [--jobs N] [--duplicates skip|merge|keep]", cmd_import},
+   {"export", "export [--deck NAME] [--format tsv|json] [-o FILE]", cmd_export},
+   {"schema", "schema", cmd_schema},
+   {"config", "config", cmd_config},
+   {"check-counts", "check-counts [--repair]", cmd_check_counts},
+   {"search", "search WORDS... [--limit N] [--offset N]", cmd_search},
+   {"list", "list [--deck NAME] [--json]", cmd_list},
+   {"add", "add --deck NAME [--create] [--duplicates skip|merge|keep] FRONT BACK", cmd_add},
+   {"delete", "delete --card ID | --deck NAME", cmd_delete},
+   {"stats", "stats [--json]", cmd_stats},
+   {"query", "query SQL [--json]", cmd_query},
+   {"dedupe", "dedupe [--merge] [--dry-run]", cmd_dedupe},
+   {"backup", "backup [FILE] | --list", cmd_backup},
+   {"restore", "restore SNAPSHOT|latest", cmd_restore},
+};
+
+#define COMMAND_COUNT (sizeof(commands) / sizeof(commands[0]))
+
+static void print_usage(FILE* out) {
+   fprintf(out, "Usage: flash-cards [--stats] [--trace FILE] [COMMAND]\n");
+   fprintf(out, "Without a command the interactive TUI is started.\n");
+   fprintf(out, "--stats prints span latencies on exit, --trace FILE writes a Chrome trace.\n\nCommands:\n");
+   for (size_t i = 0; i < COMMAND_COUNT; i++)
+      fprintf(out, "  flash-cards %s\n", commands[i].usage);
+}
+
+int run_cli(FlashDb* db, int argc, char** argv) {
+   if (strcmp(argv[1], "-h") == 0 || strcmp(argv[1], "--help") == 0) {
+      print_usage(stdout);
+      return EXIT_SUCCESS;
+   }
+
+   for (size_t i = 0; i < COMMAND_COUNT; i++) {
+      if (strcmp(argv[1], commands[i].name) == 0)
+         return commands[i].handler(db, argc - 1, argv + 1);
+   }
+
+   fprintf(stderr, "Unknown command '%s'\n", argv[1]);
+   print_usage(stderr);
+   return EXIT_FAILURE;
+}
+
+static void print_command_usage(const char* name) {
+   for (size_t i = 0; i < COMMAND_COUNT; i++) {
+      if (strcmp(commands[i].name, name) == 0)
+         fprintf(stderr, "Usage: flash-cards %s\n", commands[i].usage);
+   }
+}
+
+static int cmd_import(FlashDb* db, int argc, char** argv) {
+   ImportOptions opts = {0};
+   const char* path = NULL;
+
+   for (int i = 1; i < argc; i++) {
+      if (strcmp(argv[i], "--deck") == 0 && i + 1 < argc) {
+         opts.deck_name = argv[++i];
+      } else if (strcmp(argv[i], "--format") == 0 && i + 1 < argc) {
+         const char* fmt = argv[++i];
+         if (strcmp(fmt, "csv") == 0) {
+            opts.separator = ',';
+         } else if (strcmp(fmt, "tsv") == 0 || strcmp(fmt, "anki") == 0) {
+            opts.separator = '\t';
+         } else {
+            fprintf(stderr, "import: unknown format '%s'\n", fmt);
+            return EXIT_FAILURE;
+         }
+      } else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+         opts.batch_rows = strtoul(argv[++i], NULL, 10);
+      } else if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) {
+         opts.jobs = atoi(argv[++i]);
+      } else if (strcmp(argv[i], "--duplicates") == 0 && i + 1 < argc) {
+         if (!parse_dup_policy(argv[++i], &opts.duplicates)) {
+            fprintf(stderr, "import: unknown duplicate policy '%s'\n", argv[i]);
+            return EXIT_FAILURE;
+         }
+      } else if (!path) {
+         path = argv[i];
+      } else {
+         fprintf(stderr, "import: unexpected argument '%s'\n", argv[i]);
+         return EXIT_FAILURE;
+      }
+   }
+
+   if (!path) {
+      print_command_usage("import");
+      return EXIT_FAILURE;
+   }
+
+   ImportStats stats;
+   int ok = import_cards(db, path, &opts, &stats);
+
+   double rate = stats.seconds > 0 ? stats.rows / stats.seconds : 0;
+   printf("Imported %zu cards (%zu skipped, %zu invalid UTF-8) in %zu transactions, %.2f s, %.0f rows/s\n",
+          stats.rows, stats.skipped, stats.invalid, stats.batches, stats.seconds, rate);
+   if (stats.duplicates > 0)
+      printf("%zu duplicate fronts: %zu merged, the rest skipped\n", stats.duplicates, stats.merged);
+   printf("Stages: read %.2f s, parse %.2f s on %d worker(s), insert %.2f s (%.2f s waiting for rows)\n",
+          stats.read_seconds, stats.parse_seconds, stats.jobs, stats.insert_seconds, stats.wait_seconds);
+   return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static int cmd_export(FlashDb* db, int argc, char** argv) {
+   ExportOptions opts = {0};
+   const char* path = "-";
+   int format_set = 0;
+
+   for (int i = 1; i < argc; i++) {
+      if (strcmp(argv[i], "--deck") == 0 && i + 1 < argc) {
+         opts.deck_name = argv[++i];
+      } else if (strcmp(argv[i], "--format") == 0 && i + 1 < argc) {
+         const char* fmt = argv[++i];
+         if (strcmp(fmt, "tsv") == 0) {
+            opts.format = EXPORT_TSV;
+         } else if (strcmp(fmt, "json") == 0) {
+            opts.format = EXPORT_JSON;
+         } else {
+            fprintf(stderr, "export: unknown format '%s'\n", fmt);
+            return EXIT_FAILURE;
+         }
+         format_set = 1;
+      } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+         path = argv[++i];
+      } else {
+         print_command_usage("export");
+         return EXIT_FAILURE;
+      }
+   }
+
+   if (!format_set) {
+      const char* ext = strrchr(path, '.');
+      opts.format = (ext && strcmp(ext, ".json") == 0) ? EXPORT_JSON : EXPORT_TSV;
+   }
+
+   ExportStats stats;
+   int ok = export_cards(db, path, &opts, &stats);
+
+   // Data may be going to stdout, so the summary goes to stderr
+   double rate = stats.seconds > 0 ? stats.cards / stats.seconds : 0;
+   fprintf(stderr, "Exported %zu cards from %zu decks in %.2f s, %.0f rows/s\n",
+           stats.cards, stats.decks, stats.seconds, rate);
+   return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static int cmd_schema(FlashDb* db, int argc, char** argv) {
+   (void)argc;
+   (void)argv;
+   print_migrations(db->conn, stdout);
+   return EXIT_SUCCESS;
+}
+
+static int cmd_config(FlashDb* db, int argc, char** argv) {
+   (void)argc;
+   (void)argv;
+   db_print_config(db, stdout);
+   return EXIT_SUCCESS;
+}
+
+static int cmd_check_counts(FlashDb* db, int argc, char** argv) {
+   int repair = argc > 1 && strcmp(argv[1], "--repair") == 0;
+   if (argc > 1 && !repair) {
+      print_command_usage("check-counts");
+      return EXIT_FAILURE;
+   }
+
+   int mismatches = check_deck_counts(db, repair, stdout);
+   if (mismatches < 0) {
+      fprintf(stderr, "check-counts: %s\n", sqlite3_errmsg(db->conn));
+      return EXIT_FAILURE;
+   }
+
+   if (mismatches == 0)
+      printf("All deck card counts are consistent\n");
+   else
+      printf("%d deck(s) inconsistent%s\n", mismatches, repair ? ", repaired" : "");
+   return (mismatches == 0 || repair) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static int cmd_search(FlashDb* db, int argc, char** argv) {
+   char text[MAX_BUFFER] = {0};
+   size_t len = 0;
+   int limit = SEARCH_PAGE_SIZE;
+   int offset = 0;
+
+   for (int i = 1; i < argc; i++) {
+      if (strcmp(argv[i], "--limit") == 0 && i + 1 < argc) {
+         limit = atoi(argv[++i]);
+      } else if (strcmp(argv[i], "--offset") == 0 && i + 1 < argc) {
+         offset = atoi(argv[++i]);
+      } else {
+         len += snprintf(text + len, sizeof(text) - len, "%s%s", len ? " " : "", argv[i]);
+         if (len >= sizeof(text))
+            len = sizeof(text) - 1;
+      }
+   }
+
+   if (len == 0 || limit <= 0 || offset < 0) {
+      print_command_usage("search");
+      return EXIT_FAILURE;
+   }
+
+   struct timespec start, end;
+   clock_gettime(CLOCK_MONOTONIC, &start);
+   SearchResults results = {0};
+   int ok = search_cards(db, text, limit, offset, &results);
+   clock_gettime(CLOCK_MONOTONIC, &end);
+
+   if (!ok) {
+      fprintf(stderr, "search: %s\n", sqlite3_errmsg(db->conn));
+      free_search_results(&results);
+      return EXIT_FAILURE;
+   }
+
+   for (size_t i = 0; i < results.count; i++) {
+      SearchResult* r = &results.items[i];
+      // Quoted like list and export, so a tab or newline in a card stays one hit per line
+      printf("%d\t", r->card_id);
+      write_tsv_field(stdout, r->deck_name, (int)strlen(r->deck_name));
+      putchar('\t');
+      write_tsv_field(stdout, r->front, (int)strlen(r->front));
+      putchar('\t');
+      write_tsv_field(stdout, r->back, (int)strlen(r->back));
+      putchar('\n');
+   }
+
+   double ms = (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+   fprintf(stderr, "%zu result(s)%s in %.2f ms\n", results.count, results.has_more ? ", more available" : "", ms);
+   free_search_results(&results);
+   return EXIT_SUCCESS;
+}
+
+// Cards of one deck, one row or object per card
+static int list_cards(FlashDb* db, const char* deck_name, int json) {
+   int deck_id;
+   if (!deck_exists(db, deck_name, &deck_id)) {
+      fprintf(stderr, "list: deck '%s' does not exist\n", deck_name);
+      return EXIT_FAILURE;
+   }
+
+   Deck deck = {0};
+   load_deck_cards(db, deck_id, &deck);
+   if (json)
+      putchar('[');
+   int ok = 1;
+   for (size_t i = 0; i < deck.count; i++) {
+      const Cards* card = deck_card(&deck, i);
+      if (!card) {
+         fprintf(stderr, "list: %s\n", sqlite3_errmsg(db->conn));
+         ok = 0;
+         break;
+      }
+      if (json) {
+         printf("%s{\"id\":%d,\"front\":", i ? "," : "", card->id);
+         write_json_string(stdout, card->front, (int)strlen(card->front));
+         fputs(",\"back\":", stdout);
+         write_json_string(stdout, card->back, (int)strlen(card->back));
+         putchar('}');
+      } else {
+         printf("%d\t", card->id);
+         write_tsv_field(stdout, card->front, (int)strlen(card->front));
+         putchar('\t');
+         write_tsv_field(stdout, card->back, (int)strlen(card->back));
+         putchar('\n');
+      }
+   }
+   if (json)
+      puts("]");
+   free_deck_cards(&deck);
+   return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static int cmd_list(FlashDb* db, int argc, char** argv) {
+   const char* deck_name = NULL;
+   int json = 0;
+
+   for (int i = 1; i < argc; i++) {
+      if (strcmp(argv[i], "--deck") == 0 && i + 1 < argc) {
+         deck_name = argv[++i];
+      } else if (strcmp(argv[i], "--json") == 0) {
+         json = 1;
+      } else {
+         print_command_usage("list");
+         return EXIT_FAILURE;
+      }
+   }
+
+   if (deck_name)
+      return list_cards(db, deck_name, json);
+
+   DeckInfoList decks = {0};
+   load_deck_list(db, &decks);
+   if (json)
+      putchar('[');
+   for (size_t i = 0; i < decks.count; i++) {
+      DeckInfo* d = &decks.items[i];
+      if (json) {
+         printf("%s{\"id\":%d,\"name\":", i ? "," : "", d->id);
+         write_json_string(stdout, d->name, (int)strlen(d->name));
+         printf(",\"cards\":%d}", d->card_count);
+      } else {
+         printf("%d\t", d->id);
+         write_tsv_field(stdout, d->name, (int)strlen(d->name));
+         printf("\t%d\n", d->card_count);
+      }
+   }
+   if (json)
+      puts("]");
+   free_deck_list(&decks);
+   return EXIT_SUCCESS;
+}
+
+static int cmd_add(FlashDb* db, int argc, char** argv) {
+   const char* deck_name = NULL;
+   const char* front = NULL;
+   const char* back = NULL;
+   int create = 0;
+   DupPolicy duplicates = DUP_SKIP;
+
+   for (int i = 1; i < argc; i++) {
+      if (strcmp(argv[i], "--deck") == 0 && i + 1 < argc) {
+         deck_name = argv[++i];
+      } else if (strcmp(argv[i], "--create") == 0) {
+         create = 1;
+      } else if (strcmp(argv[i], "--duplicates") == 0 && i + 1 < argc) {
+         if (!parse_dup_policy(argv[++i], &duplicates)) {
+            fprintf(stderr, "add: unknown duplicate policy '%s'\n", argv[i]);
+            return EXIT_FAILURE;
+         }
+      } else if (!front) {
+         front = argv[i];
+      } else if (!back) {
+         back = argv[i];
+      } else {
+         fprintf(stderr, "add: unexpected argument '%s'\n", argv[i]);
+         return EXIT_FAILURE;
+      }
+   }
+
+   if (!deck_name || !front || !back || !*front || !*back) {
+      print_command_usage("add");
+      return EXIT_FAILURE;
+   }
+
+   int deck_id;
+   if (create) {
+      if (!get_or_create_deck(db, deck_name, &deck_id))
+         return EXIT_FAILURE;
+   } else if (!deck_exists(db, deck_name, &deck_id)) {
+      fprintf(stderr, "add: deck '%s' does not exist (use --create)\n", deck_name);
+      return EXIT_FAILURE;
+   }
+
+   // A duplicate prints the existing card's id, so scripts get the same output either way
+   Cards existing;
+   if (duplicates != DUP_KEEP && find_duplicate_card(db, deck_id, front, card_text_hash(front), &existing)) {
+      int ok = 1;
+      char* merged = duplicates == DUP_MERGE ? merge_backs(existing.back, back) : NULL;
+      if (merged) {
+         ok = update_card(db, NULL, existing.id, existing.front, merged);
+         fprintf(stderr, "add: merged into card %d, which has the same front\n", existing.id);
+      } else {
+         fprintf(stderr, "add: skipped, card %d has the same front\n", existing.id);
+      }
+      if (ok)
+         printf("%d\n", existing.id);
+      free(merged);
+      free(existing.front);
+      free(existing.back);
+      return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+   }
+
+   int card_id = add_card(db, NULL, deck_id, front, back);
+   if (card_id == 0)
+      return EXIT_FAILURE;
+   printf("%d\n", card_id);
+   return EXIT_SUCCESS;
+}
+
+static int cmd_delete(FlashDb* db, int argc, char** argv) {
+   if (argc != 3) {
+      print_command_usage("delete");
+      return EXIT_FAILURE;
+   }
+
+   if (strcmp(argv[1], "--card") == 0) {
+      char* end;
+      long card_id = strtol(argv[2], &end, 10);
+      if (*end || card_id <= 0) {
+         fprintf(stderr, "delete: invalid card id '%s'\n", argv[2]);
+         return EXIT_FAILURE;
+      }
+      if (!delete_card_by_id(db, NULL, (int)card_id))
+         return EXIT_FAILURE;
+      if (sqlite3_changes(db->conn) == 0) {
+         fprintf(stderr, "delete: no card with id %ld\n", card_id);
+         return EXIT_FAILURE;
+      }
+      return EXIT_SUCCESS;
+   }
+
+   if (strcmp(argv[1], "--deck") == 0) {
+      int deck_id;
+      if (!deck_exists(db, argv[2], &deck_id)) {
+         fprintf(stderr, "delete: deck '%s' does not exist\n", argv[2]);
+         return EXIT_FAILURE;
+      }
+      return delete_deck_by_id(db, deck_id) ? EXIT_SUCCESS : EXIT_FAILURE;
+   }
+
+   print_command_usage("delete");
+   return EXIT_FAILURE;
+}
+
+static int cmd_stats(FlashDb* db, int argc, char** argv) {
+   int json = argc == 2 && strcmp(argv[1], "--json") == 0;
+   if (argc > 1 && !json) {
+      print_command_usage("stats");
+      return EXIT_FAILURE;
+   }
+
+   DeckStatsList stats = {0};
+   if (!load_deck_stats(db, time(NULL), &stats)) {
+      fprintf(stderr, "stats: %s\n", sqlite3_errmsg(db->conn));
+      free_deck_stats(&stats);
+      return EXIT_FAILURE;
+   }
+
+   if (json)
+      putchar('[');
+   for (size_t i = 0; i < stats.count; i++) {
+      DeckStats* d = &stats.items[i];
+      if (json) {
+         printf("%s{\"id\":%d,\"name\":", i ? "," : "", d->id);
+         write_json_string(stdout, d->name, (int)strlen(d->name));
+         printf(",\"cards\":%d,\"due\":%d,\"reviewed\":%d}", d->cards, d->due, d->reviewed);
+      } else {
+         printf("%d\t", d->id);
+         write_tsv_field(stdout, d->name, (int)strlen(d->name));
+         printf("\t%d\t%d\t%d\n", d->cards, d->due, d->reviewed);
+      }
+   }
+   if (json)
+      puts("]");
+   free_deck_stats(&stats);
+   return EXIT_SUCCESS;
+}
+
+static void print_query_value(sqlite3_stmt* stmt, int col, int json) {
+   int type = sqlite3_column_type(stmt, col);
+   if (type == SQLITE_NULL) {
+      if (json)
+         fputs("null", stdout);
+   } else if (json && (type == SQLITE_INTEGER || type == SQLITE_FLOAT)) {
+      fputs((const char*)sqlite3_column_text(stmt, col), stdout);
+   } else {
+      const char* text = (const char*)sqlite3_column_text(stmt, col);
+      int len = sqlite3_column_bytes(stmt, col);
+      if (json)
+         write_json_string(stdout, text, len);
+      else
+         write_tsv_field(stdout, text, len);
+   }
+}
+
+// Read-only SQL for scripts: TSV with a header row, or a JSON array of objects
+static int cmd_query(FlashDb* db, int argc, char** argv) {
+   const char* sql = NULL;
+   int json = 0;
+
+   for (int i = 1; i < argc; i++) {
+      if (strcmp(argv[i], "--json") == 0)
+         json = 1;
+      else if (!sql)
+         sql = argv[i];
+      else {
+         print_command_usage("query");
+         return EXIT_FAILURE;
+      }
+   }
+   if (!sql) {
+      print_command_usage("query");
+      return EXIT_FAILURE;
+   }
+
+   sqlite3_stmt* stmt;
+   const char* rest;
+   if (sqlite3_prepare_v2(db->conn, sql, -1, &stmt, &rest) != SQLITE_OK) {
+      fprintf(stderr, "query: %s\n", sqlite3_errmsg(db->conn));
+      return EXIT_FAILURE;
+   }
+   while (*rest && (isspace((unsigned char)*rest) || *rest == ';'))
+      rest++;
+   if (!stmt || *rest) {
+      fprintf(stderr, "query: expected exactly one statement\n");
+      sqlite3_finalize(stmt);
+      return EXIT_FAILURE;
+   }
+   if (!sqlite3_stmt_readonly(stmt)) {
+      fprintf(stderr, "query: only read-only statements are allowed\n");
+      sqlite3_finalize(stmt);
+      return EXIT_FAILURE;
+   }
+
+   int cols = sqlite3_column_count(stmt);
+   if (json) {
+      putchar('[');
+   } else {
+      for (int c = 0; c < cols; c++) {
+         const char* name = sqlite3_column_name(stmt, c);
+         if (c)
+            putchar('\t');
+         write_tsv_field(stdout, name, (int)strlen(name));
+      }
+      putchar('\n');
+   }
+
+   int rc;
+   size_t rows = 0;
+   while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+      if (json)
+         fputs(rows ? ",{" : "{", stdout);
+      for (int c = 0; c < cols; c++) {
+         if (json) {
+            const char* name = sqlite3_column_name(stmt, c);
+            if (c)
+               putchar(',');
+            write_json_string(stdout, name, (int)strlen(name));
+            putchar(':');
+         } else if (c) {
+            putchar('\t');
+         }
+         print_query_value(stmt, c, json);
+      }
+      putchar(json ? '}' : '\n');
+      rows++;
+   }
+   if (json)
+      puts("]");
+
+   int ok = rc == SQLITE_DONE;
+   if (!ok)
+      fprintf(stderr, "query: %s\n", sqlite3_errmsg(db->conn));
+   sqlite3_finalize(stmt);
+   return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static int cmd_dedupe(FlashDb* db, int argc, char** argv) {
+   int merge = 0;
+   int dry_run = 0;
+   for (int i = 1; i < argc; i++) {
+      if (strcmp(argv[i], "--merge") == 0) {
+         merge = 1;
+      } else if (strcmp(argv[i], "--dry-run") == 0) {
+         dry_run = 1;
+      } else {
+         print_command_usage("dedupe");
+         return EXIT_FAILURE;
+      }
+   }
+
+   DedupeStats stats;
+   if (!dedupe_cards(db, merge, dry_run, &stats))
+      return EXIT_FAILURE;
+   printf("%s %zu duplicate cards of %zu (%zu fronts, %zu backs merged) in %.2f s\n",
+          dry_run ? "Would remove" : "Removed", stats.removed, stats.cards, stats.groups,
+          stats.merged, stats.seconds);
+   return EXIT_SUCCESS;
+}
+
+typedef struct {
+   int tty;                  // show a percentage on one line of stderr
+   int percent;              // last shown, -1 before the first
+   char dest[PATH_MAX];
+} BackupReport;
+
+static int report_backup_progress(const BackupProgress* progress, void* data) {
+   BackupReport* report = data;
+   snprintf(report->dest, sizeof(report->dest), "%s", progress->dest);
+   if (report->tty && progress->pages > 0) {
+      int percent = (int)(100LL * (progress->pages - progress->remaining) / progress->pages);
+      if (percent != report->percent) {
+         fprintf(stderr, "\r%3d%% of %d pages", percent, progress->pages);
+         report->percent = percent;
+      }
+   }
+   return 1;
+}
+
+static int list_snapshots(FlashDb* db) {
+   char dir[PATH_MAX];
+   BackupList list;
+   if (!backup_dir(db, dir, sizeof(dir)) || !list_backups(db, &list)) {
+      fprintf(stderr, "backup: cannot read the backup directory\n");
+      return EXIT_FAILURE;
+   }
+   for (size_t i = 0; i < list.count; i++) {
+      char path[PATH_MAX];
+      struct stat st;
+      if (snprintf(path, sizeof(path), "%s/%s", dir, list.items[i]) < (int)sizeof(path)
+          && stat(path, &st) == 0)
+         printf("%s\t%.1f MiB\n", list.items[i], st.st_size / (1024.0 * 1024.0));
+   }
+   fprintf(stderr, "%zu snapshot(s) in %s\n", list.count, dir);
+   free_backup_list(&list);
+   return EXIT_SUCCESS;
+}
+
+static int cmd_backup(FlashDb* db, int argc, char** argv) {
+   const char* dest = NULL;
+   for (int i = 1; i < argc; i++) {
+      if (strcmp(argv[i], "--list") == 0 && argc == 2) {
+         return list_snapshots(db);
+      } else if (!dest && argv[i][0] != '-') {
+         dest = argv[i];
+      } else {
+         print_command_usage("backup");
+         return EXIT_FAILURE;
+      }
+   }
+
+   struct timespec start, end;
+   BackupReport report = { .tty = isatty(STDERR_FILENO), .percent = -1 };
+   clock_gettime(CLOCK_MONOTONIC, &start);
+   int ok = backup_database(db, dest, report_backup_progress, &report);
+   clock_gettime(CLOCK_MONOTONIC, &end);
+   if (report.percent >= 0)
+      fputc('\n', stderr);
+   if (!ok)
+      return EXIT_FAILURE;
+
+   double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+   printf("%s\n", report.dest);
+   fprintf(stderr, "Backed up in %.2f s\n", seconds);
+   return EXIT_SUCCESS;
+}
+
+static int cmd_restore(FlashDb* db, int argc, char** argv) {
+   if (argc != 2) {
+      print_command_usage("restore");
+      return EXIT_FAILURE;
+   }
+
+   BackupReport report = { .tty = isatty(STDERR_FILENO), .percent = -1 };
+   int ok = restore_backup(db, argv[1], report_backup_progress, &report);
+   if (report.percent >= 0)
+      fputc('\n', stderr);
+   if (!ok)
+      return EXIT_FAILURE;
+   fprintf(stderr, "Restored %s\n", argv[1]);
+   return EXIT_SUCCESS;
+}
@@ -0,0 +1,1169 @@
+#define _GNU_SOURCE  // accept4, pipe2
+#include "../include/daemon.h"
+#include "../include/protocol.h"
+#include "../include/db.h"
+#include "../include/writer.h"
+#include "../include/scheduler.h"
+#include "../include/search.h"
+#include "../include/review_log.h"
+#include "../include/dedupe.h"
+#include "../include/backup.h"
+#include "../include/trace.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define CACHE_BUCKETS 4096                 // a power of two
+#define CACHE_MAX_ENTRY (DAEMON_CACHE_BYTES / 4)
+#define READ_CHUNK 65536
+#define READ_PER_WAKEUP (1u << 20)         // bytes read from one client before serving others
+
+// What a cached reply depends on
+#define TAG_NONE (-2)                      // not cached
+#define TAG_DECK_NAMES (-1)                // which decks exist
+#define TAG_ALL 0                          // any card of any deck
+                                           // > 0: the cards of that deck
+
+// A reply is kept whole, header included, so a hit is one copy into the
+// client's output. Entries are not removed when a write makes them stale: each
+// remembers the generation of what it depends on, and a lookup that finds an
+// older one drops it then.
+typedef struct CacheEntry {
+   struct CacheEntry* next;                // bucket chain
+   struct CacheEntry* newer;               // LRU list
+   struct CacheEntry* older;
+   uint64_t hash;
+   int tag;
+   unsigned gen;
+   unsigned epoch;
+   uint8_t* key;                           // request op and payload
+   size_t key_len;
+   uint8_t* reply;
+   size_t reply_len;
+} CacheEntry;
+
+typedef struct {
+   CacheEntry* buckets[CACHE_BUCKETS];
+   CacheEntry* newest;
+   CacheEntry* oldest;
+   size_t bytes;
+   size_t count;
+   unsigned* deck_gen;                     // by deck id, bumped when a card of the deck changes
+   size_t deck_gen_len;
+   unsigned all_gen;                       // bumped when any card changes
+   unsigned epoch;                         // bumped when a deck is created or deleted
+   unsigned long long hits;
+   unsigned long long misses;
+   unsigned long long evictions;
+} ReplyCache;
+
+typedef struct {
+   int fd;                                 // -1 once closed, removed at the end of the round
+   int hello;                              // HELLO accepted
+   int events;                             // wants PROTO_EVENT_INVALIDATE
+   int wrote;                              // queued a write since errors were last taken
+   ProtoBuf in;                            // bytes read, in_used of them served
+   size_t in_used;
+   ProtoBuf out;                           // frames to send, out_sent of them sent
+   size_t out_sent;
+   int told[DAEMON_INVALIDATE_DEDUP];      // decks announced since its last request
+   size_t told_count;
+   int told_all;
+} Client;
+
+typedef struct {
+   unsigned long long requests;
+   unsigned long long serve_ns;
+   unsigned long long max_serve_ns;
+   unsigned long long accepted;
+   unsigned long long rejected;            // connections closed unserved at DAEMON_MAX_CLIENTS
+   unsigned long long accept_pauses;       // times the listen socket was set aside
+   size_t peak_clients;
+   unsigned long long events;
+   unsigned long long write_rounds;        // rounds that ended with a commit of queued writes
+   unsigned long long write_errors;
+} DaemonStats;
+
+struct Daemon {
+   FlashDb* db;
+   int listen_fd;
+   unsigned long long accept_paused_until; // listen_fd is not polled before then, 0: it is
+   int wake[2];                            // daemon_stop writes to wake[1]
+   char path[sizeof(((struct sockaddr_un*)0)->sun_path)];
+   Client** clients;
+   size_t count;
+   size_t capacity;
+   ReplyCache cache;
+   int serving;                            // messages go into the reply, not stderr
+   ProtoBuf messages;                      // reported while serving, for the reply
+   int message_count;
+   ProtoBuf body;                          // the reply's own fields
+   ProtoBuf frame;
+   Deck deck;                              // reused by PROTO_DECK_CARDS
+   SearchResults search;                   // reused by PROTO_SEARCH
+   sqlite3_stmt* data_version;             // PRAGMA data_version, moves on commits by other connections
+   int last_version;
+   Backup* backup;
+   unsigned long long next_backup_check;
+   DaemonStats stats;
+};
+
+// Reply cache
+
+static uint64_t hash_key(uint8_t op, const uint8_t* data, size_t len) {
+   uint64_t h = 14695981039346656037ULL ^ op;
+   h *= 1099511628211ULL;
+   for (size_t i = 0; i < len; i++) {
+      h ^= data[i];
+      h *= 1099511628211ULL;
+   }
+   return h;
+}
+
+static unsigned deck_gen(const ReplyCache* cache, int deck_id) {
+   return (size_t)deck_id < cache->deck_gen_len ? cache->deck_gen[deck_id] : 0;
+}
+
+static unsigned tag_gen(const ReplyCache* cache, int tag) {
+   return tag > 0 ? deck_gen(cache, tag) : tag == TAG_ALL ? cache->all_gen : 0;
+}
+
+static void lru_unlink(ReplyCache* cache, CacheEntry* e) {
+   if (e->newer) e->newer->older = e->older;
+   else cache->newest = e->older;
+   if (e->older) e->older->newer = e->newer;
+   else cache->oldest = e->newer;
+   e->newer = e->older = NULL;
+}
+
+static void lru_push(ReplyCache* cache, CacheEntry* e) {
+   e->older = cache->newest;
+   e->newer = NULL;
+   if (cache->newest) cache->newest->newer = e;
+   cache->newest = e;
+   if (!cache->oldest) cache->oldest = e;
+}
+
+static size_t entry_bytes(const CacheEntry* e) {
+   return sizeof(*e) + e->key_len + e->reply_len;
+}
+
+static void cache_remove(ReplyCache* cache, CacheEntry* e) {
+   CacheEntry** link = &cache->buckets[e->hash & (CACHE_BUCKETS - 1)];
+   while (*link != e)
+      link = &(*link)->next;
+   *link = e->next;
+   lru_unlink(cache, e);
+   cache->bytes -= entry_bytes(e);
+   cache->count--;
+   free(e->key);
+   free(e->reply);
+   free(e);
+}
+
+static CacheEntry* cache_find(ReplyCache* cache, uint8_t op, const uint8_t* payload, size_t len) {
+   uint64_t h = hash_key(op, payload, len);
+   CacheEntry* e = cache->buckets[h & (CACHE_BUCKETS - 1)];
+   while (e && !(e->hash == h && e->key_len == len + 1 && e->key[0] == op &&
+                 memcmp(e->key + 1, payload, len) == 0))
+      e = e->next;
+   if (!e) {
+      cache->misses++;
+      return NULL;
+   }
+   if (e->epoch != cache->epoch || e->gen != tag_gen(cache, e->tag)) {
+      cache_remove(cache, e);
+      cache->misses++;
+      return NULL;
+   }
+   lru_unlink(cache, e);
+   lru_push(cache, e);
+   cache->hits++;
+   return e;
+}
+
+static void cache_insert(ReplyCache* cache, uint8_t op, const uint8_t* payload, size_t len,
+                         const ProtoBuf* reply, int tag) {
+   if (reply->len > CACHE_MAX_ENTRY)
+      return;
+   CacheEntry* e = calloc(1, sizeof(*e));
+   if (!e)
+      return;
+   e->key = malloc(len + 1);
+   e->reply = malloc(reply->len);
+   if (!e->key || !e->reply) {
+      free(e->key);
+      free(e->reply);
+      free(e);
+      return;
+   }
+   e->key[0] = op;
+   memcpy(e->key + 1, payload, len);
+   e->key_len = len + 1;
+   memcpy(e->reply, reply->data, reply->len);
+   e->reply_len = reply->len;
+   e->hash = hash_key(op, payload, len);
+   e->tag = tag;
+   e->gen = tag_gen(cache, tag);
+   e->epoch = cache->epoch;
+
+   while (cache->oldest && cache->bytes + entry_bytes(e) > DAEMON_CACHE_BYTES) {
+      cache_remove(cache, cache->oldest);
+      cache->evictions++;
+   }
+   CacheEntry** bucket = &cache->buckets[e->hash & (CACHE_BUCKETS - 1)];
+   e->next = *bucket;
+   *bucket = e;
+   lru_push(cache, e);
+   cache->bytes += entry_bytes(e);
+   cache->count++;
+}
+
+// A card of deck_id changed (0: of a deck we were not told)
+static void cache_card_changed(ReplyCache* cache, int deck_id) {
+   cache->all_gen++;
+   if (deck_id <= 0) {
+      cache->epoch++;
+      return;
+   }
+   if ((size_t)deck_id >= cache->deck_gen_len) {
+      size_t len = cache->deck_gen_len ? cache->deck_gen_len : 64;
+      while (len <= (size_t)deck_id)
+         len *= 2;
+      unsigned* gen = realloc(cache->deck_gen, len * sizeof(*gen));
+      if (!gen) { // every deck's entries go instead
+         cache->epoch++;
+         return;
+      }
+      memset(gen + cache->deck_gen_len, 0, (len - cache->deck_gen_len) * sizeof(*gen));
+      cache->deck_gen = gen;
+      cache->deck_gen_len = len;
+   }
+   cache->deck_gen[deck_id]++;
+}
+
+static void cache_decks_changed(ReplyCache* cache) {
+   cache->all_gen++;
+   cache->epoch++;
+}
+
+static void cache_free(ReplyCache* cache) {
+   while (cache->oldest)
+      cache_remove(cache, cache->oldest);
+   free(cache->deck_gen);
+   cache->deck_gen = NULL;
+   cache->deck_gen_len = 0;
+}
+
+// Clients
+
+static void close_client(Client* c) {
+   if (c->fd >= 0)
+      close(c->fd);
+   c->fd = -1;
+}
+
+static void free_client(Client* c) {
+   close_client(c);
+   proto_free(&c->in);
+   proto_free(&c->out);
+   free(c);
+}
+
+static void queue_frame(Client* c, const ProtoBuf* frame) {
+   proto_put_bytes(&c->out, frame->data, frame->len);
+   if (c->out.failed)
+      close_client(c);
+}
+
+static void flush_client(Client* c) {
+   while (c->fd >= 0 && c->out_sent < c->out.len) {
+      ssize_t n = send(c->fd, c->out.data + c->out_sent, c->out.len - c->out_sent,
+                       MSG_NOSIGNAL | MSG_DONTWAIT);
+      if (n > 0) {
+         c->out_sent += n;
+      } else if (n < 0 && errno == EINTR) {
+         continue;
+      } else {
+         if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+            close_client(c);
+         break;
+      }
+   }
+   if (c->out_sent == c->out.len) {
+      c->out.len = 0;
+      c->out_sent = 0;
+   } else if (c->out_sent > c->out.len / 2) {
+      memmove(c->out.data, c->out.data + c->out_sent, c->out.len - c->out_sent);
+      c->out.len -= c->out_sent;
+      c->out_sent = 0;
+   }
+}
+
+static size_t queued(const Client* c) {
+   return c->out.len - c->out_sent;
+}
+
+// Tell a client a deck changed, once per deck until it sends another request,
+// so one that is not reading gets a bounded number of events
+static void tell(Daemon* d, Client* c, int deck_id) {
+   if (c->fd < 0 || !c->events || c->told_all)
+      return;
+   for (size_t i = 0; i < c->told_count; i++) {
+      if (c->told[i] == deck_id)
+         return;
+   }
+   if (deck_id < 0 || c->told_count == DAEMON_INVALIDATE_DEDUP) {
+      deck_id = -1;
+      c->told_all = 1;
+   } else {
+      c->told[c->told_count++] = deck_id;
+   }
+   proto_begin(&d->frame, PROTO_EVENT_INVALIDATE, PROTO_OK);
+   proto_put_i32(&d->frame, deck_id);
+   if (proto_end(&d->frame)) {
+      queue_frame(c, &d->frame);
+      d->stats.events++;
+   }
+}
+
+static void tell_others(Daemon* d, Client* from, int deck_id) {
+   for (size_t i = 0; i < d->count; i++) {
+      if (d->clients[i] != from)
+         tell(d, d->clients[i], deck_id);
+   }
+}
+
+static void card_changed(Daemon* d, Client* c, int deck_id) {
+   cache_card_changed(&d->cache, deck_id);
+   tell_others(d, c, deck_id > 0 ? deck_id : -1);
+   if (d->db->writer)
+      c->wrote = 1;
+}
+
+static void deck_changed(Daemon* d, Client* c, int deck_id) {
+   cache_decks_changed(&d->cache);
+   tell_others(d, c, deck_id);
+}
+
+// Data layer messages raised while serving a request travel back with its reply
+static void capture_message(DbMessageLevel level, const char* message, void* data) {
+   Daemon* d = data;
+   if (!d->serving) {
+      fprintf(stderr, "flash-cardsd: %s\n", message);
+      return;
+   }
+   if (d->message_count == UINT8_MAX)
+      return;
+   proto_put_u8(&d->messages, (uint8_t)level);
+   proto_put_str(&d->messages, message);
+   d->message_count++;
+}
+
+// Requests
+
+// Room for a count that is only known after the rows, filled in by patch_count
+static size_t reserve_count(ProtoBuf* body) {
+   size_t at = body->len;
+   proto_put_u32(body, 0);
+   return at;
+}
+
+static void patch_count(ProtoBuf* body, size_t at, uint32_t count) {
+   if (body->failed)
+      return;
+   for (int i = 0; i < 4; i++)
+      body->data[at + i] = (uint8_t)(count >> (8 * i));
+}
+
+static int copy_name(char* buf, size_t size, ProtoReader* in) {
+   snprintf(buf, size, "%s", proto_get_str(in, NULL));
+   return !in->failed;
+}
+
+static int serve_deck_page(Daemon* d, ProtoReader* in) {
+   FlashDb* db = d->db;
+   ProtoBuf* out = &d->body;
+   int deck_id = proto_get_i32(in);
+   int first = proto_get_i32(in);
+   int last = proto_get_i32(in);
+   if (in->failed)
+      return TAG_NONE;
+
+   writer_flush(db);
+   sqlite3_stmt* stmt = db_stmt_acquire(db, STMT_DECK_PAGE);
+   if (!stmt) {
+      proto_put_u8(out, 0);
+      proto_put_u32(out, 0);
+      return TAG_NONE;
+   }
+   sqlite3_bind_int(stmt, 1, deck_id);
+   sqlite3_bind_int(stmt, 2, first);
+   sqlite3_bind_int(stmt, 3, last);
+
+   size_t ok_at = out->len;
+   proto_put_u8(out, 1);
+   size_t count_at = reserve_count(out);
+   uint32_t count = 0;
+   int rc;
+   while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+      proto_put_i32(out, sqlite3_column_int(stmt, 0));
+      proto_put_strn(out, (const char*)sqlite3_column_text(stmt, 1), sqlite3_column_bytes(stmt, 1));
+      proto_put_strn(out, (const char*)sqlite3_column_text(stmt, 2), sqlite3_column_bytes(stmt, 2));
+      count++;
+   }
+   db_stmt_release(db, STMT_DECK_PAGE);
+   patch_count(out, count_at, count);
+   if (rc != SQLITE_DONE) {
+      out->data[ok_at] = 0;
+      return TAG_NONE;
+   }
+   return deck_id;
+}
+
+static int serve_card_text(Daemon* d, ProtoReader* in) {
+   FlashDb* db = d->db;
+   ProtoBuf* out = &d->body;
+   int card_id = proto_get_i32(in);
+   if (in->failed)
+      return TAG_NONE;
+
+   writer_flush(db);
+   sqlite3_stmt* stmt = db_stmt_acquire(db, STMT_CARD_TEXT);
+   if (!stmt) {
+      proto_put_u8(out, 0);
+      return TAG_NONE;
+   }
+   sqlite3_bind_int(stmt, 1, card_id);
+   int tag = TAG_ALL;   // a card that is not there yet may be added to any deck
+   if (sqlite3_step(stmt) == SQLITE_ROW) {
+      tag = sqlite3_column_int(stmt, 0);
+      proto_put_u8(out, 1);
+      proto_put_i32(out, tag);
+      proto_put_strn(out, (const char*)sqlite3_column_text(stmt, 1), sqlite3_column_bytes(stmt, 1));
+      proto_put_strn(out, (const char*)sqlite3_column_text(stmt, 2), sqlite3_column_bytes(stmt, 2));
+   } else {
+      proto_put_u8(out, 0);
+   }
+   db_stmt_release(db, STMT_CARD_TEXT);
+   return tag;
+}
+
+static int serve_log_reviews(Daemon* d, Client* c, ProtoReader* in) {
+   ReviewLog log = {0};
+   int ok = 1;
+   uint32_t count = proto_get_u32(in);
+   for (uint32_t i = 0; i < count && !in->failed; i++) {
+      ReviewEntry* entry = &log.pending[log.count++];
+      entry->card_id = proto_get_i32(in);
+      entry->deck_id = proto_get_i32(in);
+      entry->reviewed_at = (time_t)proto_get_i64(in);
+      entry->correct = proto_get_u8(in);
+      entry->response_ms = proto_get_i32(in);
+      if (log.count == REVIEW_LOG_BATCH && !in->failed)
+         ok &= review_log_flush(d->db, &log);
+   }
+   if (in->failed)
+      return TAG_NONE;
+   ok &= review_log_flush(d->db, &log);
+   if (d->db->writer)
+      c->wrote = 1;
+   proto_put_u8(&d->body, (uint8_t)ok);
+   return TAG_NONE;
+}
+
+// Run one request against the database, its fields going to d->body. Returns
+// what the reply depends on, for the cache.
+static int serve_request(Daemon* d, Client* c, uint8_t op, ProtoReader* in) {
+   FlashDb* db = d->db;
+   ProtoBuf* out = &d->body;
+   char name[MAX_BUFFER];
+   time_t now;
+
+   switch ((ProtoOp)op) {
+      case PROTO_DECK_LIST: {
+         DeckInfoList list;
+         load_deck_list(db, &list);
+         proto_put_u32(out, (uint32_t)list.count);
+         for (size_t i = 0; i < list.count; i++) {
+            proto_put_i32(out, list.items[i].id);
+            proto_put_str(out, list.items[i].name);
+            proto_put_i32(out, list.items[i].card_count);
+         }
+         free_deck_list(&list);
+         return TAG_ALL;
+      }
+      case PROTO_DECK_STATS: {
+         DeckStatsList list;
+         now = (time_t)proto_get_i64(in);
+         proto_put_u8(out, (uint8_t)load_deck_stats(db, now, &list));
+         proto_put_u32(out, (uint32_t)list.count);
+         for (size_t i = 0; i < list.count; i++) {
+            proto_put_i32(out, list.items[i].id);
+            proto_put_str(out, list.items[i].name);
+            proto_put_i32(out, list.items[i].cards);
+            proto_put_i32(out, list.items[i].due);
+            proto_put_i32(out, list.items[i].reviewed);
+         }
+         free_deck_stats(&list);
+         return TAG_NONE;
+      }
+      case PROTO_REVIEW_STATS: {
+         DeckReviewStatsList list;
+         now = (time_t)proto_get_i64(in);
+         proto_put_u8(out, (uint8_t)load_review_stats(db, now, &list));
+         proto_put_u32(out, (uint32_t)list.count);
+         for (size_t i = 0; i < list.count; i++) {
+            const DeckReviewStats* s = &list.items[i];
+            proto_put_i32(out, s->id);
+            proto_put_str(out, s->name);
+            proto_put_i32(out, s->cards);
+            proto_put_i32(out, s->reviews);
+            proto_put_i32(out, s->correct);
+            proto_put_i64(out, s->response_ms);
+            proto_put_i32(out, s->streak);
+            proto_put_i32(out, s->best_streak);
+            proto_put_i32(out, s->day_streak);
+            proto_put_i64(out, s->last_review);
+         }
+         free_review_stats(&list);
+         return TAG_NONE;
+      }
+      case PROTO_DECK_EXISTS: {
+         int deck_id = 0;
+         int found = deck_exists(db, proto_get_str(in, NULL), &deck_id);
+         proto_put_u8(out, (uint8_t)found);
+         proto_put_i32(out, deck_id);
+         return TAG_DECK_NAMES;
+      }
+      case PROTO_CREATE_DECK: {
+         if (!copy_name(name, sizeof(name), in))
+            return TAG_NONE;
+         int ok = create_deck(db, name);
+         if (ok)
+            deck_changed(d, c, 0);
+         proto_put_u8(out, (uint8_t)ok);
+         return TAG_NONE;
+      }
+      case PROTO_DELETE_DECK: {
+         int deck_id = proto_get_i32(in);
+         if (in->failed)
+            return TAG_NONE;
+         int ok = delete_deck_by_id(db, deck_id);
+         if (ok)
+            deck_changed(d, c, deck_id);
+         proto_put_u8(out, (uint8_t)ok);
+         return TAG_NONE;
+      }
+      case PROTO_DELETE_DECK_NAME: {
+         int deck_id = -1;
+         if (!copy_name(name, sizeof(name), in))
+            return TAG_NONE;
+         deck_exists(db, name, &deck_id);
+         int ok = delete_deck_by_name(db, name);
+         if (ok)
+            deck_changed(d, c, deck_id);
+         proto_put_u8(out, (uint8_t)ok);
+         return TAG_NONE;
+      }
+      case PROTO_DECK_CARDS: {
+         int deck_id = proto_get_i32(in);
+         load_deck_cards(db, deck_id, &d->deck);
+         proto_put_u8(out, d->deck.deck_name != NULL);
+         if (d->deck.deck_name) {
+            proto_put_str(out, d->deck.deck_name);
+            proto_put_u32(out, (uint32_t)d->deck.count);
+            for (size_t i = 0; i < d->deck.count; i++)
+               proto_put_i32(out, d->deck.ids[i]);
+         }
+         return d->deck.stale ? TAG_NONE : deck_id;
+      }
+      case PROTO_DECK_PAGE:
+         return serve_deck_page(d, in);
+      case PROTO_CARD_TEXT:
+         return serve_card_text(d, in);
+      case PROTO_ADD_CARD: {
+         int deck_id = proto_get_i32(in);
+         const char* front = proto_get_str(in, NULL);
+         const char* back = proto_get_str(in, NULL);
+         if (in->failed)
+            return TAG_NONE;
+         int card_id = add_card(db, NULL, deck_id, front, back);
+         if (card_id)
+            card_changed(d, c, deck_id);
+         proto_put_i32(out, card_id);
+         return TAG_NONE;
+      }
+      case PROTO_UPDATE_CARD: {
+         int deck_id = proto_get_i32(in);
+         int card_id = proto_get_i32(in);
+         const char* front = proto_get_str(in, NULL);
+         const char* back = proto_get_str(in, NULL);
+         if (in->failed)
+            return TAG_NONE;
+         int ok = update_card(db, NULL, card_id, front, back);
+         card_changed(d, c, deck_id);
+         proto_put_u8(out, (uint8_t)ok);
+         return TAG_NONE;
+      }
+      case PROTO_DELETE_CARD: {
+         int deck_id = proto_get_i32(in);
+         int card_id = proto_get_i32(in);
+         if (in->failed)
+            return TAG_NONE;
+         int ok = delete_card_by_id(db, NULL, card_id);
+         card_changed(d, c, deck_id);
+         proto_put_u8(out, (uint8_t)ok);
+         return TAG_NONE;
+      }
+      case PROTO_FIND_DUPLICATE: {
+         int deck_id = proto_get_i32(in);
+         const char* front = proto_get_str(in, NULL);
+         long long hash = proto_get_i64(in);
+         Cards card;
+         if (in->failed)
+            return TAG_NONE;
+         int found = find_duplicate_card(db, deck_id, front, hash, &card);
+         proto_put_u8(out, (uint8_t)found);
+         if (found) {
+            proto_put_i32(out, card.id);
+            proto_put_str(out, card.front);
+            proto_put_str(out, card.back);
+            free(card.front);
+            free(card.back);
+         }
+         return deck_id;
+      }
+      case PROTO_SEARCH: {
+         const char* text = proto_get_str(in, NULL);
+         int limit = proto_get_i32(in);
+         int offset = proto_get_i32(in);
+         if (in->failed || limit < 1 || limit > 10 * SEARCH_PAGE_SIZE || offset < 0)
+            return TAG_NONE;
+         int ok = search_cards(db, text, limit, offset, &d->search);
+         proto_put_u8(out, (uint8_t)ok);
+         proto_put_u8(out, (uint8_t)d->search.has_more);
+         proto_put_u32(out, (uint32_t)d->search.count);
+         for (size_t i = 0; i < d->search.count; i++) {
+            const SearchResult* r = &d->search.items[i];
+            proto_put_i32(out, r->card_id);
+            proto_put_i32(out, r->deck_id);
+            proto_put_str(out, r->deck_name);
+            proto_put_str(out, r->front);
+            proto_put_str(out, r->back);
+         }
+         return ok ? TAG_ALL : TAG_NONE;
+      }
+      case PROTO_STUDY_LOAD: {
+         int deck_id = proto_get_i32(in);
+         now = (time_t)proto_get_i64(in);
+         if (in->failed)
+            return TAG_NONE;
+         StudyQueue queue = {0};
+         proto_put_u8(out, (uint8_t)load_due_cards(db, deck_id, now, &queue));
+         proto_put_u32(out, (uint32_t)queue.count);
+         for (size_t i = 0; i < queue.count; i++) {
+            const StudyCard* card = &queue.items[i];
+            proto_put_i32(out, card->card_id);
+            proto_put_i64(out, card->sched.due);
+            proto_put_f64(out, card->sched.interval);
+            proto_put_f64(out, card->sched.ease);
+            proto_put_i32(out, card->sched.reps);
+            proto_put_i32(out, card->sched.lapses);
+         }
+         free(queue.items);
+         return TAG_NONE;
+      }
+      case PROTO_SAVE_SCHEDULE: {
+         int card_id = proto_get_i32(in);
+         Schedule sched = {
+            .due = (time_t)proto_get_i64(in),
+            .interval = proto_get_f64(in),
+            .ease = proto_get_f64(in),
+            .reps = proto_get_i32(in),
+            .lapses = proto_get_i32(in)
+         };
+         if (in->failed)
+            return TAG_NONE;
+         int ok = 1;
+         if (db->writer) { // joins the other clients' writes in the next group commit
+            WriteRequest req = { .op = WRITE_SAVE_SCHEDULE, .card_id = card_id, .sched = sched };
+            writer_submit(db, &req);
+            c->wrote = 1;
+         } else {
+            ok = save_schedule(db, card_id, &sched);
+         }
+         proto_put_u8(out, (uint8_t)ok);
+         return TAG_NONE;
+      }
+      case PROTO_LOG_REVIEWS:
+         return serve_log_reviews(d, c, in);
+      default:
+         in->failed = 1;
+         return TAG_NONE;
+   }
+}
+
+static int cacheable(uint8_t op) {
+   switch (op) {
+      case PROTO_DECK_LIST:
+      case PROTO_DECK_EXISTS:
+      case PROTO_DECK_CARDS:
+      case PROTO_DECK_PAGE:
+      case PROTO_CARD_TEXT:
+      case PROTO_FIND_DUPLICATE:
+      case PROTO_SEARCH:
+         return 1;
+      default:
+         return 0;
+   }
+}
+
+static void reply_failed(Daemon* d, Client* c, uint8_t op, const char* reason) {
+   proto_begin(&d->frame, op, PROTO_FAILED);
+   proto_put_str(&d->frame, reason);
+   if (proto_end(&d->frame))
+      queue_frame(c, &d->frame);
+}
+
+static void serve_hello(Daemon* d, Client* c, ProtoReader* in) {
+   uint32_t version = proto_get_u32(in);
+   uint8_t flags = proto_get_u8(in);
+   if (in->failed || version != PROTO_VERSION) {
+      char reason[MAX_BUFFER];
+      snprintf(reason, sizeof(reason), "flash-cardsd speaks protocol version %d", PROTO_VERSION);
+      reply_failed(d, c, PROTO_HELLO, reason);
+      return;
+   }
+   c->hello = 1;
+   c->events = (flags & PROTO_WANT_EVENTS) != 0;
+   proto_begin(&d->frame, PROTO_HELLO, PROTO_OK);
+   proto_put_u8(&d->frame, 0);
+   proto_put_u32(&d->frame, PROTO_VERSION);
+   if (proto_end(&d->frame))
+      queue_frame(c, &d->frame);
+}
+
+static void serve(Daemon* d, Client* c, uint8_t op, const uint8_t* payload, size_t len) {
+   TRACE_SCOPE(TRACE_DAEMON_REQUEST);
+   unsigned long long start = trace_now_ns();
+   ProtoReader in = { .pos = payload, .left = len };
+   c->told_count = 0;
+   c->told_all = 0;
+
+   if (op == PROTO_HELLO) {
+      serve_hello(d, c, &in);
+      return;
+   }
+   if (!c->hello) {
+      reply_failed(d, c, op, "Expected HELLO");
+      close_client(c);
+      return;
+   }
+
+   CacheEntry* hit = cacheable(op) ? cache_find(&d->cache, op, payload, len) : NULL;
+   if (hit) {
+      proto_put_bytes(&c->out, hit->reply, hit->reply_len);
+   } else {
+      d->body.len = 0;
+      d->body.failed = 0;
+      d->messages.len = 0;
+      d->messages.failed = 0;
+      d->message_count = 0;
+      d->serving = 1;
+      int tag = serve_request(d, c, op, &in);
+      d->serving = 0;
+
+      if (in.failed) {
+         reply_failed(d, c, op, "Malformed request");
+      } else {
+         proto_begin(&d->frame, op, PROTO_OK);
+         proto_put_u8(&d->frame, (uint8_t)d->message_count);
+         proto_put_bytes(&d->frame, d->messages.data, d->messages.len);
+         proto_put_bytes(&d->frame, d->body.data, d->body.len);
+         if (d->messages.failed || d->body.failed || !proto_end(&d->frame)) {
+            reply_failed(d, c, op, "Reply too large");
+         } else {
+            queue_frame(c, &d->frame);
+            // A reply that reported something is not replayed to someone else
+            if (tag != TAG_NONE && d->message_count == 0 && cacheable(op))
+               cache_insert(&d->cache, op, payload, len, &d->frame, tag);
+         }
+      }
+   }
+
+   unsigned long long took = trace_now_ns() - start;
+   d->stats.requests++;
+   d->stats.serve_ns += took;
+   if (took > d->stats.max_serve_ns)
+      d->stats.max_serve_ns = took;
+}
+
+// Serve every whole frame read so far, unless the client is not reading its replies
+static void serve_buffered(Daemon* d, Client* c) {
+   while (c->fd >= 0 && queued(c) < DAEMON_OUT_LIMIT && c->in.len - c->in_used >= PROTO_HEADER_SIZE) {
+      const uint8_t* frame = c->in.data + c->in_used;
+      uint32_t len;
+      uint8_t op, status;
+      proto_read_header(frame, &len, &op, &status);
+      if (len > PROTO_MAX_PAYLOAD) {
+         close_client(c);
+         return;
+      }
+      if (c->in.len - c->in_used < PROTO_HEADER_SIZE + (size_t)len)
+         break;
+      c->in_used += PROTO_HEADER_SIZE + len;
+      serve(d, c, op, frame + PROTO_HEADER_SIZE, len);
+   }
+   if (c->in_used == c->in.len) {
+      c->in.len = 0;
+      c->in_used = 0;
+   } else if (c->in_used > 0) {
+      memmove(c->in.data, c->in.data + c->in_used, c->in.len - c->in_used);
+      c->in.len -= c->in_used;
+      c->in_used = 0;
+   }
+}
+
+static void read_client(Daemon* d, Client* c) {
+   uint8_t chunk[READ_CHUNK];
+   size_t total = 0;
+   while (c->fd >= 0 && total < READ_PER_WAKEUP) {
+      ssize_t n = recv(c->fd, chunk, sizeof(chunk), MSG_DONTWAIT);
+      if (n > 0) {
+         proto_put_bytes(&c->in, chunk, (size_t)n);
+         if (c->in.failed)
+            close_client(c);
+         total += n;
+      } else if (n < 0 && errno == EINTR) {
+         continue;
+      } else {
+         if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+            close_client(c);
+         break;
+      }
+   }
+   serve_buffered(d, c);
+}
+
+// Stop polling the listen socket for a while. A connection it cannot take stays
+// readable, so polling it would wake the loop at once every round.
+static void pause_accepting(Daemon* d) {
+   d->accept_paused_until = trace_now_ns() + DAEMON_ACCEPT_RETRY_MS * 1000000ULL;
+   d->stats.accept_pauses++;
+}
+
+static void accept_clients(Daemon* d) {
+   while (1) {
+      int fd = accept4(d->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+      if (fd < 0) {
+         if (errno == EINTR)
+            continue;
+         // Out of descriptors or memory: retry later, or once a client leaves
+         if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM)
+            pause_accepting(d);
+         return;
+      }
+      // Full: the TUIs waiting are turned away (they open the file themselves)
+      // and the rest of the backlog waits until a client leaves
+      if (d->count >= DAEMON_MAX_CLIENTS) {
+         close(fd);
+         d->stats.rejected++;
+         pause_accepting(d);
+         return;
+      }
+      Client* c = calloc(1, sizeof(*c));
+      if (!c) {
+         close(fd);
+         pause_accepting(d);
+         return;
+      }
+      if (d->count == d->capacity) {
+         size_t capacity = d->capacity ? d->capacity * 2 : 16;
+         Client** clients = realloc(d->clients, capacity * sizeof(*clients));
+         if (!clients) {
+            close(fd);
+            free(c);
+            pause_accepting(d);
+            return;
+         }
+         d->clients = clients;
+         d->capacity = capacity;
+      }
+      c->fd = fd;
+      d->clients[d->count++] = c;
+      d->stats.accepted++;
+      if (d->count > d->stats.peak_clients)
+         d->stats.peak_clients = d->count;
+   }
+}
+
+static int data_version(Daemon* d) {
+   int version = d->last_version;
+   if (d->data_version && sqlite3_step(d->data_version) == SQLITE_ROW)
+      version = sqlite3_column_int(d->data_version, 0);
+   sqlite3_reset(d->data_version);
+   return version;
+}
+
+// A commit neither the daemon nor its writer made, e.g. by a flash-cards
+// command run meanwhile, may have changed anything the cache holds
+static void check_outside_writes(Daemon* d) {
+   int version = data_version(d);
+   if (version == d->last_version)
+      return;
+   d->last_version = version;
+   cache_decks_changed(&d->cache);
+   tell_others(d, NULL, -1);
+}
+
+// Writes queued this round are committed together, and the clients that made
+// them are told if any failed
+static void finish_writes(Daemon* d) {
+   int wrote = 0;
+   for (size_t i = 0; i < d->count; i++)
+      wrote |= d->clients[i]->wrote;
+   if (!wrote)
+      return;
+
+   writer_flush(d->db);
+   d->last_version = data_version(d);  // the writer's commits are not someone else's
+   unsigned long failed = writer_take_errors(d->db);
+   d->stats.write_rounds++;
+   d->stats.write_errors += failed;
+   for (size_t i = 0; i < d->count; i++) {
+      Client* c = d->clients[i];
+      if (!c->wrote)
+         continue;
+      c->wrote = 0;
+      if (failed == 0 || c->fd < 0)
+         continue;
+      proto_begin(&d->frame, PROTO_EVENT_WRITE_ERRORS, PROTO_OK);
+      proto_put_u32(&d->frame, (uint32_t)failed);
+      if (proto_end(&d->frame))
+         queue_frame(c, &d->frame);
+   }
+}
+
+static void check_backup(Daemon* d) {
+   if (d->backup) {
+      BackupProgress progress;
+      backup_poll(d->backup, &progress);
+      if (progress.done) {
+         backup_finish(d->backup, 0);
+         d->backup = NULL;
+      }
+      return;
+   }
+   unsigned long long now = trace_now_ns();
+   if (now < d->next_backup_check)
+      return;
+   d->next_backup_check = now + DAEMON_BACKUP_CHECK_MS * 1000000ULL;
+   if (backup_due(d->db, time(NULL)))
+      d->backup = backup_start(d->db, NULL);
+}
+
+static int listen_socket(const char* path) {
+   struct sockaddr_un addr = { .sun_family = AF_UNIX };
+   if (strlen(path) >= sizeof(addr.sun_path)) {
+      fprintf(stderr, "flash-cardsd: socket path too long: %s\n", path);
+      return -1;
+   }
+   snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+
+   int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+   if (fd < 0) {
+      perror("flash-cardsd: socket");
+      return -1;
+   }
+   // Only the owner may connect; the socket carries every card
+   mode_t old_mask = umask(0077);
+   int rc = bind(fd, (struct sockaddr*)&addr, sizeof(addr));
+   if (rc != 0 && errno == EADDRINUSE) {
+      // A socket nobody answers on was left behind by a daemon that died
+      int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+      int live = probe >= 0 && connect(probe, (struct sockaddr*)&addr, sizeof(addr)) == 0;
+      if (probe >= 0)
+         close(probe);
+      if (live) {
+         umask(old_mask);
+         fprintf(stderr, "flash-cardsd: already running on %s\n", path);
+         close(fd);
+         return -1;
+      }
+      unlink(path);
+      rc = bind(fd, (struct sockaddr*)&addr, sizeof(addr));
+   }
+   umask(old_mask);
+   if (rc != 0 || listen(fd, 64) != 0) {
+      fprintf(stderr, "flash-cardsd: cannot listen on %s: %s\n", path, strerror(errno));
+      close(fd);
+      return -1;
+   }
+   return fd;
+}
+
+Daemon* daemon_start(FlashDb* db, const char* path) {
+   Daemon* d = calloc(1, sizeof(*d));
+   if (!d) {
+      fprintf(stderr, "flash-cardsd: out of memory\n");
+      return NULL;
+   }
+   d->db = db;
+   d->wake[0] = d->wake[1] = -1;
+   snprintf(d->path, sizeof(d->path), "%s", path);
+   if (pipe2(d->wake, O_NONBLOCK | O_CLOEXEC) != 0) {
+      perror("flash-cardsd: pipe");
+      free(d);
+      return NULL;
+   }
+   if ((d->listen_fd = listen_socket(path)) < 0) {
+      close(d->wake[0]);
+      close(d->wake[1]);
+      free(d);
+      return NULL;
+   }
+   if (sqlite3_prepare_v2(db->conn, "PRAGMA data_version;", -1, &d->data_version, NULL) == SQLITE_OK)
+      d->last_version = data_version(d);
+   db_set_message_sink(db, capture_message, d);
+   return d;
+}
+
+int daemon_run(Daemon* d) {
+   trace_set_thread_name("daemon");
+   struct pollfd* fds = NULL;
+   size_t fds_capacity = 0;
+   int ok = 1;
+
+   while (1) {
+      size_t n = 2 + d->count;
+      if (n > fds_capacity) {
+         struct pollfd* grown = realloc(fds, n * sizeof(*fds));
+         if (!grown) {
+            ok = 0;
+            break;
+         }
+         fds = grown;
+         fds_capacity = n;
+      }
+      fds[0] = (struct pollfd){ .fd = d->wake[0], .events = POLLIN };
+      int timeout = d->backup ? 250 : DAEMON_BACKUP_CHECK_MS;
+      if (d->accept_paused_until) {
+         unsigned long long now = trace_now_ns();
+         if (now >= d->accept_paused_until) {
+            d->accept_paused_until = 0;
+         } else {
+            int left = (int)((d->accept_paused_until - now) / 1000000ULL) + 1;
+            if (left < timeout)
+               timeout = left;
+         }
+      }
+      // A negative fd is skipped by poll
+      fds[1] = (struct pollfd){ .fd = d->accept_paused_until ? -1 : d->listen_fd, .events = POLLIN };
+      for (size_t i = 0; i < d->count; i++) {
+         Client* c = d->clients[i];
+         fds[2 + i] = (struct pollfd){
+            .fd = c->fd,
+            .events = (queued(c) ? POLLOUT : 0) | (queued(c) < DAEMON_OUT_LIMIT ? POLLIN : 0)
+         };
+      }
+
+      int rc = poll(fds, n, timeout);
+      if (rc < 0 && errno != EINTR) {
+         perror("flash-cardsd: poll");
+         ok = 0;
+         break;
+      }
+      if (rc > 0 && fds[0].revents)
+         break;
+      check_outside_writes(d);
+
+      // Clients accepted now are not in fds yet, they are polled next round
+      size_t polled = n - 2;
+      for (size_t i = 0; rc > 0 && i < polled; i++) {
+         Client* c = d->clients[i];
+         short revents = fds[2 + i].revents;
+         if (revents & POLLOUT) {
+            flush_client(c);
+            serve_buffered(d, c);
+         }
+         if (revents & (POLLIN | POLLHUP | POLLERR))
+            read_client(d, c);
+      }
+      if (rc > 0 && (fds[1].revents & POLLIN))
+         accept_clients(d);
+
+      // Requests held back while a client's replies piled up are served as soon
+      // as it has read them, or it may wait for a reply that is never sent
+      for (size_t i = 0; i < d->count; i++) {
+         flush_client(d->clients[i]);
+         serve_buffered(d, d->clients[i]);
+      }
+      finish_writes(d);
+      size_t kept = 0;
+      for (size_t i = 0; i < d->count; i++) {
+         Client* c = d->clients[i];
+         flush_client(c);
+         if (c->fd < 0) {
+            free_client(c);
+            d->accept_paused_until = 0;  // a descriptor and a slot are free again
+         } else
+            d->clients[kept++] = c;
+      }
+      d->count = kept;
+      check_backup(d);
+   }
+   free(fds);
+   return ok;
+}
+
+void daemon_stop(Daemon* d) {
+   char byte = 1;
+   ssize_t n = write(d->wake[1], &byte, 1);
+   (void)n;
+}
+
+void daemon_free(Daemon* d) {
+   if (!d)
+      return;
+   backup_finish(d->backup, 1);
+   for (size_t i = 0; i < d->count; i++)
+      free_client(d->clients[i]);
+   free(d->clients);
+   close(d->listen_fd);
+   unlink(d->path);
+   close(d->wake[0]);
+   close(d->wake[1]);
+   cache_free(&d->cache);
+   sqlite3_finalize(d->data_version);
+   proto_free(&d->messages);
+   proto_free(&d->body);
+   proto_free(&d->frame);
+   free_deck_cards(&d->deck);
+   free_search_results(&d->search);
+   db_set_message_sink(d->db, NULL, NULL);
+   free(d);
+}
+
+void daemon_print_stats(Daemon* d, FILE* out) {
+   const DaemonStats* s = &d->stats;
+   const ReplyCache* cache = &d->cache;
+   unsigned long long lookups = cache->hits + cache->misses;
+   fprintf(out, "daemon: %llu requests from %llu clients (peak %zu at once), avg %.3f ms, max %.3f ms\n",
+           s->requests, s->accepted, s->peak_clients,
+           s->requests ? s->serve_ns / 1e6 / s->requests : 0.0, s->max_serve_ns / 1e6);
+   fprintf(out, "daemon cache: %llu hits, %llu misses (%.1f%% hit rate), %llu evicted, "
+           "%zu replies in %.1f MiB\n",
+           cache->hits, cache->misses, lookups ? 100.0 * cache->hits / lookups : 0.0,
+           cache->evictions, cache->count, cache->bytes / 1048576.0);
+   fprintf(out, "daemon: %llu invalidations sent, %llu rounds of writes committed, %llu writes failed\n",
+           s->events, s->write_rounds, s->write_errors);
+   if (s->rejected || s->accept_pauses)
+      fprintf(out, "daemon: %llu clients turned away when full, accepting paused %llu times\n",
+              s->rejected, s->accept_pauses);
+}
@@ -0,0 +1,79 @@
+// flash-cardsd: owns the database and serves every flash-cards TUI started
+// while it runs, see daemon.h
+#include "../include/daemon.h"
+#include "../include/db.h"
+#include "../include/writer.h"
+#include "../include/protocol.h"
+#include "../include/trace.h"
+
+#include <linux/limits.h>
+#include <signal.h>
+
+FlashDb* db;
+static Daemon* server;
+
+static void on_signal(int sig) {
+   (void)sig;
+   daemon_stop(server);
+}
+
+static void usage(void) {
+   fprintf(stderr, "Usage: flash-cardsd [--socket PATH] [--stats]\n");
+   fprintf(stderr, "  --socket PATH  listen on PATH instead of $FLASH_CARDS_SOCKET or ~/tui-cards/%s\n",
+           PROTO_SOCKET_NAME);
+   fprintf(stderr, "  --stats        print request, cache and writer counters on exit\n");
+}
+
+int main(int argc, char** argv) {
+   char path[PATH_MAX];
+   const char* socket_path = NULL;
+   int stats = getenv("FLASH_CARDS_STATS") != NULL;
+   for (int i = 1; i < argc; i++) {
+      if (strcmp(argv[i], "--socket") == 0 && i + 1 < argc) {
+         socket_path = argv[++i];
+      } else if (strcmp(argv[i], "--stats") == 0) {
+         stats = 1;
+      } else {
+         usage();
+         return EXIT_FAILURE;
+      }
+   }
+   if (!socket_path) {
+      if (!proto_socket_path(path, sizeof(path))) {
+         fprintf(stderr, "flash-cardsd: could not determine the socket path\n");
+         return EXIT_FAILURE;
+      }
+      socket_path = path;
+   }
+   if (stats)
+      trace_init(TRACE_STATS, NULL);
+
+   setup_database(&db);
+   // Writes from every client are committed in groups off the serving thread
+   if (!writer_start(db))
+      fprintf(stderr, "flash-cardsd: background writer unavailable, writing inline\n");
+
+   if (!(server = daemon_start(db, socket_path))) {
+      writer_stop(db);
+      close_database(db);
+      return EXIT_FAILURE;
+   }
+   struct sigaction sa = { .sa_handler = on_signal };
+   sigemptyset(&sa.sa_mask);
+   sigaction(SIGINT, &sa, NULL);
+   sigaction(SIGTERM, &sa, NULL);
+   fprintf(stderr, "flash-cardsd: listening on %s\n", socket_path);
+
+   int ok = daemon_run(server);
+   if (stats) {
+      daemon_print_stats(server, stderr);
+      db_print_stmt_stats(db, stderr);
+      writer_print_stats(db, stderr);
+      trace_print_report(stderr);
+   }
+   daemon_free(server);
+   writer_stop(db);
+   trace_finish();
+   close_database(db);
+   return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -1,15 +1,18 @@
 #include "../include/db.h"
-#include "../include/tui.h"
+#include "../include/migrate.h"
+#include "../include/dedupe.h"
+#include "../include/writer.h"
+#include "../include/remote.h"
+#include "../include/trace.h"
 
 #include <linux/limits.h>
 #include <sys/stat.h>
-#include <unistd.h>
 #include <errno.h>
 
 #define DB_RELATIVE_PATH "tui-cards/flashcards.db"
+#define CONFIG_RELATIVE_PATH "tui-cards/flash-cards.conf"
 
-void setup_database(sqlite3 **db) {
-   char* err_msg = 0;
+void setup_database(FlashDb** out) {
    const char* home = getenv("HOME");
    if (!home) {
       fprintf(stderr, "Could not determine $HOME\n");
@@ -19,62 +22,70 @@ void setup_database(sqlite3 **db) {
    char db_path[PATH_MAX];
    snprintf(db_path, sizeof(db_path), "%s/%s", home, DB_RELATIVE_PATH);
 
-   char dir_path[PATH_MAX];
-   snprintf(dir_path, sizeof(dir_path), "%s/tui-cards", home);
+   FlashDb* db = calloc(1, sizeof(FlashDb));
+   if (!db) {
+      fprintf(stderr, "Out of memory\n");
+      exit(EXIT_FAILURE);
+   }
 
-   if (access(dir_path, F_OK) != 0) {
+   // Bad settings are reported and left at their defaults, the app still starts
+   char config_path[PATH_MAX];
+   snprintf(config_path, sizeof(config_path), "%s/%s", home, CONFIG_RELATIVE_PATH);
+   db_default_config(&db->config);
+   db_load_config(&db->config, config_path);
+
+   // Only the first run has to create ~/tui-cards and the file, later ones open it directly
+   int rc = sqlite3_open_v2(db_path, &db->conn, SQLITE_OPEN_READWRITE, NULL);
+   if (rc == SQLITE_CANTOPEN) {
+      sqlite3_close(db->conn);
+      char dir_path[PATH_MAX];
+      snprintf(dir_path, sizeof(dir_path), "%s/tui-cards", home);
       if (mkdir(dir_path, 0755) != 0 && errno != EEXIST) {
          perror("Failed to create ~/tui-cards directory");
          exit(EXIT_FAILURE);
       }
+      rc = sqlite3_open_v2(db_path, &db->conn, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, NULL);
    }
-
-   int rc = sqlite3_open(db_path, db);
    if (rc != SQLITE_OK) {
-      fprintf(stderr, "Unable to open database: %s\n", sqlite3_errmsg(*db));
+      fprintf(stderr, "Unable to open database: %s\n", sqlite3_errmsg(db->conn));
       exit(EXIT_FAILURE);
    }
-   sqlite3_exec(*db, "PRAGMA foreign_keys = ON;", 0, 0, 0);
-
-   const char *sql =
-        "CREATE TABLE IF NOT EXISTS decks ("
-        "id INTEGER PRIMARY KEY AUTOINCREMENT, "
-        "name TEXT NOT NULL UNIQUE);"
-
-        "CREATE TABLE IF NOT EXISTS cards ("
-        "id INTEGER PRIMARY KEY AUTOINCREMENT, "
-        "deck_id INTEGER, "
-        "front TEXT NOT NULL, "
-        "back TEXT NOT NULL, "
-        "FOREIGN KEY(deck_id) REFERENCES decks(id) ON DELETE CASCADE);";
-
-   if (sqlite3_exec(*db, sql, 0, 0, &err_msg) != SQLITE_OK) {
-      fprintf(stderr, "SQL Error: %s\n", err_msg);
-      sqlite3_free(err_msg);
-      sqlite3_close(*db);
+   // WAL: readers are not blocked by a commit in progress, and a commit appends instead of
+   // rewriting pages through a rollback journal. It is stored in the file, so this only
+   // changes anything on a new database.
+   sqlite3_exec(db->conn, "PRAGMA foreign_keys = ON; PRAGMA journal_mode = WAL;", 0, 0, 0);
+   sqlite3_busy_timeout(db->conn, DB_BUSY_TIMEOUT_MS);
+   db_apply_config(db);
+   register_card_hash(db->conn);
+
+   // Creates or upgrades the schema in place; a current one costs a single
+   // user_version read and no DDL
+   if (!run_migrations(db->conn)) {
+      close_database(db);
       exit(EXIT_FAILURE);
    }
+   *out = db;
 }
 
-void load_deck_list(sqlite3* db, DeckInfoList* list) {
-    const char* sql =
-        "SELECT d.id, d.name, COUNT(c.id) AS card_count "
-        "FROM decks d "
-        "LEFT JOIN cards c ON d.id = c.deck_id "
-        "GROUP BY d.id "
-        "ORDER BY d.name ASC;";
-
-    sqlite3_stmt* stmt;
-    int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
-    if (rc != SQLITE_OK) {
-        //fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(db));
+void load_deck_list(FlashDb* db, DeckInfoList* list) {
+    TRACE_SCOPE(TRACE_LOAD_DECK_LIST);
+    if (db->remote) {
+        remote_load_deck_list(db, list);
+        return;
+    }
+    writer_flush(db);  // card counts must include queued cards
+    sqlite3_stmt* stmt = db_stmt_acquire(db, STMT_DECK_LIST);
+    if (!stmt) {
+        //fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(db->conn));
         return;
     }
+    int rc;
 
     // Zero out list
     list->items = NULL;
     list->count = 0;
     list->capacity = 0;
+    list->arena = (Arena){0};
 
     while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
         int id = sqlite3_column_int(stmt, 0);
@@ -85,277 +96,646 @@ void load_deck_list(sqlite3* db, DeckInfoList* list) {
 
         DeckInfo info = {
             .id = id,
-            .name = strdup((const char*)name_text),
+            .name = arena_strndup(&list->arena, (const char*)name_text, sqlite3_column_bytes(stmt, 1)),
             .card_count = card_count
         };
 
         da_append(list, info);
     }
 
-    sqlite3_finalize(stmt);
+    db_stmt_release(db, STMT_DECK_LIST);
+}
+
+int check_deck_counts(FlashDb* db, int repair, FILE* out) {
+   TRACE_SCOPE(TRACE_CHECK_DECK_COUNTS);
+   // Runs rarely, so the statements are not worth caching
+   const char* check_sql =
+      "SELECT d.id, d.name, d.card_count, "
+      "(SELECT COUNT(*) FROM cards c WHERE c.deck_id = d.id) AS actual "
+      "FROM decks d WHERE d.card_count != actual;";
+   const char* repair_sql =
+      "UPDATE decks SET card_count = (SELECT COUNT(*) FROM cards c WHERE c.deck_id = decks.id) "
+      "WHERE card_count != (SELECT COUNT(*) FROM cards c WHERE c.deck_id = decks.id);";
+
+   writer_flush(db);
+   sqlite3_stmt* stmt;
+   if (sqlite3_prepare_v2(db->conn, check_sql, -1, &stmt, NULL) != SQLITE_OK)
+      return -1;
+
+   int mismatches = 0;
+   while (sqlite3_step(stmt) == SQLITE_ROW) {
+      if (out) {
+         fprintf(out, "deck %d '%s': stored %d, actual %d\n",
+                 sqlite3_column_int(stmt, 0),
+                 (const char*)sqlite3_column_text(stmt, 1),
+                 sqlite3_column_int(stmt, 2),
+                 sqlite3_column_int(stmt, 3));
+      }
+      mismatches++;
+   }
+   sqlite3_finalize(stmt);
+
+   if (repair && mismatches > 0 && sqlite3_exec(db->conn, repair_sql, 0, 0, 0) != SQLITE_OK)
+      return -1;
+   return mismatches;
 }
 
 void free_deck_list(DeckInfoList* list) {
-    for (int i = 0; i < list->count; ++i) {
-        free(list->items[i].name);  // Free the strdup'd name
-    }
+    arena_free(&list->arena);  // Every name lives in the arena
     free(list->items);  // Free the array itself
     list->items = NULL;
     list->count = 0;
     list->capacity = 0;
 }
 
-void load_deck_cards(sqlite3* db, int deck_id, Deck* deck) {
-   // Clear any memory before rewriting
-   free(deck->deck_name);
-   for (size_t i = 0; i < deck->count; ++i) {
-      free(deck->items[i].front);
-      free(deck->items[i].back);
+int load_deck_stats(FlashDb* db, time_t now, DeckStatsList* list) {
+   TRACE_SCOPE(TRACE_LOAD_DECK_STATS);
+   if (db->remote)
+      return remote_load_deck_stats(db, now, list);
+   // Runs rarely, so the statement is not worth caching
+   const char* stats_sql =
+      "SELECT d.id, d.name, d.card_count, "
+      "COUNT(c.id) - COUNT(s.card_id) + COALESCE(SUM(s.due <= ?), 0), "
+      "COUNT(s.card_id) "
+      "FROM decks d "
+      "LEFT JOIN cards c ON c.deck_id = d.id "
+      "LEFT JOIN card_schedule s ON s.card_id = c.id "
+      "GROUP BY d.id ORDER BY d.name ASC;";
+
+   list->items = NULL;
+   list->count = 0;
+   list->capacity = 0;
+   list->arena = (Arena){0};
+
+   writer_flush(db);
+   sqlite3_stmt* stmt;
+   if (sqlite3_prepare_v2(db->conn, stats_sql, -1, &stmt, NULL) != SQLITE_OK)
+      return 0;
+   sqlite3_bind_int64(stmt, 1, (sqlite3_int64)now);
+
+   int rc;
+   while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+      DeckStats stats = {
+         .id = sqlite3_column_int(stmt, 0),
+         .name = arena_strndup(&list->arena, (const char*)sqlite3_column_text(stmt, 1),
+                               sqlite3_column_bytes(stmt, 1)),
+         .cards = sqlite3_column_int(stmt, 2),
+         .due = sqlite3_column_int(stmt, 3),
+         .reviewed = sqlite3_column_int(stmt, 4)
+      };
+      da_append(list, stats);
    }
-   free(deck->items);
+   sqlite3_finalize(stmt);
+   return rc == SQLITE_DONE;
+}
+
+void free_deck_stats(DeckStatsList* list) {
+   arena_free(&list->arena);
+   free(list->items);
+   list->items = NULL;
+   list->count = 0;
+   list->capacity = 0;
+}
+
+// Forget every cached page; the slots keep their arena blocks for reuse
+static void deck_drop_pages(Deck* deck, size_t from_page) {
+   for (int i = 0; i < DECK_CACHE_PAGES; i++) {
+      DeckPage* page = &deck->pages[i];
+      if (page->last_used && page->page >= from_page) {
+         page->last_used = 0;
+         arena_reset(&page->arena);
+      }
+   }
+}
+
+static int deck_push_id(Deck* deck, int card_id) {
+   if (deck->count == deck->capacity) {
+      size_t capacity = deck->capacity ? deck->capacity * 2 : 256;
+      int* ids = realloc(deck->ids, capacity * sizeof(*ids));
+      if (!ids)
+         return 0;
+      deck->ids = ids;
+      deck->capacity = capacity;
+   }
+   deck->ids[deck->count++] = card_id;
+   return 1;
+}
+
+void load_deck_cards(FlashDb* db, int deck_id, Deck* deck) {
+   TRACE_SCOPE(TRACE_LOAD_DECK_CARDS);
+   // Drop the old name and pages, the id array and arena blocks are reused
+   arena_reset(&deck->arena);
+   deck_drop_pages(deck, 0);
    deck->deck_name = NULL;
-   deck->items = NULL;
+   deck->deck_id = deck_id;
+   deck->stale = 0;
    deck->count = 0;
-   deck->capacity = 0;
+   deck->db = db;
+   if (db->remote) {
+      remote_load_deck_cards(db, deck_id, deck);
+      return;
+   }
+   writer_flush(db);
 
    char status_msg[MAX_BUFFER] = {0};
 
    // Get deck name
-   sqlite3_stmt* name_stmt;
-   const char* name_sql = "SELECT name FROM decks WHERE id = ?";
-   if (sqlite3_prepare_v2(db, name_sql, -1, &name_stmt, 0) != SQLITE_OK) {
-      snprintf(status_msg, sizeof(status_msg), "Failed to prepare name statement: %s", sqlite3_errmsg(db));
-      perrorw(status_msg);
+   sqlite3_stmt* name_stmt = db_stmt_acquire(db, STMT_DECK_NAME);
+   if (!name_stmt) {
+      snprintf(status_msg, sizeof(status_msg), "Failed to prepare name statement: %s", sqlite3_errmsg(db->conn));
+      db_report(db, DB_MSG_ERROR, status_msg);
       return;
    }
 
    sqlite3_bind_int(name_stmt, 1, deck_id);
    if (sqlite3_step(name_stmt) == SQLITE_ROW) {
       const unsigned char* name = sqlite3_column_text(name_stmt, 0);
-      deck->deck_name = strdup((const char*)name);
+      deck->deck_name = arena_strdup(&deck->arena, (const char*)name);
    } else {
       snprintf(status_msg, sizeof(status_msg), "Deck ID %d not found", deck_id);
-      perrorw(status_msg);
-      sqlite3_finalize(name_stmt);
+      db_report(db, DB_MSG_ERROR, status_msg);
+      db_stmt_release(db, STMT_DECK_NAME);
       return;
    }
-   sqlite3_finalize(name_stmt);
-
-   // Get cards
-   sqlite3_stmt* stmt;
-   const char* sql = "SELECT id, front, back FROM cards WHERE deck_id = ?";
+   db_stmt_release(db, STMT_DECK_NAME);
 
-   if (sqlite3_prepare_v2(db, sql, -1, &stmt, 0) != SQLITE_OK) {
-      snprintf(status_msg, sizeof(status_msg), "Failed to prepare card statement: %s", sqlite3_errmsg(db));
-      perrorw(status_msg);
+   // Get card ids, the text comes later one page at a time
+   sqlite3_stmt* stmt = db_stmt_acquire(db, STMT_DECK_CARD_IDS);
+   if (!stmt) {
+      snprintf(status_msg, sizeof(status_msg), "Failed to prepare card statement: %s", sqlite3_errmsg(db->conn));
+      db_report(db, DB_MSG_ERROR, status_msg);
       return;
    }
 
    sqlite3_bind_int(stmt, 1, deck_id);
-   
    while (sqlite3_step(stmt) == SQLITE_ROW) {
-      int id = sqlite3_column_int(stmt, 0);
-      const unsigned char* front = sqlite3_column_text(stmt, 1);
-      const unsigned char* back = sqlite3_column_text(stmt, 2);
+      if (!deck_push_id(deck, sqlite3_column_int(stmt, 0))) {
+         deck->stale = 1;
+         break;
+      }
+   }
 
-      Cards card = {
-         .id = id,
-         .deck_id = deck_id,
-         .study_flag = 0,
-         .front = strdup((const char*)front),
-         .back = strdup((const char*)back)
-      };
-      da_append(deck, card);
+   db_stmt_release(db, STMT_DECK_CARD_IDS);
+}
+
+// Read the text of one page by id range (keyset), so the cost does not depend
+// on how far into the deck the page is
+static int deck_fetch_page(Deck* deck, DeckPage* page, size_t page_no) {
+   FlashDb* db = deck->db;
+   size_t first = page_no * DECK_PAGE_SIZE;
+   size_t end = first + DECK_PAGE_SIZE < deck->count ? first + DECK_PAGE_SIZE : deck->count;
+
+   arena_reset(&page->arena);
+   page->page = page_no;
+   page->count = 0;
+
+   if (db->remote) {
+      int ok = remote_deck_page(db, deck->deck_id, &deck->ids[first], end - first, page->cards,
+                                &page->arena, &deck->stale);
+      page->count = end - first;
+      return ok;
    }
 
-   sqlite3_finalize(stmt);
+   writer_flush(db);  // queued edits must be visible
+   sqlite3_stmt* stmt = db_stmt_acquire(db, STMT_DECK_PAGE);
+   if (!stmt)
+      return 0;
+   sqlite3_bind_int(stmt, 1, deck->deck_id);
+   sqlite3_bind_int(stmt, 2, deck->ids[first]);
+   sqlite3_bind_int(stmt, 3, deck->ids[end - 1]);
+
+   // Rows and ids are both in id order; an id without a row was deleted
+   // elsewhere, a row without an id was added elsewhere
+   int rc = sqlite3_step(stmt);
+   for (size_t i = first; i < end; i++) {
+      int id = deck->ids[i];
+      while (rc == SQLITE_ROW && sqlite3_column_int(stmt, 0) < id) {
+         deck->stale = 1;
+         rc = sqlite3_step(stmt);
+      }
+
+      Cards card = { .id = id, .deck_id = deck->deck_id, .front = "", .back = "" };
+      if (rc == SQLITE_ROW && sqlite3_column_int(stmt, 0) == id) {
+         card.front = arena_strndup(&page->arena, (const char*)sqlite3_column_text(stmt, 1),
+                                    sqlite3_column_bytes(stmt, 1));
+         card.back = arena_strndup(&page->arena, (const char*)sqlite3_column_text(stmt, 2),
+                                   sqlite3_column_bytes(stmt, 2));
+         rc = sqlite3_step(stmt);
+      } else {
+         deck->stale = 1;
+      }
+      page->cards[page->count++] = card;
+   }
+   db_stmt_release(db, STMT_DECK_PAGE);
+   return rc == SQLITE_ROW || rc == SQLITE_DONE;
 }
 
-void reset_study_flags(Deck* deck) {
-   for (size_t i = 0; i < deck->count; i++) {
-      deck->items[i].study_flag = 0;
+static DeckPage* deck_cached_page(Deck* deck, size_t page_no) {
+   for (int i = 0; i < DECK_CACHE_PAGES; i++) {
+      if (deck->pages[i].last_used && deck->pages[i].page == page_no)
+         return &deck->pages[i];
+   }
+   return NULL;
+}
+
+const Cards* deck_card(Deck* deck, size_t index) {
+   if (index >= deck->count)
+      return NULL;
+   size_t page_no = index / DECK_PAGE_SIZE;
+
+   // Another client changed the deck: its text is read again, and the ids are
+   // reloaded at the next menu
+   if (remote_deck_changed(deck->db, deck->deck_id)) {
+      deck_drop_pages(deck, 0);
+      deck->stale = 1;
+   }
+
+   DeckPage* page = deck_cached_page(deck, page_no);
+   if (!page) {
+      // Take an empty slot, else the least recently used one
+      page = &deck->pages[0];
+      for (int i = 1; i < DECK_CACHE_PAGES && page->last_used; i++) {
+         if (deck->pages[i].last_used < page->last_used)
+            page = &deck->pages[i];
+      }
+      if (!deck_fetch_page(deck, page, page_no)) {
+         page->last_used = 0;
+         return NULL;
+      }
+   }
+
+   page->last_used = ++deck->tick;
+   return &page->cards[index % DECK_PAGE_SIZE];
+}
+
+int deck_find_card(const Deck* deck, int card_id) {
+   size_t lo = 0;
+   size_t hi = deck->count;
+   while (lo < hi) {
+      size_t mid = lo + (hi - lo) / 2;
+      int id = deck->ids[mid];
+      if (id == card_id)
+         return (int)mid;
+      if (id < card_id)
+         lo = mid + 1;
+      else
+         hi = mid;
+   }
+   return -1;
+}
+
+// Later cards move down one ordinal, so every page from the removed card on is dropped
+static void deck_remove_card(Deck* deck, int card_id) {
+   int index = deck_find_card(deck, card_id);
+   if (index >= 0) {
+      memmove(&deck->ids[index], &deck->ids[index + 1],
+              (deck->count - index - 1) * sizeof(*deck->ids));
+      deck->count--;
+      deck_drop_pages(deck, index / DECK_PAGE_SIZE);
+   }
+}
+
+static void deck_replace_card_text(Deck* deck, int card_id, const char* front, const char* back) {
+   int index = deck_find_card(deck, card_id);
+   DeckPage* page = index >= 0 ? deck_cached_page(deck, index / DECK_PAGE_SIZE) : NULL;
+   if (page) {
+      // The old text stays in the page arena until the page is dropped
+      Cards* card = &page->cards[index % DECK_PAGE_SIZE];
+      card->front = arena_strdup(&page->arena, front);
+      card->back = arena_strdup(&page->arena, back);
    }
 }
 
 void free_deck_cards(Deck* deck) {
-   free(deck->deck_name);
-   for (size_t i = 0; i < deck->count; i++) {
-      free(deck->items[i].front);
-      free(deck->items[i].back);
+   arena_free(&deck->arena);
+   for (int i = 0; i < DECK_CACHE_PAGES; i++) {
+      arena_free(&deck->pages[i].arena);
+      deck->pages[i].last_used = 0;
    }
-   free(deck->items);
+   free(deck->ids);
+   deck->deck_name = NULL;
+   deck->ids = NULL;
+   deck->count = 0;
+   deck->capacity = 0;
 }
 
-void create_deck(sqlite3 *db, char* deck_name) {
+int create_deck(FlashDb* db, char* deck_name) {
+   TRACE_SCOPE(TRACE_CREATE_DECK);
    remove_newline(deck_name);
+   if (db->remote)
+      return remote_create_deck(db, deck_name);
+   writer_flush(db);
 
    char status_msg[MAX_BUFFER] = {0};
-   sqlite3_stmt* stmt;
 
    if (deck_exists(db, deck_name, NULL)) { // return if deck already exists
       snprintf(status_msg, sizeof(status_msg), "Deck: '%s' already exists", deck_name); 
-      popup_message(stdscr, status_msg);
-      return;
+      db_report(db, DB_MSG_NOTICE, status_msg);
+      return 0;
    }
 
    // Insert new deck
-   const char *insert_sql = "INSERT INTO decks (name) VALUES (?);";
-   if (sqlite3_prepare_v2(db, insert_sql, -1, &stmt, 0) != SQLITE_OK) {
-      snprintf(status_msg, sizeof(status_msg), "Deck creation failed: '%s' - %s", deck_name, sqlite3_errmsg(db));
-      perrorw(status_msg);
-      return;
+   sqlite3_stmt* stmt = db_stmt_acquire(db, STMT_CREATE_DECK);
+   if (!stmt) {
+      snprintf(status_msg, sizeof(status_msg), "Deck creation failed: '%s' - %s", deck_name, sqlite3_errmsg(db->conn));
+      db_report(db, DB_MSG_ERROR, status_msg);
+      return 0;
    }
    sqlite3_bind_text(stmt, 1, deck_name, -1, SQLITE_STATIC);
 
-   if (sqlite3_step(stmt) == SQLITE_DONE) {
+   int ok = sqlite3_step(stmt) == SQLITE_DONE;
+   if (ok) {
       snprintf(status_msg, sizeof(status_msg), "Deck: '%s' created!", deck_name); 
-      popup_message(stdscr, status_msg);
+      db_report(db, DB_MSG_NOTICE, status_msg);
    } else {
-      snprintf(status_msg, sizeof(status_msg), "Deck creation failed: '%s' - %s", deck_name, sqlite3_errmsg(db));
-      perrorw(status_msg);
+      snprintf(status_msg, sizeof(status_msg), "Deck creation failed: '%s' - %s", deck_name, sqlite3_errmsg(db->conn));
+      db_report(db, DB_MSG_ERROR, status_msg);
    }
 
+   db_stmt_release(db, STMT_CREATE_DECK);
+   return ok;
+}
 
-   sqlite3_finalize(stmt);
+int get_or_create_deck(FlashDb* db, const char* deck_name, int* deck_id) {
+   if (deck_exists(db, deck_name, deck_id))
+      return 1;
+
+   sqlite3_stmt* stmt = db_stmt_acquire(db, STMT_CREATE_DECK);
+   if (!stmt)
+      return 0;
+
+   sqlite3_bind_text(stmt, 1, deck_name, -1, SQLITE_STATIC);
+   int ok = sqlite3_step(stmt) == SQLITE_DONE;
+   if (ok)
+      *deck_id = (int)sqlite3_last_insert_rowid(db->conn);
+
+   db_stmt_release(db, STMT_CREATE_DECK);
+   return ok;
 }
 
-void delete_deck_by_name(sqlite3* db, char* deck_name) {
+int delete_deck_by_name(FlashDb* db, char* deck_name) {
+   TRACE_SCOPE(TRACE_DELETE_DECK);
    remove_newline(deck_name);
+   if (db->remote)
+      return remote_delete_deck_by_name(db, deck_name);
+   writer_flush(db);  // queued cards of this deck go first, then the cascade removes them
 
    char status_msg[MAX_BUFFER] = {0};
-   sqlite3_stmt* stmt;
    int deck_id;
 
    if (!deck_exists(db, deck_name, &deck_id)) {
       snprintf(status_msg, sizeof(status_msg), "Deck: '%s' does not exist", deck_name);
-      popup_message(stdscr, status_msg);
-      return;
+      db_report(db, DB_MSG_NOTICE, status_msg);
+      return 0;
    }
 
    // Delete deck and cascade-delete cards
-   const char *delete_sql = "DELETE FROM decks WHERE id = ?;";
-   if (sqlite3_prepare_v2(db, delete_sql, -1, &stmt, 0) != SQLITE_OK) {
-      snprintf(status_msg, sizeof(status_msg), "Deck deletion failed: '%s' - %s", deck_name, sqlite3_errmsg(db));
-      perrorw(status_msg);
-      return;
+   sqlite3_stmt* stmt = db_stmt_acquire(db, STMT_DELETE_DECK);
+   if (!stmt) {
+      snprintf(status_msg, sizeof(status_msg), "Deck deletion failed: '%s' - %s", deck_name, sqlite3_errmsg(db->conn));
+      db_report(db, DB_MSG_ERROR, status_msg);
+      return 0;
    }
 
    sqlite3_bind_int(stmt, 1, deck_id);
-   if (sqlite3_step(stmt) == SQLITE_DONE) {
+   int ok = sqlite3_step(stmt) == SQLITE_DONE;
+   if (ok) {
       snprintf(status_msg, sizeof(status_msg), "Deck: '%s' and its cards have been deleted", deck_name);
-      popup_message(stdscr, status_msg);
+      db_report(db, DB_MSG_NOTICE, status_msg);
    } else {
-      snprintf(status_msg, sizeof(status_msg), "Deck deletion failed: '%s' - %s", deck_name, sqlite3_errmsg(db));
-      perrorw(status_msg);
+      snprintf(status_msg, sizeof(status_msg), "Deck deletion failed: '%s' - %s", deck_name, sqlite3_errmsg(db->conn));
+      db_report(db, DB_MSG_ERROR, status_msg);
    }
 
-   sqlite3_finalize(stmt);
+   db_stmt_release(db, STMT_DELETE_DECK);
+   return ok;
 }
 
-void delete_deck_by_id(sqlite3* db, int deck_id) {
+int delete_deck_by_id(FlashDb* db, int deck_id) {
+   TRACE_SCOPE(TRACE_DELETE_DECK);
+   if (db->remote)
+      return remote_delete_deck(db, deck_id);
    char status_msg[MAX_BUFFER] = {0};
-   sqlite3_stmt* stmt;
+   writer_flush(db);
 
-   const char *delete_sql = "DELETE FROM decks WHERE id = ?;";
-   if (sqlite3_prepare_v2(db, delete_sql, -1, &stmt, 0) != SQLITE_OK) {
-      snprintf(status_msg, sizeof(status_msg), "Deck deletion failed [id=%d]: %s", deck_id, sqlite3_errmsg(db));
-      perrorw(status_msg);
-      return;
+   sqlite3_stmt* stmt = db_stmt_acquire(db, STMT_DELETE_DECK);
+   if (!stmt) {
+      snprintf(status_msg, sizeof(status_msg), "Deck deletion failed [id=%d]: %s", deck_id, sqlite3_errmsg(db->conn));
+      db_report(db, DB_MSG_ERROR, status_msg);
+      return 0;
    }
 
    sqlite3_bind_int(stmt, 1, deck_id);
-   if (sqlite3_step(stmt) == SQLITE_DONE) {
+   int ok = sqlite3_step(stmt) == SQLITE_DONE;
+   if (ok) {
       snprintf(status_msg, sizeof(status_msg), "Deck [id=%d] and its cards have been deleted", deck_id);
-      popup_message(stdscr, status_msg);
+      db_report(db, DB_MSG_NOTICE, status_msg);
    } else {
-      snprintf(status_msg, sizeof(status_msg), "Deck deletion failed [id=%d]: %s", deck_id, sqlite3_errmsg(db));
-      perrorw(status_msg);
+      snprintf(status_msg, sizeof(status_msg), "Deck deletion failed [id=%d]: %s", deck_id, sqlite3_errmsg(db->conn));
+      db_report(db, DB_MSG_ERROR, status_msg);
    }
 
-   sqlite3_finalize(stmt);
+   db_stmt_release(db, STMT_DELETE_DECK);
+   return ok;
 }
 
-void add_card(sqlite3* db, int deck_id, const char* front, const char* back) {
+// Insert on this connection, returns the new card's id or 0
+static int insert_card(FlashDb* db, int deck_id, const char* front, const char* back) {
    char status_msg[MAX_BUFFER] = {0};
-   sqlite3_stmt* stmt;
 
-   const char *insert_sql = "INSERT INTO cards (deck_id, front, back) VALUES (?, ?, ?);";
-   if (sqlite3_prepare_v2(db, insert_sql, -1, &stmt, 0) != SQLITE_OK) {
-      snprintf(status_msg, sizeof(status_msg), "Prepare failed %s", sqlite3_errmsg(db));
-      perrorw(status_msg);
-      return;
+   sqlite3_stmt* stmt = db_stmt_acquire(db, STMT_ADD_CARD);
+   if (!stmt) {
+      snprintf(status_msg, sizeof(status_msg), "Prepare failed %s", sqlite3_errmsg(db->conn));
+      db_report(db, DB_MSG_ERROR, status_msg);
+      return 0;
    }
 
    sqlite3_bind_int(stmt, 1, deck_id);
    sqlite3_bind_text(stmt, 2, front, -1, SQLITE_STATIC);
    sqlite3_bind_text(stmt, 3, back, -1, SQLITE_STATIC);
 
-   if (sqlite3_step(stmt) != SQLITE_DONE) {
-      snprintf(status_msg, sizeof(status_msg), "Failed to insert card %s", sqlite3_errmsg(db));
-      perrorw(status_msg);
+   int card_id = 0;
+   if (sqlite3_step(stmt) == SQLITE_DONE) {
+      card_id = (int)sqlite3_last_insert_rowid(db->conn);
+   } else {
+      snprintf(status_msg, sizeof(status_msg), "Failed to insert card %s", sqlite3_errmsg(db->conn));
+      db_report(db, DB_MSG_ERROR, status_msg);
    }
+   db_stmt_release(db, STMT_ADD_CARD);
+   return card_id;
+}
 
-   sqlite3_finalize(stmt);
+// Queue the insert for the writer thread under an id reserved up front
+static int queue_card(FlashDb* db, int deck_id, const char* front, const char* back) {
+   int card_id = writer_reserve_card_id(db);
+   if (card_id == 0) {
+      db_report(db, DB_MSG_ERROR, "Failed to reserve a card id");
+      return 0;
+   }
+
+   WriteRequest req = {
+      .op = WRITE_ADD_CARD,
+      .card_id = card_id,
+      .deck_id = deck_id,
+      .front = strdup(front),
+      .back = strdup(back)
+   };
+   writer_submit(db, &req);
+   return card_id;
+}
+
+int add_card(FlashDb* db, Deck* deck, int deck_id, const char* front, const char* back) {
+   TRACE_SCOPE(TRACE_ADD_CARD);
+   int card_id = db->remote ? remote_add_card(db, deck_id, front, back)
+               : db->writer ? queue_card(db, deck_id, front, back)
+                            : insert_card(db, deck_id, front, back);
+   if (!deck || deck->deck_id != deck_id)
+      return card_id;
+   if (card_id == 0) {
+      deck->stale = 1;
+      return 0;
+   }
+
+   // Ids only grow, so appending keeps ids sorted
+   if ((deck->count > 0 && deck->ids[deck->count - 1] > card_id) || !deck_push_id(deck, card_id)) {
+      deck->stale = 1;
+      return card_id;
+   }
+
+   // A cached last page with room gets the card; otherwise it is fetched when shown
+   DeckPage* page = deck_cached_page(deck, (deck->count - 1) / DECK_PAGE_SIZE);
+   if (page && page->count == (deck->count - 1) % DECK_PAGE_SIZE) {
+      page->cards[page->count++] = (Cards){
+         .id = card_id,
+         .deck_id = deck_id,
+         .front = arena_strdup(&page->arena, front),
+         .back = arena_strdup(&page->arena, back)
+      };
+   }
+   return card_id;
+}
+
+// Hand an update or delete to the daemon or the writer thread, which commit it later
+static int post_card_write(FlashDb* db, WriteOp op, int deck_id, int card_id,
+                           const char* front, const char* back) {
+   if (db->remote) {
+      return op == WRITE_UPDATE_CARD ? remote_update_card(db, deck_id, card_id, front, back)
+                                     : remote_delete_card(db, deck_id, card_id);
+   }
+   WriteRequest req = {
+      .op = op,
+      .card_id = card_id,
+      .front = front ? strdup(front) : NULL,
+      .back = back ? strdup(back) : NULL
+   };
+   writer_submit(db, &req);
+   return 1;
 }
 
-void delete_card_by_id(sqlite3* db, int card_id) {
+int delete_card_by_id(FlashDb* db, Deck* deck, int card_id) {
+   TRACE_SCOPE(TRACE_DELETE_CARD);
    char status_msg[MAX_BUFFER] = {0};
-   sqlite3_stmt* stmt;
-   const char* sql = "DELETE FROM cards WHERE id = ?;";
 
-   if (sqlite3_prepare_v2(db, sql, -1, &stmt, 0) != SQLITE_OK) {
-      snprintf(status_msg, sizeof(status_msg), "Prepare failed %s", sqlite3_errmsg(db));
-      perrorw(status_msg);
-      return;
+   if (db->remote || db->writer) {
+      if (!post_card_write(db, WRITE_DELETE_CARD, deck ? deck->deck_id : 0, card_id, NULL, NULL)) {
+         if (deck) deck->stale = 1;
+         return 0;
+      }
+      db_report(db, DB_MSG_STATUS, "Card Deleted");
+      if (deck)
+         deck_remove_card(deck, card_id);
+      return 1;
+   }
+
+   sqlite3_stmt* stmt = db_stmt_acquire(db, STMT_DELETE_CARD);
+   if (!stmt) {
+      snprintf(status_msg, sizeof(status_msg), "Prepare failed %s", sqlite3_errmsg(db->conn));
+      db_report(db, DB_MSG_ERROR, status_msg);
+      if (deck) deck->stale = 1;
+      return 0;
    }
 
    sqlite3_bind_int(stmt, 1, card_id);
 
-   if (sqlite3_step(stmt) == SQLITE_DONE) {
+   int ok = sqlite3_step(stmt) == SQLITE_DONE;
+   if (ok) {
       snprintf(status_msg, sizeof(status_msg), "Card Deleted");
-      perrorw(status_msg);
+      db_report(db, DB_MSG_STATUS, status_msg);
    } else {
-      snprintf(status_msg, sizeof(status_msg), "Failed to delete card %s", sqlite3_errmsg(db));
-      perrorw(status_msg);
+      snprintf(status_msg, sizeof(status_msg), "Failed to delete card %s", sqlite3_errmsg(db->conn));
+      db_report(db, DB_MSG_ERROR, status_msg);
    }
+   db_stmt_release(db, STMT_DELETE_CARD);
 
-   sqlite3_finalize(stmt);
+   if (!deck)
+      return ok;
+   if (!ok) {
+      deck->stale = 1;
+      return ok;
+   }
+
+   deck_remove_card(deck, card_id);
+   return ok;
 }
 
-void update_card(sqlite3* db, int card_id, const char* new_front, const char* new_back) {
+int update_card(FlashDb* db, Deck* deck, int card_id, const char* new_front, const char* new_back) {
+   TRACE_SCOPE(TRACE_UPDATE_CARD);
    char status_msg[MAX_BUFFER] = {0};
-   sqlite3_stmt* stmt;
-   const char* sql = "UPDATE cards SET front = ?, back = ? WHERE id = ?;";
 
-   if (sqlite3_prepare_v2(db, sql, -1, &stmt, 0) != SQLITE_OK) {
-      snprintf(status_msg, sizeof(status_msg), "Prepare failed: %s", sqlite3_errmsg(db));
-      perrorw(status_msg);
-      return;
+   if (db->remote || db->writer) {
+      if (!post_card_write(db, WRITE_UPDATE_CARD, deck ? deck->deck_id : 0, card_id, new_front, new_back)) {
+         if (deck) deck->stale = 1;
+         return 0;
+      }
+      db_report(db, DB_MSG_STATUS, "Card updated.");
+      if (deck)
+         deck_replace_card_text(deck, card_id, new_front, new_back);
+      return 1;
+   }
+
+   sqlite3_stmt* stmt = db_stmt_acquire(db, STMT_UPDATE_CARD);
+   if (!stmt) {
+      snprintf(status_msg, sizeof(status_msg), "Prepare failed: %s", sqlite3_errmsg(db->conn));
+      db_report(db, DB_MSG_ERROR, status_msg);
+      if (deck) deck->stale = 1;
+      return 0;
    }
 
    sqlite3_bind_text(stmt, 1, new_front, -1, SQLITE_STATIC);
    sqlite3_bind_text(stmt, 2, new_back, -1, SQLITE_STATIC);
    sqlite3_bind_int(stmt, 3, card_id);
 
-   if (sqlite3_step(stmt) != SQLITE_DONE) {
-      snprintf(status_msg, sizeof(status_msg), "Failed to update card: %s", sqlite3_errmsg(db));
-      perrorw(status_msg);
+   int ok = sqlite3_step(stmt) == SQLITE_DONE;
+   if (!ok) {
+      snprintf(status_msg, sizeof(status_msg), "Failed to update card: %s", sqlite3_errmsg(db->conn));
+      db_report(db, DB_MSG_ERROR, status_msg);
    } else {
       snprintf(status_msg, sizeof(status_msg), "Card updated.");
-      perrorw(status_msg);
+      db_report(db, DB_MSG_STATUS, status_msg);
    }
+   db_stmt_release(db, STMT_UPDATE_CARD);
 
-   sqlite3_finalize(stmt);
+   if (!deck)
+      return ok;
+   if (!ok) {
+      deck->stale = 1;
+      return ok;
+   }
+
+   deck_replace_card_text(deck, card_id, new_front, new_back);
+   return ok;
 }
 
-int deck_exists(sqlite3* db, const char* deck_name, int* deck_id) {
+int deck_exists(FlashDb* db, const char* deck_name, int* deck_id) {
+   TRACE_SCOPE(TRACE_DECK_EXISTS);
    char status_msg[MAX_BUFFER] = {0};
-   sqlite3_stmt* stmt;
-   const char* sql = "SELECT id FROM decks WHERE name = ? LIMIT 1;";
+   if (db->remote)
+      return remote_deck_exists(db, deck_name, deck_id);
 
-   if (sqlite3_prepare_v2(db, sql, -1, &stmt, 0) != SQLITE_OK) {
-      snprintf(status_msg, sizeof(status_msg), "Prepare failed %s", sqlite3_errmsg(db));
-      perrorw(status_msg);
+   sqlite3_stmt* stmt = db_stmt_acquire(db, STMT_DECK_EXISTS);
+   if (!stmt) {
+      snprintf(status_msg, sizeof(status_msg), "Prepare failed %s", sqlite3_errmsg(db->conn));
+      db_report(db, DB_MSG_ERROR, status_msg);
       return 0;
    }
 
@@ -369,7 +749,7 @@ int deck_exists(sqlite3* db, const char* deck_name, int* deck_id) {
       exists = 1;
    }
 
-   sqlite3_finalize(stmt);
+   db_stmt_release(db, STMT_DECK_EXISTS);
    return exists;
 }
 
@@ -0,0 +1,435 @@
+#include "../include/dedupe.h"
+#include "../include/writer.h"
+#include "../include/remote.h"
+#include "../include/trace.h"
+
+#include <time.h>
+
+#define FNV_OFFSET 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+// Walks text the way card_text_hash sees it: one case folded code point at a
+// time, a run of whitespace as one space, and none at either end
+typedef struct {
+   const unsigned char* p;
+   const unsigned char* end;
+   int started;
+} NormReader;
+
+typedef struct {
+   int* items;
+   size_t count;
+   size_t capacity;
+} IdList;
+
+typedef struct {
+   int id;
+   const char* front;
+   const char* back;
+} CardUpdate;
+
+typedef struct {
+   CardUpdate* items;
+   size_t count;
+   size_t capacity;
+   Arena arena;             // owns the text of every update
+} UpdateList;
+
+// Cards sharing a (deck_id, front_hash) pair, oldest first
+typedef struct {
+   int id;
+   char* front;
+   char* back;
+   int kept;
+   int copies;              // later cards removed in its favour
+   int changed;             // back took in a copy's back
+} GroupCard;
+
+typedef struct {
+   GroupCard* items;
+   size_t count;
+   size_t capacity;
+   Arena arena;             // text of the current group, reset between groups
+} Group;
+
+static int space_length(const unsigned char* p, const unsigned char* end) {
+   if (*p == ' ' || (*p >= '\t' && *p <= '\r'))
+      return 1;
+   if (*p == 0xC2 && p + 1 < end && p[1] == 0xA0) // no-break space
+      return 2;
+   return 0;
+}
+
+// A byte that does not start a valid sequence stands for itself, mapped to a
+// surrogate that valid UTF-8 cannot produce
+static unsigned int decode(const unsigned char* p, const unsigned char* end, int* len) {
+   static const unsigned int min_cp[] = {0, 0x80, 0x800, 0x10000};
+   int extra;
+   unsigned int cp;
+   if (*p < 0x80) { *len = 1; return *p; }
+   else if ((*p & 0xE0) == 0xC0) { extra = 1; cp = *p & 0x1F; }
+   else if ((*p & 0xF0) == 0xE0) { extra = 2; cp = *p & 0x0F; }
+   else if ((*p & 0xF8) == 0xF0) { extra = 3; cp = *p & 0x07; }
+   else { *len = 1; return 0xDC00 + *p; }
+
+   if (end - p <= extra) {
+      *len = 1;
+      return 0xDC00 + *p;
+   }
+   for (int i = 1; i <= extra; i++) {
+      if ((p[i] & 0xC0) != 0x80) {
+         *len = 1;
+         return 0xDC00 + *p;
+      }
+      cp = (cp << 6) | (p[i] & 0x3F);
+   }
+   if (cp < min_cp[extra] || (cp >= 0xD800 && cp <= 0xDFFF) || cp > 0x10FFFF) {
+      *len = 1;
+      return 0xDC00 + *p;
+   }
+   *len = extra + 1;
+   return cp;
+}
+
+// Simple case folding for the scripts decks are written in most
+static unsigned int fold(unsigned int c) {
+   if (c < 0x80)
+      return c >= 'A' && c <= 'Z' ? c + 32 : c;
+   if (c >= 0xC0 && c <= 0xDE && c != 0xD7)               // Latin-1
+      return c + 32;
+   if (c >= 0x100 && c <= 0x17F) {                        // Latin Extended-A
+      if (c == 0x178)
+         return 0xFF;
+      int odd_upper = (c >= 0x139 && c <= 0x148) || (c >= 0x179 && c <= 0x17E);
+      if (c == 0x130 || c == 0x131 || c == 0x138 || c == 0x149 || c == 0x17F)
+         return c;
+      return (c % 2 == 1) == odd_upper ? c + 1 : c;
+   }
+   if (c >= 0x391 && c <= 0x3A9 && c != 0x3A2)            // Greek
+      return c + 32;
+   if (c == 0x3C2)                                        // final sigma
+      return 0x3C3;
+   if (c >= 0x410 && c <= 0x42F)                          // Cyrillic
+      return c + 32;
+   if (c >= 0x400 && c <= 0x40F)
+      return c + 80;
+   return c;
+}
+
+// Next normalized code point, 0 at the end
+static unsigned int norm_next(NormReader* r) {
+   int space = 0;
+   int len;
+   while (r->p < r->end && (len = space_length(r->p, r->end)) > 0) {
+      r->p += len;
+      space = 1;
+   }
+   if (r->p >= r->end)
+      return 0;
+   if (space && r->started)
+      return ' ';
+
+   r->started = 1;
+   unsigned int cp = decode(r->p, r->end, &len);
+   r->p += len;
+   return fold(cp);
+}
+
+static unsigned long long fnv_byte(unsigned long long h, unsigned char b) {
+   return (h ^ b) * FNV_PRIME;
+}
+
+long long card_text_hash(const char* text) {
+   NormReader r = { (const unsigned char*)text, (const unsigned char*)text + strlen(text), 0 };
+   unsigned long long h = FNV_OFFSET;
+   unsigned int cp;
+
+   // Hashed as UTF-8, so plain ASCII hashes like its lowercase bytes
+   while ((cp = norm_next(&r)) != 0) {
+      if (cp < 0x80) {
+         h = fnv_byte(h, cp);
+      } else if (cp < 0x800) {
+         h = fnv_byte(h, 0xC0 | (cp >> 6));
+         h = fnv_byte(h, 0x80 | (cp & 0x3F));
+      } else if (cp < 0x10000) {
+         h = fnv_byte(h, 0xE0 | (cp >> 12));
+         h = fnv_byte(h, 0x80 | ((cp >> 6) & 0x3F));
+         h = fnv_byte(h, 0x80 | (cp & 0x3F));
+      } else {
+         h = fnv_byte(h, 0xF0 | (cp >> 18));
+         h = fnv_byte(h, 0x80 | ((cp >> 12) & 0x3F));
+         h = fnv_byte(h, 0x80 | ((cp >> 6) & 0x3F));
+         h = fnv_byte(h, 0x80 | (cp & 0x3F));
+      }
+   }
+   return (long long)h;
+}
+
+static int norm_equal(const char* a, size_t a_len, const char* b, size_t b_len) {
+   NormReader ra = { (const unsigned char*)a, (const unsigned char*)a + a_len, 0 };
+   NormReader rb = { (const unsigned char*)b, (const unsigned char*)b + b_len, 0 };
+   unsigned int ca, cb;
+   do {
+      ca = norm_next(&ra);
+      cb = norm_next(&rb);
+   } while (ca == cb && ca != 0);
+   return ca == cb;
+}
+
+int card_text_equal(const char* a, const char* b) {
+   return norm_equal(a, strlen(a), b, strlen(b));
+}
+
+static void card_hash_sql(sqlite3_context* ctx, int argc, sqlite3_value** argv) {
+   (void)argc;
+   const unsigned char* text = sqlite3_value_text(argv[0]);
+   if (text)
+      sqlite3_result_int64(ctx, card_text_hash((const char*)text));
+   else
+      sqlite3_result_null(ctx);
+}
+
+int register_card_hash(sqlite3* conn) {
+   return sqlite3_create_function(conn, "card_hash", 1, SQLITE_UTF8 | SQLITE_DETERMINISTIC | SQLITE_INNOCUOUS,
+                                  NULL, card_hash_sql, NULL, NULL) == SQLITE_OK;
+}
+
+int parse_dup_policy(const char* name, DupPolicy* policy) {
+   if (strcmp(name, "skip") == 0)
+      *policy = DUP_SKIP;
+   else if (strcmp(name, "merge") == 0)
+      *policy = DUP_MERGE;
+   else if (strcmp(name, "keep") == 0)
+      *policy = DUP_KEEP;
+   else
+      return 0;
+   return 1;
+}
+
+int find_duplicate_card(FlashDb* db, int deck_id, const char* front, long long hash, Cards* card) {
+   TRACE_SCOPE(TRACE_FIND_DUPLICATE);
+   char status_msg[MAX_BUFFER] = {0};
+   if (db->remote)
+      return remote_find_duplicate(db, deck_id, front, hash, card);
+   writer_flush(db);
+
+   sqlite3_stmt* stmt = db_stmt_acquire(db, STMT_FIND_DUPLICATE);
+   if (!stmt) {
+      snprintf(status_msg, sizeof(status_msg), "Prepare failed %s", sqlite3_errmsg(db->conn));
+      db_report(db, DB_MSG_ERROR, status_msg);
+      return 0;
+   }
+   sqlite3_bind_int(stmt, 1, deck_id);
+   sqlite3_bind_int64(stmt, 2, hash);
+
+   // Different fronts may share a hash, so each candidate is compared
+   int found = 0;
+   while (!found && sqlite3_step(stmt) == SQLITE_ROW) {
+      const char* other = (const char*)sqlite3_column_text(stmt, 1);
+      if (!other || !card_text_equal(front, other))
+         continue;
+      *card = (Cards){
+         .id = sqlite3_column_int(stmt, 0),
+         .deck_id = deck_id,
+         .front = strdup(other),
+         .back = strdup((const char*)sqlite3_column_text(stmt, 2))
+      };
+      found = card->front && card->back;
+      if (!found) {
+         free(card->front);
+         free(card->back);
+         break;
+      }
+   }
+   db_stmt_release(db, STMT_FIND_DUPLICATE);
+   return found;
+}
+
+char* merge_backs(const char* existing, const char* added) {
+   size_t added_len = strlen(added);
+   if (card_text_equal(existing, added))
+      return NULL;
+   for (const char* line = existing; line; ) {
+      const char* nl = strchr(line, '\n');
+      size_t len = nl ? (size_t)(nl - line) : strlen(line);
+      if (norm_equal(line, len, added, added_len))
+         return NULL;
+      line = nl ? nl + 1 : NULL;
+   }
+
+   size_t existing_len = strlen(existing);
+   char* merged = malloc(existing_len + added_len + 2);
+   if (!merged)
+      return NULL;
+   memcpy(merged, existing, existing_len);
+   merged[existing_len] = '\n';
+   memcpy(merged + existing_len + 1, added, added_len + 1);
+   return merged;
+}
+
+static int load_group_text(FlashDb* db, Group* group) {
+   sqlite3_stmt* stmt = db_stmt_acquire(db, STMT_CARD_TEXT);
+   if (!stmt)
+      return 0;
+   int ok = 1;
+   for (size_t i = 0; i < group->count && ok; i++) {
+      GroupCard* card = &group->items[i];
+      sqlite3_bind_int(stmt, 1, card->id);
+      ok = sqlite3_step(stmt) == SQLITE_ROW;
+      if (ok) {
+         card->front = arena_strndup(&group->arena, (const char*)sqlite3_column_text(stmt, 1),
+                                     sqlite3_column_bytes(stmt, 1));
+         card->back = arena_strndup(&group->arena, (const char*)sqlite3_column_text(stmt, 2),
+                                    sqlite3_column_bytes(stmt, 2));
+         ok = card->front && card->back;
+      }
+      sqlite3_reset(stmt);
+   }
+   db_stmt_release(db, STMT_CARD_TEXT);
+   return ok;
+}
+
+// Every card keeps the first earlier card with the same front, if there is one
+static int dedupe_group(FlashDb* db, Group* group, int merge, IdList* deletes, UpdateList* updates,
+                        DedupeStats* stats) {
+   if (group->count < 2)
+      return 1;
+   if (!load_group_text(db, group))
+      return 0;
+
+   for (size_t i = 0; i < group->count; i++) {
+      GroupCard* card = &group->items[i];
+      GroupCard* keeper = NULL;
+      for (size_t j = 0; j < i && !keeper; j++) {
+         if (group->items[j].kept && card_text_equal(group->items[j].front, card->front))
+            keeper = &group->items[j];
+      }
+      if (!keeper) {
+         card->kept = 1;
+         continue;
+      }
+
+      keeper->copies++;
+      da_append(deletes, card->id);
+      if (merge) {
+         char* merged = merge_backs(keeper->back, card->back);
+         if (merged) {
+            keeper->back = arena_strdup(&group->arena, merged);
+            keeper->changed = 1;
+            free(merged);
+         }
+      }
+   }
+
+   for (size_t i = 0; i < group->count; i++) {
+      GroupCard* card = &group->items[i];
+      stats->groups += card->copies > 0;
+      if (!card->changed)
+         continue;
+      CardUpdate update = {
+         .id = card->id,
+         .front = arena_strdup(&updates->arena, card->front),
+         .back = arena_strdup(&updates->arena, card->back),
+      };
+      da_append(updates, update);
+      stats->merged++;
+   }
+   stats->removed = deletes->count;
+   return 1;
+}
+
+static int apply_dedupe(FlashDb* db, const IdList* deletes, const UpdateList* updates) {
+   sqlite3_stmt* stmt = db_stmt_acquire(db, STMT_UPDATE_CARD);
+   int ok = stmt != NULL;
+   for (size_t i = 0; i < updates->count && ok; i++) {
+      sqlite3_bind_text(stmt, 1, updates->items[i].front, -1, SQLITE_STATIC);
+      sqlite3_bind_text(stmt, 2, updates->items[i].back, -1, SQLITE_STATIC);
+      sqlite3_bind_int(stmt, 3, updates->items[i].id);
+      ok = sqlite3_step(stmt) == SQLITE_DONE;
+      sqlite3_reset(stmt);
+   }
+   if (stmt)
+      db_stmt_release(db, STMT_UPDATE_CARD);
+   if (!ok)
+      return 0;
+
+   stmt = db_stmt_acquire(db, STMT_DELETE_CARD);
+   ok = stmt != NULL;
+   for (size_t i = 0; i < deletes->count && ok; i++) {
+      sqlite3_bind_int(stmt, 1, deletes->items[i]);
+      ok = sqlite3_step(stmt) == SQLITE_DONE;
+      sqlite3_reset(stmt);
+   }
+   if (stmt)
+      db_stmt_release(db, STMT_DELETE_CARD);
+   return ok;
+}
+
+int dedupe_cards(FlashDb* db, int merge, int dry_run, DedupeStats* stats) {
+   TRACE_SCOPE(TRACE_DEDUPE_CARDS);
+   // Cards inserted without card_hash() (e.g. by hand in sqlite3) get their hash first.
+   // The scan then reads only the index, in (deck_id, front_hash, id) order.
+   const char* backfill_sql = "UPDATE cards SET front_hash = card_hash(front) WHERE front_hash IS NULL;";
+   const char* scan_sql =
+      "SELECT deck_id, front_hash, id FROM cards INDEXED BY idx_cards_deck_front_hash "
+      "ORDER BY deck_id, front_hash, id;";
+
+   DedupeStats local_stats;
+   if (!stats) stats = &local_stats;
+   memset(stats, 0, sizeof(*stats));
+   unsigned long long start = trace_now_ns();
+
+   writer_flush(db);
+   if (!db_begin(db)) {
+      fprintf(stderr, "dedupe: begin failed: %s\n", sqlite3_errmsg(db->conn));
+      return 0;
+   }
+
+   sqlite3_stmt* scan = NULL;
+   int ok = sqlite3_exec(db->conn, backfill_sql, 0, 0, 0) == SQLITE_OK
+         && sqlite3_prepare_v2(db->conn, scan_sql, -1, &scan, NULL) == SQLITE_OK;
+
+   Group group = {0};
+   IdList deletes = {0};
+   UpdateList updates = {0};
+   int deck_id = 0;
+   long long hash = 0;
+   int rc = SQLITE_DONE;
+   while (ok && (rc = sqlite3_step(scan)) == SQLITE_ROW) {
+      int row_deck = sqlite3_column_int(scan, 0);
+      long long row_hash = sqlite3_column_int64(scan, 1);
+      if (group.count > 0 && (row_deck != deck_id || row_hash != hash)) {
+         ok = dedupe_group(db, &group, merge, &deletes, &updates, stats);
+         group.count = 0;
+         arena_reset(&group.arena);
+      }
+      deck_id = row_deck;
+      hash = row_hash;
+      GroupCard card = { .id = sqlite3_column_int(scan, 2) };
+      da_append(&group, card);
+      stats->cards++;
+   }
+   if (ok && rc != SQLITE_DONE)
+      ok = 0;
+   if (ok)
+      ok = dedupe_group(db, &group, merge, &deletes, &updates, stats);
+   sqlite3_finalize(scan);
+
+   if (ok && !dry_run)
+      ok = apply_dedupe(db, &deletes, &updates);
+   if (!ok)
+      fprintf(stderr, "dedupe: %s\n", sqlite3_errmsg(db->conn));
+
+   if (ok && !dry_run)
+      ok = db_commit(db);
+   if (!ok || dry_run)
+      db_rollback(db);
+
+   stats->seconds = (trace_now_ns() - start) / 1e9;
+   free(group.items);
+   arena_free(&group.arena);
+   free(deletes.items);
+   free(updates.items);
+   arena_free(&updates.arena);
+   return ok;
+}
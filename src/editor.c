@@ -0,0 +1,487 @@
+#include "../include/editor.h"
+#include "../include/layout.h"
+#include "../include/render.h"
+#include "../include/trace.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define GAP_MIN_SIZE 64
+#define UTF8_MAX_BYTES 4
+
+// Key Macros
+#define ESC_KEY 27
+#define CTRL_W 23
+
+int gap_init(GapBuffer* gb, const char* text) {
+   size_t len = text ? strlen(text) : 0;
+   size_t size = len * 2 > GAP_MIN_SIZE ? len * 2 : GAP_MIN_SIZE;
+   gb->data = malloc(size);
+   if (!gb->data)
+      return 0;
+   if (len)
+      memcpy(gb->data, text, len);
+   gb->size = size;
+   gb->gap_start = len;
+   gb->gap_end = size;
+   return 1;
+}
+
+void gap_free(GapBuffer* gb) {
+   free(gb->data);
+   *gb = (GapBuffer){0};
+}
+
+size_t gap_length(const GapBuffer* gb) {
+   return gb->size - (gb->gap_end - gb->gap_start);
+}
+
+char gap_byte(const GapBuffer* gb, size_t pos) {
+   return pos < gb->gap_start ? gb->data[pos] : gb->data[pos + gb->gap_end - gb->gap_start];
+}
+
+void gap_copy(const GapBuffer* gb, size_t from, size_t to, char* out) {
+   if (from < gb->gap_start) {
+      size_t n = (to < gb->gap_start ? to : gb->gap_start) - from;
+      memcpy(out, gb->data + from, n);
+      out += n;
+      from += n;
+   }
+   if (from < to)
+      memcpy(out, gb->data + from + (gb->gap_end - gb->gap_start), to - from);
+}
+
+void gap_move(GapBuffer* gb, size_t pos) {
+   if (pos < gb->gap_start) {
+      size_t n = gb->gap_start - pos;
+      memmove(gb->data + gb->gap_end - n, gb->data + pos, n);
+      gb->gap_start -= n;
+      gb->gap_end -= n;
+   } else if (pos > gb->gap_start) {
+      size_t n = pos - gb->gap_start;
+      memmove(gb->data + gb->gap_start, gb->data + gb->gap_end, n);
+      gb->gap_start += n;
+      gb->gap_end += n;
+   }
+}
+
+int gap_insert(GapBuffer* gb, const char* bytes, size_t n) {
+   if (gb->gap_end - gb->gap_start < n) {
+      size_t tail = gb->size - gb->gap_end;
+      size_t size = (gb->size + n) * 2;
+      char* tmp = realloc(gb->data, size);
+      if (!tmp)
+         return 0;
+      memmove(tmp + size - tail, tmp + gb->gap_end, tail);
+      gb->data = tmp;
+      gb->gap_end = size - tail;
+      gb->size = size;
+   }
+   memcpy(gb->data + gb->gap_start, bytes, n);
+   gb->gap_start += n;
+   return 1;
+}
+
+void gap_delete(GapBuffer* gb, size_t from, size_t to) {
+   gap_move(gb, from);
+   gb->gap_end += to - from;
+}
+
+char* gap_text(const GapBuffer* gb) {
+   size_t len = gap_length(gb);
+   char* text = malloc(len + 1);
+   if (!text)
+      return NULL;
+   gap_copy(gb, 0, len, text);
+   text[len] = '\0';
+   return text;
+}
+
+// One screen row of the text
+typedef struct {
+   size_t start;                   // first byte on the row
+   size_t end;                     // first byte not on the row
+   size_t next;                    // start of the following row, past the '\n' if there is one
+   int columns;
+   int last;                       // the text ends on this row
+} Row;
+
+// What a row of the box shows, so an unchanged row is not drawn again
+typedef struct {
+   char* text;
+   size_t bytes;
+   int valid;                      // 0 until the row is first drawn
+} DrawnRow;
+
+typedef struct {
+   WINDOW* win;
+   int y, x;
+   int rows, columns;
+   GapBuffer gb;
+   size_t top;                     // start of the row shown first
+   DrawnRow* drawn;
+   size_t* starts;                 // scratch for scrolling down, one per row
+   char* line;                     // scratch for a row's bytes
+   size_t line_size;
+} Editor;
+
+static size_t char_at(const GapBuffer* gb, size_t pos, int* columns) {
+   if (!(gap_byte(gb, pos) & 0x80)) {
+      *columns = 1;
+      return 1;
+   }
+   // A character may straddle the gap, so it is measured from a copy
+   char bytes[UTF8_MAX_BYTES];
+   size_t n = gap_length(gb) - pos;
+   if (n > UTF8_MAX_BYTES)
+      n = UTF8_MAX_BYTES;
+   gap_copy(gb, pos, pos + n, bytes);
+   return layout_char(bytes, n, columns);
+}
+
+static size_t char_left(const GapBuffer* gb, size_t pos) {
+   if (pos == 0)
+      return 0;
+   pos--;
+   while (pos > 0 && (gap_byte(gb, pos) & 0xC0) == 0x80)
+      pos--;
+   return pos;
+}
+
+static size_t char_right(const GapBuffer* gb, size_t pos) {
+   int w;
+   return pos < gap_length(gb) ? pos + char_at(gb, pos, &w) : pos;
+}
+
+static int is_space(char c) {
+   return c == ' ' || c == '\n' || c == '\t';
+}
+
+static size_t word_left(const GapBuffer* gb, size_t pos) {
+   while (pos > 0 && is_space(gap_byte(gb, pos - 1)))
+      pos--;
+   while (pos > 0 && !is_space(gap_byte(gb, pos - 1)))
+      pos--;
+   return pos;
+}
+
+static size_t word_right(const GapBuffer* gb, size_t pos) {
+   size_t len = gap_length(gb);
+   while (pos < len && !is_space(gap_byte(gb, pos)))
+      pos++;
+   while (pos < len && is_space(gap_byte(gb, pos)))
+      pos++;
+   return pos;
+}
+
+static size_t line_start(const GapBuffer* gb, size_t pos) {
+   while (pos > 0 && gap_byte(gb, pos - 1) != '\n')
+      pos--;
+   return pos;
+}
+
+static size_t line_end(const GapBuffer* gb, size_t pos) {
+   size_t len = gap_length(gb);
+   while (pos < len && gap_byte(gb, pos) != '\n')
+      pos++;
+   return pos;
+}
+
+// Characters are wrapped rather than words, so every byte is on a row and the
+// cursor can sit anywhere
+static Row wrap_row(const GapBuffer* gb, size_t start, int width) {
+   size_t len = gap_length(gb);
+   Row row = { .start = start };
+   size_t pos = start;
+   while (pos < len) {
+      if (gap_byte(gb, pos) == '\n') {
+         row.end = pos;
+         row.next = pos + 1;
+         return row;
+      }
+      int w;
+      size_t step = char_at(gb, pos, &w);
+      if (row.columns + w > width && row.columns > 0) {
+         row.end = row.next = pos;
+         return row;
+      }
+      row.columns += w;
+      pos += step;
+   }
+   row.end = row.next = len;
+   // The cursor after the last character needs a cell, a full row leaves it to an empty one
+   row.last = row.columns < width;
+   return row;
+}
+
+static int row_has(const Row* row, size_t pos) {
+   return pos >= row->start && (pos < row->next || row->last);
+}
+
+// Rows are only known from the start of a line, so this wraps the line up to pos
+static Row row_at(const Editor* ed, size_t pos) {
+   Row row = wrap_row(&ed->gb, line_start(&ed->gb, pos), ed->columns);
+   while (!row_has(&row, pos))
+      row = wrap_row(&ed->gb, row.next, ed->columns);
+   return row;
+}
+
+static int column_of(const GapBuffer* gb, const Row* row, size_t pos) {
+   int columns = 0;
+   for (size_t i = row->start; i < pos; ) {
+      int w;
+      i += char_at(gb, i, &w);
+      columns += w;
+   }
+   return columns;
+}
+
+// The character at a column of a row, never past the end of a wrapped row since
+// that position belongs to the row below
+static size_t column_pos(const GapBuffer* gb, const Row* row, int column) {
+   int wrapped = row->end == row->next && !row->last;
+   size_t pos = row->start;
+   int columns = 0;
+   while (pos < row->end) {
+      int w;
+      size_t step = char_at(gb, pos, &w);
+      if (columns + w > column || (wrapped && pos + step == row->end))
+         break;
+      columns += w;
+      pos += step;
+   }
+   return pos;
+}
+
+// Rows before an edit keep their breaks, except the one that ends where it starts
+static void edited(Editor* ed, size_t pos) {
+   if (pos <= ed->top)
+      ed->top = row_at(ed, pos).start;
+}
+
+static int insert(Editor* ed, const char* bytes, size_t n) {
+   size_t at = ed->gb.gap_start;
+   if (!gap_insert(&ed->gb, bytes, n))
+      return 0;
+   edited(ed, at);
+   return 1;
+}
+
+static void delete_text(Editor* ed, size_t from, size_t to) {
+   if (from == to)
+      return;
+   gap_delete(&ed->gb, from, to);
+   edited(ed, from);
+}
+
+static void scroll_to_cursor(Editor* ed) {
+   size_t cursor = ed->gb.gap_start;
+   if (cursor < ed->top) {
+      ed->top = row_at(ed, cursor).start;
+      return;
+   }
+
+   // Walk down to the cursor's row, the last rows starts tell where the box begins
+   Row row = wrap_row(&ed->gb, ed->top, ed->columns);
+   int n = 0;
+   while (1) {
+      ed->starts[n % ed->rows] = row.start;
+      n++;
+      if (row_has(&row, cursor))
+         break;
+      row = wrap_row(&ed->gb, row.next, ed->columns);
+   }
+   if (n > ed->rows)
+      ed->top = ed->starts[n % ed->rows];
+}
+
+// Redraw a row unless it already shows this text
+static void draw_row(Editor* ed, int i, const char* text, size_t bytes, int columns) {
+   DrawnRow* drawn = &ed->drawn[i];
+   if (drawn->valid && drawn->bytes == bytes && memcmp(drawn->text, text, bytes) == 0)
+      return;
+
+   render_text_line(ed->win, ed->y + i, ed->x, text, bytes);
+   if (columns < ed->columns)
+      mvwhline(ed->win, ed->y + i, ed->x + columns, ' ', ed->columns - columns);
+
+   char* copy = realloc(drawn->text, bytes ? bytes : 1);
+   if (copy) {
+      memcpy(copy, text, bytes);
+      drawn->text = copy;
+      drawn->bytes = bytes;
+      drawn->valid = 1;
+   } else {
+      drawn->valid = 0;
+   }
+}
+
+static void draw(Editor* ed) {
+   TRACE_SCOPE(TRACE_EDITOR_REDRAW);
+   size_t cursor = ed->gb.gap_start;
+   int cursor_y = 0, cursor_x = 0;
+   Row row = wrap_row(&ed->gb, ed->top, ed->columns);
+   int more = 1;
+
+   for (int i = 0; i < ed->rows; i++) {
+      if (!more) {
+         draw_row(ed, i, "", 0, 0);
+         continue;
+      }
+
+      size_t bytes = row.end - row.start;
+      if (bytes > ed->line_size) {
+         char* tmp = realloc(ed->line, bytes);
+         if (!tmp)
+            return;
+         ed->line = tmp;
+         ed->line_size = bytes;
+      }
+      gap_copy(&ed->gb, row.start, row.end, ed->line);
+      draw_row(ed, i, ed->line, bytes, row.columns);
+
+      if (row_has(&row, cursor)) {
+         cursor_y = i;
+         cursor_x = column_of(&ed->gb, &row, cursor);
+      }
+      if (row.last)
+         more = 0;
+      else
+         row = wrap_row(&ed->gb, row.next, ed->columns);
+   }
+   wmove(ed->win, ed->y + cursor_y, ed->x + cursor_x);
+}
+
+// Ctrl and Alt arrows have no fixed key codes, terminfo names them
+static int key_named(int ch, const char* a, const char* b) {
+   const char* name = keyname(ch);
+   return name && (strcmp(name, a) == 0 || strcmp(name, b) == 0);
+}
+
+static int utf8_length(int lead) {
+   if ((lead & 0xE0) == 0xC0)
+      return 2;
+   if ((lead & 0xF0) == 0xE0)
+      return 3;
+   if ((lead & 0xF8) == 0xF0)
+      return 4;
+   return 0;
+}
+
+static void free_editor(Editor* ed) {
+   for (int i = 0; ed->drawn && i < ed->rows; i++)
+      free(ed->drawn[i].text);
+   free(ed->drawn);
+   free(ed->starts);
+   free(ed->line);
+   gap_free(&ed->gb);
+}
+
+int edit_text(WINDOW* win, int y, int x, int rows, int columns, const char* initial, int flags, char** result) {
+   *result = NULL;
+   if (rows < 1 || columns < 1)
+      return 0;
+
+   Editor ed = { .win = win, .y = y, .x = x, .rows = rows, .columns = columns };
+   if (!gap_init(&ed.gb, initial))
+      return 0;
+   ed.drawn = calloc(rows, sizeof(DrawnRow));
+   ed.starts = malloc(rows * sizeof(size_t));
+   if (!ed.drawn || !ed.starts) {
+      free_editor(&ed);
+      return 0;
+   }
+
+   keypad(win, TRUE);
+   curs_set(1);
+   int goal = -1;                  // column kept while moving up and down
+   int submitted = -1;
+
+   while (submitted < 0) {
+      scroll_to_cursor(&ed);
+      draw(&ed);
+      wnoutrefresh(win);
+      render_flush();
+
+      int ch = render_getch(win);
+      size_t cursor = ed.gb.gap_start;
+      int vertical = 0;
+
+      // Alt sends ESC first; a lone ESC has nothing after it
+      int alt = 0;
+      if (ch == ESC_KEY) {
+         nodelay(win, TRUE);
+         ch = wgetch(win);
+         nodelay(win, FALSE);
+         if (ch == ERR) {
+            submitted = 0;
+            continue;
+         }
+         alt = 1;
+      }
+
+      if (alt && (ch == '\n' || ch == KEY_ENTER)) {
+         if (flags & EDIT_MULTILINE)
+            insert(&ed, "\n", 1);
+      } else if (ch == '\n' || ch == KEY_ENTER) {
+         *result = gap_text(&ed.gb);
+         submitted = *result != NULL;
+      } else if ((alt && ch == 'b') || key_named(ch, "kLFT5", "kLFT3")) {
+         gap_move(&ed.gb, word_left(&ed.gb, cursor));
+      } else if ((alt && ch == 'f') || key_named(ch, "kRIT5", "kRIT3")) {
+         gap_move(&ed.gb, word_right(&ed.gb, cursor));
+      } else if (alt) {
+         // Other Alt keys do nothing
+      } else if (ch == KEY_LEFT) {
+         gap_move(&ed.gb, char_left(&ed.gb, cursor));
+      } else if (ch == KEY_RIGHT) {
+         gap_move(&ed.gb, char_right(&ed.gb, cursor));
+      } else if (ch == KEY_UP || ch == KEY_DOWN) {
+         Row row = row_at(&ed, cursor);
+         if (goal < 0)
+            goal = column_of(&ed.gb, &row, cursor);
+         if (ch == KEY_UP && row.start > 0) {
+            Row above = row_at(&ed, row.start - 1);
+            gap_move(&ed.gb, column_pos(&ed.gb, &above, goal));
+         } else if (ch == KEY_DOWN && !row.last) {
+            Row below = wrap_row(&ed.gb, row.next, ed.columns);
+            gap_move(&ed.gb, column_pos(&ed.gb, &below, goal));
+         }
+         vertical = 1;
+      } else if (ch == KEY_HOME) {
+         gap_move(&ed.gb, line_start(&ed.gb, cursor));
+      } else if (ch == KEY_END) {
+         gap_move(&ed.gb, line_end(&ed.gb, cursor));
+      } else if (ch == KEY_BACKSPACE || ch == 127 || ch == '\b') {
+         delete_text(&ed, char_left(&ed.gb, cursor), cursor);
+      } else if (ch == KEY_DC) {
+         delete_text(&ed, cursor, char_right(&ed.gb, cursor));
+      } else if (ch == CTRL_W) {
+         delete_text(&ed, word_left(&ed.gb, cursor), cursor);
+      } else if (ch >= 32 && ch < 127) {
+         char c = (flags & EDIT_DASHES) && ch == ' ' ? '-' : ch;
+         if (!insert(&ed, &c, 1))
+            beep();
+      } else if (ch >= 0x80 && ch < 0x100) {
+         // The rest of a UTF-8 character is already waiting, take it before drawing
+         char bytes[UTF8_MAX_BYTES] = { (char)ch };
+         int n = utf8_length(ch);
+         int got = 1;
+         while (got < n) {
+            int next = wgetch(win);
+            if (next < 0x80 || next >= 0xC0)
+               break;
+            bytes[got++] = (char)next;
+         }
+         if (n && got == n && !insert(&ed, bytes, n))
+            beep();
+      }
+
+      if (!vertical)
+         goal = -1;
+   }
+
+   free_editor(&ed);
+   curs_set(0);
+   return submitted;
+}
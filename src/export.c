@@ -0,0 +1,202 @@
+#include "../include/export.h"
+#include "../include/db.h"
+
+#include <errno.h>
+#include <time.h>
+
+static char out_buffer[EXPORT_BUFFER_SIZE];
+
+typedef struct {
+   FILE* out;
+   const ExportOptions* opts;
+   ExportStats* stats;
+   int first_deck;
+} ExportState;
+
+void write_tsv_field(FILE* out, const char* text, int len) {
+   int needs_quotes = len > 0 && text[0] == '#';
+   for (int i = 0; i < len && !needs_quotes; i++) {
+      char c = text[i];
+      needs_quotes = c == '\t' || c == '\n' || c == '\r' || c == '"';
+   }
+
+   if (!needs_quotes) {
+      fwrite(text, 1, len, out);
+      return;
+   }
+
+   putc('"', out);
+   int span = 0;
+   for (int i = 0; i < len; i++) {
+      if (text[i] == '"') {
+         fwrite(text + span, 1, i + 1 - span, out);
+         putc('"', out);
+         span = i + 1;
+      }
+   }
+   fwrite(text + span, 1, len - span, out);
+   putc('"', out);
+}
+
+void write_json_string(FILE* out, const char* text, int len) {
+   putc('"', out);
+   int span = 0;
+   for (int i = 0; i < len; i++) {
+      unsigned char c = (unsigned char)text[i];
+      if (c >= 0x20 && c != '"' && c != '\\')
+         continue;
+
+      fwrite(text + span, 1, i - span, out);
+      span = i + 1;
+      switch (c) {
+         case '"':  fputs("\\\"", out); break;
+         case '\\': fputs("\\\\", out); break;
+         case '\n': fputs("\\n", out); break;
+         case '\r': fputs("\\r", out); break;
+         case '\t': fputs("\\t", out); break;
+         default:   fprintf(out, "\\u%04x", c); break;
+      }
+   }
+   fwrite(text + span, 1, len - span, out);
+   putc('"', out);
+}
+
+static int export_deck(FlashDb* db, ExportState* st, int deck_id, const char* name, int name_len) {
+   FILE* out = st->out;
+   int all_decks = st->opts->deck_name == NULL;
+
+   if (st->opts->format == EXPORT_JSON) {
+      if (all_decks)
+         fputs(st->first_deck ? "\n" : ",\n", out);
+      fputs("{\"deck\":", out);
+      write_json_string(out, name, name_len);
+      fputs(",\"cards\":[", out);
+   }
+   st->first_deck = 0;
+
+   sqlite3_stmt* stmt = db_stmt_acquire(db, STMT_DECK_CARDS);
+   if (!stmt) {
+      fprintf(stderr, "export: prepare failed: %s\n", sqlite3_errmsg(db->conn));
+      return 0;
+   }
+   sqlite3_bind_int(stmt, 1, deck_id);
+
+   int rc;
+   size_t count = 0;
+   while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+      const char* front = (const char*)sqlite3_column_text(stmt, 1);
+      int front_len = sqlite3_column_bytes(stmt, 1);
+      const char* back = (const char*)sqlite3_column_text(stmt, 2);
+      int back_len = sqlite3_column_bytes(stmt, 2);
+
+      if (st->opts->format == EXPORT_JSON) {
+         fprintf(out, "%s{\"id\":%d,\"front\":", count ? "," : "", sqlite3_column_int(stmt, 0));
+         write_json_string(out, front, front_len);
+         fputs(",\"back\":", out);
+         write_json_string(out, back, back_len);
+         putc('}', out);
+      } else {
+         if (all_decks) {
+            write_tsv_field(out, name, name_len);
+            putc('\t', out);
+         }
+         write_tsv_field(out, front, front_len);
+         putc('\t', out);
+         write_tsv_field(out, back, back_len);
+         putc('\n', out);
+      }
+      count++;
+   }
+   db_stmt_release(db, STMT_DECK_CARDS);
+
+   if (rc != SQLITE_DONE) {
+      fprintf(stderr, "export: read failed: %s\n", sqlite3_errmsg(db->conn));
+      return 0;
+   }
+
+   if (st->opts->format == EXPORT_JSON)
+      fputs("]}", out);
+
+   st->stats->decks++;
+   st->stats->cards += count;
+   return 1;
+}
+
+static int export_all_decks(FlashDb* db, ExportState* st) {
+   sqlite3_stmt* stmt = db_stmt_acquire(db, STMT_DECK_NAMES);
+   if (!stmt) {
+      fprintf(stderr, "export: prepare failed: %s\n", sqlite3_errmsg(db->conn));
+      return 0;
+   }
+
+   int ok = 1;
+   int rc;
+   while (ok && (rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+      ok = export_deck(db, st, sqlite3_column_int(stmt, 0),
+                       (const char*)sqlite3_column_text(stmt, 1),
+                       sqlite3_column_bytes(stmt, 1));
+   }
+   if (ok && rc != SQLITE_DONE) {
+      fprintf(stderr, "export: read failed: %s\n", sqlite3_errmsg(db->conn));
+      ok = 0;
+   }
+   db_stmt_release(db, STMT_DECK_NAMES);
+   return ok;
+}
+
+int export_cards(FlashDb* db, const char* path, const ExportOptions* opts, ExportStats* stats) {
+   ExportStats local_stats;
+   if (!stats) stats = &local_stats;
+   memset(stats, 0, sizeof(*stats));
+
+   int deck_id = 0;
+   if (opts->deck_name && !deck_exists(db, opts->deck_name, &deck_id)) {
+      fprintf(stderr, "export: deck '%s' does not exist\n", opts->deck_name);
+      return 0;
+   }
+
+   int use_stdout = strcmp(path, "-") == 0;
+   FILE* out = use_stdout ? stdout : fopen(path, "wb");
+   if (!out) {
+      fprintf(stderr, "export: cannot open '%s': %s\n", path, strerror(errno));
+      return 0;
+   }
+   setvbuf(out, out_buffer, _IOFBF, EXPORT_BUFFER_SIZE);
+
+   struct timespec start, end;
+   clock_gettime(CLOCK_MONOTONIC, &start);
+
+   ExportState st = {
+      .out = out,
+      .opts = opts,
+      .stats = stats,
+      .first_deck = 1,
+   };
+
+   // A single read transaction keeps the output consistent with concurrent edits
+   int ok = sqlite3_exec(db->conn, "BEGIN;", 0, 0, 0) == SQLITE_OK;
+   if (opts->format == EXPORT_TSV)
+      fputs(opts->deck_name ? "#separator:tab\n" : "#separator:tab\n#deck column:1\n", out);
+   else if (!opts->deck_name)
+      fputs("{\"decks\":[", out);
+
+   if (ok && opts->deck_name)
+      ok = export_deck(db, &st, deck_id, opts->deck_name, (int)strlen(opts->deck_name));
+   else if (ok)
+      ok = export_all_decks(db, &st);
+
+   if (opts->format == EXPORT_JSON)
+      fputs(opts->deck_name ? "\n" : "\n]}\n", out);
+   sqlite3_exec(db->conn, "COMMIT;", 0, 0, 0);
+
+   if (fflush(out) != 0 || ferror(out)) {
+      fprintf(stderr, "export: write failed: %s\n", strerror(errno));
+      ok = 0;
+   }
+   if (!use_stdout && fclose(out) != 0)
+      ok = 0;
+
+   clock_gettime(CLOCK_MONOTONIC, &end);
+   stats->seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+   return ok;
+}
@@ -0,0 +1,363 @@
+#include "../include/flash_db.h"
+#include "../include/remote.h"
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+typedef struct {
+   const char* name;
+   const char* sql;
+} StmtDef;
+
+static const StmtDef stmt_defs[STMT_COUNT] = {
+   [STMT_DECK_LIST]   = {"deck_list",   "SELECT id, name, card_count FROM decks ORDER BY name ASC;"},
+   [STMT_DECK_NAME]   = {"deck_name",   "SELECT name FROM decks WHERE id = ?;"},
+   [STMT_DECK_NAMES]  = {"deck_names",  "SELECT id, name FROM decks ORDER BY name ASC;"},
+   [STMT_DECK_CARDS]  = {"deck_cards",  "SELECT id, front, back FROM cards WHERE deck_id = ? ORDER BY id;"},
+   // Both read idx_cards_deck_id, whose entries are ordered by id within a deck
+   [STMT_DECK_CARD_IDS] = {"deck_card_ids", "SELECT id FROM cards WHERE deck_id = ? ORDER BY id;"},
+   [STMT_DECK_PAGE]   = {"deck_page",
+      "SELECT id, front, back FROM cards WHERE deck_id = ? AND id BETWEEN ? AND ? ORDER BY id;"},
+   [STMT_DECK_EXISTS] = {"deck_exists", "SELECT id FROM decks WHERE name = ? LIMIT 1;"},
+   [STMT_CREATE_DECK] = {"create_deck", "INSERT INTO decks (name) VALUES (?);"},
+   [STMT_DELETE_DECK] = {"delete_deck", "DELETE FROM decks WHERE id = ?;"},
+   // card_hash() is registered on every writing connection, see dedupe.c
+   [STMT_ADD_CARD]    = {"add_card",
+      "INSERT INTO cards (deck_id, front, back, front_hash) VALUES (?1, ?2, ?3, card_hash(?2));"},
+   [STMT_INSERT_CARD] = {"insert_card",
+      "INSERT INTO cards (id, deck_id, front, back, front_hash) VALUES (?1, ?2, ?3, ?4, card_hash(?3));"},
+   [STMT_DELETE_CARD] = {"delete_card", "DELETE FROM cards WHERE id = ?;"},
+   [STMT_UPDATE_CARD] = {"update_card",
+      "UPDATE cards SET front = ?1, back = ?2, front_hash = card_hash(?1) WHERE id = ?3;"},
+   [STMT_FIND_DUPLICATE] = {"find_duplicate",
+      "SELECT id, front, back FROM cards WHERE deck_id = ? AND front_hash = ? ORDER BY id;"},
+   [STMT_DUE_CARDS] = {"due_cards",
+      "SELECT c.id, s.due, s.interval, s.ease, s.reps, s.lapses "
+      "FROM cards c "
+      "LEFT JOIN card_schedule s ON s.card_id = c.id "
+      "WHERE c.deck_id = ? AND (s.due IS NULL OR s.due <= ?);"},
+   [STMT_CARD_TEXT] = {"card_text", "SELECT deck_id, front, back FROM cards WHERE id = ?;"},
+   [STMT_SAVE_SCHEDULE] = {"save_schedule",
+      "INSERT INTO card_schedule (card_id, due, interval, ease, reps, lapses) "
+      "VALUES (?, ?, ?, ?, ?, ?) "
+      "ON CONFLICT(card_id) DO UPDATE SET due = excluded.due, interval = excluded.interval, "
+      "ease = excluded.ease, reps = excluded.reps, lapses = excluded.lapses;"},
+   [STMT_LOG_REVIEW] = {"log_review",
+      "INSERT INTO review_log (card_id, deck_id, reviewed_at, day, correct, response_ms) "
+      "VALUES (?, ?, ?, ?, ?, ?);"},
+   // Rank and page inside the index first so only one page of rows is joined
+   [STMT_SEARCH_CARDS] = {"search_cards",
+      "WITH hits AS ("
+      "SELECT rowid, rank FROM cards_fts WHERE cards_fts MATCH ? ORDER BY rank LIMIT ? OFFSET ?) "
+      "SELECT c.id, c.deck_id, d.name, c.front, c.back "
+      "FROM hits "
+      "JOIN cards c ON c.id = hits.rowid "
+      "JOIN decks d ON d.id = c.deck_id "
+      "ORDER BY hits.rank;"},
+   // AUTOINCREMENT never hands out an id at or below seq, so raising it reserves ids
+   [STMT_CARD_SEQ] = {"card_seq",
+      "SELECT MAX(COALESCE((SELECT seq FROM sqlite_sequence WHERE name = 'cards'), 0), "
+      "COALESCE((SELECT MAX(id) FROM cards), 0));"},
+   [STMT_SET_CARD_SEQ]  = {"set_card_seq",  "UPDATE sqlite_sequence SET seq = ? WHERE name = 'cards';"},
+   [STMT_INIT_CARD_SEQ] = {"init_card_seq", "INSERT INTO sqlite_sequence (name, seq) VALUES ('cards', ?);"},
+   [STMT_BEGIN]       = {"begin",       "BEGIN IMMEDIATE;"},
+   [STMT_COMMIT]      = {"commit",      "COMMIT;"},
+   [STMT_ROLLBACK]    = {"rollback",    "ROLLBACK;"},
+};
+
+static unsigned long long now_ns(void) {
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+sqlite3_stmt* db_stmt_acquire(FlashDb* db, StmtId id) {
+   StmtCacheEntry* entry = &db->stmts[id];
+   unsigned long long start = now_ns();
+
+   if (entry->stmt) {
+      entry->hits++;
+   } else {
+      if (sqlite3_prepare_v3(db->conn, stmt_defs[id].sql, -1, SQLITE_PREPARE_PERSISTENT,
+                             &entry->stmt, NULL) != SQLITE_OK) {
+         entry->stmt = NULL;
+         return NULL;
+      }
+      entry->prepares++;
+   }
+
+   entry->started_ns = start;
+   return entry->stmt;
+}
+
+void db_stmt_release(FlashDb* db, StmtId id) {
+   StmtCacheEntry* entry = &db->stmts[id];
+   if (!entry->stmt)
+      return;
+
+   sqlite3_reset(entry->stmt);
+   sqlite3_clear_bindings(entry->stmt);
+
+   unsigned long long elapsed = now_ns() - entry->started_ns;
+   entry->total_ns += elapsed;
+   if (elapsed > entry->max_ns)
+      entry->max_ns = elapsed;
+}
+
+static int run_simple(FlashDb* db, StmtId id) {
+   sqlite3_stmt* stmt = db_stmt_acquire(db, id);
+   if (!stmt)
+      return 0;
+
+   int ok = sqlite3_step(stmt) == SQLITE_DONE;
+   db_stmt_release(db, id);
+   return ok;
+}
+
+int db_begin(FlashDb* db) {
+   return run_simple(db, STMT_BEGIN);
+}
+
+int db_commit(FlashDb* db) {
+   return run_simple(db, STMT_COMMIT);
+}
+
+int db_rollback(FlashDb* db) {
+   return run_simple(db, STMT_ROLLBACK);
+}
+
+const char* db_stmt_sql(StmtId id) {
+   return stmt_defs[id].sql;
+}
+
+const char* db_stmt_name(StmtId id) {
+   return stmt_defs[id].name;
+}
+
+void db_print_stmt_stats(const FlashDb* db, FILE* out) {
+   fprintf(out, "%-14s %8s %10s %12s %12s\n", "statement", "prepares", "hits", "avg_us", "max_us");
+   for (int i = 0; i < STMT_COUNT; i++) {
+      const StmtCacheEntry* entry = &db->stmts[i];
+      unsigned long calls = entry->prepares + entry->hits;
+      if (calls == 0)
+         continue;
+
+      fprintf(out, "%-14s %8lu %10lu %12.2f %12.2f\n",
+              stmt_defs[i].name,
+              entry->prepares,
+              entry->hits,
+              entry->total_ns / 1000.0 / calls,
+              entry->max_ns / 1000.0);
+   }
+}
+
+void db_set_message_sink(FlashDb* db, DbMessageSink sink, void* data) {
+   db->sink = sink;
+   db->sink_data = data;
+}
+
+void db_report(FlashDb* db, DbMessageLevel level, const char* message) {
+   if (db->sink)
+      db->sink(level, message, db->sink_data);
+   else if (level == DB_MSG_ERROR)
+      fprintf(stderr, "%s\n", message);
+}
+
+typedef enum {
+   SETTING_CACHE_SIZE,
+   SETTING_MMAP_SIZE,
+   SETTING_TEMP_STORE,
+   SETTING_SYNCHRONOUS,
+   SETTING_BACKUP_KEEP,
+   SETTING_BACKUP_INTERVAL,
+   SETTING_COUNT
+} SettingId;
+
+static const struct {
+   const char* key;           // in the config file, and the pragma name for pragmas
+   const char* env;
+   int pragma;                // applied to connections, rather than read by the app
+   const char* names[5];      // values that may be given by name, by their number
+} settings[SETTING_COUNT] = {
+   [SETTING_CACHE_SIZE]      = {"cache_size",      "FLASH_CARDS_CACHE_SIZE",      1, {NULL}},
+   [SETTING_MMAP_SIZE]       = {"mmap_size",       "FLASH_CARDS_MMAP_SIZE",       1, {NULL}},
+   [SETTING_TEMP_STORE]      = {"temp_store",      "FLASH_CARDS_TEMP_STORE",      1, {"default", "file", "memory", NULL}},
+   [SETTING_SYNCHRONOUS]     = {"synchronous",     "FLASH_CARDS_SYNCHRONOUS",     1, {"off", "normal", "full", "extra", NULL}},
+   [SETTING_BACKUP_KEEP]     = {"backup_keep",     "FLASH_CARDS_BACKUP_KEEP",     0, {NULL}},
+   [SETTING_BACKUP_INTERVAL] = {"backup_interval", "FLASH_CARDS_BACKUP_INTERVAL", 0, {"off", NULL}},
+};
+
+void db_default_config(DbConfig* config) {
+   *config = (DbConfig){
+      .cache_size = -8192,
+      .mmap_size = 256LL << 20,
+      .temp_store = 2,
+      .synchronous = 1,
+      .backup_keep = 5,
+      .backup_interval = 24,
+   };
+}
+
+static int parse_setting(DbConfig* config, SettingId id, const char* value) {
+   long long number = 0;
+   int named = 0;
+   for (int i = 0; settings[id].names[i]; i++) {
+      if (strcasecmp(value, settings[id].names[i]) == 0) {
+         number = i;
+         named = 1;
+      }
+   }
+   if (!named) {
+      char* end;
+      number = strtoll(value, &end, 10);
+      if (end == value || *end != '\0')
+         return 0;
+   }
+
+   switch (id) {
+      case SETTING_CACHE_SIZE:
+         if (number < -(1LL << 30) || number > (1LL << 30))
+            return 0;
+         config->cache_size = (int)number;
+         return 1;
+      case SETTING_MMAP_SIZE:
+         if (number < 0)
+            return 0;
+         config->mmap_size = number;
+         return 1;
+      case SETTING_TEMP_STORE:
+         if (number < 0 || number > 2)
+            return 0;
+         config->temp_store = (int)number;
+         return 1;
+      case SETTING_SYNCHRONOUS:
+         if (number < 0 || number > 3)
+            return 0;
+         config->synchronous = (int)number;
+         return 1;
+      case SETTING_BACKUP_KEEP:
+         if (number < 0 || number > 10000)
+            return 0;
+         config->backup_keep = (int)number;
+         return 1;
+      case SETTING_BACKUP_INTERVAL:
+         if (number < 0 || number > 24 * 366)
+            return 0;
+         config->backup_interval = (int)number;
+         return 1;
+      default:
+         return 0;
+   }
+}
+
+static char* trim(char* text) {
+   while (isspace((unsigned char)*text))
+      text++;
+   char* end = text + strlen(text);
+   while (end > text && isspace((unsigned char)end[-1]))
+      *--end = '\0';
+   return text;
+}
+
+static int load_config_file(DbConfig* config, const char* path) {
+   FILE* file = fopen(path, "r");
+   if (!file)
+      return 1;
+
+   int ok = 1;
+   char line[256];
+   for (int line_no = 1; fgets(line, sizeof(line), file); line_no++) {
+      char* comment = strchr(line, '#');
+      if (comment)
+         *comment = '\0';
+      char* key = trim(line);
+      if (*key == '\0')
+         continue;
+
+      char* eq = strchr(key, '=');
+      int id = SETTING_COUNT;
+      if (eq) {
+         *eq = '\0';
+         key = trim(key);
+         for (id = 0; id < SETTING_COUNT && strcmp(key, settings[id].key) != 0; id++)
+            ;
+      }
+      if (id == SETTING_COUNT) {
+         fprintf(stderr, "%s:%d: expected cache_size, mmap_size, temp_store, synchronous, "
+                 "backup_keep or backup_interval = VALUE\n",
+                 path, line_no);
+         ok = 0;
+      } else if (!parse_setting(config, id, trim(eq + 1))) {
+         fprintf(stderr, "%s:%d: invalid value for %s\n", path, line_no, key);
+         ok = 0;
+      }
+   }
+   fclose(file);
+   return ok;
+}
+
+int db_load_config(DbConfig* config, const char* path) {
+   int ok = load_config_file(config, path);
+   for (int id = 0; id < SETTING_COUNT; id++) {
+      const char* value = getenv(settings[id].env);
+      if (value && !parse_setting(config, id, value)) {
+         fprintf(stderr, "%s: invalid value '%s'\n", settings[id].env, value);
+         ok = 0;
+      }
+   }
+   return ok;
+}
+
+int db_apply_config(FlashDb* db) {
+   char sql[256];
+   snprintf(sql, sizeof(sql),
+            "PRAGMA cache_size = %d; PRAGMA mmap_size = %lld; "
+            "PRAGMA temp_store = %d; PRAGMA synchronous = %d;",
+            db->config.cache_size, db->config.mmap_size,
+            db->config.temp_store, db->config.synchronous);
+   return sqlite3_exec(db->conn, sql, 0, 0, 0) == SQLITE_OK;
+}
+
+// Read back from SQLite, so a value it capped (mmap_size has a compile time limit) shows as used
+void db_print_config(FlashDb* db, FILE* out) {
+   for (int id = 0; id < SETTING_COUNT; id++) {
+      if (!settings[id].pragma) {
+         int value = id == SETTING_BACKUP_KEEP ? db->config.backup_keep : db->config.backup_interval;
+         if (id == SETTING_BACKUP_INTERVAL && value == 0)
+            fprintf(out, "%-16s off (0)\n", settings[id].key);
+         else
+            fprintf(out, "%-16s %d\n", settings[id].key, value);
+         continue;
+      }
+      char sql[64];
+      snprintf(sql, sizeof(sql), "PRAGMA %s;", settings[id].key);
+      sqlite3_stmt* stmt;
+      if (sqlite3_prepare_v2(db->conn, sql, -1, &stmt, NULL) != SQLITE_OK)
+         continue;
+      if (sqlite3_step(stmt) == SQLITE_ROW) {
+         long long value = sqlite3_column_int64(stmt, 0);
+         const char* name = value >= 0 && value < 4 ? settings[id].names[value] : NULL;
+         if (name)
+            fprintf(out, "%-16s %s (%lld)\n", settings[id].key, name, value);
+         else
+            fprintf(out, "%-16s %lld\n", settings[id].key, value);
+      }
+      sqlite3_finalize(stmt);
+   }
+}
+
+void close_database(FlashDb* db) {
+   if (!db)
+      return;
+
+   for (int i = 0; i < STMT_COUNT; i++) {
+      sqlite3_finalize(db->stmts[i].stmt);
+      db->stmts[i].stmt = NULL;
+   }
+   remote_close(db);
+   sqlite3_close(db->conn);
+   free(db);
+}
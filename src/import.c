@@ -0,0 +1,711 @@
+#include "../include/import.h"
+#include "../include/db.h"
+#include "../include/trace.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+
+// Import runs as a pipeline. A reader thread reads the input and cuts it into
+// chunks at row ends, tracking quotes so a quoted newline never splits a row.
+// Worker threads parse and validate whole chunks in place, and the calling
+// thread, the only one touching the database, inserts them in file order.
+// Chunks circulate through a fixed ring, so a slow insert stalls the reader
+// instead of letting parsed rows pile up in memory.
+
+typedef enum {
+   CHUNK_FREE,
+   CHUNK_READ,              // waiting for a worker
+   CHUNK_PARSING,
+   CHUNK_PARSED             // waiting for the inserter
+} ChunkState;
+
+typedef struct {
+   const char* deck;        // NULL: the default deck
+   const char* front;
+   const char* back;
+   long long hash;          // card_text_hash(front), for the duplicate check
+} ImportRow;
+
+typedef struct {
+   ChunkState state;
+   char* data;              // whole rows, parsed in place into NUL terminated fields
+   size_t len;
+   size_t cap;              // one byte more than len can reach, for the last NUL
+   ImportRow* items;        // points into data
+   size_t count;
+   size_t capacity;
+   size_t skipped;
+   size_t invalid;
+} Chunk;
+
+// Quote state of the reader's scan, carried from one read into the next
+typedef struct {
+   int quoted;
+   int pending_quote;
+   int at_field_start;
+} RowScanner;
+
+typedef struct {
+   FILE* in;
+   const char* path;
+   int use_deck_column;     // no --deck, so a "#deck column:" header is honoured
+   char sep;                // both fixed once the headers are read, before the first chunk
+   int deck_column;         // 1-based column holding the deck name, 0: none
+   int headers_read;
+
+   pthread_mutex_t lock;
+   pthread_cond_t filled;   // a chunk was read, or reading finished or stopped
+   pthread_cond_t parsed;   // a chunk was parsed, or reading finished
+   pthread_cond_t freed;    // a chunk was inserted, or stop was set
+   Chunk* chunks;           // chunk n of the input lives at chunks[n % depth]
+   size_t depth;
+   size_t read_count;       // chunks handed out by the reader
+   size_t parse_next;       // next chunk for a worker
+   int read_done;
+   int read_failed;
+   int stop;                // the inserter gave up
+   size_t bytes;
+   unsigned long long read_ns;
+   unsigned long long parse_ns;
+} Pipeline;
+
+typedef struct {
+   FlashDb* db;
+   const ImportOptions* opts;
+   ImportStats* stats;
+   const char* default_deck;
+   int default_deck_id;
+   char* cached_deck;       // last deck name resolved from the deck column
+   int cached_deck_id;
+   size_t batch_count;      // writes in the open transaction
+   size_t batch_inserted;   // cards among them
+   int failed;
+} ImportState;
+
+static void handle_header(Pipeline* p, const char* line) {
+   if (strncmp(line, "#separator:", 11) == 0) {
+      const char* v = line + 11;
+      if (strcasecmp(v, "tab") == 0) p->sep = '\t';
+      else if (strcasecmp(v, "comma") == 0) p->sep = ',';
+      else if (strcasecmp(v, "semicolon") == 0) p->sep = ';';
+      else if (strcasecmp(v, "pipe") == 0) p->sep = '|';
+      else if (strcasecmp(v, "space") == 0) p->sep = ' ';
+      else if (strlen(v) == 1) p->sep = v[0];
+   } else if (strncmp(line, "#deck column:", 13) == 0 && p->use_deck_column) {
+      p->deck_column = atoi(line + 13);
+   }
+}
+
+// Anki style file headers are the '#' lines before the first card. They change
+// how the rest is split, so they are read before anything is scanned.
+// Returns the number of bytes they take.
+static size_t read_headers(Pipeline* p, char* data, size_t len) {
+   size_t pos = 0;
+   while (pos < len && data[pos] == '#') {
+      char* nl = memchr(data + pos, '\n', len - pos);
+      size_t end = nl ? (size_t)(nl - data) : len;
+      char* line = data + pos;
+      line[end - pos] = '\0'; // the header is the first field of its row
+      char* sep = strchr(line, p->sep);
+      if (sep)
+         *sep = '\0';
+      line[strcspn(line, "\r")] = '\0';
+      handle_header(p, line);
+      pos = nl ? end + 1 : len;
+   }
+   return pos;
+}
+
+// Follow quotes over data[from, to), setting *row_end past every newline that
+// ends a row. Mirrors the quote rules of parse_row.
+static void scan_rows(RowScanner* s, char sep, const char* data, size_t from, size_t to, size_t* row_end) {
+   for (size_t i = from; i < to; i++) {
+      char c = data[i];
+
+      if (s->quoted) {
+         if (s->pending_quote) {
+            s->pending_quote = 0;
+            if (c == '"')
+               continue;
+            s->quoted = 0; // closing quote, handle c as unquoted below
+         } else {
+            if (c == '"')
+               s->pending_quote = 1;
+            continue;
+         }
+      }
+
+      if (c == '"' && s->at_field_start) {
+         s->quoted = 1;
+         s->at_field_start = 0;
+      } else if (c == sep) {
+         s->at_field_start = 1;
+      } else if (c == '\n') {
+         s->at_field_start = 1;
+         *row_end = i + 1;
+      } else if (c != '\r') {
+         s->at_field_start = 0;
+      }
+   }
+}
+
+static int grow_chunk(Chunk* c, size_t cap) {
+   if (c->cap >= cap)
+      return 1;
+   char* data = realloc(c->data, cap);
+   if (!data)
+      return 0;
+   c->data = data;
+   c->cap = cap;
+   return 1;
+}
+
+// Fill c with whole rows: the carried over tail of the last read, then reads
+// of IMPORT_CHUNK_SIZE until at least one row ends (or the input does).
+// Whatever follows the last row end is moved to carry.
+static int read_chunk(Pipeline* p, RowScanner* scanner, Chunk* c, char** carry, size_t* carry_len, int* eof) {
+   c->len = 0;
+   if (!grow_chunk(c, *carry_len + IMPORT_CHUNK_SIZE + 1))
+      return 0;
+   if (*carry_len > 0)
+      memcpy(c->data, *carry, *carry_len);
+   c->len = *carry_len;
+   size_t scanned = c->len;   // the carry was scanned last time
+   size_t row_end = 0;
+
+   while (row_end == 0 && !*eof) {
+      if (!grow_chunk(c, c->len + IMPORT_CHUNK_SIZE + 1))
+         return 0;
+      size_t n = fread(c->data + c->len, 1, IMPORT_CHUNK_SIZE, p->in);
+      if (n < IMPORT_CHUNK_SIZE) {
+         if (ferror(p->in)) {
+            fprintf(stderr, "import: read error on '%s': %s\n", p->path, strerror(errno));
+            return 0;
+         }
+         *eof = 1;
+      }
+      p->bytes += n;
+
+      if (!p->headers_read) {
+         p->headers_read = 1;
+         size_t skip = read_headers(p, c->data, n);
+         memmove(c->data, c->data + skip, n - skip);
+         n -= skip;
+      }
+      c->len += n;
+      scan_rows(scanner, p->sep, c->data, scanned, c->len, &row_end);
+      scanned = c->len;
+   }
+
+   // The last row of the input may have no newline
+   if (*eof)
+      row_end = c->len;
+
+   *carry_len = c->len - row_end;
+   if (*carry_len > 0) {
+      char* tail = realloc(*carry, *carry_len);
+      if (!tail)
+         return 0;
+      *carry = tail;
+      memcpy(*carry, c->data + row_end, *carry_len);
+   }
+   c->len = row_end;
+   return 1;
+}
+
+static void* reader_main(void* arg) {
+   Pipeline* p = arg;
+   trace_set_thread_name("import reader");
+   RowScanner scanner = { .at_field_start = 1 };
+   char* carry = NULL;
+   size_t carry_len = 0;
+   int eof = 0;
+   int ok = 1;
+
+   while (ok && !eof) {
+      pthread_mutex_lock(&p->lock);
+      Chunk* c = &p->chunks[p->read_count % p->depth];
+      while (c->state != CHUNK_FREE && !p->stop)
+         pthread_cond_wait(&p->freed, &p->lock);
+      int stop = p->stop;
+      pthread_mutex_unlock(&p->lock);
+      if (stop)
+         break;
+
+      unsigned long long start = trace_now_ns();
+      ok = read_chunk(p, &scanner, c, &carry, &carry_len, &eof);
+      unsigned long long end = trace_now_ns();
+      if (trace_enabled)
+         trace_record(TRACE_IMPORT_READ, start, end);
+      if (!ok || c->len == 0)
+         continue;
+
+      pthread_mutex_lock(&p->lock);
+      c->state = CHUNK_READ;
+      p->read_count++;
+      p->read_ns += end - start;
+      pthread_cond_signal(&p->filled);
+      pthread_mutex_unlock(&p->lock);
+   }
+
+   pthread_mutex_lock(&p->lock);
+   if (!ok)
+      p->read_failed = 1;
+   p->read_done = 1;
+   pthread_cond_broadcast(&p->filled);
+   pthread_cond_signal(&p->parsed);
+   pthread_mutex_unlock(&p->lock);
+   free(carry);
+   return NULL;
+}
+
+// Parse the row at *pos in place: quotes are dropped, "" becomes ", and each
+// field is NUL terminated where it ends. Fields may be wrapped in double quotes
+// to carry separators and newlines, which is what both RFC 4180 CSV and Anki's
+// text export produce. Columns past IMPORT_MAX_FIELDS are dropped.
+// data[len] must be writable. Returns the number of fields, 0 for no row.
+static int parse_row(char* data, size_t len, char sep, size_t* pos, char** fields) {
+   size_t r = *pos;
+   size_t w = r;           // never passes r, unescaping only shrinks the text
+   size_t field_start = w;
+   int nfields = 0;
+   int quoted = 0;
+   int at_field_start = 1;
+   int row_ended = 0;
+   fields[0] = data + w;
+
+   while (r < len && !row_ended) {
+      char c = data[r++];
+
+      if (quoted) {
+         if (c != '"') {
+            data[w++] = c;
+         } else if (r < len && data[r] == '"') {
+            data[w++] = '"';
+            r++;
+         } else {
+            quoted = 0; // closing quote
+         }
+         continue;
+      }
+
+      if (c == '"' && at_field_start) {
+         quoted = 1;
+         at_field_start = 0;
+      } else if (c == sep || c == '\n') {
+         if (nfields < IMPORT_MAX_FIELDS) {
+            data[w++] = '\0';
+            nfields++;
+            if (nfields < IMPORT_MAX_FIELDS)
+               fields[nfields] = data + w;
+         } else {
+            w = field_start;
+         }
+         field_start = w;
+         at_field_start = 1;
+         row_ended = c == '\n';
+      } else if (c != '\r') {
+         data[w++] = c;
+         at_field_start = 0;
+      }
+   }
+
+   // Last row without a trailing newline
+   if (!row_ended && (w > field_start || nfields > 0) && nfields < IMPORT_MAX_FIELDS) {
+      data[w] = '\0';
+      nfields++;
+   }
+
+   *pos = r;
+   return nfields;
+}
+
+static int utf8_valid(const char* s) {
+   const unsigned char* p = (const unsigned char*)s;
+   while (*p) {
+      if (*p < 0x80) {
+         p++;
+         continue;
+      }
+      int extra;
+      unsigned int cp;
+      if ((*p & 0xE0) == 0xC0) { extra = 1; cp = *p & 0x1F; }
+      else if ((*p & 0xF0) == 0xE0) { extra = 2; cp = *p & 0x0F; }
+      else if ((*p & 0xF8) == 0xF0) { extra = 3; cp = *p & 0x07; }
+      else return 0;
+      for (int i = 1; i <= extra; i++) {
+         if ((p[i] & 0xC0) != 0x80)
+            return 0;
+         cp = (cp << 6) | (p[i] & 0x3F);
+      }
+      // Overlong forms, UTF-16 surrogates and code points past U+10FFFF
+      static const unsigned int min_cp[] = {0, 0x80, 0x800, 0x10000};
+      if (cp < min_cp[extra] || (cp >= 0xD800 && cp <= 0xDFFF) || cp > 0x10FFFF)
+         return 0;
+      p += extra + 1;
+   }
+   return 1;
+}
+
+static void parse_chunk(const Pipeline* p, Chunk* c) {
+   c->count = 0;
+   c->skipped = 0;
+   c->invalid = 0;
+
+   char* fields[IMPORT_MAX_FIELDS];
+   size_t pos = 0;
+   while (pos < c->len) {
+      int nfields = parse_row(c->data, c->len, p->sep, &pos, fields);
+      if (nfields == 0)
+         continue;
+
+      const char* cols[IMPORT_MAX_FIELDS];
+      int ncols = 0;
+      const char* deck_name = NULL;
+      for (int i = 0; i < nfields; i++) {
+         if (i + 1 == p->deck_column)
+            deck_name = fields[i];
+         else
+            cols[ncols++] = fields[i];
+      }
+
+      if (ncols < 2 || cols[0][0] == '\0' || cols[1][0] == '\0') {
+         int blank_line = nfields == 1 && fields[0][0] == '\0';
+         if (!blank_line)
+            c->skipped++;
+         continue;
+      }
+      if (!utf8_valid(cols[0]) || !utf8_valid(cols[1]) || (deck_name && !utf8_valid(deck_name))) {
+         c->invalid++;
+         continue;
+      }
+
+      ImportRow row = {
+         .deck = deck_name && deck_name[0] ? deck_name : NULL,
+         .front = cols[0],
+         .back = cols[1],
+         .hash = card_text_hash(cols[0]),
+      };
+      da_append(c, row);
+   }
+}
+
+static void* worker_main(void* arg) {
+   Pipeline* p = arg;
+   trace_set_thread_name("import worker");
+
+   pthread_mutex_lock(&p->lock);
+   for (;;) {
+      while (!p->stop && p->parse_next == p->read_count && !p->read_done)
+         pthread_cond_wait(&p->filled, &p->lock);
+      if (p->stop || p->parse_next == p->read_count)
+         break;
+
+      Chunk* c = &p->chunks[p->parse_next++ % p->depth];
+      c->state = CHUNK_PARSING;
+      pthread_mutex_unlock(&p->lock);
+
+      unsigned long long start = trace_now_ns();
+      parse_chunk(p, c);
+      unsigned long long end = trace_now_ns();
+      if (trace_enabled)
+         trace_record(TRACE_IMPORT_PARSE, start, end);
+
+      pthread_mutex_lock(&p->lock);
+      c->state = CHUNK_PARSED;
+      p->parse_ns += end - start;
+      pthread_cond_signal(&p->parsed);
+   }
+   pthread_mutex_unlock(&p->lock);
+   return NULL;
+}
+
+static int resolve_deck(ImportState* st, const char* name, int* deck_id) {
+   if (st->cached_deck && strcmp(st->cached_deck, name) == 0) {
+      *deck_id = st->cached_deck_id;
+      return 1;
+   }
+   if (!get_or_create_deck(st->db, name, deck_id))
+      return 0;
+
+   free(st->cached_deck);
+   st->cached_deck = strdup(name);
+   st->cached_deck_id = *deck_id;
+   return 1;
+}
+
+static int commit_batch(ImportState* st) {
+   if (sqlite3_get_autocommit(st->db->conn))
+      return 1;
+   if (!db_commit(st->db)) {
+      fprintf(stderr, "import: commit failed: %s\n", sqlite3_errmsg(st->db->conn));
+      return 0;
+   }
+   st->stats->batches += st->batch_count > 0;
+   st->batch_count = 0;
+   st->batch_inserted = 0;
+   return 1;
+}
+
+// Add the back of a duplicate row to the card that has its front
+static void merge_row(ImportState* st, const Cards* existing, const char* back) {
+   char* merged = merge_backs(existing->back, back);
+   if (!merged)
+      return;
+
+   sqlite3_stmt* stmt = db_stmt_acquire(st->db, STMT_UPDATE_CARD);
+   if (!stmt) {
+      fprintf(stderr, "import: prepare failed: %s\n", sqlite3_errmsg(st->db->conn));
+      st->failed = 1;
+      free(merged);
+      return;
+   }
+   sqlite3_bind_text(stmt, 1, existing->front, -1, SQLITE_STATIC);
+   sqlite3_bind_text(stmt, 2, merged, -1, SQLITE_STATIC);
+   sqlite3_bind_int(stmt, 3, existing->id);
+   if (sqlite3_step(stmt) != SQLITE_DONE) {
+      fprintf(stderr, "import: merge failed: %s\n", sqlite3_errmsg(st->db->conn));
+      st->failed = 1;
+   }
+   db_stmt_release(st->db, STMT_UPDATE_CARD);
+   free(merged);
+   if (st->failed)
+      return;
+
+   st->stats->merged++;
+   if (++st->batch_count >= st->opts->batch_rows && !commit_batch(st))
+      st->failed = 1;
+}
+
+static void insert_row(ImportState* st, const ImportRow* row) {
+   int deck_id = st->default_deck_id;
+   if (row->deck) {
+      if (!resolve_deck(st, row->deck, &deck_id)) {
+         fprintf(stderr, "import: cannot create deck '%s': %s\n", row->deck, sqlite3_errmsg(st->db->conn));
+         st->failed = 1;
+         return;
+      }
+   } else if (deck_id <= 0) {
+      if (!get_or_create_deck(st->db, st->default_deck, &st->default_deck_id)) {
+         fprintf(stderr, "import: cannot create deck '%s': %s\n", st->default_deck, sqlite3_errmsg(st->db->conn));
+         st->failed = 1;
+         return;
+      }
+      deck_id = st->default_deck_id;
+   }
+
+   // A batch of only skipped duplicates leaves the transaction open and empty
+   if (sqlite3_get_autocommit(st->db->conn) && !db_begin(st->db)) {
+      fprintf(stderr, "import: begin failed: %s\n", sqlite3_errmsg(st->db->conn));
+      st->failed = 1;
+      return;
+   }
+
+   if (st->opts->duplicates != DUP_KEEP) {
+      Cards existing;
+      if (find_duplicate_card(st->db, deck_id, row->front, row->hash, &existing)) {
+         st->stats->duplicates++;
+         if (st->opts->duplicates == DUP_MERGE)
+            merge_row(st, &existing, row->back);
+         free(existing.front);
+         free(existing.back);
+         return;
+      }
+   }
+
+   sqlite3_stmt* stmt = db_stmt_acquire(st->db, STMT_ADD_CARD);
+   if (!stmt) {
+      fprintf(stderr, "import: prepare failed: %s\n", sqlite3_errmsg(st->db->conn));
+      st->failed = 1;
+      return;
+   }
+   sqlite3_bind_int(stmt, 1, deck_id);
+   sqlite3_bind_text(stmt, 2, row->front, -1, SQLITE_STATIC);
+   sqlite3_bind_text(stmt, 3, row->back, -1, SQLITE_STATIC);
+   if (sqlite3_step(stmt) != SQLITE_DONE) {
+      fprintf(stderr, "import: insert failed: %s\n", sqlite3_errmsg(st->db->conn));
+      st->failed = 1;
+   }
+   db_stmt_release(st->db, STMT_ADD_CARD);
+   if (st->failed)
+      return;
+
+   st->stats->rows++;
+   st->batch_inserted++;
+   if (++st->batch_count >= st->opts->batch_rows && !commit_batch(st))
+      st->failed = 1;
+}
+
+// The insert stage, on the calling thread: takes parsed chunks in file order
+static void insert_chunks(Pipeline* p, ImportState* st) {
+   size_t next = 0;
+   unsigned long long wait_ns = 0;
+   unsigned long long insert_ns = 0;
+
+   pthread_mutex_lock(&p->lock);
+   for (;;) {
+      Chunk* c = &p->chunks[next % p->depth];
+      unsigned long long wait_start = trace_now_ns();
+      while (!(next < p->read_count && c->state == CHUNK_PARSED) && !(p->read_done && next == p->read_count))
+         pthread_cond_wait(&p->parsed, &p->lock);
+      wait_ns += trace_now_ns() - wait_start;
+      if (next == p->read_count)
+         break;
+      pthread_mutex_unlock(&p->lock);
+
+      unsigned long long start = trace_now_ns();
+      st->stats->skipped += c->skipped;
+      st->stats->invalid += c->invalid;
+      for (size_t i = 0; i < c->count && !st->failed; i++)
+         insert_row(st, &c->items[i]);
+      unsigned long long end = trace_now_ns();
+      if (trace_enabled)
+         trace_record(TRACE_IMPORT_INSERT, start, end);
+      insert_ns += end - start;
+
+      pthread_mutex_lock(&p->lock);
+      c->state = CHUNK_FREE;
+      next++;
+      if (st->failed) {
+         p->stop = 1;
+         pthread_cond_broadcast(&p->filled);
+         pthread_cond_signal(&p->freed);
+         break;
+      }
+      pthread_cond_signal(&p->freed);
+   }
+   pthread_mutex_unlock(&p->lock);
+
+   st->stats->insert_seconds = insert_ns / 1e9;
+   st->stats->wait_seconds = wait_ns / 1e9;
+}
+
+static char guess_separator(const char* path) {
+   const char* ext = strrchr(path, '.');
+   if (ext && strcasecmp(ext, ".csv") == 0)
+      return ',';
+   return '\t';
+}
+
+static char* deck_name_from_path(const char* path) {
+   const char* base = strrchr(path, '/');
+   base = base ? base + 1 : path;
+
+   char* name = strdup(base);
+   char* ext = strrchr(name, '.');
+   if (ext && ext != name)
+      *ext = '\0';
+   return name;
+}
+
+static int default_jobs(void) {
+   long cores = sysconf(_SC_NPROCESSORS_ONLN);
+   return cores > 0 ? (int)cores : 1;
+}
+
+int import_cards(FlashDb* db, const char* path, const ImportOptions* opts, ImportStats* stats) {
+   ImportOptions defaults = {0};
+   ImportStats local_stats;
+   if (!opts) opts = &defaults;
+   if (!stats) stats = &local_stats;
+   memset(stats, 0, sizeof(*stats));
+
+   ImportOptions resolved = *opts;
+   if (resolved.batch_rows == 0)
+      resolved.batch_rows = IMPORT_BATCH_ROWS;
+   if (resolved.jobs <= 0)
+      resolved.jobs = default_jobs();
+   if (resolved.jobs > IMPORT_MAX_JOBS)
+      resolved.jobs = IMPORT_MAX_JOBS;
+
+   int use_stdin = strcmp(path, "-") == 0;
+   FILE* in = use_stdin ? stdin : fopen(path, "rb");
+   if (!in) {
+      fprintf(stderr, "import: cannot open '%s': %s\n", path, strerror(errno));
+      return 0;
+   }
+
+   char* default_deck = resolved.deck_name ? strdup(resolved.deck_name)
+                                           : deck_name_from_path(use_stdin ? "stdin" : path);
+   ImportState st = {
+      .db = db,
+      .opts = &resolved,
+      .stats = stats,
+      .default_deck = default_deck,
+   };
+
+   // Two chunks per worker keep every worker busy while the inserter drains one
+   Pipeline p = {
+      .in = in,
+      .path = path,
+      .use_deck_column = !resolved.deck_name,
+      .sep = resolved.separator ? resolved.separator : guess_separator(path),
+      .depth = 2 * (size_t)resolved.jobs + 2,
+   };
+   p.chunks = calloc(p.depth, sizeof(Chunk));
+   pthread_mutex_init(&p.lock, NULL);
+   pthread_cond_init(&p.filled, NULL);
+   pthread_cond_init(&p.parsed, NULL);
+   pthread_cond_init(&p.freed, NULL);
+
+   unsigned long long start = trace_now_ns();
+
+   pthread_t reader;
+   pthread_t workers[IMPORT_MAX_JOBS];
+   int started = 0;
+   int reader_started = 0;
+   if (p.chunks) {
+      while (started < resolved.jobs && pthread_create(&workers[started], NULL, worker_main, &p) == 0)
+         started++;
+      reader_started = started > 0 && pthread_create(&reader, NULL, reader_main, &p) == 0;
+   }
+
+   if (reader_started) {
+      insert_chunks(&p, &st);
+   } else {
+      fprintf(stderr, "import: cannot start the import threads\n");
+      st.failed = 1;
+      pthread_mutex_lock(&p.lock);
+      p.stop = 1;
+      pthread_cond_broadcast(&p.filled);
+      pthread_mutex_unlock(&p.lock);
+   }
+
+   if (reader_started)
+      pthread_join(reader, NULL);
+   for (int i = 0; i < started; i++)
+      pthread_join(workers[i], NULL);
+   if (p.read_failed)
+      st.failed = 1;
+
+   if (!st.failed && !commit_batch(&st))
+      st.failed = 1;
+   if (st.failed && !sqlite3_get_autocommit(db->conn)) {
+      db_rollback(db);
+      stats->rows -= st.batch_inserted;
+   }
+
+   stats->seconds = (trace_now_ns() - start) / 1e9;
+   stats->bytes = p.bytes;
+   stats->jobs = started;
+   stats->read_seconds = p.read_ns / 1e9;
+   stats->parse_seconds = p.parse_ns / 1e9;
+
+   for (size_t i = 0; p.chunks && i < p.depth; i++) {
+      free(p.chunks[i].data);
+      free(p.chunks[i].items);
+   }
+   free(p.chunks);
+   pthread_mutex_destroy(&p.lock);
+   pthread_cond_destroy(&p.filled);
+   pthread_cond_destroy(&p.parsed);
+   pthread_cond_destroy(&p.freed);
+   free(st.cached_deck);
+   free(default_deck);
+   if (!use_stdin)
+      fclose(in);
+   return !st.failed;
+}
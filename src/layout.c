@@ -0,0 +1,226 @@
+#define _XOPEN_SOURCE 700   // wcwidth
+#include "../include/layout.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+
+// The prefetch worker warms layouts while the UI thread draws them, so the
+// cache is shared. Wrapping happens outside the lock; only lookups take it.
+static TextLayout cache[LAYOUT_CACHE_SIZE];
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long tick;
+static unsigned long long hits;
+static unsigned long long misses;
+
+size_t layout_char(const char* text, size_t len, int* columns) {
+   unsigned char c = (unsigned char)*text;
+   if (c < 0x80) {
+      *columns = 1;  // control characters are drawn as a space
+      return 1;
+   }
+
+   mbstate_t state;
+   memset(&state, 0, sizeof(state));
+   wchar_t wc;
+   size_t n = mbrtowc(&wc, text, len, &state);
+   if (n == (size_t)-1 || n == (size_t)-2 || n == 0) {
+      *columns = 1;
+      return 1;
+   }
+   int w = wcwidth(wc);
+   *columns = w < 0 ? 1 : w;
+   return n;
+}
+
+static int push_line(LayoutLine** lines, int* count, int* capacity, size_t start, size_t end, int columns) {
+   if (*count == *capacity) {
+      int grown = *capacity ? *capacity * 2 : 8;
+      LayoutLine* tmp = realloc(*lines, grown * sizeof(**lines));
+      if (!tmp)
+         return 0;
+      *lines = tmp;
+      *capacity = grown;
+   }
+   (*lines)[(*count)++] = (LayoutLine){ (int)start, (int)(end - start), columns };
+   return 1;
+}
+
+int layout_wrap(const char* text, int width, LayoutLine** lines, int* count) {
+   if (width < 1)
+      width = 1;
+   size_t len = strlen(text);
+   LayoutLine* out = NULL;
+   int n = 0, capacity = 0;
+
+   size_t pos = 0;
+   while (1) {
+      size_t start = pos;
+      int columns = 0;
+      int have_break = 0;          // a space was seen, the line can end before it
+      size_t break_end = 0, break_next = 0;
+      int break_columns = 0;
+      size_t end, next;
+      int end_columns, wrapped = 0;
+
+      while (1) {
+         if (pos >= len || text[pos] == '\n') {
+            end = pos;
+            end_columns = columns;
+            next = pos < len ? pos + 1 : pos;
+            break;
+         }
+
+         int w;
+         size_t step = layout_char(text + pos, len - pos, &w);
+         if (text[pos] == ' ' && pos > start) {
+            have_break = 1;
+            break_end = pos;
+            break_columns = columns;
+            break_next = pos + 1;
+         }
+
+         // The first character always goes in, so a line makes progress even
+         // when one character is wider than the whole line
+         if (columns + w > width && columns > 0) {
+            wrapped = 1;
+            if (have_break) {
+               end = break_end;
+               end_columns = break_columns;
+               next = break_next;
+            } else { // one word wider than the line, split it
+               end = pos;
+               end_columns = columns;
+               next = pos;
+            }
+            break;
+         }
+         columns += w;
+         pos += step;
+      }
+
+      if (!push_line(&out, &n, &capacity, start, end, end_columns)) {
+         free(out);
+         return 0;
+      }
+
+      // A wrapped line does not carry its spaces over to the next one
+      if (wrapped) {
+         while (next < len && text[next] == ' ')
+            next++;
+      }
+      // A trailing '\n' does not start an empty last line
+      pos = next;
+      if (pos >= len)
+         break;
+   }
+
+   *lines = out;
+   *count = n;
+   return 1;
+}
+
+static unsigned hash_text(const char* text, size_t* length) {
+   unsigned hash = 2166136261u;
+   const unsigned char* p = (const unsigned char*)text;
+   for (; *p; p++) {
+      hash ^= *p;
+      hash *= 16777619u;
+   }
+   *length = (size_t)(p - (const unsigned char*)text);
+   return hash;
+}
+
+static TextLayout* find(int card_id, int width, size_t length, unsigned hash) {
+   for (int i = 0; i < LAYOUT_CACHE_SIZE; i++) {
+      TextLayout* l = &cache[i];
+      if (l->last_used && l->card_id == card_id && l->width == width &&
+          l->length == length && l->hash == hash)
+         return l;
+   }
+   return NULL;
+}
+
+const TextLayout* layout_acquire(int card_id, const char* text, int width) {
+   size_t length;
+   unsigned hash = hash_text(text, &length);
+
+   pthread_mutex_lock(&cache_lock);
+   TextLayout* found = find(card_id, width, length, hash);
+   if (found) {
+      found->pins++;
+      found->last_used = ++tick;
+      hits++;
+      pthread_mutex_unlock(&cache_lock);
+      return found;
+   }
+   misses++;
+   pthread_mutex_unlock(&cache_lock);
+
+   LayoutLine* lines;
+   int count;
+   if (!layout_wrap(text, width, &lines, &count))
+      return NULL;
+
+   pthread_mutex_lock(&cache_lock);
+   // Another thread may have laid out the same text meanwhile
+   TextLayout* slot = find(card_id, width, length, hash);
+   if (slot) {
+      free(lines);
+   } else {
+      for (int i = 0; i < LAYOUT_CACHE_SIZE; i++) {
+         TextLayout* l = &cache[i];
+         if (l->pins == 0 && (!slot || l->last_used < slot->last_used))
+            slot = l;
+      }
+      if (!slot) { // everything pinned, which only a leaked pin can cause
+         pthread_mutex_unlock(&cache_lock);
+         free(lines);
+         return NULL;
+      }
+      free(slot->lines);
+      *slot = (TextLayout){
+         .card_id = card_id,
+         .width = width,
+         .length = length,
+         .hash = hash,
+         .lines = lines,
+         .count = count,
+      };
+   }
+   slot->pins++;
+   slot->last_used = ++tick;
+   pthread_mutex_unlock(&cache_lock);
+   return slot;
+}
+
+void layout_release(const TextLayout* layout) {
+   if (!layout)
+      return;
+   pthread_mutex_lock(&cache_lock);
+   ((TextLayout*)layout)->pins--;
+   pthread_mutex_unlock(&cache_lock);
+}
+
+void layout_warm(int card_id, const char* text, int width) {
+   layout_release(layout_acquire(card_id, text, width));
+}
+
+void layout_print_stats(FILE* out) {
+   pthread_mutex_lock(&cache_lock);
+   if (hits + misses > 0) {
+      fprintf(out, "layout: %llu lookups, %llu laid out (%.1f%% hit rate)\n",
+              hits + misses, misses, 100.0 * hits / (hits + misses));
+   }
+   pthread_mutex_unlock(&cache_lock);
+}
+
+void layout_cache_free(void) {
+   pthread_mutex_lock(&cache_lock);
+   for (int i = 0; i < LAYOUT_CACHE_SIZE; i++) {
+      free(cache[i].lines);
+      cache[i] = (TextLayout){0};
+   }
+   pthread_mutex_unlock(&cache_lock);
+}
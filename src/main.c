@@ -1,20 +1,100 @@
 #include "../include/db.h"
 #include "../include/tui.h"
+#include "../include/cli.h"
+#include "../include/render.h"
+#include "../include/writer.h"
+#include "../include/prefetch.h"
+#include "../include/trace.h"
+#include "../include/layout.h"
+#include "../include/dedupe.h"
+#include "../include/backup.h"
+#include "../include/remote.h"
+#include "../include/protocol.h"
+#include <linux/limits.h>
+#include <locale.h>
 #include <ncurses.h>
 
 void deck_wizard(WINDOW* deck_win, const int deck_id);
+static int report_write_errors(void);
+static void report_backup(void);
+static void print_startup_stats(void);
 
 extern const char* main_menu_choices[];
 extern const char* deck_actions_menu_choices[];
+extern const char* duplicate_menu_choices[];
 
-sqlite3* db;
+FlashDb* db;
+static Backup* auto_backup;   // snapshot taken in the background at startup, NULL once reported
 
-int main() {
-   // Set up DB
-   setup_database(&db);
+// When each startup stage finished, for the --stats startup line
+static struct {
+   unsigned long long launch_ns;
+   unsigned long long open_ns;
+   unsigned long long writer_ns;
+   unsigned long long terminal_ns;
+} startup;
 
-   // Set up screen
-   initscr();
+int main(int argc, char** argv) {
+   startup.launch_ns = trace_now_ns();
+   // Card text is measured in display columns, which needs the terminal's encoding
+   setlocale(LC_ALL, "");
+
+   // Options before the command: --stats reports on exit (as FLASH_CARDS_STATS=1 does),
+   // --trace FILE also writes a Chrome trace
+   int stats = getenv("FLASH_CARDS_STATS") != NULL;
+   const char* trace_path = NULL;
+   int skip = 0;
+   while (skip + 1 < argc) {
+      if (strcmp(argv[skip + 1], "--stats") == 0) {
+         stats = 1;
+         skip++;
+      } else if (strcmp(argv[skip + 1], "--trace") == 0 && skip + 2 < argc) {
+         trace_path = argv[skip + 2];
+         skip += 2;
+      } else {
+         break;
+      }
+   }
+   argc -= skip;
+   argv += skip;
+   if (stats || trace_path)
+      trace_init(trace_path ? TRACE_STATS | TRACE_EVENTS : TRACE_STATS, trace_path);
+
+   // Set up DB. The TUI uses flash-cardsd when one is running, so several
+   // terminals share its cache and writer; subcommands always open the file.
+   char socket_path[PATH_MAX];
+   if (argc > 1 || !proto_socket_path(socket_path, sizeof(socket_path)) ||
+       !remote_connect(&db, socket_path))
+      setup_database(&db);
+   startup.open_ns = trace_now_ns();
+
+   // Subcommands run without touching the terminal
+   if (argc > 1) {
+      int status = run_cli(db, argc, argv);
+      if (stats)
+         trace_print_report(stderr);
+      if (!trace_finish())
+         fprintf(stderr, "Could not write trace to %s\n", trace_path);
+      close_database(db);
+      return status;
+   }
+
+   // Card and review writes go to a background thread unless FLASH_CARDS_SYNC_WRITES is set.
+   // A daemon batches them itself.
+   if (!db->remote && !getenv("FLASH_CARDS_SYNC_WRITES") && !writer_start(db))
+      fprintf(stderr, "Background writer unavailable, writing inline\n");
+   startup.writer_ns = trace_now_ns();
+
+   // Set up screen, counting what is sent to the terminal only when it is reported
+   if (!render_init(stats)) {
+      fprintf(stderr, "Unable to initialise the terminal\n");
+      writer_stop(db);
+      close_database(db);
+      return 1;
+   }
+   startup.terminal_ns = trace_now_ns();
+   // From here on data layer messages are shown on screen instead of stderr
+   db_set_message_sink(db, tui_message_sink, NULL);
    set_escdelay(10);
    cbreak();
    noecho();
@@ -28,24 +108,31 @@ int main() {
 
    WINDOW* menu_win = newwin(height, width, MAIN_MENU_Y, MAIN_MENU_X);
 
+   // Its own connection reads a WAL snapshot, so studying goes on while it copies
+   if (backup_due(db, time(NULL)))
+      auto_backup = backup_start(db, NULL);
+
    // Main loop for user interaction
    int running = 1;
    while (running) {
-      int choice = draw_menu(menu_win, main_menu_choices, 4, "Main Menu");
-      char input1[MAX_BUFFER];
-      char input2[MAX_BUFFER];
+      report_write_errors();
+      report_backup();
+      int choice = draw_menu(menu_win, main_menu_choices, 6, "Main Menu");
+      char* name = NULL;
       Deck decks = {0};
       DeckInfoList deck_info = {0};
 
       switch(choice) {
          case 0: { // create deck
-            form_input(stdscr, DECKC_PROMPT, input1, MAX_BUFFER, 1);
-            if (strlen(input1) == 0) {
+            name = form_input(stdscr, DECKC_PROMPT, NULL, EDIT_DASHES);
+            if (!name || !*name) {
+               free(name);
                perrorw("Enter valid deck name");
                continue;
             }
-            create_deck(db, input1);
-            perrorw("Deck added");
+            if (create_deck(db, name))
+               perrorw("Deck added");
+            free(name);
             break;
          }
          case 1: { // View deck data and select deck
@@ -63,18 +150,26 @@ int main() {
                deck_wizard(menu_win, deck_id);
             break;
          }
-         case 2: { // delete deck
-            form_input(stdscr, DECKD_PROMPT, input1, MAX_BUFFER, 1);
-            if (strlen(input1) == 0) {
+         case 2: // search every deck
+            search_screen(stdscr);
+            break;
+         case 3: // review history of every deck
+            review_stats_screen(stdscr);
+            break;
+         case 4: { // delete deck
+            name = form_input(stdscr, DECKD_PROMPT, NULL, EDIT_DASHES);
+            if (!name || !*name) {
+               free(name);
                perrorw("Enter valid deck name");
                continue;
             }
 
-            delete_deck_by_name(db, input1);
-            perrorw("Deck deleted");
+            if (delete_deck_by_name(db, name))
+               perrorw("Deck deleted");
+            free(name);
             break;
          }
-         case 3: // exit
+         case 5: // exit
          case -1:
             running = 0;
             break;
@@ -84,11 +179,56 @@ int main() {
       werase(menu_win);
    }
    delwin(menu_win);
-   endwin();
-   sqlite3_close(db);
+   render_end();
+   db_set_message_sink(db, NULL, NULL);
+
+   // A snapshot still copying is dropped rather than keeping the app from exiting
+   backup_finish(auto_backup, 1);
+
+   // Everything queued is committed before the connection closes
+   writer_stop(db);
+
+   // Statement cache, writer, prefetch, layout and terminal counters and span latencies, after the UI closes
+   if (stats) {
+      db_print_stmt_stats(db, stderr);
+      writer_print_stats(db, stderr);
+      remote_print_stats(db, stderr);
+      prefetch_print_stats(stderr);
+      layout_print_stats(stderr);
+      render_print_stats(stderr);
+      print_startup_stats();
+      trace_print_report(stderr);
+   }
+   if (!trace_finish())
+      fprintf(stderr, "Could not write trace to %s\n", trace_path);
+   layout_cache_free();
+   close_database(db);
    return 0;
 }
 
+// A front the deck already has asks whether to skip, merge or keep the card
+static void add_card_checked(WINDOW* deck_win, Deck* deck, const char* front, const char* back) {
+   Cards existing;
+   if (!find_duplicate_card(db, deck->deck_id, front, card_text_hash(front), &existing)) {
+      add_card(db, deck, deck->deck_id, front, back);
+      return;
+   }
+
+   int choice = draw_menu(deck_win, duplicate_menu_choices, 3, "This deck already has a card with that front");
+   if (choice == DUP_KEEP) {
+      add_card(db, deck, deck->deck_id, front, back);
+   } else if (choice == DUP_MERGE) {
+      char* merged = merge_backs(existing.back, back);
+      if (merged)
+         update_card(db, deck, existing.id, existing.front, merged);
+      else
+         perrorw("The existing card already has that back");
+      free(merged);
+   }
+   free(existing.front);
+   free(existing.back);
+}
+
 void deck_wizard(WINDOW* deck_win, const int deck_id) {
    int running = 1;
    Deck deck = {0};
@@ -98,25 +238,31 @@ void deck_wizard(WINDOW* deck_win, const int deck_id) {
 
    while (running) {
       int choice = draw_menu(deck_win, deck_actions_menu_choices, 5, title);
-      load_deck_cards(db, deck_id, &deck);
-      char input1[MAX_BUFFER];
-      char input2[MAX_BUFFER];
+      // Edits patch the deck in place, only reload when they could not
+      if (report_write_errors() || deck.stale)
+         load_deck_cards(db, deck_id, &deck);
+      char* front;
+      char* back;
       switch(choice) {
          case 0: { // study deck
-            study_cards(stdscr, &deck);
+            study_cards(stdscr, deck_id);
             break;
          }
          case 1: { // view cards
-            display_cards(stdscr, &deck);
+            display_cards(stdscr, &deck, 0);
             break;
          }
          case 2: { // add cards
-            card_input(stdscr, CARD_PROMPT, input1, input2, MAX_BUFFER);
-             if (strlen(input1) == 0 || strlen(input2) == 0) {
+            card_input(stdscr, CARD_PROMPT, &front, &back);
+            if (!front || !*front || !back || !*back) {
+               free(front);
+               free(back);
                perrorw("Card information cannot be blank");
                continue;
             }
-            add_card(db, deck_id, input1, input2);
+            add_card_checked(deck_win, &deck, front, back);
+            free(front);
+            free(back);
             break;
          }
          case 3: { // delete deck
@@ -134,3 +280,42 @@ void deck_wizard(WINDOW* deck_win, const int deck_id) {
    free_deck_cards(&deck);
 }
 
+
+// Queued writes fail after the UI has moved on, so they are reported at the next menu
+static int report_write_errors(void) {
+   unsigned long failed = writer_take_errors(db) + remote_take_errors(db);
+   if (failed == 0)
+      return 0;
+
+   char status_msg[MAX_BUFFER];
+   snprintf(status_msg, sizeof(status_msg), "%lu change(s) could not be saved", failed);
+   perrorw(status_msg);
+   return 1;
+}
+
+// The startup snapshot says it is done (or failed) at the first main menu after it finishes
+static void report_backup(void) {
+   BackupProgress progress;
+   if (!auto_backup)
+      return;
+   backup_poll(auto_backup, &progress);
+   if (progress.done) {
+      backup_finish(auto_backup, 0);
+      auto_backup = NULL;
+   }
+}
+
+// Measured from entering main, so exec and the dynamic loader are not included
+static void print_startup_stats(void) {
+   RenderStats render;
+   render_get_stats(&render);
+   if (!render.first_flush_ns)
+      return;
+   fprintf(stderr, "startup: first paint %.2f ms after launch "
+           "(database %.2f ms, writer %.2f ms, terminal %.2f ms, menu %.2f ms)\n",
+           (render.first_flush_ns - startup.launch_ns) / 1e6,
+           (startup.open_ns - startup.launch_ns) / 1e6,
+           (startup.writer_ns - startup.open_ns) / 1e6,
+           (startup.terminal_ns - startup.writer_ns) / 1e6,
+           (render.first_flush_ns - startup.terminal_ns) / 1e6);
+}
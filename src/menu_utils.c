@@ -1,11 +1,18 @@
 #include "../include/menu_utils.h"
 #include "../include/db.h"
 #include "../include/tui.h"
+#include "../include/render.h"
+#include "../include/trace.h"
+#include "../include/layout.h"
 #include <ncurses.h>
+#include <strings.h>
+#include <time.h>
 
 const char* main_menu_choices[] = {
    "Create New Deck",
    "Select a Deck to Study or Edit",
+   "Search Cards",
+   "Review Statistics",
    "Delete a Deck",
    "Exit"
 };
@@ -18,29 +25,98 @@ const char* deck_actions_menu_choices[] = {
    "Back to Main Menu"
 };
 
+// In DupPolicy order
+const char* duplicate_menu_choices[] = {
+   "Skip, keep the existing card",
+   "Merge the backs into the existing card",
+   "Keep both cards"
+};
+
+// Keep the highlighted item inside the visible window
+static int clamp_offset(int offset, int highlight, int visible) {
+   if (highlight < offset)
+      return highlight;
+   if (highlight >= offset + visible)
+      return highlight - visible + 1;
+   return offset;
+}
+
+// Next item (starting at `from`, wrapping) whose label starts with prefix
+static int find_prefix(int item_count, int from, const char* prefix, void* data, MenuItemLabel label) {
+   size_t len = strlen(prefix);
+   for (int n = 0; n < item_count; n++) {
+      int i = (from + n) % item_count;
+      if (strncasecmp(label(i, data), prefix, len) == 0)
+         return i;
+   }
+   return -1;
+}
+
+// Blank a row inside the border before the renderer draws an item on it
+static void draw_menu_row(WINDOW* win, int row, int index, int highlight, void* data,
+                          MenuItemRenderer renderer) {
+   mvwhline(win, row, 1, ' ', getmaxx(win) - 2);
+   renderer(win, row, index, highlight, data);
+}
+
 int generic_menu(WINDOW* win, int item_count, const char* title, void* data,
-                 MenuItemRenderer renderer, int return_id) {
+                 MenuItemRenderer renderer, MenuItemLabel label, int return_id) {
    int highlight = 0;
+   int offset = 0;
    int ch;
 
+   char prefix[64] = {0};
+   size_t prefix_len = 0;
+   time_t last_typed = 0;
+
+   int height = getmaxy(win);
+   int visible = height - MENU_CHROME_ROWS;
+   if (visible > item_count) visible = item_count;
+   if (visible < 1) visible = 1;
+
+   // What is on screen, so a key only repaints the rows it changed
+   int drawn_offset = -1;
+   int drawn_highlight = -1;
+   unsigned drawn_generation = render_generation();
+
    keypad(win, TRUE);
    while (1) {
-      werase(win);
-      box(win, 0, 0);
-      wattron(win, A_UNDERLINE);
-      mvwprintw(win, 1, 2, "%s", title);
-      all_attr_off(win);
+      unsigned long long redraw_start = trace_begin();
+      offset = clamp_offset(offset, highlight, visible);
 
-      for (int i = 0; i < item_count; i++) {
-         renderer(win, i, highlight, data);
+      if (drawn_offset < 0 || drawn_generation != render_generation()) {
+         werase(win);
+         box(win, 0, 0);
+         wattron(win, A_UNDERLINE);
+         mvwprintw(win, 1, 2, "%s", title);
+         all_attr_off(win);
+
+         wattron(win, A_BOLD);
+         mvwprintw(win, MENU_FIRST_ROW + visible + 2, 2, "%s", MENU_FOOTER);
+         all_attr_off(win);
+         drawn_offset = -1;
+         drawn_highlight = -1;
+         drawn_generation = render_generation();
       }
 
-      wattron(win, A_BOLD);
-      mvwprintw(win, item_count + 5, 2, "Arrow keys to navigate, Enter to select, ESC to quit");
-      all_attr_off(win);
-      wrefresh(win);
+      // Only the rows in view are rendered, and only the damaged ones
+      if (offset != drawn_offset) {
+         for (int i = offset; i < offset + visible && i < item_count; i++)
+            draw_menu_row(win, MENU_FIRST_ROW + i - offset, i, highlight, data, renderer);
+      } else if (highlight != drawn_highlight) {
+         draw_menu_row(win, MENU_FIRST_ROW + drawn_highlight - offset, drawn_highlight, highlight, data, renderer);
+         draw_menu_row(win, MENU_FIRST_ROW + highlight - offset, highlight, highlight, data, renderer);
+      }
+      if (visible < item_count && highlight != drawn_highlight)
+         mvwprintw(win, 1, getmaxx(win) - 16, "%7d/%-7d", highlight + 1, item_count);
+
+      drawn_offset = offset;
+      drawn_highlight = highlight;
+      wnoutrefresh(win);
+      trace_end(TRACE_MENU_REDRAW, redraw_start);
+      render_flush();
 
-      ch = wgetch(win);
+      ch = render_getch(win);
       switch (ch) {
          case KEY_UP:
             highlight = (highlight == 0) ? item_count - 1 : highlight - 1;
@@ -48,63 +124,177 @@ int generic_menu(WINDOW* win, int item_count, const char* title, void* data,
          case KEY_DOWN:
             highlight = (highlight == item_count - 1) ? 0 : highlight + 1;
             break;
+         case KEY_PPAGE:
+            highlight = (highlight > visible) ? highlight - visible : 0;
+            offset = (offset > visible) ? offset - visible : 0;
+            break;
+         case KEY_NPAGE:
+            highlight = (highlight + visible < item_count) ? highlight + visible : item_count - 1;
+            offset += visible;
+            if (offset > item_count - visible) offset = item_count - visible;
+            break;
+         case KEY_HOME:
+            highlight = 0;
+            break;
+         case KEY_END:
+            highlight = item_count - 1;
+            break;
          case 10: // Enter
             return return_id ? ((DeckInfoList*)data)->items[highlight].id : highlight;
          case ESC_KEY: // ESC_KEY
             return -1;
          default:
+            if (label && ch > SPACE_KEY && ch < 127) {
+               time_t now = time(NULL);
+               if (now - last_typed > MENU_PREFIX_TIMEOUT)
+                  prefix_len = 0;
+               last_typed = now;
+
+               if (prefix_len < sizeof(prefix) - 1) {
+                  prefix[prefix_len++] = (char)ch;
+                  prefix[prefix_len] = '\0';
+               }
+               // A new search starts after the current item, a longer prefix may stay on it
+               int from = (prefix_len == 1) ? highlight + 1 : highlight;
+               int match = find_prefix(item_count, from, prefix, data, label);
+               if (match >= 0)
+                  highlight = match;
+            }
             break;
         }
     }
 }
 
-void render_string_menu_item(WINDOW* win, int index, int highlight, void* data) {
+void render_string_menu_item(WINDOW* win, int row, int index, int highlight, void* data) {
    const char** items = (const char**)data;  // cast data
    
    // print items
    if (index == highlight) wattron(win, A_REVERSE);
 
-   mvwprintw(win, index + 3, 4, "%s", items[index]);
+   mvwprintw(win, row, 4, "%s", items[index]);
 
    if (index == highlight) wattroff(win, A_REVERSE);
 }
 
-void render_deck_info_item(WINDOW* win, int index, int highlight, void* data) {
+void render_deck_info_item(WINDOW* win, int row, int index, int highlight, void* data) {
    DeckInfoList* info = (DeckInfoList*)data;    // cast data 
+   char line[MAX_BUFFER];
+
+   snprintf(line, sizeof(line), "%d: %s (%d cards)",
+            info->items[index].id,
+            info->items[index].name,
+            info->items[index].card_count);
 
-   // print info
+   // print info, clipped to the window
    if (index == highlight) wattron(win, A_REVERSE);
 
-   mvwprintw(win, index + 2, 2, "%d: %s (%d cards)",
-               info->items[index].id,
-               info->items[index].name,
-               info->items[index].card_count);
+   mvwaddnstr(win, row, 2, line, getmaxx(win) - 4);
 
    if (index == highlight) wattroff(win, A_REVERSE);
 }
 
-void render_card(WINDOW* win, Deck* deck, int index, State state, const char* footer) {
-   werase(win);
-   box(win, 0, 0);
+const char* string_menu_label(int index, void* data) {
+   return ((const char**)data)[index];
+}
+
+const char* deck_info_label(int index, void* data) {
+   return ((DeckInfoList*)data)->items[index].name;
+}
 
-   // Card Number Display 
-   wattron(win, A_UNDERLINE);
-   mvwprintw(win, 1, 2, "Card %d/%zu", index + 1, deck->count);
-   all_attr_off(win);
+// What render_card last put on screen
+static struct {
+   WINDOW* win;
+   unsigned generation;
+   int card_id;
+   // A page fetched again or an edit can put new text at the old address, so the
+   // text is known by the length and hash its layout was made from
+   size_t text_length;
+   unsigned text_hash;
+   int position;
+   size_t total;
+   State state;
+   const char* footer;
+   int scroll;
+} card_drawn;
 
-   // Show front or back 
+void render_card(WINDOW* win, const Cards* card, int position, size_t total, State state,
+                 const char* footer, int* scroll) {
+   TRACE_SCOPE(TRACE_RENDER_CARD);
    const char* side = (state == SHOW_FRONT) ? "Front:" : "Back:";
-   const char* text = (state == SHOW_FRONT) ? deck->items[index].front : deck->items[index].back;
+   const char* text = (state == SHOW_FRONT) ? card->front : card->back;
+
+   // Cached, so this is a lookup unless the card or its size changed
+   const TextLayout* layout = layout_acquire(card->id, text, CARD_TEXT_COLUMNS(getmaxx(win)));
+   int rows = CARD_HEIGHT - 2 - CARD_TEXT_Y;    // up to the footer row
+   int lines = layout ? layout->count : 0;
+   if (*scroll > lines - rows)
+      *scroll = lines - rows;
+   if (*scroll < 0)
+      *scroll = 0;
+
+   int full = card_drawn.win != win || card_drawn.generation != render_generation();
+   if (full) {
+      werase(win);
+      box(win, 0, 0);
+   }
+
+   // Card Number Display 
+   if (full || position != card_drawn.position || total != card_drawn.total) {
+      mvwhline(win, 1, 1, ' ', getmaxx(win) - 2);
+      wattron(win, A_UNDERLINE);
+      mvwprintw(win, 1, 2, "Card %d/%zu", position, total);
+      all_attr_off(win);
+   }
+
+   // Show front or back, only the lines that fit
+   if (full || !layout || card->id != card_drawn.card_id || layout->length != card_drawn.text_length ||
+       layout->hash != card_drawn.text_hash || state != card_drawn.state || *scroll != card_drawn.scroll) {
+      // Text never reaches the border any more, so only the inside is cleared
+      for (int row = 2; row < CARD_TEXT_Y + rows; row++)
+         mvwhline(win, row, 1, ' ', getmaxx(win) - 2);
+      wattron(win, A_BOLD);
+      mvwprintw(win, 2, 2, "%s", side);
+      all_attr_off(win);
 
-   wattron(win, A_BOLD);
-   mvwprintw(win, 2, 2, "%s", side);
-   all_attr_off(win);
-   mvwprintw(win, 3, 4, "%s", text);
+      if (lines > rows) {
+         char where[64];
+         int n = snprintf(where, sizeof(where), "[UP/DOWN] lines %d-%d of %d",
+                          *scroll + 1, *scroll + rows, lines);
+         wattron(win, A_DIM);
+         mvwprintw(win, 2, getmaxx(win) - 2 - n, "%s", where);
+         all_attr_off(win);
+      }
+      for (int i = 0; i < rows && *scroll + i < lines; i++) {
+         const LayoutLine* line = &layout->lines[*scroll + i];
+         render_text_line(win, CARD_TEXT_Y + i, CARD_TEXT_X, text + line->start, line->bytes);
+      }
+   }
+   card_drawn.text_length = layout ? layout->length : 0;
+   card_drawn.text_hash = layout ? layout->hash : 0;
+   layout_release(layout);
 
    // Footer 
-   wattron(win, A_BOLD);
-   mvwprintw(win, CARD_HEIGHT - 2, 2, "%s", footer);
-   all_attr_off(win);
+   if (full || footer != card_drawn.footer) {
+      mvwhline(win, CARD_HEIGHT - 2, 1, ' ', getmaxx(win) - 2);
+      wattron(win, A_BOLD);
+      mvwprintw(win, CARD_HEIGHT - 2, 2, "%s", footer);
+      all_attr_off(win);
+   }
+
+   card_drawn.win = win;
+   card_drawn.generation = render_generation();
+   card_drawn.card_id = card->id;
+   card_drawn.position = position;
+   card_drawn.total = total;
+   card_drawn.state = state;
+   card_drawn.footer = footer;
+   card_drawn.scroll = *scroll;
+
+   wnoutrefresh(win);
+   render_flush();
+}
 
-   wrefresh(win);
+void warm_card_layout(const Cards* card) {
+   layout_warm(card->id, card->front, CARD_TEXT_COLUMNS(CARD_WIDTH));
+   layout_warm(card->id, card->back, CARD_TEXT_COLUMNS(CARD_WIDTH));
 }
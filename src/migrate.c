@@ -0,0 +1,219 @@
+#include "../include/migrate.h"
+
+#include <time.h>
+
+// Append only: never edit a migration that has shipped, add a new one instead.
+static const Migration migrations[] = {
+   {1, "base schema",
+      "CREATE TABLE IF NOT EXISTS decks ("
+      "id INTEGER PRIMARY KEY AUTOINCREMENT, "
+      "name TEXT NOT NULL UNIQUE);"
+
+      "CREATE TABLE IF NOT EXISTS cards ("
+      "id INTEGER PRIMARY KEY AUTOINCREMENT, "
+      "deck_id INTEGER, "
+      "front TEXT NOT NULL, "
+      "back TEXT NOT NULL, "
+      "FOREIGN KEY(deck_id) REFERENCES decks(id) ON DELETE CASCADE);"},
+
+   {2, "card schedule",
+      "CREATE TABLE IF NOT EXISTS card_schedule ("
+      "card_id INTEGER PRIMARY KEY, "
+      "due INTEGER NOT NULL, "
+      "interval REAL NOT NULL, "
+      "ease REAL NOT NULL, "
+      "reps INTEGER NOT NULL DEFAULT 0, "
+      "lapses INTEGER NOT NULL DEFAULT 0, "
+      "FOREIGN KEY(card_id) REFERENCES cards(id) ON DELETE CASCADE);"},
+
+   {3, "index cards by deck",
+      "CREATE INDEX IF NOT EXISTS idx_cards_deck_id ON cards(deck_id);"},
+
+   {4, "materialized card counts",
+      "ALTER TABLE decks ADD COLUMN card_count INTEGER NOT NULL DEFAULT 0;"
+      "UPDATE decks SET card_count = (SELECT COUNT(*) FROM cards WHERE cards.deck_id = decks.id);"
+
+      "CREATE TRIGGER IF NOT EXISTS trg_cards_count_insert AFTER INSERT ON cards BEGIN "
+      "UPDATE decks SET card_count = card_count + 1 WHERE id = NEW.deck_id; END;"
+
+      "CREATE TRIGGER IF NOT EXISTS trg_cards_count_delete AFTER DELETE ON cards BEGIN "
+      "UPDATE decks SET card_count = card_count - 1 WHERE id = OLD.deck_id; END;"
+
+      "CREATE TRIGGER IF NOT EXISTS trg_cards_count_move AFTER UPDATE OF deck_id ON cards "
+      "WHEN OLD.deck_id IS NOT NEW.deck_id BEGIN "
+      "UPDATE decks SET card_count = card_count - 1 WHERE id = OLD.deck_id; "
+      "UPDATE decks SET card_count = card_count + 1 WHERE id = NEW.deck_id; END;"},
+
+   // External content index: the text lives in cards only, the triggers keep the index in step
+   {5, "full text search",
+      "CREATE VIRTUAL TABLE IF NOT EXISTS cards_fts USING fts5("
+      "front, back, content='cards', content_rowid='id');"
+
+      "CREATE TRIGGER IF NOT EXISTS trg_cards_fts_insert AFTER INSERT ON cards BEGIN "
+      "INSERT INTO cards_fts (rowid, front, back) VALUES (NEW.id, NEW.front, NEW.back); END;"
+
+      "CREATE TRIGGER IF NOT EXISTS trg_cards_fts_delete AFTER DELETE ON cards BEGIN "
+      "INSERT INTO cards_fts (cards_fts, rowid, front, back) "
+      "VALUES ('delete', OLD.id, OLD.front, OLD.back); END;"
+
+      "CREATE TRIGGER IF NOT EXISTS trg_cards_fts_update AFTER UPDATE OF front, back ON cards BEGIN "
+      "INSERT INTO cards_fts (cards_fts, rowid, front, back) "
+      "VALUES ('delete', OLD.id, OLD.front, OLD.back); "
+      "INSERT INTO cards_fts (rowid, front, back) VALUES (NEW.id, NEW.front, NEW.back); END;"
+
+      // A match on the front counts double
+      "INSERT INTO cards_fts (cards_fts, rank) VALUES ('rank', 'bm25(2.0, 1.0)');"
+      "INSERT INTO cards_fts (cards_fts) VALUES ('rebuild');"},
+
+   // The log is history: it keeps answers for cards and decks deleted since.
+   // Per deck aggregates are kept in step by a trigger so stats never scan it.
+   {6, "review log",
+      "CREATE TABLE IF NOT EXISTS review_log ("
+      "id INTEGER PRIMARY KEY, "
+      "card_id INTEGER NOT NULL, "
+      "deck_id INTEGER NOT NULL, "
+      "reviewed_at INTEGER NOT NULL, "
+      "day INTEGER NOT NULL, "
+      "correct INTEGER NOT NULL, "
+      "response_ms INTEGER NOT NULL);"
+
+      "CREATE TABLE IF NOT EXISTS deck_review_stats ("
+      "deck_id INTEGER PRIMARY KEY, "
+      "reviews INTEGER NOT NULL DEFAULT 0, "
+      "correct INTEGER NOT NULL DEFAULT 0, "
+      "response_ms INTEGER NOT NULL DEFAULT 0, "
+      "streak INTEGER NOT NULL DEFAULT 0, "
+      "best_streak INTEGER NOT NULL DEFAULT 0, "
+      "day_streak INTEGER NOT NULL DEFAULT 0, "
+      "last_day INTEGER, "
+      "last_review INTEGER, "
+      "FOREIGN KEY(deck_id) REFERENCES decks(id) ON DELETE CASCADE);"
+
+      // One upsert per answer. Bare names in DO UPDATE are the row as it was,
+      // so streak + 1 is the new streak. A deck deleted meanwhile gets no row.
+      "CREATE TRIGGER IF NOT EXISTS trg_review_log_stats AFTER INSERT ON review_log BEGIN "
+      "INSERT INTO deck_review_stats (deck_id, reviews, correct, response_ms, streak, "
+      "best_streak, day_streak, last_day, last_review) "
+      "SELECT NEW.deck_id, 1, NEW.correct, NEW.response_ms, NEW.correct, NEW.correct, 1, "
+      "NEW.day, NEW.reviewed_at WHERE EXISTS (SELECT 1 FROM decks WHERE id = NEW.deck_id) "
+      "ON CONFLICT(deck_id) DO UPDATE SET "
+      "reviews = reviews + 1, "
+      "correct = correct + NEW.correct, "
+      "response_ms = response_ms + NEW.response_ms, "
+      "streak = CASE WHEN NEW.correct THEN streak + 1 ELSE 0 END, "
+      "best_streak = MAX(best_streak, CASE WHEN NEW.correct THEN streak + 1 ELSE 0 END), "
+      "day_streak = CASE WHEN last_day = NEW.day THEN day_streak "
+      "WHEN last_day = NEW.day - 1 THEN day_streak + 1 ELSE 1 END, "
+      "last_day = NEW.day, "
+      "last_review = NEW.reviewed_at; END;"},
+
+   // Duplicate fronts are found by a hash of the normalized front, indexed per
+   // deck. card_hash() is the C function every connection registers (dedupe.c).
+   {7, "card front hash",
+      "ALTER TABLE cards ADD COLUMN front_hash INTEGER;"
+      "UPDATE cards SET front_hash = card_hash(front);"
+      "CREATE INDEX IF NOT EXISTS idx_cards_deck_front_hash ON cards(deck_id, front_hash);"},
+};
+
+#define MIGRATION_COUNT ((int)(sizeof(migrations) / sizeof(migrations[0])))
+
+int latest_schema_version(void) {
+   return migrations[MIGRATION_COUNT - 1].version;
+}
+
+static int get_user_version(sqlite3* conn) {
+   sqlite3_stmt* stmt;
+   int version = -1;
+   if (sqlite3_prepare_v2(conn, "PRAGMA user_version;", -1, &stmt, NULL) != SQLITE_OK)
+      return -1;
+   if (sqlite3_step(stmt) == SQLITE_ROW)
+      version = sqlite3_column_int(stmt, 0);
+   sqlite3_finalize(stmt);
+   return version;
+}
+
+static int apply_migration(sqlite3* conn, const Migration* m) {
+   char* err_msg = NULL;
+   struct timespec start, end;
+   clock_gettime(CLOCK_MONOTONIC, &start);
+
+   int ok = sqlite3_exec(conn, "BEGIN IMMEDIATE;", 0, 0, &err_msg) == SQLITE_OK;
+
+   // Another process opening the same outdated database may have applied it
+   // while this one waited for the lock; the version read before it is stale
+   if (ok && get_user_version(conn) >= m->version)
+      return sqlite3_exec(conn, "COMMIT;", 0, 0, 0) == SQLITE_OK;
+
+   ok = ok && sqlite3_exec(conn, m->sql, 0, 0, &err_msg) == SQLITE_OK;
+   if (ok) {
+      clock_gettime(CLOCK_MONOTONIC, &end);
+      double duration_ms = (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+
+      char sql[256];
+      snprintf(sql, sizeof(sql),
+               "INSERT OR REPLACE INTO schema_migrations (version, name, applied_at, duration_ms) "
+               "VALUES (%d, '%s', %lld, %.3f);"
+               "PRAGMA user_version = %d;",
+               m->version, m->name, (long long)time(NULL), duration_ms, m->version);
+      ok = sqlite3_exec(conn, sql, 0, 0, &err_msg) == SQLITE_OK
+        && sqlite3_exec(conn, "COMMIT;", 0, 0, &err_msg) == SQLITE_OK;
+   }
+
+   if (!ok) {
+      fprintf(stderr, "Migration %d (%s) failed: %s\n", m->version, m->name,
+              err_msg ? err_msg : sqlite3_errmsg(conn));
+      sqlite3_free(err_msg);
+      sqlite3_exec(conn, "ROLLBACK;", 0, 0, 0);
+   }
+   return ok;
+}
+
+int run_migrations(sqlite3* conn) {
+   int version = get_user_version(conn);
+   if (version < 0) {
+      fprintf(stderr, "Unable to read schema version: %s\n", sqlite3_errmsg(conn));
+      return 0;
+   }
+   if (version >= latest_schema_version())
+      return 1;
+
+   const char* log_sql =
+      "CREATE TABLE IF NOT EXISTS schema_migrations ("
+      "version INTEGER PRIMARY KEY, "
+      "name TEXT NOT NULL, "
+      "applied_at INTEGER NOT NULL, "
+      "duration_ms REAL NOT NULL);";
+   char* err_msg = NULL;
+   if (sqlite3_exec(conn, log_sql, 0, 0, &err_msg) != SQLITE_OK) {
+      fprintf(stderr, "SQL Error: %s\n", err_msg);
+      sqlite3_free(err_msg);
+      return 0;
+   }
+
+   for (int i = 0; i < MIGRATION_COUNT; i++) {
+      if (migrations[i].version <= version)
+         continue;
+      if (!apply_migration(conn, &migrations[i]))
+         return 0;
+   }
+   return 1;
+}
+
+void print_migrations(sqlite3* conn, FILE* out) {
+   sqlite3_stmt* stmt;
+   const char* sql =
+      "SELECT version, name, datetime(applied_at, 'unixepoch'), duration_ms "
+      "FROM schema_migrations ORDER BY version;";
+
+   fprintf(out, "schema version %d (latest %d)\n", get_user_version(conn), latest_schema_version());
+   if (sqlite3_prepare_v2(conn, sql, -1, &stmt, NULL) != SQLITE_OK)
+      return;
+   while (sqlite3_step(stmt) == SQLITE_ROW) {
+      fprintf(out, "%4d  %-24s %s  %10.3f ms\n",
+              sqlite3_column_int(stmt, 0),
+              (const char*)sqlite3_column_text(stmt, 1),
+              (const char*)sqlite3_column_text(stmt, 2),
+              sqlite3_column_double(stmt, 3));
+   }
+   sqlite3_finalize(stmt);
+}
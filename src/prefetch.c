@@ -0,0 +1,277 @@
+#include "../include/prefetch.h"
+#include "../include/trace.h"
+#include "../include/remote.h"
+
+#include <pthread.h>
+
+typedef enum {
+   SLOT_EMPTY,
+   SLOT_WANTED,          // waiting for the worker (or for an inline read)
+   SLOT_LOADING,         // the worker is reading it without the lock held
+   SLOT_READY,
+   SLOT_FAILED
+} SlotState;
+
+typedef struct {
+   SlotState state;
+   size_t rank;          // position in the last prefetch_want, the worker takes the lowest first
+   int card_id;
+   Cards card;
+   char* text;           // front and back in one allocation, card points into it
+} Slot;
+
+typedef struct {
+   unsigned long long hits;       // ready when the UI asked for it
+   unsigned long long waits;      // the worker was still reading it
+   unsigned long long misses;     // read inline on the UI connection
+} PrefetchStats;
+
+// Slots are only changed with lock held. Once a slot is READY the worker leaves
+// it alone, so the UI thread can hand out pointers into it.
+struct Prefetch {
+   FlashDb* db;                   // the UI connection, for inline reads
+   FlashDb* conn;                 // the worker's own connection, NULL without a worker
+   pthread_t thread;
+   pthread_mutex_t lock;
+   pthread_cond_t work;           // a slot became WANTED, or stop was set
+   pthread_cond_t loaded;         // a slot left LOADING
+   PrefetchHook warm;
+   int stop;
+   Slot slots[PREFETCH_DEPTH];
+   Slot spare;                    // a card asked for without prefetch_want
+};
+
+static PrefetchStats totals;      // UI thread only
+
+// Front and back go into one allocation so a slot frees them with one call
+static int read_card(FlashDb* db, int card_id, Cards* card, char** text) {
+   if (db->remote)
+      return remote_card_text(db, card_id, card, text);
+   sqlite3_stmt* stmt = db_stmt_acquire(db, STMT_CARD_TEXT);
+   if (!stmt)
+      return 0;
+
+   int ok = 0;
+   sqlite3_bind_int(stmt, 1, card_id);
+   if (sqlite3_step(stmt) == SQLITE_ROW) {
+      const char* front = (const char*)sqlite3_column_text(stmt, 1);
+      int front_len = sqlite3_column_bytes(stmt, 1);
+      const char* back = (const char*)sqlite3_column_text(stmt, 2);
+      int back_len = sqlite3_column_bytes(stmt, 2);
+
+      char* buf = malloc((size_t)front_len + back_len + 2);
+      if (buf) {
+         memcpy(buf, front ? front : "", front_len);
+         buf[front_len] = '\0';
+         memcpy(buf + front_len + 1, back ? back : "", back_len);
+         buf[front_len + 1 + back_len] = '\0';
+         *card = (Cards){
+            .id = card_id,
+            .deck_id = sqlite3_column_int(stmt, 0),
+            .front = buf,
+            .back = buf + front_len + 1,
+         };
+         *text = buf;
+         ok = 1;
+      }
+   }
+   db_stmt_release(db, STMT_CARD_TEXT);
+   return ok;
+}
+
+// A LOADING slot released here is noticed by the worker when its read finishes
+static void release_slot(Slot* slot) {
+   free(slot->text);
+   *slot = (Slot){0};
+}
+
+static void* prefetch_main(void* arg) {
+   Prefetch* p = arg;
+   trace_set_thread_name("prefetch");
+
+   pthread_mutex_lock(&p->lock);
+   while (!p->stop) {
+      Slot* next = NULL;
+      for (int i = 0; i < PREFETCH_DEPTH; i++) {
+         Slot* s = &p->slots[i];
+         if (s->state == SLOT_WANTED && (!next || s->rank < next->rank))
+            next = s;
+      }
+      if (!next) {
+         pthread_cond_wait(&p->work, &p->lock);
+         continue;
+      }
+
+      next->state = SLOT_LOADING;
+      int card_id = next->card_id;
+      pthread_mutex_unlock(&p->lock);
+
+      Cards card = {0};
+      char* text = NULL;
+      unsigned long long start = trace_begin();
+      int ok = read_card(p->conn, card_id, &card, &text);
+      if (ok && p->warm)
+         p->warm(&card);
+      trace_end(TRACE_PREFETCH_LOAD, start);
+
+      pthread_mutex_lock(&p->lock);
+      // Only this thread sets LOADING, so a slot still LOADING for the same card
+      // was not given away while the lock was dropped
+      if (next->state == SLOT_LOADING && next->card_id == card_id) {
+         next->card = card;
+         next->text = text;
+         next->state = ok ? SLOT_READY : SLOT_FAILED;
+         text = NULL;
+      }
+      free(text);
+      pthread_cond_broadcast(&p->loaded);
+   }
+   pthread_mutex_unlock(&p->lock);
+   return NULL;
+}
+
+Prefetch* prefetch_start(FlashDb* db, PrefetchHook warm) {
+   Prefetch* p = calloc(1, sizeof(*p));
+   if (!p)
+      return NULL;
+   p->db = db;
+   p->warm = warm;
+   pthread_mutex_init(&p->lock, NULL);
+   pthread_cond_init(&p->work, NULL);
+   pthread_cond_init(&p->loaded, NULL);
+
+   FlashDb* conn;
+   if (db->remote) {
+      // A second daemon connection, so reads ahead never queue behind the UI's
+      if (!(conn = remote_reconnect(db)))
+         return p;
+   } else {
+      // An in-memory database cannot be opened twice, its cards are read inline
+      const char* path = sqlite3_db_filename(db->conn, "main");
+      if (!path || !*path)
+         return p;
+
+      conn = calloc(1, sizeof(FlashDb));
+      if (!conn || sqlite3_open_v2(path, &conn->conn, SQLITE_OPEN_READONLY, NULL) != SQLITE_OK) {
+         close_database(conn);
+         return p;
+      }
+      sqlite3_busy_timeout(conn->conn, DB_BUSY_TIMEOUT_MS);
+      conn->config = db->config;
+      db_apply_config(conn);
+   }
+
+   p->conn = conn;
+   if (pthread_create(&p->thread, NULL, prefetch_main, p) != 0) {
+      close_database(conn);
+      p->conn = NULL;
+   }
+   return p;
+}
+
+void prefetch_want(Prefetch* p, const int* ids, size_t count) {
+   if (count > PREFETCH_DEPTH)
+      count = PREFETCH_DEPTH;
+
+   pthread_mutex_lock(&p->lock);
+   int held[PREFETCH_DEPTH] = {0};
+   for (int i = 0; i < PREFETCH_DEPTH; i++) {
+      Slot* s = &p->slots[i];
+      if (s->state == SLOT_EMPTY)
+         continue;
+      size_t rank = 0;
+      while (rank < count && ids[rank] != s->card_id)
+         rank++;
+      if (rank < count && !held[rank]) {
+         s->rank = rank;
+         held[rank] = 1;
+      } else {
+         release_slot(s);
+      }
+   }
+
+   // Every slot not holding a wanted card is empty now, so there is room for the rest
+   int queued = 0;
+   for (size_t rank = 0; rank < count; rank++) {
+      if (held[rank])
+         continue;
+      Slot* s = p->slots;
+      while (s->state != SLOT_EMPTY)
+         s++;
+      *s = (Slot){ .state = SLOT_WANTED, .rank = rank, .card_id = ids[rank] };
+      queued = 1;
+   }
+   if (queued && p->conn)
+      pthread_cond_signal(&p->work);
+   pthread_mutex_unlock(&p->lock);
+}
+
+const Cards* prefetch_get(Prefetch* p, int card_id) {
+   pthread_mutex_lock(&p->lock);
+   Slot* s = NULL;
+   for (int i = 0; i < PREFETCH_DEPTH && !s; i++) {
+      if (p->slots[i].state != SLOT_EMPTY && p->slots[i].card_id == card_id)
+         s = &p->slots[i];
+   }
+   if (!s) {
+      s = &p->spare;
+      if (s->card_id != card_id) {
+         release_slot(s);
+         *s = (Slot){ .state = SLOT_WANTED, .card_id = card_id };
+      }
+   }
+
+   if (s->state == SLOT_READY) {
+      totals.hits++;
+   } else if (p->conn && s != &p->spare && (s->state == SLOT_WANTED || s->state == SLOT_LOADING)) {
+      // Asked for too soon after prefetch_want, the worker is on it
+      totals.waits++;
+      unsigned long long start = trace_begin();
+      while (s->card_id == card_id && (s->state == SLOT_WANTED || s->state == SLOT_LOADING))
+         pthread_cond_wait(&p->loaded, &p->lock);
+      trace_end(TRACE_PREFETCH_WAIT, start);
+   }
+
+   // No worker, not asked for, or the worker's read failed: read it here.
+   // The worker never picks up a slot in these states, so the lock can stay held.
+   if (s->card_id == card_id && s->state != SLOT_READY) {
+      totals.misses++;
+      free(s->text);
+      s->text = NULL;
+      s->state = read_card(p->db, card_id, &s->card, &s->text) ? SLOT_READY : SLOT_FAILED;
+   }
+
+   const Cards* card = (s->card_id == card_id && s->state == SLOT_READY) ? &s->card : NULL;
+   pthread_mutex_unlock(&p->lock);
+   return card;
+}
+
+void prefetch_stop(Prefetch* p) {
+   if (!p)
+      return;
+
+   if (p->conn) {
+      pthread_mutex_lock(&p->lock);
+      p->stop = 1;
+      pthread_cond_signal(&p->work);
+      pthread_mutex_unlock(&p->lock);
+      pthread_join(p->thread, NULL);
+      close_database(p->conn);
+   }
+
+   for (int i = 0; i < PREFETCH_DEPTH; i++)
+      release_slot(&p->slots[i]);
+   release_slot(&p->spare);
+   pthread_cond_destroy(&p->loaded);
+   pthread_cond_destroy(&p->work);
+   pthread_mutex_destroy(&p->lock);
+   free(p);
+}
+
+void prefetch_print_stats(FILE* out) {
+   unsigned long long shown = totals.hits + totals.waits + totals.misses;
+   if (shown == 0)
+      return;
+   fprintf(out, "prefetch: %llu card reads, %llu ready, %llu waited for, %llu read inline\n",
+           shown, totals.hits, totals.waits, totals.misses);
+}
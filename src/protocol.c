@@ -0,0 +1,218 @@
+#include "../include/protocol.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+static int reserve(ProtoBuf* buf, size_t extra) {
+   if (buf->failed)
+      return 0;
+   if (buf->len + extra <= buf->cap)
+      return 1;
+   size_t cap = buf->cap ? buf->cap * 2 : 4096;
+   while (cap < buf->len + extra)
+      cap *= 2;
+   uint8_t* data = realloc(buf->data, cap);
+   if (!data) {
+      buf->failed = 1;
+      return 0;
+   }
+   buf->data = data;
+   buf->cap = cap;
+   return 1;
+}
+
+static void put_le(ProtoBuf* buf, uint64_t value, int bytes) {
+   if (!reserve(buf, bytes))
+      return;
+   for (int i = 0; i < bytes; i++)
+      buf->data[buf->len++] = (uint8_t)(value >> (8 * i));
+}
+
+void proto_begin(ProtoBuf* buf, uint8_t op, uint8_t status) {
+   buf->len = 0;
+   buf->failed = 0;
+   put_le(buf, 0, 4);  // length, filled in by proto_end
+   put_le(buf, op, 1);
+   put_le(buf, status, 1);
+   put_le(buf, 0, 2);
+}
+
+int proto_end(ProtoBuf* buf) {
+   if (buf->failed || buf->len - PROTO_HEADER_SIZE > PROTO_MAX_PAYLOAD)
+      return 0;
+   uint32_t len = (uint32_t)(buf->len - PROTO_HEADER_SIZE);
+   for (int i = 0; i < 4; i++)
+      buf->data[i] = (uint8_t)(len >> (8 * i));
+   return 1;
+}
+
+void proto_put_u8(ProtoBuf* buf, uint8_t value) {
+   put_le(buf, value, 1);
+}
+
+void proto_put_u32(ProtoBuf* buf, uint32_t value) {
+   put_le(buf, value, 4);
+}
+
+void proto_put_i32(ProtoBuf* buf, int32_t value) {
+   put_le(buf, (uint32_t)value, 4);
+}
+
+void proto_put_i64(ProtoBuf* buf, int64_t value) {
+   put_le(buf, (uint64_t)value, 8);
+}
+
+void proto_put_f64(ProtoBuf* buf, double value) {
+   uint64_t bits;
+   memcpy(&bits, &value, sizeof(bits));
+   put_le(buf, bits, 8);
+}
+
+void proto_put_strn(ProtoBuf* buf, const char* text, size_t len) {
+   if (!text)
+      len = 0;
+   put_le(buf, (uint32_t)len, 4);
+   if (!reserve(buf, len + 1))
+      return;
+   if (len > 0)
+      memcpy(buf->data + buf->len, text, len);
+   buf->data[buf->len + len] = '\0';
+   buf->len += len + 1;
+}
+
+void proto_put_str(ProtoBuf* buf, const char* text) {
+   proto_put_strn(buf, text, text ? strlen(text) : 0);
+}
+
+void proto_put_bytes(ProtoBuf* buf, const void* data, size_t len) {
+   if (len == 0 || !reserve(buf, len))
+      return;
+   memcpy(buf->data + buf->len, data, len);
+   buf->len += len;
+}
+
+void proto_free(ProtoBuf* buf) {
+   free(buf->data);
+   *buf = (ProtoBuf){0};
+}
+
+static uint64_t get_le(ProtoReader* r, int bytes) {
+   if (r->failed || r->left < (size_t)bytes) {
+      r->failed = 1;
+      return 0;
+   }
+   uint64_t value = 0;
+   for (int i = 0; i < bytes; i++)
+      value |= (uint64_t)r->pos[i] << (8 * i);
+   r->pos += bytes;
+   r->left -= bytes;
+   return value;
+}
+
+void proto_read_header(const uint8_t* data, uint32_t* len, uint8_t* op, uint8_t* status) {
+   *len = (uint32_t)data[0] | (uint32_t)data[1] << 8 | (uint32_t)data[2] << 16 | (uint32_t)data[3] << 24;
+   *op = data[4];
+   *status = data[5];
+}
+
+uint8_t proto_get_u8(ProtoReader* r) {
+   return (uint8_t)get_le(r, 1);
+}
+
+uint32_t proto_get_u32(ProtoReader* r) {
+   return (uint32_t)get_le(r, 4);
+}
+
+int32_t proto_get_i32(ProtoReader* r) {
+   return (int32_t)(uint32_t)get_le(r, 4);
+}
+
+int64_t proto_get_i64(ProtoReader* r) {
+   return (int64_t)get_le(r, 8);
+}
+
+double proto_get_f64(ProtoReader* r) {
+   uint64_t bits = get_le(r, 8);
+   double value;
+   memcpy(&value, &bits, sizeof(value));
+   return value;
+}
+
+const char* proto_get_str(ProtoReader* r, size_t* len) {
+   uint32_t n = proto_get_u32(r);
+   if (r->failed || r->left < (size_t)n + 1 || r->pos[n] != '\0') {
+      r->failed = 1;
+      if (len)
+         *len = 0;
+      return "";
+   }
+   const char* text = (const char*)r->pos;
+   r->pos += n + 1;
+   r->left -= n + 1;
+   if (len)
+      *len = n;
+   return text;
+}
+
+int proto_write_all(int fd, const void* data, size_t len) {
+   const uint8_t* p = data;
+   while (len > 0) {
+      ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+      if (n < 0 && errno == EINTR)
+         continue;
+      if (n <= 0)
+         return 0;
+      p += n;
+      len -= n;
+   }
+   return 1;
+}
+
+static int read_all(int fd, void* data, size_t len) {
+   uint8_t* p = data;
+   while (len > 0) {
+      ssize_t n = read(fd, p, len);
+      if (n < 0 && errno == EINTR)
+         continue;
+      if (n <= 0)
+         return 0;
+      p += n;
+      len -= n;
+   }
+   return 1;
+}
+
+int proto_read_frame(int fd, ProtoBuf* buf, uint8_t* op, uint8_t* status, ProtoReader* payload) {
+   uint8_t header[PROTO_HEADER_SIZE];
+   uint32_t len;
+   if (!read_all(fd, header, sizeof(header)))
+      return 0;
+   proto_read_header(header, &len, op, status);
+   if (len > PROTO_MAX_PAYLOAD)
+      return 0;
+
+   buf->len = 0;
+   buf->failed = 0;
+   if (!reserve(buf, PROTO_HEADER_SIZE + len))
+      return 0;
+   memcpy(buf->data, header, sizeof(header));
+   if (!read_all(fd, buf->data + PROTO_HEADER_SIZE, len))
+      return 0;
+   buf->len = PROTO_HEADER_SIZE + len;
+   *payload = (ProtoReader){ .pos = buf->data + PROTO_HEADER_SIZE, .left = len };
+   return 1;
+}
+
+int proto_socket_path(char* path, size_t size) {
+   const char* env = getenv("FLASH_CARDS_SOCKET");
+   if (env && *env)
+      return snprintf(path, size, "%s", env) < (int)size;
+   const char* home = getenv("HOME");
+   if (!home)
+      return 0;
+   return snprintf(path, size, "%s/tui-cards/%s", home, PROTO_SOCKET_NAME) < (int)size;
+}
@@ -0,0 +1,644 @@
+#include "../include/remote.h"
+#include "../include/protocol.h"
+#include "../include/trace.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define REMOTE_CHANGED_DECKS 16    // decks remembered as changed before falling back to "all"
+
+typedef struct {
+   unsigned long long calls;       // requests that waited for their reply
+   unsigned long long posts;       // writes sent without waiting
+   unsigned long long events;
+   unsigned long long wait_ns;     // total time calls spent waiting
+   unsigned long long max_wait_ns;
+   unsigned long long bytes_out;
+   unsigned long long bytes_in;
+} RemoteStats;
+
+struct Remote {
+   int fd;
+   int flags;                      // HELLO flags, a reconnect drops PROTO_WANT_EVENTS
+   int broken;                     // the connection is gone, every call fails at once
+   char path[sizeof(((struct sockaddr_un*)0)->sun_path)];
+   ProtoBuf out;
+   ProtoBuf in;                    // the last frame read
+   size_t pending;                 // replies to posted writes not read yet
+   unsigned long errors;           // posted writes that failed
+   int changed[REMOTE_CHANGED_DECKS];
+   size_t changed_count;
+   int changed_all;
+   RemoteStats stats;
+};
+
+static void lost(FlashDb* db) {
+   Remote* r = db->remote;
+   if (r->broken)
+      return;
+   r->broken = 1;
+   close(r->fd);
+   r->fd = -1;
+   db_report(db, DB_MSG_ERROR, "Lost the connection to flash-cardsd");
+}
+
+static void note_changed(Remote* r, int deck_id) {
+   if (deck_id == 0 || r->changed_all)
+      return;
+   for (size_t i = 0; i < r->changed_count; i++) {
+      if (r->changed[i] == deck_id)
+         return;
+   }
+   if (deck_id < 0 || r->changed_count == REMOTE_CHANGED_DECKS)
+      r->changed_all = 1;
+   else
+      r->changed[r->changed_count++] = deck_id;
+}
+
+// Skip the messages at the start of a reply, counting the errors among them
+static int skip_messages(ProtoReader* in) {
+   int errors = 0;
+   uint8_t count = proto_get_u8(in);
+   for (uint8_t i = 0; i < count; i++) {
+      errors += proto_get_u8(in) == DB_MSG_ERROR;
+      proto_get_str(in, NULL);
+   }
+   return errors;
+}
+
+// Handle a frame that is not the reply being waited for: an event, or the reply
+// to a posted write. Returns 0 if it is neither.
+static int handle_async(Remote* r, uint8_t op, uint8_t status, ProtoReader* in) {
+   if (op == PROTO_EVENT_INVALIDATE) {
+      r->stats.events++;
+      note_changed(r, proto_get_i32(in));
+      return 1;
+   }
+   if (op == PROTO_EVENT_WRITE_ERRORS) {
+      r->stats.events++;
+      r->errors += proto_get_u32(in);
+      return 1;
+   }
+   if (r->pending == 0)
+      return 0;
+   // Posted writes were reported done when they were sent, only failures matter now
+   r->pending--;
+   if (status != PROTO_OK || skip_messages(in) > 0 || !proto_get_u8(in))
+      r->errors++;
+   return 1;
+}
+
+static int read_frame(Remote* r, uint8_t* op, uint8_t* status, ProtoReader* in) {
+   if (!proto_read_frame(r->fd, &r->in, op, status, in))
+      return 0;
+   r->stats.bytes_in += r->in.len;
+   return 1;
+}
+
+// Read whatever the daemon already sent, without waiting for more
+static void drain(FlashDb* db) {
+   Remote* r = db->remote;
+   struct pollfd pfd = { .fd = r->fd, .events = POLLIN };
+   while (!r->broken && poll(&pfd, 1, 0) > 0) {
+      uint8_t op, status;
+      ProtoReader in;
+      if (!read_frame(r, &op, &status, &in) || !handle_async(r, op, status, &in))
+         lost(db);
+   }
+}
+
+static int send_request(FlashDb* db) {
+   Remote* r = db->remote;
+   if (r->broken)
+      return 0;
+   if (!proto_end(&r->out)) {
+      db_report(db, DB_MSG_ERROR, "Request too large for flash-cardsd");
+      return 0;
+   }
+   if (!proto_write_all(r->fd, r->out.data, r->out.len)) {
+      lost(db);
+      return 0;
+   }
+   r->stats.bytes_out += r->out.len;
+   return 1;
+}
+
+static ProtoBuf* begin(FlashDb* db, ProtoOp op) {
+   proto_begin(&db->remote->out, op, 0);
+   return &db->remote->out;
+}
+
+// Send the request built since begin and wait for its reply. The messages the
+// daemon reported go to db_report as if they were raised here; reply is left at
+// the start of the reply's own fields.
+static int call(FlashDb* db, ProtoReader* reply) {
+   TRACE_SCOPE(TRACE_REMOTE_CALL);
+   Remote* r = db->remote;
+   uint8_t want = r->out.data ? r->out.data[4] : 0;
+   unsigned long long start = trace_now_ns();
+   if (!send_request(db))
+      return 0;
+
+   uint8_t op, status;
+   do {
+      if (!read_frame(r, &op, &status, reply)) {
+         lost(db);
+         return 0;
+      }
+   } while (op != want && handle_async(r, op, status, reply));
+   if (op != want) {
+      lost(db);
+      return 0;
+   }
+
+   unsigned long long wait = trace_now_ns() - start;
+   r->stats.calls++;
+   r->stats.wait_ns += wait;
+   if (wait > r->stats.max_wait_ns)
+      r->stats.max_wait_ns = wait;
+
+   if (status != PROTO_OK) {
+      db_report(db, DB_MSG_ERROR, proto_get_str(reply, NULL));
+      return 0;
+   }
+   uint8_t count = proto_get_u8(reply);
+   for (uint8_t i = 0; i < count; i++) {
+      DbMessageLevel level = proto_get_u8(reply);
+      const char* text = proto_get_str(reply, NULL);
+      if (!reply->failed)
+         db_report(db, level, text);
+   }
+   return !reply->failed;
+}
+
+// Send a write without waiting; its reply is read by a later call or drain
+static int post(FlashDb* db) {
+   Remote* r = db->remote;
+   if (!send_request(db))
+      return 0;
+   r->pending++;
+   r->stats.posts++;
+   drain(db);
+   return 1;
+}
+
+static Remote* open_remote(const char* path, int flags) {
+   struct sockaddr_un addr = { .sun_family = AF_UNIX };
+   if (strlen(path) >= sizeof(addr.sun_path))
+      return NULL;
+   snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+
+   int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+   if (fd < 0)
+      return NULL;
+   if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+      close(fd);
+      return NULL;
+   }
+
+   Remote* r = calloc(1, sizeof(*r));
+   if (!r) {
+      close(fd);
+      return NULL;
+   }
+   r->fd = fd;
+   r->flags = flags;
+   snprintf(r->path, sizeof(r->path), "%s", path);
+
+   // A daemon of another version is treated as no daemon at all
+   proto_begin(&r->out, PROTO_HELLO, 0);
+   proto_put_u32(&r->out, PROTO_VERSION);
+   proto_put_u8(&r->out, (uint8_t)flags);
+   uint8_t op, status;
+   ProtoReader in;
+   if (!proto_end(&r->out) || !proto_write_all(fd, r->out.data, r->out.len) ||
+       !proto_read_frame(fd, &r->in, &op, &status, &in) || op != PROTO_HELLO || status != PROTO_OK) {
+      close(fd);
+      proto_free(&r->out);
+      proto_free(&r->in);
+      free(r);
+      return NULL;
+   }
+   return r;
+}
+
+static FlashDb* wrap(Remote* r) {
+   FlashDb* db = calloc(1, sizeof(FlashDb));
+   if (!db)
+      return NULL;
+   db_default_config(&db->config);
+   db->remote = r;
+   return db;
+}
+
+int remote_connect(FlashDb** out, const char* path) {
+   Remote* r = open_remote(path, PROTO_WANT_EVENTS);
+   if (!r)
+      return 0;
+   FlashDb* db = wrap(r);
+   if (!db) {
+      close(r->fd);
+      free(r);
+      return 0;
+   }
+   *out = db;
+   return 1;
+}
+
+FlashDb* remote_reconnect(FlashDb* db) {
+   Remote* r = open_remote(db->remote->path, 0);
+   if (!r)
+      return NULL;
+   FlashDb* other = wrap(r);
+   if (!other) {
+      close(r->fd);
+      free(r);
+      return NULL;
+   }
+   other->config = db->config;
+   return other;
+}
+
+void remote_close(FlashDb* db) {
+   Remote* r = db->remote;
+   if (!r)
+      return;
+   if (!r->broken)
+      close(r->fd);
+   proto_free(&r->out);
+   proto_free(&r->in);
+   free(r);
+   db->remote = NULL;
+}
+
+int remote_deck_changed(FlashDb* db, int deck_id) {
+   Remote* r = db->remote;
+   if (!r)
+      return 0;
+   drain(db);
+
+   int changed = r->changed_all;
+   for (size_t i = 0; i < r->changed_count && !changed; i++)
+      changed = r->changed[i] == deck_id;
+   r->changed_count = 0;
+   r->changed_all = 0;
+   return changed;
+}
+
+unsigned long remote_take_errors(FlashDb* db) {
+   Remote* r = db->remote;
+   if (!r)
+      return 0;
+   drain(db);
+   unsigned long errors = r->errors;
+   r->errors = 0;
+   return errors;
+}
+
+void remote_print_stats(FlashDb* db, FILE* out) {
+   Remote* r = db->remote;
+   if (!r)
+      return;
+   const RemoteStats* s = &r->stats;
+   fprintf(out, "remote: %llu calls (avg %.3f ms, max %.3f ms), %llu writes sent without waiting, "
+           "%llu events, %.1f KiB sent, %.1f KiB received\n",
+           s->calls, s->calls ? s->wait_ns / 1e6 / s->calls : 0.0, s->max_wait_ns / 1e6,
+           s->posts, s->events, s->bytes_out / 1024.0, s->bytes_in / 1024.0);
+}
+
+void remote_load_deck_list(FlashDb* db, DeckInfoList* list) {
+   list->items = NULL;
+   list->count = 0;
+   list->capacity = 0;
+   list->arena = (Arena){0};
+
+   begin(db, PROTO_DECK_LIST);
+   ProtoReader in;
+   if (!call(db, &in))
+      return;
+   uint32_t count = proto_get_u32(&in);
+   for (uint32_t i = 0; i < count && !in.failed; i++) {
+      DeckInfo info = { .id = proto_get_i32(&in) };
+      size_t len;
+      const char* name = proto_get_str(&in, &len);
+      info.name = arena_strndup(&list->arena, name, len);
+      info.card_count = proto_get_i32(&in);
+      da_append(list, info);
+   }
+}
+
+int remote_load_deck_stats(FlashDb* db, time_t now, DeckStatsList* list) {
+   list->items = NULL;
+   list->count = 0;
+   list->capacity = 0;
+   list->arena = (Arena){0};
+
+   proto_put_i64(begin(db, PROTO_DECK_STATS), now);
+   ProtoReader in;
+   if (!call(db, &in))
+      return 0;
+   int ok = proto_get_u8(&in);
+   uint32_t count = proto_get_u32(&in);
+   for (uint32_t i = 0; i < count && !in.failed; i++) {
+      DeckStats stats = { .id = proto_get_i32(&in) };
+      size_t len;
+      const char* name = proto_get_str(&in, &len);
+      stats.name = arena_strndup(&list->arena, name, len);
+      stats.cards = proto_get_i32(&in);
+      stats.due = proto_get_i32(&in);
+      stats.reviewed = proto_get_i32(&in);
+      da_append(list, stats);
+   }
+   return ok && !in.failed;
+}
+
+int remote_load_review_stats(FlashDb* db, time_t now, DeckReviewStatsList* list) {
+   list->items = NULL;
+   list->count = 0;
+   list->capacity = 0;
+   list->arena = (Arena){0};
+
+   proto_put_i64(begin(db, PROTO_REVIEW_STATS), now);
+   ProtoReader in;
+   if (!call(db, &in))
+      return 0;
+   int ok = proto_get_u8(&in);
+   uint32_t count = proto_get_u32(&in);
+   for (uint32_t i = 0; i < count && !in.failed; i++) {
+      DeckReviewStats stats = { .id = proto_get_i32(&in) };
+      size_t len;
+      const char* name = proto_get_str(&in, &len);
+      stats.name = arena_strndup(&list->arena, name, len);
+      stats.cards = proto_get_i32(&in);
+      stats.reviews = proto_get_i32(&in);
+      stats.correct = proto_get_i32(&in);
+      stats.response_ms = proto_get_i64(&in);
+      stats.streak = proto_get_i32(&in);
+      stats.best_streak = proto_get_i32(&in);
+      stats.day_streak = proto_get_i32(&in);
+      stats.last_review = (time_t)proto_get_i64(&in);
+      da_append(list, stats);
+   }
+   return ok && !in.failed;
+}
+
+int remote_deck_exists(FlashDb* db, const char* deck_name, int* deck_id) {
+   proto_put_str(begin(db, PROTO_DECK_EXISTS), deck_name);
+   ProtoReader in;
+   if (!call(db, &in))
+      return 0;
+   int found = proto_get_u8(&in);
+   int id = proto_get_i32(&in);
+   if (found && deck_id)
+      *deck_id = id;
+   return found && !in.failed;
+}
+
+// The request has a name or an id and the reply is a single ok byte
+static int call_ok(FlashDb* db, ProtoOp op, const char* name, int id) {
+   ProtoBuf* out = begin(db, op);
+   if (name)
+      proto_put_str(out, name);
+   else
+      proto_put_i32(out, id);
+   ProtoReader in;
+   if (!call(db, &in))
+      return 0;
+   return proto_get_u8(&in) && !in.failed;
+}
+
+int remote_create_deck(FlashDb* db, const char* deck_name) {
+   return call_ok(db, PROTO_CREATE_DECK, deck_name, 0);
+}
+
+int remote_delete_deck(FlashDb* db, int deck_id) {
+   return call_ok(db, PROTO_DELETE_DECK, NULL, deck_id);
+}
+
+int remote_delete_deck_by_name(FlashDb* db, const char* deck_name) {
+   return call_ok(db, PROTO_DELETE_DECK_NAME, deck_name, 0);
+}
+
+int remote_load_deck_cards(FlashDb* db, int deck_id, Deck* deck) {
+   proto_put_i32(begin(db, PROTO_DECK_CARDS), deck_id);
+   ProtoReader in;
+   if (!call(db, &in))
+      return 0;
+   if (!proto_get_u8(&in))
+      return 0;
+   size_t len;
+   const char* name = proto_get_str(&in, &len);
+   deck->deck_name = arena_strndup(&deck->arena, name, len);
+
+   uint32_t count = proto_get_u32(&in);
+   if (in.failed || count > in.left / sizeof(int32_t)) {
+      deck->stale = 1;
+      return 0;
+   }
+   if (count > deck->capacity) {
+      int* ids = realloc(deck->ids, count * sizeof(*ids));
+      if (!ids) {
+         deck->stale = 1;
+         return 0;
+      }
+      deck->ids = ids;
+      deck->capacity = count;
+   }
+   for (uint32_t i = 0; i < count; i++)
+      deck->ids[i] = proto_get_i32(&in);
+   deck->count = count;
+   return 1;
+}
+
+int remote_deck_page(FlashDb* db, int deck_id, const int* ids, size_t count, Cards* cards,
+                     Arena* arena, int* stale) {
+   // The range, not the ids, is sent, so every client browsing the deck asks the
+   // same question and the daemon's cache answers it once for all of them
+   ProtoBuf* out = begin(db, PROTO_DECK_PAGE);
+   proto_put_i32(out, deck_id);
+   proto_put_i32(out, ids[0]);
+   proto_put_i32(out, ids[count - 1]);
+   ProtoReader in;
+   if (!call(db, &in))
+      return 0;
+   int ok = proto_get_u8(&in);
+   uint32_t rows = proto_get_u32(&in);
+
+   // Same merge as a local page: an id without a row was deleted, a row without
+   // an id was added
+   int row_id = rows > 0 ? proto_get_i32(&in) : 0;
+   uint32_t row = 0;
+   for (size_t i = 0; i < count; i++) {
+      while (row < rows && row_id < ids[i]) {
+         *stale = 1;
+         proto_get_str(&in, NULL);
+         proto_get_str(&in, NULL);
+         row_id = ++row < rows ? proto_get_i32(&in) : 0;
+      }
+
+      Cards card = { .id = ids[i], .deck_id = deck_id, .front = "", .back = "" };
+      if (row < rows && row_id == ids[i]) {
+         size_t len;
+         const char* text = proto_get_str(&in, &len);
+         card.front = arena_strndup(arena, text, len);
+         text = proto_get_str(&in, &len);
+         card.back = arena_strndup(arena, text, len);
+         row_id = ++row < rows ? proto_get_i32(&in) : 0;
+      } else {
+         *stale = 1;
+      }
+      cards[i] = card;
+   }
+   return ok && !in.failed;
+}
+
+int remote_card_text(FlashDb* db, int card_id, Cards* card, char** text) {
+   proto_put_i32(begin(db, PROTO_CARD_TEXT), card_id);
+   ProtoReader in;
+   if (!call(db, &in) || !proto_get_u8(&in))
+      return 0;
+   int deck_id = proto_get_i32(&in);
+   size_t front_len, back_len;
+   const char* front = proto_get_str(&in, &front_len);
+   const char* back = proto_get_str(&in, &back_len);
+   if (in.failed)
+      return 0;
+
+   // One allocation, as a local read makes
+   char* buf = malloc(front_len + back_len + 2);
+   if (!buf)
+      return 0;
+   memcpy(buf, front, front_len + 1);
+   memcpy(buf + front_len + 1, back, back_len + 1);
+   *card = (Cards){ .id = card_id, .deck_id = deck_id, .front = buf, .back = buf + front_len + 1 };
+   *text = buf;
+   return 1;
+}
+
+int remote_add_card(FlashDb* db, int deck_id, const char* front, const char* back) {
+   ProtoBuf* out = begin(db, PROTO_ADD_CARD);
+   proto_put_i32(out, deck_id);
+   proto_put_str(out, front);
+   proto_put_str(out, back);
+   ProtoReader in;
+   if (!call(db, &in))
+      return 0;
+   int card_id = proto_get_i32(&in);
+   return in.failed ? 0 : card_id;
+}
+
+int remote_update_card(FlashDb* db, int deck_id, int card_id, const char* front, const char* back) {
+   ProtoBuf* out = begin(db, PROTO_UPDATE_CARD);
+   proto_put_i32(out, deck_id);
+   proto_put_i32(out, card_id);
+   proto_put_str(out, front);
+   proto_put_str(out, back);
+   return post(db);
+}
+
+int remote_delete_card(FlashDb* db, int deck_id, int card_id) {
+   ProtoBuf* out = begin(db, PROTO_DELETE_CARD);
+   proto_put_i32(out, deck_id);
+   proto_put_i32(out, card_id);
+   return post(db);
+}
+
+int remote_find_duplicate(FlashDb* db, int deck_id, const char* front, long long hash, Cards* card) {
+   ProtoBuf* out = begin(db, PROTO_FIND_DUPLICATE);
+   proto_put_i32(out, deck_id);
+   proto_put_str(out, front);
+   proto_put_i64(out, hash);
+   ProtoReader in;
+   if (!call(db, &in) || !proto_get_u8(&in))
+      return 0;
+   int card_id = proto_get_i32(&in);
+   const char* other_front = proto_get_str(&in, NULL);
+   const char* other_back = proto_get_str(&in, NULL);
+   if (in.failed)
+      return 0;
+   *card = (Cards){
+      .id = card_id,
+      .deck_id = deck_id,
+      .front = strdup(other_front),
+      .back = strdup(other_back)
+   };
+   if (!card->front || !card->back) {
+      free(card->front);
+      free(card->back);
+      return 0;
+   }
+   return 1;
+}
+
+int remote_search(FlashDb* db, const char* text, int limit, int offset, SearchResults* results) {
+   ProtoBuf* out = begin(db, PROTO_SEARCH);
+   proto_put_str(out, text);
+   proto_put_i32(out, limit);
+   proto_put_i32(out, offset);
+   ProtoReader in;
+   if (!call(db, &in))
+      return 0;
+   int ok = proto_get_u8(&in);
+   results->has_more = proto_get_u8(&in);
+   uint32_t count = proto_get_u32(&in);
+   for (uint32_t i = 0; i < count && !in.failed; i++) {
+      SearchResult result = { .card_id = proto_get_i32(&in), .deck_id = proto_get_i32(&in) };
+      size_t len;
+      const char* field = proto_get_str(&in, &len);
+      result.deck_name = arena_strndup(&results->arena, field, len);
+      field = proto_get_str(&in, &len);
+      result.front = arena_strndup(&results->arena, field, len);
+      field = proto_get_str(&in, &len);
+      result.back = arena_strndup(&results->arena, field, len);
+      da_append(results, result);
+   }
+   return ok && !in.failed;
+}
+
+int remote_load_due_cards(FlashDb* db, int deck_id, time_t now, StudyQueue* queue) {
+   ProtoBuf* out = begin(db, PROTO_STUDY_LOAD);
+   proto_put_i32(out, deck_id);
+   proto_put_i64(out, now);
+   ProtoReader in;
+   if (!call(db, &in))
+      return 0;
+   int ok = proto_get_u8(&in);
+   uint32_t count = proto_get_u32(&in);
+   for (uint32_t i = 0; i < count && !in.failed; i++) {
+      StudyCard card = { .card_id = proto_get_i32(&in) };
+      card.sched.due = (time_t)proto_get_i64(&in);
+      card.sched.interval = proto_get_f64(&in);
+      card.sched.ease = proto_get_f64(&in);
+      card.sched.reps = proto_get_i32(&in);
+      card.sched.lapses = proto_get_i32(&in);
+      da_append(queue, card);
+   }
+   return ok && !in.failed;
+}
+
+int remote_save_schedule(FlashDb* db, int card_id, const Schedule* sched) {
+   ProtoBuf* out = begin(db, PROTO_SAVE_SCHEDULE);
+   proto_put_i32(out, card_id);
+   proto_put_i64(out, sched->due);
+   proto_put_f64(out, sched->interval);
+   proto_put_f64(out, sched->ease);
+   proto_put_i32(out, sched->reps);
+   proto_put_i32(out, sched->lapses);
+   return post(db);
+}
+
+int remote_log_reviews(FlashDb* db, const ReviewEntry* entries, size_t count) {
+   ProtoBuf* out = begin(db, PROTO_LOG_REVIEWS);
+   proto_put_u32(out, (uint32_t)count);
+   for (size_t i = 0; i < count; i++) {
+      proto_put_i32(out, entries[i].card_id);
+      proto_put_i32(out, entries[i].deck_id);
+      proto_put_i64(out, entries[i].reviewed_at);
+      proto_put_u8(out, (uint8_t)entries[i].correct);
+      proto_put_i32(out, entries[i].response_ms);
+   }
+   return post(db);
+}
@@ -0,0 +1,205 @@
+#include "../include/render.h"
+#include "../include/trace.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+
+// The terminal tap, only set up when output is counted: while curses runs,
+// stdout is a pipe and a thread copies everything from it to the real
+// terminal, counting the bytes. curses takes the terminal modes and size from
+// stderr when stdout is not a tty, so stderr is pointed at the terminal for
+// the duration too.
+static int tty_fd = -1;
+static int saved_stdout = -1;
+static int saved_stderr = -1;
+static int pipe_read = -1;
+static pthread_t tap_thread;
+static int tapped;
+
+static _Atomic unsigned long long bytes_written;
+static atomic_int tap_lost;       // the tap stopped early, bytes_written is short
+static unsigned long long flushes;
+static unsigned long long first_flush_ns;
+static unsigned generation;
+
+// Input to screen latency: from a key arriving to the update that answers it
+static unsigned long long key_ns;
+static unsigned long long keys;
+static unsigned long long latency_total_ns;
+static unsigned long long latency_max_ns;
+
+static unsigned long long now_ns(void) {
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Stops when curses' side closes or the terminal goes away (EIO after a hangup).
+// In the second case stdout is pointed straight at the terminal again, so later
+// output fails there like it would untapped instead of filling a dead pipe.
+static void* tap_main(void* arg) {
+   (void)arg;
+   char buf[8192];
+   ssize_t n;
+   while ((n = read(pipe_read, buf, sizeof(buf))) != 0) {
+      if (n < 0) {
+         if (errno == EINTR)
+            continue;
+         break;
+      }
+      for (ssize_t done = 0; done < n;) {
+         ssize_t w = write(tty_fd, buf + done, n - done);
+         if (w < 0) {
+            if (errno == EINTR)
+               continue;
+            atomic_store(&tap_lost, 1);
+            dup2(tty_fd, STDOUT_FILENO);
+            return NULL;
+         }
+         done += w;
+      }
+      atomic_fetch_add(&bytes_written, (unsigned long long)n);
+   }
+   if (n < 0) {
+      atomic_store(&tap_lost, 1);
+      dup2(tty_fd, STDOUT_FILENO);
+   }
+   return NULL;
+}
+
+static int start_tap(void) {
+   int fds[2];
+   if (!isatty(STDOUT_FILENO) || pipe(fds) != 0)
+      return 0;
+
+   tty_fd = dup(STDOUT_FILENO);
+   saved_stdout = dup(STDOUT_FILENO);
+   pipe_read = fds[0];
+   if (pthread_create(&tap_thread, NULL, tap_main, NULL) != 0) {
+      close(fds[0]);
+      close(fds[1]);
+      close(tty_fd);
+      close(saved_stdout);
+      return 0;
+   }
+
+   if (!isatty(STDERR_FILENO)) {
+      saved_stderr = dup(STDERR_FILENO);
+      dup2(tty_fd, STDERR_FILENO);
+   }
+   fflush(stdout);
+   dup2(fds[1], STDOUT_FILENO);
+   close(fds[1]);
+   return 1;
+}
+
+static void stop_tap(void) {
+   // Closing the last write end lets the thread drain the pipe and finish
+   fflush(stdout);
+   dup2(saved_stdout, STDOUT_FILENO);
+   pthread_join(tap_thread, NULL);
+   if (saved_stderr >= 0) {
+      dup2(saved_stderr, STDERR_FILENO);
+      close(saved_stderr);
+   }
+   close(saved_stdout);
+   close(pipe_read);
+   close(tty_fd);
+}
+
+int render_init(int count_output) {
+   // Without a tap curses still runs, the counter just stays at zero
+   tapped = count_output && start_tap();
+   if (!initscr())
+      return 0;
+
+   // stdscr starts fully touched; stage it now so the first message printed on it
+   // does not repaint the whole screen over the open windows
+   wnoutrefresh(stdscr);
+   return 1;
+}
+
+int render_getch(WINDOW* win) {
+   unsigned long long wait_start = trace_begin();
+   int ch = wgetch(win);
+
+   // The snapshot hotkey is handled here so no screen has to know about it
+   while (ch == TRACE_HOTKEY && trace_enabled) {
+      trace_snapshot();
+      ch = wgetch(win);
+   }
+   key_ns = now_ns();
+   trace_end(TRACE_INPUT_WAIT, wait_start);
+   return ch;
+}
+
+void render_flush(void) {
+   unsigned long long start = trace_begin();
+   doupdate();
+   trace_end(TRACE_SCREEN_UPDATE, start);
+   if (flushes++ == 0)
+      first_flush_ns = now_ns();
+
+   if (key_ns) {
+      unsigned long long latency = now_ns() - key_ns;
+      key_ns = 0;
+      keys++;
+      latency_total_ns += latency;
+      if (latency > latency_max_ns)
+         latency_max_ns = latency;
+   }
+}
+
+void render_touch(void) {
+   generation++;
+}
+
+unsigned render_generation(void) {
+   return generation;
+}
+
+void render_text_line(WINDOW* win, int row, int col, const char* text, size_t bytes) {
+   wmove(win, row, col);
+   size_t from = 0;
+   for (size_t i = 0; i < bytes; i++) {
+      if ((unsigned char)text[i] < 0x20 || text[i] == 0x7f) {
+         waddnstr(win, text + from, i - from);
+         waddch(win, ' ');
+         from = i + 1;
+      }
+   }
+   waddnstr(win, text + from, bytes - from);
+}
+
+void render_get_stats(RenderStats* stats) {
+   stats->bytes = atomic_load(&bytes_written);
+   stats->flushes = flushes;
+   stats->keys = keys;
+   stats->latency_total_ns = latency_total_ns;
+   stats->latency_max_ns = latency_max_ns;
+   stats->first_flush_ns = first_flush_ns;
+}
+
+void render_print_stats(FILE* out) {
+   if (keys > 0) {
+      fprintf(out, "input to screen: %llu keys, avg %.1f us, max %.1f us\n",
+              keys, latency_total_ns / 1e3 / keys, latency_max_ns / 1e3);
+   }
+   if (!tapped) {
+      fprintf(out, "terminal: output not counted (stdout is not a terminal)\n");
+      return;
+   }
+   unsigned long long bytes = atomic_load(&bytes_written);
+   fprintf(out, "terminal: %llu bytes in %llu updates (%.1f bytes/update)%s\n",
+           bytes, flushes, flushes ? (double)bytes / flushes : 0.0,
+           atomic_load(&tap_lost) ? ", counting stopped when a write failed" : "");
+}
+
+void render_end(void) {
+   endwin();
+   if (tapped)
+      stop_tap();
+}
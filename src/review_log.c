@@ -0,0 +1,134 @@
+#include "../include/review_log.h"
+#include "../include/writer.h"
+#include "../include/remote.h"
+#include "../include/trace.h"
+
+// Offset of local time from UTC at t, in seconds
+static long utc_offset(time_t t) {
+   struct tm tm;
+   localtime_r(&t, &tm);
+   return tm.tm_gmtoff;
+}
+
+// Days since the epoch in local time, so a day streak follows the user's midnight
+static long long local_day(time_t t, long offset) {
+   return ((long long)t + offset) / SECONDS_PER_DAY;
+}
+
+int review_log_add(FlashDb* db, ReviewLog* log, const ReviewEntry* entry) {
+   log->pending[log->count++] = *entry;
+   return log->count < REVIEW_LOG_BATCH || review_log_flush(db, log);
+}
+
+int review_log_flush(FlashDb* db, ReviewLog* log) {
+   char status_msg[MAX_BUFFER] = {0};
+   size_t count = log->count;
+   if (count == 0)
+      return 1;
+   log->count = 0;
+
+   if (db->remote)
+      return remote_log_reviews(db, log->pending, count);
+   if (db->writer) {
+      ReviewEntry* copy = malloc(count * sizeof(*copy));
+      if (copy) { // the writer frees it once the rows are in
+         memcpy(copy, log->pending, count * sizeof(*copy));
+         WriteRequest req = { .op = WRITE_LOG_REVIEWS, .reviews = copy, .review_count = count };
+         writer_submit(db, &req);
+         return 1;
+      }
+   }
+
+   // Inside a transaction the rows join it (and its rollback), otherwise they get their own
+   int own = sqlite3_get_autocommit(db->conn);
+   int ok = (!own || db_begin(db)) && write_reviews(db, log->pending, count);
+   if (own) {
+      if (ok)
+         ok = db_commit(db);
+      if (!ok)
+         db_rollback(db);
+   }
+   if (!ok) {
+      snprintf(status_msg, sizeof(status_msg), "Failed to log %zu reviews: %s", count, sqlite3_errmsg(db->conn));
+      db_report(db, DB_MSG_ERROR, status_msg);
+   }
+   return ok;
+}
+
+int write_reviews(FlashDb* db, const ReviewEntry* entries, size_t count) {
+   sqlite3_stmt* stmt = db_stmt_acquire(db, STMT_LOG_REVIEW);
+   if (!stmt)
+      return 0;
+
+   // localtime_r is most of the cost of a row, and a batch is minutes long, so
+   // one offset serves all of it
+   long offset = count ? utc_offset(entries[0].reviewed_at) : 0;
+   int ok = 1;
+   for (size_t i = 0; i < count && ok; i++) {
+      sqlite3_bind_int(stmt, 1, entries[i].card_id);
+      sqlite3_bind_int(stmt, 2, entries[i].deck_id);
+      sqlite3_bind_int64(stmt, 3, (sqlite3_int64)entries[i].reviewed_at);
+      sqlite3_bind_int64(stmt, 4, local_day(entries[i].reviewed_at, offset));
+      sqlite3_bind_int(stmt, 5, entries[i].correct);
+      sqlite3_bind_int(stmt, 6, entries[i].response_ms);
+      ok = sqlite3_step(stmt) == SQLITE_DONE;
+      sqlite3_reset(stmt);
+   }
+   db_stmt_release(db, STMT_LOG_REVIEW);
+   return ok;
+}
+
+int load_review_stats(FlashDb* db, time_t now, DeckReviewStatsList* list) {
+   TRACE_SCOPE(TRACE_LOAD_REVIEW_STATS);
+   if (db->remote)
+      return remote_load_review_stats(db, now, list);
+   // A day streak is still running if the last review was today or yesterday
+   const char* stats_sql =
+      "SELECT d.id, d.name, d.card_count, "
+      "COALESCE(r.reviews, 0), COALESCE(r.correct, 0), COALESCE(r.response_ms, 0), "
+      "COALESCE(r.streak, 0), COALESCE(r.best_streak, 0), "
+      "CASE WHEN r.last_day >= ? - 1 THEN r.day_streak ELSE 0 END, "
+      "COALESCE(r.last_review, 0) "
+      "FROM decks d "
+      "LEFT JOIN deck_review_stats r ON r.deck_id = d.id "
+      "ORDER BY d.name ASC;";
+
+   list->items = NULL;
+   list->count = 0;
+   list->capacity = 0;
+   list->arena = (Arena){0};
+
+   writer_flush(db);
+   sqlite3_stmt* stmt;
+   if (sqlite3_prepare_v2(db->conn, stats_sql, -1, &stmt, NULL) != SQLITE_OK)
+      return 0;
+   sqlite3_bind_int64(stmt, 1, local_day(now, utc_offset(now)));
+
+   int rc;
+   while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+      DeckReviewStats stats = {
+         .id = sqlite3_column_int(stmt, 0),
+         .name = arena_strndup(&list->arena, (const char*)sqlite3_column_text(stmt, 1),
+                               sqlite3_column_bytes(stmt, 1)),
+         .cards = sqlite3_column_int(stmt, 2),
+         .reviews = sqlite3_column_int(stmt, 3),
+         .correct = sqlite3_column_int(stmt, 4),
+         .response_ms = sqlite3_column_int64(stmt, 5),
+         .streak = sqlite3_column_int(stmt, 6),
+         .best_streak = sqlite3_column_int(stmt, 7),
+         .day_streak = sqlite3_column_int(stmt, 8),
+         .last_review = (time_t)sqlite3_column_int64(stmt, 9)
+      };
+      da_append(list, stats);
+   }
+   sqlite3_finalize(stmt);
+   return rc == SQLITE_DONE;
+}
+
+void free_review_stats(DeckReviewStatsList* list) {
+   arena_free(&list->arena);
+   free(list->items);
+   list->items = NULL;
+   list->count = 0;
+   list->capacity = 0;
+}
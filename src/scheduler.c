@@ -0,0 +1,214 @@
+#include "../include/scheduler.h"
+#include "../include/writer.h"
+#include "../include/remote.h"
+#include "../include/trace.h"
+
+static int due_before(const StudyQueue* q, size_t a, size_t b) {
+   const StudyCard* x = &q->items[a];
+   const StudyCard* y = &q->items[b];
+   if (x->sched.due != y->sched.due)
+      return x->sched.due < y->sched.due;
+   return x->card_id < y->card_id;
+}
+
+static void sift_down(StudyQueue* q, size_t pos) {
+   while (1) {
+      size_t left = 2 * pos + 1;
+      size_t right = left + 1;
+      size_t min = pos;
+
+      if (left < q->heap_len && due_before(q, q->heap[left], q->heap[min]))
+         min = left;
+      if (right < q->heap_len && due_before(q, q->heap[right], q->heap[min]))
+         min = right;
+      if (min == pos)
+         return;
+
+      size_t tmp = q->heap[pos];
+      q->heap[pos] = q->heap[min];
+      q->heap[min] = tmp;
+      pos = min;
+   }
+}
+
+// Ask for the PREFETCH_DEPTH cards due first, in order. A best-first walk from
+// the root: the next card is always a child of one already taken, so only a
+// handful of heap slots are looked at and the heap is left as it is.
+static void prefetch_next(StudyQueue* q) {
+   int ids[PREFETCH_DEPTH];
+   size_t frontier[PREFETCH_DEPTH + 1];
+   size_t open = 0, count = 0;
+
+   if (q->heap_len > 0)
+      frontier[open++] = 0;
+   while (open > 0 && count < PREFETCH_DEPTH) {
+      size_t best = 0;
+      for (size_t i = 1; i < open; i++) {
+         if (due_before(q, q->heap[frontier[i]], q->heap[frontier[best]]))
+            best = i;
+      }
+      size_t pos = frontier[best];
+      frontier[best] = frontier[--open];
+      ids[count++] = q->items[q->heap[pos]].card_id;
+
+      for (size_t child = 2 * pos + 1; child <= 2 * pos + 2 && child < q->heap_len; child++)
+         frontier[open++] = child;
+   }
+   prefetch_want(q->prefetch, ids, count);
+}
+
+int load_due_cards(FlashDb* db, int deck_id, time_t now, StudyQueue* queue) {
+   if (db->remote)
+      return remote_load_due_cards(db, deck_id, now, queue);
+   writer_flush(db);
+
+   sqlite3_stmt* stmt = db_stmt_acquire(db, STMT_DUE_CARDS);
+   if (!stmt)
+      return 0;
+
+   sqlite3_bind_int(stmt, 1, deck_id);
+   sqlite3_bind_int64(stmt, 2, (sqlite3_int64)now);
+
+   while (sqlite3_step(stmt) == SQLITE_ROW) {
+      StudyCard card = { .card_id = sqlite3_column_int(stmt, 0) };
+
+      if (sqlite3_column_type(stmt, 1) == SQLITE_NULL) { // never reviewed
+         card.sched = (Schedule){ .due = now, .interval = 0, .ease = SCHED_INITIAL_EASE };
+      } else {
+         card.sched.due = (time_t)sqlite3_column_int64(stmt, 1);
+         card.sched.interval = sqlite3_column_double(stmt, 2);
+         card.sched.ease = sqlite3_column_double(stmt, 3);
+         card.sched.reps = sqlite3_column_int(stmt, 4);
+         card.sched.lapses = sqlite3_column_int(stmt, 5);
+      }
+      da_append(queue, card);
+   }
+   db_stmt_release(db, STMT_DUE_CARDS);
+   return 1;
+}
+
+int study_queue_load(FlashDb* db, int deck_id, time_t now, PrefetchHook warm, StudyQueue* queue) {
+   TRACE_SCOPE(TRACE_STUDY_LOAD);
+   queue->deck_id = deck_id;
+   queue->db = db;
+   if (!load_due_cards(db, deck_id, now, queue))
+      return 0;
+
+   // Floyd heap construction, O(n)
+   queue->heap = malloc((queue->count ? queue->count : 1) * sizeof(*queue->heap));
+   queue->heap_len = queue->count;
+   for (size_t i = 0; i < queue->count; i++)
+      queue->heap[i] = i;
+   for (size_t i = queue->heap_len / 2; i-- > 0;)
+      sift_down(queue, i);
+
+   if (!(queue->prefetch = prefetch_start(db, warm)))
+      return 0;
+   prefetch_next(queue);
+   return 1;
+}
+
+StudyCard* study_queue_peek(StudyQueue* queue) {
+   if (queue->heap_len == 0)
+      return NULL;
+   return &queue->items[queue->heap[0]];
+}
+
+const Cards* study_queue_card(StudyQueue* queue) {
+   StudyCard* next = study_queue_peek(queue);
+   if (!next)
+      return NULL;
+   return prefetch_get(queue->prefetch, next->card_id);
+}
+
+void sm2_review(Schedule* sched, int grade, time_t now) {
+   if (grade >= 3) {
+      if (sched->reps == 0)
+         sched->interval = 1;
+      else if (sched->reps == 1)
+         sched->interval = 6;
+      else
+         sched->interval *= sched->ease;
+      sched->reps++;
+      sched->due = now + (time_t)(sched->interval * SECONDS_PER_DAY);
+   } else {
+      sched->reps = 0;
+      sched->lapses++;
+      sched->interval = 0;
+      sched->due = now + SCHED_RELEARN_SECONDS;
+   }
+
+   int q = 5 - grade;
+   sched->ease += 0.1 - q * (0.08 + q * 0.02);
+   if (sched->ease < SCHED_MIN_EASE)
+      sched->ease = SCHED_MIN_EASE;
+}
+
+int save_schedule(FlashDb* db, int card_id, const Schedule* sched) {
+   if (db->remote)
+      return remote_save_schedule(db, card_id, sched);
+   sqlite3_stmt* stmt = db_stmt_acquire(db, STMT_SAVE_SCHEDULE);
+   if (!stmt)
+      return 0;
+
+   sqlite3_bind_int(stmt, 1, card_id);
+   sqlite3_bind_int64(stmt, 2, (sqlite3_int64)sched->due);
+   sqlite3_bind_double(stmt, 3, sched->interval);
+   sqlite3_bind_double(stmt, 4, sched->ease);
+   sqlite3_bind_int(stmt, 5, sched->reps);
+   sqlite3_bind_int(stmt, 6, sched->lapses);
+
+   int ok = sqlite3_step(stmt) == SQLITE_DONE;
+   db_stmt_release(db, STMT_SAVE_SCHEDULE);
+   return ok;
+}
+
+int study_queue_answer(FlashDb* db, StudyQueue* queue, int correct, int response_ms, time_t now) {
+   TRACE_SCOPE(TRACE_STUDY_ANSWER);
+   if (queue->heap_len == 0)
+      return 0;
+
+   size_t top = queue->heap[0];
+   StudyCard* card = &queue->items[top];
+   sm2_review(&card->sched, correct ? SCHED_GRADE_CORRECT : SCHED_GRADE_INCORRECT, now);
+   int ok = 1;
+   if (db->writer) { // persisted in the background, the answer shows right away
+      WriteRequest req = { .op = WRITE_SAVE_SCHEDULE, .card_id = card->card_id, .sched = card->sched };
+      writer_submit(db, &req);
+   } else {
+      ok = save_schedule(db, card->card_id, &card->sched);
+   }
+
+   ReviewEntry entry = {
+      .card_id = card->card_id,
+      .deck_id = queue->deck_id,
+      .reviewed_at = now,
+      .correct = correct,
+      .response_ms = response_ms
+   };
+   if (!review_log_add(db, &queue->log, &entry))
+      ok = 0;
+
+   if (correct) { // done for this session, pop it
+      queue->graduated++;
+      queue->heap[0] = queue->heap[--queue->heap_len];
+   }
+   // an incorrect card keeps its slot with a later due time
+   sift_down(queue, 0);
+   prefetch_next(queue);
+   return ok;
+}
+
+void free_study_queue(StudyQueue* queue) {
+   if (queue->db)
+      review_log_flush(queue->db, &queue->log);
+   prefetch_stop(queue->prefetch);
+   queue->prefetch = NULL;
+   free(queue->items);
+   free(queue->heap);
+   queue->items = NULL;
+   queue->heap = NULL;
+   queue->count = 0;
+   queue->capacity = 0;
+   queue->heap_len = 0;
+}
@@ -0,0 +1,91 @@
+#include "../include/search.h"
+#include "../include/writer.h"
+#include "../include/remote.h"
+#include "../include/trace.h"
+
+int build_search_query(const char* text, char* query, size_t size) {
+   size_t len = 0;
+   int words = 0;
+   const char* p = text;
+
+   while (*p) {
+      while (*p && isspace((unsigned char)*p))
+         p++;
+      if (!*p)
+         break;
+
+      // "word"* with embedded quotes doubled, words are ANDed together
+      if (len + (words > 0) + 5 > size)
+         break;
+      if (words > 0)
+         query[len++] = ' ';
+      query[len++] = '"';
+      while (*p && !isspace((unsigned char)*p) && len + 4 < size) {
+         if (*p == '"')
+            query[len++] = '"';
+         query[len++] = *p++;
+      }
+      while (*p && !isspace((unsigned char)*p)) // word did not fit
+         p++;
+      query[len++] = '"';
+      query[len++] = '*';
+      words++;
+   }
+
+   query[len] = '\0';
+   return words > 0;
+}
+
+int search_cards(FlashDb* db, const char* text, int limit, int offset, SearchResults* results) {
+   TRACE_SCOPE(TRACE_SEARCH_CARDS);
+   arena_reset(&results->arena);
+   results->count = 0;
+   results->offset = offset;
+   results->has_more = 0;
+   if (db->remote)
+      return remote_search(db, text, limit, offset, results);
+
+   char query[SEARCH_MAX_QUERY];
+   if (!build_search_query(text, query, sizeof(query)))
+      return 1;
+
+   writer_flush(db);
+   sqlite3_stmt* stmt = db_stmt_acquire(db, STMT_SEARCH_CARDS);
+   if (!stmt)
+      return 0;
+
+   // One row past the page tells whether there is another page
+   sqlite3_bind_text(stmt, 1, query, -1, SQLITE_STATIC);
+   sqlite3_bind_int(stmt, 2, limit + 1);
+   sqlite3_bind_int(stmt, 3, offset);
+
+   int rc;
+   while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+      if ((int)results->count == limit) {
+         results->has_more = 1;
+         continue;
+      }
+      SearchResult result = {
+         .card_id = sqlite3_column_int(stmt, 0),
+         .deck_id = sqlite3_column_int(stmt, 1),
+         .deck_name = arena_strndup(&results->arena, (const char*)sqlite3_column_text(stmt, 2),
+                                    sqlite3_column_bytes(stmt, 2)),
+         .front = arena_strndup(&results->arena, (const char*)sqlite3_column_text(stmt, 3),
+                                sqlite3_column_bytes(stmt, 3)),
+         .back = arena_strndup(&results->arena, (const char*)sqlite3_column_text(stmt, 4),
+                               sqlite3_column_bytes(stmt, 4)),
+      };
+      da_append(results, result);
+   }
+   db_stmt_release(db, STMT_SEARCH_CARDS);
+   return rc == SQLITE_DONE;
+}
+
+void free_search_results(SearchResults* results) {
+   arena_free(&results->arena);
+   free(results->items);
+   results->items = NULL;
+   results->count = 0;
+   results->capacity = 0;
+   results->has_more = 0;
+}
@@ -0,0 +1,254 @@
+#include "../include/trace.h"
+
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Log-linear buckets: exact below 16 ns, then 8 per power of two (about 12% wide)
+#define LINEAR_BUCKETS 16
+#define SUB_BITS 3
+#define BUCKET_COUNT (LINEAR_BUCKETS + (64 - 4) * (1 << SUB_BITS))
+
+typedef struct {
+   _Atomic unsigned long long count;
+   _Atomic unsigned long long total_ns;
+   _Atomic unsigned long long max_ns;
+   _Atomic unsigned long long buckets[BUCKET_COUNT];
+} Histogram;
+
+typedef struct {
+   unsigned long long start;
+   unsigned long long duration;
+   TraceId id;
+} TraceEvent;
+
+// One per thread that recorded a span. Only the owner writes it; readers load
+// the counters relaxed, so a report taken while threads run is at most a few
+// spans behind.
+typedef struct TraceThread {
+   struct TraceThread* next;
+   const char* name;
+   int tid;
+   Histogram hist[TRACE_COUNT];
+   TraceEvent* events;                   // ring of TRACE_EVENTS_PER_THREAD, NULL without TRACE_EVENTS
+   _Atomic unsigned long long event_count;
+} TraceThread;
+
+static const struct {
+   const char* name;
+   const char* category;
+} trace_defs[TRACE_COUNT] = {
+   [TRACE_LOAD_DECK_LIST]    = {"load_deck_list",    "db"},
+   [TRACE_LOAD_DECK_STATS]   = {"load_deck_stats",   "db"},
+   [TRACE_LOAD_REVIEW_STATS] = {"load_review_stats", "db"},
+   [TRACE_LOAD_DECK_CARDS]   = {"load_deck_cards",   "db"},
+   [TRACE_CHECK_DECK_COUNTS] = {"check_deck_counts", "db"},
+   [TRACE_DECK_EXISTS]       = {"deck_exists",       "db"},
+   [TRACE_CREATE_DECK]       = {"create_deck",       "db"},
+   [TRACE_DELETE_DECK]       = {"delete_deck",       "db"},
+   [TRACE_ADD_CARD]          = {"add_card",          "db"},
+   [TRACE_DELETE_CARD]       = {"delete_card",       "db"},
+   [TRACE_UPDATE_CARD]       = {"update_card",       "db"},
+   [TRACE_FIND_DUPLICATE]    = {"find_duplicate",    "db"},
+   [TRACE_DEDUPE_CARDS]      = {"dedupe_cards",      "db"},
+   [TRACE_SEARCH_CARDS]      = {"search_cards",      "db"},
+   [TRACE_STUDY_LOAD]        = {"study_queue_load",  "db"},
+   [TRACE_STUDY_ANSWER]      = {"study_queue_answer", "db"},
+   [TRACE_PREFETCH_LOAD]     = {"prefetch_load",     "prefetch"},
+   [TRACE_PREFETCH_WAIT]     = {"prefetch_wait",     "ui"},
+   [TRACE_WRITER_COMMIT]     = {"writer_commit",     "writer"},
+   [TRACE_IMPORT_READ]       = {"import_read",       "import"},
+   [TRACE_IMPORT_PARSE]      = {"import_parse",      "import"},
+   [TRACE_IMPORT_INSERT]     = {"import_insert",     "import"},
+   [TRACE_BACKUP]            = {"backup",            "backup"},
+   [TRACE_BACKUP_STEP]       = {"backup_step",       "backup"},
+   [TRACE_REMOTE_CALL]       = {"remote_call",       "remote"},
+   [TRACE_DAEMON_REQUEST]    = {"daemon_request",    "daemon"},
+   [TRACE_MENU_REDRAW]       = {"menu_redraw",       "ui"},
+   [TRACE_RENDER_CARD]       = {"render_card",       "ui"},
+   [TRACE_EDITOR_REDRAW]     = {"editor_redraw",     "ui"},
+   [TRACE_SCREEN_UPDATE]     = {"screen_update",     "ui"},
+   [TRACE_INPUT_WAIT]        = {"input_wait",        "ui"},
+};
+
+int trace_enabled;
+
+static int trace_flags;
+static const char* trace_path;
+static unsigned long long trace_start_ns;
+static _Atomic(TraceThread*) threads;
+static _Atomic int next_tid = 1;
+static _Thread_local TraceThread* self;
+static _Thread_local const char* self_name;
+
+static int bucket_of(unsigned long long ns) {
+   if (ns < LINEAR_BUCKETS)
+      return (int)ns;
+   int exp = 63 - __builtin_clzll(ns);   // >= 4
+   int sub = (int)(ns >> (exp - SUB_BITS)) & ((1 << SUB_BITS) - 1);
+   return LINEAR_BUCKETS + (exp - 4) * (1 << SUB_BITS) + sub;
+}
+
+// Middle of the range a bucket covers
+static double bucket_value(int bucket) {
+   if (bucket < LINEAR_BUCKETS)
+      return bucket;
+   int exp = (bucket - LINEAR_BUCKETS) / (1 << SUB_BITS) + 4;
+   int sub = (bucket - LINEAR_BUCKETS) % (1 << SUB_BITS);
+   double low = (double)((1ULL << SUB_BITS) + sub) * (double)(1ULL << (exp - SUB_BITS));
+   return low + (double)(1ULL << (exp - SUB_BITS)) / 2;
+}
+
+// Single writer: a relaxed load and store is enough, no locked instruction
+static inline void bump(_Atomic unsigned long long* v, unsigned long long by) {
+   atomic_store_explicit(v, atomic_load_explicit(v, memory_order_relaxed) + by, memory_order_relaxed);
+}
+
+static TraceThread* register_thread(void) {
+   TraceThread* t = calloc(1, sizeof(*t));
+   if (!t)
+      return NULL;
+   if (trace_flags & TRACE_EVENTS)
+      t->events = malloc(TRACE_EVENTS_PER_THREAD * sizeof(*t->events));
+   t->tid = atomic_fetch_add(&next_tid, 1);
+   t->name = self_name;
+
+   t->next = atomic_load(&threads);
+   while (!atomic_compare_exchange_weak(&threads, &t->next, t))
+      ;
+   return t;
+}
+
+void trace_init(int flags, const char* path) {
+   trace_flags = flags;
+   trace_path = (flags & TRACE_EVENTS) ? path : NULL;
+   trace_start_ns = trace_now_ns();
+   trace_enabled = flags != 0;
+   trace_set_thread_name("main");
+}
+
+void trace_set_thread_name(const char* name) {
+   self_name = name;
+   if (self)
+      self->name = name;
+}
+
+void trace_record(TraceId id, unsigned long long start, unsigned long long end) {
+   if (!self && !(self = register_thread()))
+      return;
+
+   unsigned long long ns = end - start;
+   Histogram* h = &self->hist[id];
+   bump(&h->count, 1);
+   bump(&h->total_ns, ns);
+   bump(&h->buckets[bucket_of(ns)], 1);
+   if (ns > atomic_load_explicit(&h->max_ns, memory_order_relaxed))
+      atomic_store_explicit(&h->max_ns, ns, memory_order_relaxed);
+
+   if (self->events) {
+      unsigned long long n = atomic_load_explicit(&self->event_count, memory_order_relaxed);
+      self->events[n & (TRACE_EVENTS_PER_THREAD - 1)] = (TraceEvent){start, ns, id};
+      atomic_store_explicit(&self->event_count, n + 1, memory_order_release);
+   }
+}
+
+// Bucket midpoints can overshoot the largest value seen, so they are capped by it
+static double percentile(const unsigned long long* buckets, unsigned long long count,
+                         unsigned long long max, double p) {
+   unsigned long long rank = (unsigned long long)(p * (count - 1)) + 1;
+   unsigned long long seen = 0;
+   for (int b = 0; b < BUCKET_COUNT; b++) {
+      seen += buckets[b];
+      if (seen >= rank) {
+         double value = bucket_value(b);
+         return value < max ? value : (double)max;
+      }
+   }
+   return (double)max;
+}
+
+void trace_print_report(FILE* out) {
+   if (!trace_enabled)
+      return;
+
+   int thread_count = 0;
+   for (TraceThread* t = atomic_load(&threads); t; t = t->next)
+      thread_count++;
+   fprintf(out, "trace: %d thread(s), %.2f s\n", thread_count, (trace_now_ns() - trace_start_ns) / 1e9);
+   fprintf(out, "%-20s %9s %11s %10s %10s %10s %10s\n",
+           "span", "count", "total ms", "p50 us", "p90 us", "p99 us", "max us");
+
+   static unsigned long long buckets[BUCKET_COUNT];
+   for (int id = 0; id < TRACE_COUNT; id++) {
+      unsigned long long count = 0, total = 0, max = 0;
+      memset(buckets, 0, sizeof(buckets));
+
+      for (TraceThread* t = atomic_load(&threads); t; t = t->next) {
+         Histogram* h = &t->hist[id];
+         count += atomic_load_explicit(&h->count, memory_order_relaxed);
+         total += atomic_load_explicit(&h->total_ns, memory_order_relaxed);
+         unsigned long long m = atomic_load_explicit(&h->max_ns, memory_order_relaxed);
+         if (m > max)
+            max = m;
+         for (int b = 0; b < BUCKET_COUNT; b++)
+            buckets[b] += atomic_load_explicit(&h->buckets[b], memory_order_relaxed);
+      }
+      if (count == 0)
+         continue;
+
+      fprintf(out, "%-20s %9llu %11.2f %10.1f %10.1f %10.1f %10.1f\n",
+              trace_defs[id].name, count, total / 1e6,
+              percentile(buckets, count, max, 0.50) / 1e3,
+              percentile(buckets, count, max, 0.90) / 1e3,
+              percentile(buckets, count, max, 0.99) / 1e3,
+              max / 1e3);
+   }
+}
+
+int trace_write_chrome(const char* path) {
+   FILE* out = fopen(path, "w");
+   if (!out)
+      return 0;
+
+   fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n", out);
+   int first = 1;
+   for (TraceThread* t = atomic_load(&threads); t; t = t->next) {
+      fprintf(out, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+              first ? "" : ",\n", t->tid, t->name ? t->name : "thread");
+      first = 0;
+      if (!t->events)
+         continue;
+
+      // A thread still running may overwrite the oldest slots while they are read
+      unsigned long long n = atomic_load_explicit(&t->event_count, memory_order_acquire);
+      unsigned long long from = n > TRACE_EVENTS_PER_THREAD ? n - TRACE_EVENTS_PER_THREAD : 0;
+      for (unsigned long long i = from; i < n; i++) {
+         const TraceEvent* e = &t->events[i & (TRACE_EVENTS_PER_THREAD - 1)];
+         fprintf(out, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%d}",
+                 trace_defs[e->id].name, trace_defs[e->id].category,
+                 (e->start - trace_start_ns) / 1e3, e->duration / 1e3, t->tid);
+      }
+   }
+   fputs("\n]}\n", out);
+   return fclose(out) == 0;
+}
+
+int trace_snapshot(void) {
+   FILE* out = fopen(TRACE_SNAPSHOT_FILE, "a");
+   if (!out)
+      return 0;
+   time_t now = time(NULL);
+   fprintf(out, "--- %s", ctime(&now));
+   trace_print_report(out);
+   int ok = fclose(out) == 0;
+
+   if (trace_path)
+      ok = trace_write_chrome(trace_path) && ok;
+   return ok;
+}
+
+int trace_finish(void) {
+   if (!trace_path)
+      return 1;
+   return trace_write_chrome(trace_path);
+}
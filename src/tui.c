@@ -1,26 +1,41 @@
 #include "../include/tui.h"
 #include "../include/menu_utils.h"
+#include "../include/scheduler.h"
+#include "../include/search.h"
+#include "../include/render.h"
+#include "../include/review_log.h"
+#include "../include/trace.h"
 #include <ncurses.h>
 #include <strings.h>
 #include <time.h>
 
-extern sqlite3* db;
+extern FlashDb* db;
 
 int draw_menu(WINDOW* win, const char** choices, int n_choices, const char* title) {
-    return generic_menu(win, n_choices, title, (void*)choices, render_string_menu_item, RETURN_INDEX);
+    return generic_menu(win, n_choices, title, (void*)choices, render_string_menu_item,
+                        string_menu_label, RETURN_INDEX);
 }
 
 int show_deck_info(WINDOW* parent, DeckInfoList* info) {
     int max_width = calc_max_line_width(info) + GENERIC_PADDING;
-    int height = info->count + GENERIC_PADDING;
+    int min_width = strlen(MENU_FOOTER) + VISIBLE_WIDTH_MARGIN;
+    if (max_width < min_width) max_width = min_width;
+    if (max_width > COLS) max_width = COLS;
+
+    // The menu scrolls, so the window only needs to fit the screen
+    int height = info->count + MENU_CHROME_ROWS;
+    int max_height = getmaxy(parent) - BOTTOM_MARGIN;
+    if (height > max_height) height = max_height;
+    if (height < MENU_CHROME_ROWS + 1) height = MENU_CHROME_ROWS + 1;
 
     WINDOW* win = create_centered_window(parent, height, max_width);
-    int selected_id = generic_menu(win, info->count, "Deck Info", info, render_deck_info_item, RETURN_CUSTOM_ID);
+    int selected_id = generic_menu(win, info->count, "Deck Info", info, render_deck_info_item,
+                                   deck_info_label, RETURN_CUSTOM_ID);
     clear_and_destroy_window(win);
     return selected_id;
 }
 
-void display_cards(WINDOW* parent, Deck* deck) {
+void display_cards(WINDOW* parent, Deck* deck, int start) {
    if (deck->count == 0) {
       popup_message(parent, "This deck has no cards");
       return;
@@ -28,45 +43,66 @@ void display_cards(WINDOW* parent, Deck* deck) {
    WINDOW* win = create_centered_window(parent, CARD_HEIGHT, CARD_WIDTH);
    keypad(win, TRUE);
 
-   int index = 0;
+   int index = (start > 0 && start < (int)deck->count) ? start : 0;
    State state = SHOW_FRONT;
+   int scroll = 0;
    int ch;
    
    const char* footer = "[<-] Prev  [->] Next  [SPACE] Flip [DEL] Delete [e] Edit  [ESC] Quit";
    while(1) {
-      render_card(win, deck, index, state, footer);
+      // Only the shown card's page is read, so moving through a deck is O(1) in its size
+      const Cards* card = deck_card(deck, index);
+      if (!card) {
+         perrorw("Failed to read card");
+         clear_and_destroy_window(win);
+         return;
+      }
+      render_card(win, card, index + 1, deck->count, state, footer, &scroll);
 
-      ch = wgetch(win);
+      ch = render_getch(win);
       switch (ch) {
          case KEY_LEFT:
             if (index > 0) index--;
             state = SHOW_FRONT;
+            scroll = 0;
             break;
          case KEY_RIGHT:
             if (index < (int)deck->count - 1) index++;
             state = SHOW_FRONT;
+            scroll = 0;
+            break;
+         case KEY_UP: // long text scrolls, render_card keeps it in range
+            scroll--;
+            break;
+         case KEY_DOWN:
+            scroll++;
             break;
          case SPACE_KEY:
             state = !state;
+            scroll = 0;
             break;
          case 'e':
          case 'E': {
-            char edited[MAX_BUFFER] = {0};
+            // The editor starts from the side shown, so a typo is a small fix
+            char* edited;
             if (state == SHOW_FRONT) {
-               form_input(stdscr, "Edit Front:", edited, MAX_BUFFER, 0);
-               if(strlen(edited) > 0)
-                  update_card(db, deck->items[index].id, edited, deck->items[index].back);
+               edited = form_input(stdscr, "Edit Front:", card->front, EDIT_MULTILINE);
+               if (edited && *edited)
+                  update_card(db, deck, card->id, edited, card->back);
             } else {
-               form_input(stdscr, "Edit Back:", edited, MAX_BUFFER, 0);
-               if(strlen(edited) > 0)
-                  update_card(db, deck->items[index].id, deck->items[index].front, edited);
+               edited = form_input(stdscr, "Edit Back:", card->back, EDIT_MULTILINE);
+               if (edited && *edited)
+                  update_card(db, deck, card->id, card->front, edited);
             }
-            load_deck_cards(db, deck->items[index].deck_id, deck);
+            free(edited);
+            if (deck->stale)
+               load_deck_cards(db, deck->deck_id, deck);
             break;
          }
          case KEY_DC: { // deleting cards
-            delete_card_by_id(db, deck->items[index].id);
-            load_deck_cards(db, deck->items[index].deck_id, deck);
+            delete_card_by_id(db, deck, card->id);
+            if (deck->stale)
+               load_deck_cards(db, deck->deck_id, deck);
             if (index >= (int)deck->count)
                index = deck->count - 1;
             if (index == -1) {
@@ -85,126 +121,282 @@ void display_cards(WINDOW* parent, Deck* deck) {
    }
 }
 
-void study_cards(WINDOW* parent_win, Deck* deck) {
-   if (deck->count == 0) {
-      popup_message(parent_win, "Deck is empty!");
+void study_cards(WINDOW* parent_win, int deck_id) {
+   StudyQueue queue = {0};
+   if (!study_queue_load(db, deck_id, time(NULL), warm_card_layout, &queue)) {
+      perrorw("Failed to load due cards");
+      free_study_queue(&queue);
+      return;
+   }
+   if (queue.count == 0) {
+      popup_message(parent_win, "No cards due for review!");
+      free_study_queue(&queue);
       return;
    }
-   srand(time(NULL));
-   reset_study_flags(deck);
 
    WINDOW* win = create_centered_window(parent_win, CARD_HEIGHT, CARD_WIDTH);
    keypad(win, TRUE);
 
    State state = SHOW_FRONT;
+   int scroll = 0;
+   unsigned long long shown_ns = 0;   // when the current card's front came up
    int ch;
-   int index = rand() % (deck->count);
 
    while(1) {
+      if (!study_queue_peek(&queue)) {
+         popup_message(parent_win, "Study complete!");
+         break;
+      }
+      // Read ahead while the previous card was up, flipping reuses the same text
+      const Cards* card = study_queue_card(&queue);
+      if (!card) {
+         perrorw("Failed to read card");
+         break;
+      }
+
       const char* footer = (state == SHOW_FRONT)
          ? "[SPACE] Flip Card [ESC] Quit"
          : "[Y] Correct [N] Incorrect [ESC] Quit";
 
-      render_card(win, deck, index, state, footer);
+      render_card(win, card, queue.graduated + 1, queue.count, state, footer, &scroll);
+      if (!shown_ns)
+         shown_ns = trace_now_ns();
+
+      ch = render_getch(win);
+      if (ch == ESC_KEY) // exit
+         break;
 
-      ch = wgetch(win);
       switch(ch) {
          case SPACE_KEY: { // Flip Card
-            if (state == SHOW_FRONT)
+            if (state == SHOW_FRONT) {
                state = SHOW_BACK;
+               scroll = 0;
+            }
             break;
          }
+         case KEY_UP:
+            scroll--;
+            break;
+         case KEY_DOWN:
+            scroll++;
+            break;
          case 'y':
          case 'Y':
-            if (state == SHOW_BACK) {
-               deck->items[index].study_flag = 1; // mark as done
-               // check if all cards are done
-               int done = 1;
-               for (size_t i = 0; i < deck->count; i++) {
-                  if (!deck->items[i].study_flag) {
-                     done = 0;
-                     break;
-                  }
-               }
-               if (done) {
-                  popup_message(parent_win, "Study complete!");
-                  clear_and_destroy_window(win);
-                  return;
-               }
-               // pick unmarked card
-               do {
-                  index = rand() % deck->count;
-               } while (deck->items[index].study_flag);
-               state = SHOW_FRONT;
-            }
-            break;
-
          case 'n':
          case 'N':
             if (state == SHOW_BACK) {
-               // keep card unmarked and pick another random card
-               index = rand() % deck->count;
+               // Correct cards leave the session, missed ones come back shortly
+               int correct = (ch == 'y' || ch == 'Y');
+               int response_ms = (int)((trace_now_ns() - shown_ns) / 1000000);
+               if (!study_queue_answer(db, &queue, correct, response_ms, time(NULL)))
+                  perrorw("Failed to save review");
                state = SHOW_FRONT;
+               scroll = 0;
+               shown_ns = 0;
             }
             break;
-         case ESC_KEY: // exit
-            clear_and_destroy_window(win);
-            return;
          default:
             break;
       }
    }
+   clear_and_destroy_window(win);
+   free_study_queue(&queue);
 }
 
-void form_input(WINDOW* parent_win, const char* form_prompt, char* input, int max_len, int dash_flag) {
+// A page of search results as menu items, with a trailing "more" item when another page follows
+static int search_menu_count(const SearchResults* results) {
+   return results->count + (results->has_more ? 1 : 0);
+}
+
+static void render_search_item(WINDOW* win, int row, int index, int highlight, void* data) {
+   SearchResults* results = (SearchResults*)data;
+   char line[MAX_BUFFER];
+
+   if ((size_t)index == results->count) {
+      snprintf(line, sizeof(line), "-- next %d results --", SEARCH_PAGE_SIZE);
+   } else {
+      SearchResult* r = &results->items[index];
+      snprintf(line, sizeof(line), "%d. [%s] %s | %s",
+               results->offset + index + 1, r->deck_name, r->front, r->back);
+   }
+   // Multi line cards stay on one row
+   for (char* c = line; *c; c++) {
+      if (*c == '\n' || *c == '\r' || *c == '\t')
+         *c = ' ';
+   }
+
+   if (index == highlight) wattron(win, A_REVERSE);
+   mvwaddnstr(win, row, 2, line, getmaxx(win) - 4);
+   if (index == highlight) wattroff(win, A_REVERSE);
+}
+
+static const char* search_item_label(int index, void* data) {
+   SearchResults* results = (SearchResults*)data;
+   return (size_t)index < results->count ? results->items[index].front : "";
+}
+
+void search_screen(WINDOW* parent) {
+   char* text = form_input(parent, SEARCH_PROMPT, NULL, 0);
+   if (!text || !*text) {
+      free(text);
+      return;
+   }
+
+   SearchResults results = {0};
+   Deck deck = {0};
+   int offset = 0;
+
+   while (1) {
+      if (!search_cards(db, text, SEARCH_PAGE_SIZE, offset, &results)) {
+         perrorw("Search failed");
+         break;
+      }
+      if (results.count == 0) {
+         popup_message(parent, offset ? "No more matches" : "No cards match");
+         break;
+      }
+
+      char title[MAX_BUFFER];
+      snprintf(title, sizeof(title), "Search: %.60s (%d-%zu)", text, offset + 1, offset + results.count);
+
+      int count = search_menu_count(&results);
+      int height = count + MENU_CHROME_ROWS;
+      int max_height = getmaxy(parent) - BOTTOM_MARGIN;
+      if (height > max_height) height = max_height;
+      if (height < MENU_CHROME_ROWS + 1) height = MENU_CHROME_ROWS + 1;
+      int width = COLS - 2 * GENERIC_PADDING;
+      if (width > SEARCH_WIDTH) width = SEARCH_WIDTH;
+
+      WINDOW* win = create_centered_window(parent, height, width);
+      int choice = generic_menu(win, count, title, &results, render_search_item, search_item_label, RETURN_INDEX);
+      clear_and_destroy_window(win);
+
+      if (choice < 0)
+         break;
+      if ((size_t)choice == results.count) { // next page
+         offset += SEARCH_PAGE_SIZE;
+         continue;
+      }
+
+      // Open the card's deck at the card, then search again in case it was edited
+      SearchResult* hit = &results.items[choice];
+      load_deck_cards(db, hit->deck_id, &deck);
+      display_cards(parent, &deck, deck_find_card(&deck, hit->card_id));
+   }
+   free_deck_cards(&deck);
+   free_search_results(&results);
+   free(text);
+}
+
+// One deck per row: reviews, accuracy, answer streak (best), day streak, average answer time
+static void render_review_stats_item(WINDOW* win, int row, int index, int highlight, void* data) {
+   DeckReviewStats* d = &((DeckReviewStatsList*)data)->items[index];
+   char line[MAX_BUFFER];
+   char last[32] = "never";
+
+   if (d->last_review) {
+      struct tm tm;
+      localtime_r(&d->last_review, &tm);
+      strftime(last, sizeof(last), "%Y-%m-%d", &tm);
+   }
+   if (d->reviews > 0) {
+      snprintf(line, sizeof(line), "%-20.20s %7d %6.1f%% %6d %6d %5d %6.1fs  %s",
+               d->name, d->reviews, 100.0 * d->correct / d->reviews, d->streak, d->best_streak,
+               d->day_streak, d->response_ms / 1000.0 / d->reviews, last);
+   } else {
+      snprintf(line, sizeof(line), REVIEW_STATS_COLUMNS, d->name, "0", "-", "-", "-", "-", "-", last);
+   }
+
+   if (index == highlight) wattron(win, A_REVERSE);
+   mvwaddnstr(win, row, 2, line, getmaxx(win) - 4);
+   if (index == highlight) wattroff(win, A_REVERSE);
+}
+
+static const char* review_stats_label(int index, void* data) {
+   return ((DeckReviewStatsList*)data)->items[index].name;
+}
+
+void review_stats_screen(WINDOW* parent) {
+   DeckReviewStatsList stats = {0};
+   if (!load_review_stats(db, time(NULL), &stats)) {
+      perrorw("Failed to load review statistics");
+      free_review_stats(&stats);
+      return;
+   }
+   if (stats.count == 0) {
+      popup_message(parent, "No Decks Available!");
+      free_review_stats(&stats);
+      return;
+   }
+
+   char header[MAX_BUFFER];
+   snprintf(header, sizeof(header), REVIEW_STATS_COLUMNS,
+            "Deck", "Reviews", "Correct", "Streak", "Best", "Days", "Avg", "Last");
+
+   int height = stats.count + MENU_CHROME_ROWS;
+   int max_height = getmaxy(parent) - BOTTOM_MARGIN;
+   if (height > max_height) height = max_height;
+   if (height < MENU_CHROME_ROWS + 1) height = MENU_CHROME_ROWS + 1;
+   int width = STATS_WIDTH;
+   if (width > COLS) width = COLS;
+
+   WINDOW* win = create_centered_window(parent, height, width);
+   generic_menu(win, stats.count, header, &stats, render_review_stats_item, review_stats_label, RETURN_INDEX);
+   clear_and_destroy_window(win);
+   free_review_stats(&stats);
+}
+
+// Multi line forms say how to start a new line, on the bottom border
+static void draw_edit_hint(WINDOW* win, int flags) {
+   if (flags & EDIT_MULTILINE)
+      mvwprintw(win, getmaxy(win) - 1, 2, " %s ", EDIT_HINT);
+}
+
+char* form_input(WINDOW* parent_win, const char* form_prompt, const char* initial, int flags) {
    WINDOW* form_win = create_centered_window(parent_win, FORM_HEIGHT, FORM_WIDTH);
    box(form_win, 0, 0);
 
    wattron(form_win, A_BOLD);
    mvwprintw(form_win, 1, (FORM_WIDTH - strlen(form_prompt)) / 2, "%s", form_prompt);
    all_attr_off(form_win);
-   wrefresh(form_win);
-   if (!get_input_line(form_win, 2, 2, input, max_len, FORM_WIDTH - VISIBLE_WIDTH_MARGIN, dash_flag)) {
-      memset(input, 0, max_len);
-   }
+   draw_edit_hint(form_win, flags);
+   wnoutrefresh(form_win);
+
+   char* input = NULL;
+   edit_text(form_win, 2, 2, FORM_INPUT_ROWS, FORM_WIDTH - VISIBLE_WIDTH_MARGIN, initial, flags, &input);
    clear_and_destroy_window(form_win);
+   return input;
 }
 
-void card_input(WINDOW* parent_win, const char* form_prompt, char* input1, char* input2, int max_len) {
+int card_input(WINDOW* parent_win, const char* form_prompt, char** front, char** back) {
    WINDOW* card_win = create_centered_window(parent_win, CARD_FORM_HEIGHT, CARD_FORM_WIDTH);
    box(card_win, 0, 0);
 
    wattron(card_win, A_UNDERLINE);
    mvwprintw(card_win, 1, (CARD_FORM_WIDTH - strlen(form_prompt)) / 2, "%s", form_prompt);
    all_attr_off(card_win);
-
-   wattron(card_win, A_BOLD);
-   mvwprintw(card_win, 2, 2, "Front:");
-   all_attr_off(card_win);
-   wrefresh(card_win);
-
-   if (!get_input_line(card_win, 3, 2, input1, max_len, CARD_FORM_WIDTH - VISIBLE_WIDTH_MARGIN, 0)) {
-      memset(input1, 0, max_len);
-      memset(input2, 0, max_len);
-      clear_and_destroy_window(card_win);
-      return;
-   }
-   // clear screen
-   for (int i = 3; i <= CARD_FORM_HEIGHT - 2; i++)
-      mvwprintw(card_win, i, 2, "%-*s", CARD_FORM_WIDTH - VISIBLE_WIDTH_MARGIN, "");
-
-   wattron(card_win, A_BOLD);
-   mvwprintw(card_win, 4, 2, "Back:");
-   all_attr_off(card_win);
-   wrefresh(card_win);
-
-   if (!get_input_line(card_win, 5, 2, input2, max_len, CARD_FORM_WIDTH - VISIBLE_WIDTH_MARGIN, 0)) {
-      memset(input1, 0, max_len);
-      memset(input2, 0, max_len);
-      clear_and_destroy_window(card_win);
-      return;
+   draw_edit_hint(card_win, EDIT_MULTILINE);
+
+   // Front then back in the same box, the editor blanks it when it starts
+   const char* labels[] = {"Front:", "Back: "};
+   char** fields[] = {front, back};
+   *front = *back = NULL;
+   for (int i = 0; i < 2; i++) {
+      wattron(card_win, A_BOLD);
+      mvwprintw(card_win, 2, 2, "%s", labels[i]);
+      all_attr_off(card_win);
+      wnoutrefresh(card_win);
+
+      if (!edit_text(card_win, 3, 2, CARD_FORM_INPUT_ROWS, CARD_FORM_WIDTH - VISIBLE_WIDTH_MARGIN,
+                     NULL, EDIT_MULTILINE, fields[i])) {
+         free(*front);
+         *front = NULL;
+         clear_and_destroy_window(card_win);
+         return 0;
+      }
    }
    clear_and_destroy_window(card_win);
+   return 1;
 }
 
 void popup_message(WINDOW * parent_win, const char* message) {
@@ -215,78 +407,24 @@ void popup_message(WINDOW * parent_win, const char* message) {
    mvwprintw(popup_win, 1, (POPUP_WIDTH - strlen(message)) / 2, "%s", message);
    all_attr_off(popup_win);
    mvwprintw(popup_win, POPUP_HEIGHT - 2, 2, "Press enter to close");
-   wrefresh(popup_win);
+   wnoutrefresh(popup_win);
+   render_flush();
 
    while(1) { // Close popup when enter is pressed
-      ch = wgetch(popup_win);
+      ch = render_getch(popup_win);
       if (ch == '\n' || ch == KEY_ENTER)
          break;
    }
    clear_and_destroy_window(popup_win);
 }
-// ugly function 
-int get_input_line(WINDOW* win, int y, int x, char* buffer, int max_len, int visible_width, int dash_flag) {
-   int len = 0;
-   int cursor = 0;
-   int ch;
-
-   const int max_lines = 4;
-   keypad(win, TRUE);
-   curs_set(1);
-   memset(buffer, 0, max_len);
-
-   while (1) {
-      // Redraw input area
-      for (int i = 0; i < max_lines; i++)
-         mvwprintw(win, y + i, x, "%-*s", visible_width, "");  // Clear
-
-      // Print wrapped lines
-      for (int i = 0; i < len; i++) {
-         int row = i / visible_width;
-         int col = i % visible_width;
-         mvwaddch(win, y + row, x + col, buffer[i]);
-      }
-
-      int cursor_row = cursor / visible_width;
-      int cursor_col = cursor % visible_width;
-      wmove(win, y + cursor_row, x + cursor_col);
-      wrefresh(win);
-
-      ch = wgetch(win);
-      if (ch == '\n' || ch == KEY_ENTER) {
-         curs_set(0);
-         return 1; // Submitted
-      } else if (ch == KEY_LEFT) {
-            if (cursor > 0) cursor--;
-      } else if (ch == KEY_RIGHT) {
-            if (cursor < len) cursor++;
-      } else if (ch == KEY_BACKSPACE || ch == 127) {
-            if (cursor > 0) { // memmove back one and reduce len and cursor
-               memmove(&buffer[cursor - 1], &buffer[cursor], len - cursor + 1);
-               cursor--;
-               len--;
-            }
-      } else if (ch >= 32 && ch < 127) { // memmove forward one and increase len and cursor
-            if (len < max_len - 1 && (len / visible_width) < max_lines) {
-               memmove(&buffer[cursor + 1], &buffer[cursor], len - cursor + 1);
-               buffer[cursor] = dash_flag && ch == ' ' ? '-' : ch;
-               cursor++;
-               len++;
-            }
-      } else if (ch == ESC_KEY) {
-            buffer[0] = '\0';
-            curs_set(0);
-            return 0; // Cancelled
-        }
-   }
-}
-
 WINDOW* create_centered_window(WINDOW* parent, int height, int width) {
    int parent_height, parent_width;
    getmaxyx(parent, parent_height, parent_width);
 
    int starty = parent_height - height - BOTTOM_MARGIN;
    int startx = (parent_width - width) / 2;
+   if (starty < 0) starty = 0;
+   if (startx < 0) startx = 0;
 
    WINDOW* win = newwin(height, width, starty, startx);
    keypad(win, TRUE);
@@ -296,9 +434,11 @@ WINDOW* create_centered_window(WINDOW* parent, int height, int width) {
 
 void clear_and_destroy_window(WINDOW* win) {
    if(win) {
+      // The blanked area goes out with whatever is drawn over it next
       werase(win);
-      wrefresh(win);
+      wnoutrefresh(win);
       delwin(win);
+      render_touch();
    }
 }
 
@@ -322,7 +462,16 @@ void perrorw(const char* err_msg) {
    mvprintw(LINES - 3, 0, "%s", err_msg);
    attroff(A_BOLD);
    clrtoeol();
-   refresh();
+   wnoutrefresh(stdscr);
+   render_flush();
+}
+
+void tui_message_sink(DbMessageLevel level, const char* message, void* data) {
+   (void)data;
+   if (level == DB_MSG_NOTICE)
+      popup_message(stdscr, message);
+   else
+      perrorw(message);
 }
 
 // Attribute funcs 
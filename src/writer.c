@@ -0,0 +1,349 @@
+#include "../include/writer.h"
+#include "../include/trace.h"
+#include "../include/dedupe.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+
+typedef struct {
+   unsigned long long writes;
+   unsigned long long batches;        // transactions committed
+   unsigned long long max_batch;
+   unsigned long long commit_ns;
+   unsigned long long max_commit_ns;
+} WriterStats;
+
+// Single producer (the UI thread) / single consumer (the writer thread) ring.
+// head and tail only ever grow; a slot is free again once tail has passed it.
+struct Writer {
+   FlashDb* conn;                  // the writer's own connection
+   pthread_t thread;
+   sem_t ready;                    // posted once per queued request
+   WriteRequest ring[WRITER_QUEUE_SIZE];
+   _Atomic size_t head;            // advanced by the UI thread
+   _Atomic size_t tail;            // advanced by the writer thread
+   _Atomic size_t committed;       // requests before this one are committed
+   _Atomic unsigned long errors;
+   int next_card_id;               // UI thread only: the block ids are handed out from
+   int last_card_id;
+   _Atomic int spare_card_id;      // first id of the next block, reserved by the writer thread; 0: none yet
+   WriterStats stats;              // writer thread only while it runs
+};
+
+static WriterStats stopped_stats;
+
+static unsigned long long now_ns(void) {
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int apply_card_write(FlashDb* conn, const WriteRequest* req) {
+   StmtId id = req->op == WRITE_ADD_CARD ? STMT_INSERT_CARD
+             : req->op == WRITE_UPDATE_CARD ? STMT_UPDATE_CARD
+             : STMT_DELETE_CARD;
+   sqlite3_stmt* stmt = db_stmt_acquire(conn, id);
+   if (!stmt)
+      return 0;
+
+   switch (req->op) {
+      case WRITE_ADD_CARD:
+         sqlite3_bind_int(stmt, 1, req->card_id);
+         sqlite3_bind_int(stmt, 2, req->deck_id);
+         sqlite3_bind_text(stmt, 3, req->front, -1, SQLITE_STATIC);
+         sqlite3_bind_text(stmt, 4, req->back, -1, SQLITE_STATIC);
+         break;
+      case WRITE_UPDATE_CARD:
+         sqlite3_bind_text(stmt, 1, req->front, -1, SQLITE_STATIC);
+         sqlite3_bind_text(stmt, 2, req->back, -1, SQLITE_STATIC);
+         sqlite3_bind_int(stmt, 3, req->card_id);
+         break;
+      default:
+         sqlite3_bind_int(stmt, 1, req->card_id);
+         break;
+   }
+
+   int ok = sqlite3_step(stmt) == SQLITE_DONE;
+   db_stmt_release(conn, id);
+   return ok;
+}
+
+static void free_request(WriteRequest* req) {
+   free(req->front);
+   free(req->back);
+   free(req->reviews);
+}
+
+static void apply(struct Writer* w, WriteRequest* req) {
+   int ok;
+   if (req->op == WRITE_SAVE_SCHEDULE)
+      ok = save_schedule(w->conn, req->card_id, &req->sched);
+   else if (req->op == WRITE_LOG_REVIEWS)
+      ok = write_reviews(w->conn, req->reviews, req->review_count);
+   else
+      ok = apply_card_write(w->conn, req);
+   if (!ok)
+      atomic_fetch_add(&w->errors, 1);
+   free_request(req);
+   w->stats.writes++;
+}
+
+// Commit the open group and publish how far the queue is durable
+static void commit_batch(struct Writer* w, size_t batch, size_t upto) {
+   if (batch > 0) {
+      unsigned long long start = now_ns();
+      if (!db_commit(w->conn)) {
+         db_rollback(w->conn);
+         atomic_fetch_add(&w->errors, batch);
+      }
+      unsigned long long end = now_ns();
+      unsigned long long elapsed = end - start;
+      if (trace_enabled)
+         trace_record(TRACE_WRITER_COMMIT, start, end);
+
+      w->stats.batches++;
+      w->stats.commit_ns += elapsed;
+      if (elapsed > w->stats.max_commit_ns)
+         w->stats.max_commit_ns = elapsed;
+      if (batch > w->stats.max_batch)
+         w->stats.max_batch = batch;
+   }
+   atomic_store_explicit(&w->committed, upto, memory_order_release);
+}
+
+// Raise sqlite_sequence by a block so no other insert can take those ids.
+// Writer thread only, in a transaction of its own.
+static int reserve_id_block(FlashDb* conn) {
+   if (!db_begin(conn))
+      return 0;
+
+   int first = 0;
+   sqlite3_stmt* stmt = db_stmt_acquire(conn, STMT_CARD_SEQ);
+   if (stmt && sqlite3_step(stmt) == SQLITE_ROW) {
+      int seq = sqlite3_column_int(stmt, 0);
+      db_stmt_release(conn, STMT_CARD_SEQ);
+
+      StmtId set = STMT_SET_CARD_SEQ;
+      stmt = db_stmt_acquire(conn, set);
+      int ok = 0;
+      if (stmt) {
+         sqlite3_bind_int(stmt, 1, seq + WRITER_ID_BLOCK);
+         ok = sqlite3_step(stmt) == SQLITE_DONE;
+         if (ok && sqlite3_changes(conn->conn) == 0) { // no card was ever inserted
+            db_stmt_release(conn, set);
+            set = STMT_INIT_CARD_SEQ;
+            stmt = db_stmt_acquire(conn, set);
+            if (stmt) {
+               sqlite3_bind_int(stmt, 1, seq + WRITER_ID_BLOCK);
+               ok = sqlite3_step(stmt) == SQLITE_DONE;
+            }
+         }
+         db_stmt_release(conn, set);
+      }
+      if (ok)
+         first = seq + 1;
+   } else {
+      db_stmt_release(conn, STMT_CARD_SEQ);
+   }
+
+   if (first && !db_commit(conn))
+      first = 0;
+   if (!first)
+      db_rollback(conn);
+   return first;
+}
+
+// Published only once committed, so a rolled back block is never handed out
+static void refill_spare_ids(struct Writer* w) {
+   if (atomic_load(&w->spare_card_id))
+      return;
+   int first = reserve_id_block(w->conn);
+   if (first)
+      atomic_store(&w->spare_card_id, first);
+}
+
+static void* writer_main(void* arg) {
+   struct Writer* w = arg;
+   trace_set_thread_name("writer");
+   refill_spare_ids(w);  // ready for the first add
+
+   while (1) {
+      while (sem_wait(&w->ready) != 0 && errno == EINTR)
+         ;
+
+      size_t tail = atomic_load_explicit(&w->tail, memory_order_relaxed);
+      size_t head = atomic_load_explicit(&w->head, memory_order_acquire);
+      size_t batch = 0;
+
+      // Everything queued while the last commit was syncing goes into one transaction
+      while (tail != head) {
+         WriteRequest req = w->ring[tail & (WRITER_QUEUE_SIZE - 1)];
+         tail++;
+         atomic_store_explicit(&w->tail, tail, memory_order_release);
+
+         if (req.op == WRITE_FLUSH || req.op == WRITE_STOP) {
+            commit_batch(w, batch, tail);
+            batch = 0;
+            if (req.op == WRITE_STOP)
+               return NULL;
+            sem_post(req.done);
+         } else if (req.op == WRITE_RESERVE_IDS) {
+            commit_batch(w, batch, tail);
+            batch = 0;
+            refill_spare_ids(w);
+            if (req.done)
+               sem_post(req.done);
+         } else {
+            if (batch == 0 && !db_begin(w->conn)) {
+               atomic_fetch_add(&w->errors, 1);
+               free_request(&req);
+               continue;
+            }
+            apply(w, &req);
+            if (++batch == WRITER_MAX_BATCH) {
+               commit_batch(w, batch, tail);
+               batch = 0;
+            }
+         }
+
+         if (tail == head)
+            head = atomic_load_explicit(&w->head, memory_order_acquire);
+      }
+      commit_batch(w, batch, tail);
+   }
+}
+
+int writer_start(FlashDb* db) {
+   const char* path = sqlite3_db_filename(db->conn, "main");
+   if (!path || !*path)
+      return 0;
+
+   struct Writer* w = calloc(1, sizeof(*w));
+   if (!w)
+      return 0;
+   w->conn = calloc(1, sizeof(FlashDb));
+   if (!w->conn || sqlite3_open(path, &w->conn->conn) != SQLITE_OK) {
+      close_database(w->conn);
+      free(w);
+      return 0;
+   }
+   sqlite3_exec(w->conn->conn, "PRAGMA foreign_keys = ON;", 0, 0, 0);
+   sqlite3_busy_timeout(w->conn->conn, DB_BUSY_TIMEOUT_MS);
+   w->conn->config = db->config;
+   db_apply_config(w->conn);
+   register_card_hash(w->conn->conn);
+
+   // The writer thread reserves the first id block as it starts, so neither
+   // starting nor the first add commits on this thread
+   w->next_card_id = 1;
+   w->last_card_id = 0;
+   if (sem_init(&w->ready, 0, 0) != 0) {
+      close_database(w->conn);
+      free(w);
+      return 0;
+   }
+   if (pthread_create(&w->thread, NULL, writer_main, w) != 0) {
+      sem_destroy(&w->ready);
+      close_database(w->conn);
+      free(w);
+      return 0;
+   }
+
+   db->writer = w;
+   return 1;
+}
+
+void writer_submit(FlashDb* db, const WriteRequest* req) {
+   struct Writer* w = db->writer;
+   size_t head = atomic_load_explicit(&w->head, memory_order_relaxed);
+
+   // Full: the writer is behind by a whole ring, give it the CPU
+   while (head - atomic_load_explicit(&w->tail, memory_order_acquire) == WRITER_QUEUE_SIZE)
+      sched_yield();
+
+   w->ring[head & (WRITER_QUEUE_SIZE - 1)] = *req;
+   atomic_store_explicit(&w->head, head + 1, memory_order_release);
+   sem_post(&w->ready);
+}
+
+void writer_flush(FlashDb* db) {
+   struct Writer* w = db->writer;
+   if (!w)
+      return;
+   if (atomic_load_explicit(&w->committed, memory_order_acquire) ==
+       atomic_load_explicit(&w->head, memory_order_relaxed))
+      return;
+
+   sem_t done;
+   sem_init(&done, 0, 0);
+   WriteRequest req = { .op = WRITE_FLUSH, .done = &done };
+   writer_submit(db, &req);
+   while (sem_wait(&done) != 0 && errno == EINTR)
+      ;
+   sem_destroy(&done);
+}
+
+void writer_stop(FlashDb* db) {
+   struct Writer* w = db->writer;
+   if (!w)
+      return;
+
+   WriteRequest req = { .op = WRITE_STOP };
+   writer_submit(db, &req);
+   pthread_join(w->thread, NULL);
+
+   stopped_stats = w->stats;
+   sem_destroy(&w->ready);
+   close_database(w->conn);
+   free(w);
+   db->writer = NULL;
+}
+
+// Switch to the spare block and have the writer reserve the one after it while
+// this one is used
+static int take_spare_ids(FlashDb* db, struct Writer* w) {
+   int first = atomic_exchange(&w->spare_card_id, 0);
+   if (!first) {
+      // Adds outran the writer (or its last reservation failed): wait for one
+      sem_t done;
+      sem_init(&done, 0, 0);
+      WriteRequest req = { .op = WRITE_RESERVE_IDS, .done = &done };
+      writer_submit(db, &req);
+      while (sem_wait(&done) != 0 && errno == EINTR)
+         ;
+      sem_destroy(&done);
+      if (!(first = atomic_exchange(&w->spare_card_id, 0)))
+         return 0;
+   }
+   w->next_card_id = first;
+   w->last_card_id = first + WRITER_ID_BLOCK - 1;
+
+   WriteRequest req = { .op = WRITE_RESERVE_IDS };
+   writer_submit(db, &req);
+   return 1;
+}
+
+int writer_reserve_card_id(FlashDb* db) {
+   struct Writer* w = db->writer;
+   if (w->next_card_id > w->last_card_id && !take_spare_ids(db, w))
+      return 0;
+   return w->next_card_id++;
+}
+
+unsigned long writer_take_errors(FlashDb* db) {
+   if (!db->writer)
+      return 0;
+   return atomic_exchange(&db->writer->errors, 0);
+}
+
+void writer_print_stats(FlashDb* db, FILE* out) {
+   const WriterStats* s = db->writer ? &db->writer->stats : &stopped_stats;
+   if (s->writes == 0)
+      return;
+   fprintf(out, "writer: %llu writes in %llu transactions (largest %llu), commit avg %.2f ms max %.2f ms\n",
+           s->writes, s->batches, s->max_batch,
+           s->batches ? s->commit_ns / 1e6 / s->batches : 0.0,
+           s->max_commit_ns / 1e6);
+}